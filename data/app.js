@@ -1,5 +1,6 @@
 // WebSocket connection
 const ws = new WebSocket(`ws://${window.location.hostname}:81`);
+ws.binaryType = 'arraybuffer';
 const log = document.getElementById('log');
 const cmd = document.getElementById('cmd');
 const dispensersContainer = document.getElementById('dispensers');
@@ -11,6 +12,126 @@ let sequences = [];
 let isParsingSequenceList = false;
 let dispenserNames = ['Dispenser 1', 'Dispenser 2'];
 let dispensingLog = [];
+let jobs = {};
+let pendingBatches = {};
+let batchCounter = 0;
+
+// Binary protocol (include/WireProtocol.h): version, type, then tag / u16 length / value fields
+const Wire = {
+  VERSION: 1,
+  TYPE: { HELLO: 1, COMMAND: 2, ACK: 3, LOG: 4, JOB: 5, GRAPH: 6 },
+  TAG: {
+    SEQ: 1, TEXT: 2, STATUS: 3, JOB: 4, LINE: 5, SPACE: 6, TAG: 7, STATE: 8, CLIENT: 9, DONE: 10,
+    TOTAL: 11, MS: 12, RESULT: 13, SERVO: 14, TRIGGER: 15, CHANNEL: 16, SAMPLES: 17, VERSION: 18,
+    MAX_COMMAND: 19, QUEUE: 20, KEY: 21
+  },
+  STATUS: ['ACCEPTED', 'EMPTY', 'BAD_ID', 'TOO_MANY', 'TOO_LONG', 'CONTROL', 'THROTTLED', 'MALFORMED', 'BUSY', 'DUPLICATE'],
+  JOB_STATE: ['queued', 'running', 'done', 'failed', 'cancelled']
+};
+let binaryMode = false;
+let commandSeq = 0;
+let pendingCommands = {};
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+function encodeCommandFrame(seq, commands) {
+  const texts = commands.map(command => textEncoder.encode(command));
+  const size = 2 + 5 + texts.reduce((sum, text) => sum + 3 + text.length, 0);
+  const bytes = new Uint8Array(size);
+  const view = new DataView(bytes.buffer);
+  bytes[0] = Wire.VERSION;
+  bytes[1] = Wire.TYPE.COMMAND;
+  let offset = 2;
+  bytes[offset] = Wire.TAG.SEQ;
+  view.setUint16(offset + 1, 2, true);
+  view.setUint16(offset + 3, seq, true);
+  offset += 5;
+  texts.forEach(text => {
+    bytes[offset] = Wire.TAG.TEXT;
+    view.setUint16(offset + 1, text.length, true);
+    bytes.set(text, offset + 3);
+    offset += 3 + text.length;
+  });
+  return bytes.buffer;
+}
+
+// Returns { type, fields: [{ tag, view }] }, or null for another version or a truncated frame
+function decodeFrame(buffer) {
+  const bytes = new Uint8Array(buffer);
+  if (bytes.length < 2 || bytes[0] !== Wire.VERSION) return null;
+  const view = new DataView(buffer);
+  const fields = [];
+  let offset = 2;
+  while (offset < bytes.length) {
+    if (bytes.length - offset < 3) return null;
+    const length = view.getUint16(offset + 1, true);
+    if (bytes.length - offset - 3 < length) return null;
+    fields.push({ tag: bytes[offset], view: new DataView(buffer, offset + 3, length) });
+    offset += 3 + length;
+  }
+  return { type: bytes[1], fields };
+}
+
+function fieldText(field) {
+  return textDecoder.decode(new Uint8Array(field.view.buffer, field.view.byteOffset, field.view.byteLength));
+}
+
+function fieldNumber(field) {
+  if (field.view.byteLength >= 4) return field.view.getUint32(0, true);
+  if (field.view.byteLength >= 2) return field.view.getUint16(0, true);
+  return field.view.byteLength ? field.view.getUint8(0) : 0;
+}
+
+function fieldSamples(field) {
+  const samples = [];
+  for (let i = 0; i + 1 < field.view.byteLength; i += 2) samples.push(field.view.getUint16(i, true));
+  return samples;
+}
+
+// Commands go out binary once the device has accepted "PROTO 1", as text before that
+function sendCommand(command) {
+  if (!binaryMode) {
+    ws.send(command);
+    return;
+  }
+  const seq = commandSeq = (commandSeq + 1) & 0xFFFF;
+  pendingCommands[seq] = [command];
+  ws.send(encodeCommandFrame(seq, [command]));
+}
+
+// Commands that dispense carry an idempotency key ("@<key> PILL 1") and are kept here until
+// the device reports how they ended. After a reload or reconnect they are resent with the
+// same key: the device runs each key once and answers a repeat with [DUP].
+function loadKeyedCommands() {
+  return JSON.parse(localStorage.getItem('keyedCommands_' + deviceId) || '{}');
+}
+
+function saveKeyedCommands(pending) {
+  localStorage.setItem('keyedCommands_' + deviceId, JSON.stringify(pending));
+}
+
+function sendKeyedCommand(command) {
+  const key = Date.now().toString(36) + Math.random().toString(36).substr(2, 6);
+  const pending = loadKeyedCommands();
+  pending[key] = command;
+  saveKeyedCommands(pending);
+  sendCommand(`@${key} ${command}`);
+}
+
+function settleKeyedCommand(key) {
+  const pending = loadKeyedCommands();
+  if (!key || !(key in pending)) return;
+  delete pending[key];
+  saveKeyedCommands(pending);
+}
+
+function resendKeyedCommands() {
+  const pending = Object.entries(loadKeyedCommands());
+  if (pending.length === 0) return;
+  log.innerHTML += `<span style="color:#ffff00;">Resending ${pending.length} unconfirmed command(s)</span><br>`;
+  log.scrollTop = log.scrollHeight;
+  pending.forEach(([key, command]) => sendCommand(`@${key} ${command}`));
+}
 
 // Graph management
 let piezoChart = null;
@@ -83,7 +204,7 @@ function dispensePill(dispenserIndex) {
   
   const message = `PILL ${dispenserIndex}`;
   console.log('Sending WebSocket message:', message);
-  ws.send(message);
+  sendKeyedCommand(message);
   
   const dispenserName = dispenserNames[dispenserIndex - 1] || `Dispenser ${dispenserIndex}`;
   const logMessage = `Dispensing from: ${dispenserName} (Servo ${dispenserIndex})`;
@@ -303,7 +424,7 @@ function createSequence() {
   
   const command = `SEQUENCE ${deviceId} ${name} (${sequenceCounts.join(',')})`;
   console.log('Sending sequence command:', command);
-  ws.send(command);
+  sendCommand(command);
   
   resetBuilder();
   
@@ -342,7 +463,11 @@ ws.onopen = function() {
   log.innerHTML += '<span style="color:#00ff00;">Connected to ESP32</span><br>';
   log.scrollTop = log.scrollHeight;
   
+  // Ask for the binary protocol; until the HELLO arrives everything stays text
+  ws.send('PROTO ' + Wire.VERSION);
+  
   loadDispensingLog();
+  resendKeyedCommands();
   updateBuilderLabels();
   updateSequencePreview();
   updateDispensingLogDisplay();
@@ -353,8 +478,15 @@ ws.onopen = function() {
 };
 
 ws.onmessage = function(evt) {
-  let message = evt.data;
-  
+  if (evt.data instanceof ArrayBuffer) {
+    handleBinaryMessage(evt.data);
+  } else {
+    handleTextMessage(evt.data);
+  }
+};
+
+function handleTextMessage(message) {
+
   // Handle graph data first (don't display in terminal)
   if (message.startsWith('[GRAPH]')) {
     console.log('Received graph message:', message);
@@ -362,6 +494,30 @@ ws.onmessage = function(evt) {
     return; // Don't add to log or process further
   }
   
+  // Drift alerts from the per-servo similarity monitor
+  if (message.startsWith('[DRIFT]')) {
+    handleDriftEvent(message);
+    return;
+  }
+  
+  // Correlated answers to our own BATCH requests
+  if (message.startsWith('[BATCH]')) {
+    handleBatchResponse(message);
+    return;
+  }
+  
+  // Job state changes for EXECUTE/PILL/FAST/MULTI
+  if (message.startsWith('[JOB]')) {
+    handleJobEvent(message);
+    return;
+  }
+  
+  // A resent command the device had already seen
+  if (message.startsWith('[DUP]')) {
+    handleDuplicate(message);
+    return;
+  }
+  
   // Add non-graph messages to terminal display
   log.innerHTML += message + "<br>";
   log.scrollTop = log.scrollHeight;
@@ -415,7 +571,229 @@ ws.onmessage = function(evt) {
       refreshSequences();
     }, 100);
   }
-};
+}
+
+function handleDriftEvent(message) {
+  try {
+    const data = JSON.parse(message.substring(8)); // Remove "[DRIFT] " prefix
+    const colors = { OK: '#00ff00', WARNING: '#ffff00', DRIFT: '#ff4444', WARMUP: '#888888' };
+    const name = dispenserNames[data.servo - 1] || `Dispenser ${data.servo}`;
+    let text = `[DRIFT] ${name}: ${data.state} (similarity ${data.ewma}, baseline ${data.baseline})`;
+    if (data.state === 'DRIFT') {
+      text += ' - relearning recommended (RESETDATA ' + data.servo + ')';
+    }
+    log.innerHTML += `<span style="color:${colors[data.state] || '#ffffff'};">${text}</span><br>`;
+    log.scrollTop = log.scrollHeight;
+  } catch (error) {
+    console.error('Error parsing drift event:', error);
+  }
+}
+
+// Several commands in one frame: admitted together or not at all, and charged once
+// against the rate limit. Control verbs (STOP, RESET, STATUS, JOBS) must be sent alone.
+function sendBatch(commands) {
+  if (binaryMode) {
+    // One COMMAND frame with several TEXT fields; its sequence number is the request id
+    const seq = commandSeq = (commandSeq + 1) & 0xFFFF;
+    pendingBatches[String(seq)] = commands;
+    ws.send(encodeCommandFrame(seq, commands));
+    return String(seq);
+  }
+  const id = `b${Date.now().toString(36)}${(batchCounter++).toString(36)}`.slice(0, 16);
+  pendingBatches[id] = commands;
+  ws.send(`BATCH ${id}\n${commands.join('\n')}`);
+  return id;
+}
+
+function handleBatchResponse(message) {
+  try {
+    showBatchResponse(JSON.parse(message.substring(8))); // Remove "[BATCH] " prefix
+  } catch (error) {
+    console.error('Error parsing batch response:', error);
+  }
+}
+
+function showBatchResponse(response) {
+  const commands = pendingBatches[response.id] || [];
+  let text;
+  let color;
+  
+  if (response.status === 'accepted') {
+    text = `[BATCH] ${response.id}: ${response.jobs.length} commands queued (jobs ${response.jobs.join(', ')})`;
+    color = '#00ffff';
+  } else if (response.status === 'rejected') {
+    text = `[BATCH] ${response.id}: rejected (${response.reason}`;
+    if (response.line) text += `, line ${response.line}`;
+    if (response.reason === 'BUSY') text += `, ${response.space} of ${response.count} slots free`;
+    text += ')';
+    color = '#ff4444';
+    delete pendingBatches[response.id];
+  } else {
+    const details = response.results.map((result, i) => {
+      const command = commands[i] || `#${result.job}`;
+      return `${command}: ${result.state}` + (result.result ? ` (${result.result})` : '');
+    });
+    text = `[BATCH] ${response.id}: ${response.done} done, ${response.failed} failed, ${response.cancelled} cancelled - ${details.join('; ')}`;
+    color = response.failed || response.cancelled ? '#ffff00' : '#00ff00';
+    delete pendingBatches[response.id];
+  }
+  
+  log.innerHTML += `<span style="color:${color};">${text}</span><br>`;
+  log.scrollTop = log.scrollHeight;
+}
+
+function handleJobEvent(message) {
+  try {
+    showJob(JSON.parse(message.substring(6))); // Remove "[JOB] " prefix
+  } catch (error) {
+    console.error('Error parsing job event:', error);
+  }
+}
+
+function handleDuplicate(message) {
+  try {
+    const entry = JSON.parse(message.substring(6)); // Remove "[DUP] " prefix
+    let text = `[DUP] Already received as job #${entry.job}: ${entry.state}`;
+    if (entry.result) text += ' - ' + entry.result;
+    log.innerHTML += `<span style="color:#ffff00;">${text}</span><br>`;
+    log.scrollTop = log.scrollHeight;
+    
+    // Still queued or running: its [JOB] events settle it
+    if (!['queued', 'running'].includes(entry.state)) settleKeyedCommand(entry.key);
+  } catch (error) {
+    console.error('Error parsing duplicate notice:', error);
+  }
+}
+
+function showJob(job) {
+  jobs[job.id] = job;
+  
+  // Keep only the most recent jobs, like the device's own table
+  const ids = Object.keys(jobs).map(Number).sort((a, b) => b - a);
+  ids.slice(16).forEach(id => delete jobs[id]);
+  updateJobsDisplay();
+  
+  if (job.state === 'done' || job.state === 'failed' || job.state === 'cancelled') {
+    settleKeyedCommand(job.key);
+    const colors = { done: '#00ff00', failed: '#ff4444', cancelled: '#ffff00' };
+    let text = `[JOB] #${job.id} ${job.command}: ${job.state} (${job.ms} ms)`;
+    if (job.result) text += ' - ' + job.result;
+    log.innerHTML += `<span style="color:${colors[job.state]};">${text}</span><br>`;
+    log.scrollTop = log.scrollHeight;
+  }
+}
+
+// Text messages whose tag has a handler of its own; everything else goes to the terminal
+const logHandlers = { DRIFT: handleDriftEvent, BATCH: handleBatchResponse, GRAPH: updatePiezoChart, DUP: handleDuplicate };
+
+function handleBinaryMessage(buffer) {
+  const frame = decodeFrame(buffer);
+  if (!frame) {
+    console.error('Undecodable binary frame');
+    return;
+  }
+  
+  // Fields by tag; repeated tags (JOB, CHANNEL/SAMPLES) are read in order below
+  const first = {};
+  frame.fields.forEach(field => {
+    if (!(field.tag in first)) first[field.tag] = field;
+  });
+  const text = tag => first[tag] ? fieldText(first[tag]) : '';
+  const number = tag => first[tag] ? fieldNumber(first[tag]) : 0;
+  
+  switch (frame.type) {
+    case Wire.TYPE.HELLO:
+      binaryMode = true;
+      log.innerHTML += `<span style="color:#888888;">[PROTO] Binary protocol v${number(Wire.TAG.VERSION)}</span><br>`;
+      log.scrollTop = log.scrollHeight;
+      break;
+      
+    case Wire.TYPE.ACK:
+      handleBinaryAck(frame, number);
+      break;
+      
+    case Wire.TYPE.LOG: {
+      const tag = text(Wire.TAG.TAG);
+      const message = tag ? `[${tag}] ${text(Wire.TAG.TEXT)}` : text(Wire.TAG.TEXT);
+      (logHandlers[tag] || handleTextMessage)(message);
+      break;
+    }
+    
+    case Wire.TYPE.JOB: {
+      const job = {
+        id: number(Wire.TAG.JOB),
+        state: Wire.JOB_STATE[number(Wire.TAG.STATE)] || '-',
+        command: text(Wire.TAG.TEXT),
+        client: number(Wire.TAG.CLIENT),
+        ms: number(Wire.TAG.MS)
+      };
+      if (first[Wire.TAG.TOTAL]) {
+        job.done = number(Wire.TAG.DONE);
+        job.total = number(Wire.TAG.TOTAL);
+      }
+      if (first[Wire.TAG.RESULT]) job.result = text(Wire.TAG.RESULT);
+      if (first[Wire.TAG.KEY]) job.key = text(Wire.TAG.KEY);
+      showJob(job);
+      break;
+    }
+    
+    case Wire.TYPE.GRAPH: {
+      const data = { trigger: text(Wire.TAG.TRIGGER), servo: number(Wire.TAG.SERVO), channels: [] };
+      frame.fields.forEach(field => {
+        if (field.tag === Wire.TAG.CHANNEL) data.channels.push({ name: fieldText(field), data: [] });
+        if (field.tag === Wire.TAG.SAMPLES && data.channels.length) data.channels[data.channels.length - 1].data = fieldSamples(field);
+      });
+      updatePiezoChart(data);
+      break;
+    }
+    
+    default:
+      console.log('Ignoring binary message type', frame.type);
+  }
+}
+
+function handleBinaryAck(frame, number) {
+  const seq = number(Wire.TAG.SEQ);
+  const status = Wire.STATUS[number(Wire.TAG.STATUS)] || 'UNKNOWN';
+  const jobIds = frame.fields.filter(field => field.tag === Wire.TAG.JOB).map(fieldNumber);
+  
+  // Several commands in the frame: report it like a text BATCH
+  if (pendingBatches[String(seq)]) {
+    const response = { id: String(seq), status: status === 'ACCEPTED' ? 'accepted' : 'rejected', jobs: jobIds, reason: status };
+    if (number(Wire.TAG.LINE)) response.line = number(Wire.TAG.LINE);
+    response.space = number(Wire.TAG.SPACE);
+    response.count = pendingBatches[String(seq)].length;
+    showBatchResponse(response);
+    return;
+  }
+  
+  const command = (pendingCommands[seq] || [''])[0];
+  delete pendingCommands[seq];
+  if (status === 'ACCEPTED') {
+    log.innerHTML += `[ACK] Received: ${command}` + (jobIds.length ? ` (job ${jobIds[0]})` : '') + '<br>';
+  } else if (status !== 'DUPLICATE') {  // A duplicate is answered by its own [DUP] message
+    log.innerHTML += `<span style="color:#ff4444;">[ERROR] ${command}: ${status}</span><br>`;
+  }
+  log.scrollTop = log.scrollHeight;
+}
+
+function updateJobsDisplay() {
+  const container = document.getElementById('jobs');
+  if (!container) return;
+  
+  const ids = Object.keys(jobs).map(Number).sort((a, b) => b - a);
+  if (ids.length === 0) {
+    container.innerHTML = '<p style="color: #888;">No jobs yet</p>';
+    return;
+  }
+  
+  container.innerHTML = ids.map(id => {
+    const job = jobs[id];
+    const progress = job.total > 0 ? ` ${job.done}/${job.total}` : '';
+    const result = job.result ? ` - ${job.result}` : '';
+    return `<div class="job-item job-${job.state}">#${job.id} ${job.command}: ${job.state}${progress}${result}</div>`;
+  }).join('');
+}
 
 function refreshSequences() {
   console.log('Refreshing sequences for device:', deviceId);
@@ -424,7 +802,7 @@ function refreshSequences() {
   
   // Check if WebSocket is ready
   if (ws.readyState === WebSocket.OPEN) {
-    ws.send('LIST ' + deviceId);
+    sendCommand('LIST ' + deviceId);
   } else {
     console.log('WebSocket not ready, will refresh sequences when connected');
     // Retry when WebSocket is ready
@@ -446,7 +824,7 @@ function updateSequenceButtons() {
 }
 
 function executeSequence(name) {
-  ws.send('EXECUTE ' + deviceId + ' ' + name);
+  sendKeyedCommand('EXECUTE ' + deviceId + ' ' + name);
   log.innerHTML += `<span style="color:#00ffff;">Executing sequence: ${name}</span><br>`;
   log.scrollTop = log.scrollHeight;
   
@@ -469,7 +847,7 @@ function deleteSequence(name) {
     log.innerHTML += `<span style="color:#ff8800;">Deleting sequence: ${name}...</span><br>`;
     log.scrollTop = log.scrollHeight;
     
-    ws.send('DELETE ' + deviceId + ' ' + name);
+    sendCommand('DELETE ' + deviceId + ' ' + name);
   }
 }
 
@@ -505,7 +883,13 @@ cmd.addEventListener("keydown", function(e) {
       command = command.replace(/^DELETE\s+/, 'DELETE ' + deviceId + ' ');
     }
     
-    ws.send(command);
+    // "PILL 1; PILL 2" goes out as one batch
+    const parts = command.split(';').map(part => part.trim()).filter(part => part !== '');
+    if (parts.length > 1) {
+      sendBatch(parts);
+    } else {
+      sendCommand(command);
+    }
     cmd.value = "";
   }
 });
@@ -606,9 +990,8 @@ function initializePiezoChart() {
 function updatePiezoChart(graphData) {
   try {
     console.log('Processing graph data:', graphData);
-    const jsonPart = graphData.substring(8); // Remove "[GRAPH] " prefix
-    console.log('JSON part:', jsonPart);
-    const data = JSON.parse(jsonPart);
+    // Text protocol: "[GRAPH] {json}"; binary protocol: already decoded
+    const data = typeof graphData === 'string' ? JSON.parse(graphData.substring(8)) : graphData;
     console.log('Parsed data:', data);
     
     // If Chart.js isn't available, show text data
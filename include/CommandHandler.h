@@ -5,11 +5,106 @@
 #include "PiezoController.h"
 #include "SequenceManager.h"
 #include "Displayer.h"
+#include "Inventory.h"
+#include "CommandParser.h"
+#include "SerialFramer.h"
 #include "Config.h"
 
 // Forward declaration
 class ServoController;
 
+// Arguments of each verb, parsed once by its command table entry before the handler runs.
+// Text fields are views into the queued command and only valid while the handler runs.
+struct NoArgs {};
+
+struct ServoArgs {
+    int servoIndex;                     // 0-based
+};
+
+struct AngleArgs {
+    int angle;                          // 0-180
+};
+
+struct CountArgs {
+    int count;                          // >= 1
+};
+
+struct SequenceArgs {
+    std::string_view definition;        // "<device> <name> (counts)", SequenceManager owns the grammar
+};
+
+struct DeviceArgs {
+    std::string_view deviceId;
+    std::string_view name;              // Sequence name, may contain spaces; empty for LIST
+};
+
+struct ResetDataArgs {
+    bool all;
+    int servoIndex;
+};
+
+struct ThresholdArgs {
+    enum class Action : uint8_t { GET, SET_ALL, SET_SERVO };
+    enum class Field : uint8_t { AVERAGE, CHANNEL, ENVELOPE, LEARNING, MODE };
+    Action action;
+    Field field;
+    int first, last;                    // Servos covered by GET or SET_SERVO
+    float value;                        // AVERAGE, CHANNEL
+    int count;                          // ENVELOPE, LEARNING
+    SimilarityMode mode;                // MODE
+};
+
+struct CalibrateArgs {
+    enum class Action : uint8_t { START, EXPORT, CANCEL };
+    Action action;
+    int servoIndex;
+};
+
+struct LabelArgs {
+    int servoIndex;
+    bool flawed;
+};
+
+struct ModelArgs {
+    bool apply;                         // APPLY, otherwise EXPORT
+};
+
+struct ProfileArgs {
+    enum class Action : uint8_t { SHOW, SET, OFF, TUNE };
+    Action action;
+    int servoIndex;
+    float velocity, acceleration, jerk;
+    int trials;                         // TUNE
+};
+
+struct MultiArgs {
+    bool setMode;                       // MULTI ON|OFF instead of a dispense
+    bool enabled;
+    int servoCount;
+    int servoIndices[DropAttributor::MAX_CANDIDATES];   // Distinct
+};
+
+struct ServoCalArgs {
+    enum class Action : uint8_t { SHOW, FIND, RESET, SET };
+    enum class Field : uint8_t { START, DISPENSE, MINPULSE, MAXPULSE, HOLD, REVERSE };
+    Action action;
+    Field field;
+    int servoIndex;
+    int value;                          // SET: range-checked for the field; FIND: trials
+};
+
+struct RefillArgs {
+    enum class Action : uint8_t { REPORT, SET, ADD, OFF };
+    Action action;
+    int servoIndex;
+    int pills;
+};
+
+struct StatsArgs {
+    bool reset;
+    int first, last;
+};
+
 class CommandHandler {
 public:
     CommandHandler(ServoController& servo, PiezoSensor& piezo, SequenceManager& sequenceManager);
@@ -21,21 +116,48 @@ private:
     PiezoSensor& piezoController;
     SequenceManager& sequenceManager;
     
+    // What the command task is running, read by STATUS from the control task
+    portMUX_TYPE statusMux;
+    char currentCommand[Config::COMMAND_MAX_LENGTH + 1];
+    uint32_t commandStartMs;
+    
     static void commandTaskWrapper(void* parameter);
+    static void controlTaskWrapper(void* parameter);
+    void controlTask();
+    void handleControlCommand(const QueuedCommand& command);
+    void setCurrentCommand(const char* text);
+    static void onSerialReceive();
+    static void queueSerialFrame(uint8_t sequence, const char* payload);
     void commandTask();
-    void processCommand(const String& command);
-    void handleResetCommand();
-    void handleTestCommand();
-    void handleFastCommand(const String& command);
-    void handleStartAngleCommand(const String& command);
-    void handleAngleCommand(const String& command);
-    void handleIndividualPill(const String& command);
-    void handleMeasurementsCommand(const String& command);
-    void handleSequenceCommand(const String& command);
-    void handleExecuteCommand(const String& command);
-    void handleListCommand(const String& command);
-    void handleDeleteCommand(const String& command);
-    void handleResetDataCommand(const String& command);
-    void handleThresholdCommand(const String& command);
-    void handlePiezoCommand(const String& command);
+    void processCommand(std::string_view command);
+    
+    // Command table entry: parses the verb's arguments into Args, then runs the handler;
+    // false when the arguments do not parse
+    template <typename Args, void (CommandHandler::*Run)(const Args&)>
+    static bool dispatch(CommandHandler& handler, const CommandArgs& args);
+    
+    // Dispatched through the verb table in processCommand; arguments are already validated
+    void handleResetCommand(const NoArgs&);
+    void handleTestCommand(const NoArgs&);
+    void handleFastCommand(const ServoArgs& args);
+    void handleStartAngleCommand(const AngleArgs& args);
+    void handleAngleCommand(const AngleArgs& args);
+    void handleIndividualPill(const ServoArgs& args);
+    void handleMeasurementsCommand(const CountArgs& args);
+    void handleSequenceCommand(const SequenceArgs& args);
+    void handleExecuteCommand(const DeviceArgs& args);
+    void handleListCommand(const DeviceArgs& args);
+    void handleDeleteCommand(const DeviceArgs& args);
+    void handleResetDataCommand(const ResetDataArgs& args);
+    void handleThresholdCommand(const ThresholdArgs& args);
+    void handleCalibrateCommand(const CalibrateArgs& args);
+    void handleLabelCommand(const LabelArgs& args);
+    void handleReportCommand(const ServoArgs& args);
+    void handleExplainCommand(const ServoArgs& args);
+    void handleModelCommand(const ModelArgs& args);
+    void handleProfileCommand(const ProfileArgs& args);
+    void handleMultiCommand(const MultiArgs& args);
+    void handleServoCalCommand(const ServoCalArgs& args);
+    void handleRefillCommand(const RefillArgs& args);
+    void handleStatsCommand(const StatsArgs& args);
 };
\ No newline at end of file
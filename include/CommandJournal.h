@@ -0,0 +1,62 @@
+// include/CommandJournal.h
+#pragma once
+#include <Arduino.h>
+#include <string_view>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "Config.h"
+#include "JobTable.h"
+
+// What became of one keyed command
+struct JournalEntry {
+    char key[Config::JOURNAL_KEY_LENGTH + 1];      // Empty: free
+    uint32_t hash;
+    uint16_t jobId;
+    JobState state;
+    char result[sizeof(Job::result)];
+};
+
+// Idempotency keys of recent commands and their outcome. A client that lost its connection
+// resends a command with the same "@<key>" and gets the original outcome instead of a second
+// dose. Lookup goes through an open-addressing index, so intake pays one hash and usually
+// one comparison. Entries live in RAM; a background task writes them to NVS (like Inventory),
+// and after a restart anything that was still queued or running is reported as such rather
+// than forgotten.
+class CommandJournal {
+public:
+    static CommandJournal& getInstance();
+    void initialize();                             // Load entries and start the flush task
+
+    static bool isValidKey(std::string_view key);
+
+    bool lookup(std::string_view key, JournalEntry& out) const;
+    void record(std::string_view key, uint16_t jobId);     // At intake, once the command has a slot
+    void update(std::string_view key, JobState state, const char* result);   // From JobTable as the job moves on
+    String describe(const JournalEntry& entry) const;      // "[DUP] {json}" for the client that resent it
+
+    void flush();                                  // Write now if anything changed
+
+private:
+    static constexpr int INDEX_SLOTS = 2 * Config::JOURNAL_SIZE;   // Power of two, at most half full
+    static_assert((INDEX_SLOTS & (INDEX_SLOTS - 1)) == 0, "Journal index size must be a power of two");
+
+    CommandJournal();
+    CommandJournal(const CommandJournal&) = delete;
+    CommandJournal& operator=(const CommandJournal&) = delete;
+
+    JournalEntry entries[Config::JOURNAL_SIZE];
+    int8_t index[INDEX_SLOTS];                     // Entry per slot, -1 when empty
+    int oldest;                                    // Next entry to reuse
+    bool dirty;
+    mutable portMUX_TYPE mux;
+    TaskHandle_t flushTask;
+
+    static uint32_t hashKey(std::string_view key);
+    int find(std::string_view key, uint32_t hash) const;   // Entry, or -1; caller holds mux
+    void insertIndex(int entry);
+    void removeIndex(int entry);
+    void rebuildIndex();
+    void load();
+    void changed();
+    static void flushTaskWrapper(void* parameter);
+};
@@ -0,0 +1,166 @@
+// include/CommandParser.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string_view>
+
+// Zero-allocation command parsing: a line is split into string_views in place and the
+// verb is looked up in a table whose hash seed is chosen at compile time so every verb
+// gets its own slot.
+
+namespace CommandParser {
+    constexpr int MAX_TOKENS = 12;                 // Verb plus arguments; the rest stays reachable via rest()
+
+    constexpr char toUpper(char c) { return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c; }
+    constexpr bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+    constexpr bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (toUpper(a[i]) != toUpper(b[i])) return false;
+        }
+        return true;
+    }
+
+    // Case-insensitive FNV-1a mixed with a seed
+    constexpr uint32_t hash(std::string_view text, uint32_t seed) {
+        uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+        for (char c : text) {
+            h = (h ^ (uint8_t)toUpper(c)) * 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+}
+
+// A tokenized command line. Views point into the caller's buffer, which must outlive this.
+class CommandArgs {
+public:
+    explicit CommandArgs(std::string_view line) : text(line), tokenCount(0) {
+        size_t i = 0;
+        while (tokenCount < CommandParser::MAX_TOKENS) {
+            while (i < line.size() && CommandParser::isSpace(line[i])) i++;
+            if (i == line.size()) break;
+            size_t start = i;
+            while (i < line.size() && !CommandParser::isSpace(line[i])) i++;
+            tokens[tokenCount++] = line.substr(start, i - start);
+        }
+    }
+
+    std::string_view line() const { return text; }
+    std::string_view verb() const { return tokenCount > 0 ? tokens[0] : std::string_view(); }
+    int count() const { return tokenCount > 0 ? tokenCount - 1 : 0; }      // Arguments after the verb
+
+    // Argument i (0 is the first one after the verb); empty when missing
+    std::string_view operator[](int i) const {
+        return (i >= 0 && i + 1 < tokenCount) ? tokens[i + 1] : std::string_view();
+    }
+
+    // Everything from argument i to the end of the line, for free text such as sequence names
+    std::string_view rest(int i) const {
+        if (i < 0 || i + 1 >= tokenCount) return std::string_view();
+        std::string_view tail = text.substr(tokens[i + 1].data() - text.data());
+        while (!tail.empty() && CommandParser::isSpace(tail.back())) tail.remove_suffix(1);
+        return tail;
+    }
+
+    bool is(int i, std::string_view keyword) const {
+        return i + 1 < tokenCount && CommandParser::equalsIgnoreCase((*this)[i], keyword);
+    }
+
+    // The whole token must be a decimal integer that fits in an int
+    bool toInt(int i, int& out) const { return parseInt((*this)[i], out); }
+    bool toFloat(int i, float& out) const { return parseFloat((*this)[i], out); }
+
+    static bool parseInt(std::string_view token, int& out) {
+        size_t i = 0;
+        bool negative = false;
+        if (i < token.size() && (token[i] == '-' || token[i] == '+')) negative = token[i++] == '-';
+        if (i == token.size()) return false;
+
+        int64_t value = 0;
+        for (; i < token.size(); i++) {
+            if (token[i] < '0' || token[i] > '9') return false;
+            value = value * 10 + (token[i] - '0');
+            if (value > (int64_t)INT32_MAX + 1) return false;
+        }
+        value = negative ? -value : value;
+        if (value > INT32_MAX || value < INT32_MIN) return false;
+        out = (int)value;
+        return true;
+    }
+
+    static bool parseFloat(std::string_view token, float& out) {
+        size_t i = 0;
+        bool negative = false;
+        if (i < token.size() && (token[i] == '-' || token[i] == '+')) negative = token[i++] == '-';
+
+        float value = 0.0f;
+        int digits = 0;
+        for (; i < token.size() && token[i] >= '0' && token[i] <= '9'; i++, digits++) {
+            value = value * 10.0f + (token[i] - '0');
+        }
+        if (i < token.size() && token[i] == '.') {
+            float scale = 0.1f;
+            for (i++; i < token.size() && token[i] >= '0' && token[i] <= '9'; i++, digits++) {
+                value += (token[i] - '0') * scale;
+                scale *= 0.1f;
+            }
+        }
+        if (digits == 0 || i != token.size()) return false;
+        out = negative ? -value : value;
+        return true;
+    }
+
+private:
+    std::string_view text;
+    std::string_view tokens[CommandParser::MAX_TOKENS];
+    int tokenCount;
+};
+
+// One verb of a command table; the handler type is up to the dispatcher
+template <typename Handler>
+struct CommandSpec {
+    std::string_view verb;
+    Handler handler;
+    int8_t minArgs;
+    int8_t maxArgs;               // -1: no upper bound
+    const char* usage;
+};
+
+// Verb -> spec lookup in O(verb length): one hash, one slot, one comparison. The seed is
+// searched at compile time until no two verbs share a slot, so a collision is a build error
+// (via valid()) rather than a slow path. The specs must have static storage.
+template <typename Handler, size_t N, size_t SLOTS = 64>
+class CommandTable {
+public:
+    static_assert(N < SLOTS, "Command table needs more slots than verbs");
+
+    constexpr explicit CommandTable(const CommandSpec<Handler> (&specs)[N]) : specs(specs), slots(), seed(0) {
+        for (uint32_t candidate = 1; candidate < 4096 && seed == 0; candidate++) {
+            bool clean = true;
+            for (size_t s = 0; s < SLOTS; s++) slots[s] = -1;
+            for (size_t i = 0; i < N && clean; i++) {
+                size_t slot = CommandParser::hash(specs[i].verb, candidate) % SLOTS;
+                if (slots[slot] >= 0) clean = false;
+                else slots[slot] = (int8_t)i;
+            }
+            if (clean) seed = candidate;
+        }
+    }
+
+    constexpr bool valid() const { return seed != 0; }
+    constexpr size_t size() const { return N; }
+    constexpr const CommandSpec<Handler>& at(size_t i) const { return specs[i]; }
+
+    constexpr const CommandSpec<Handler>* find(std::string_view verb) const {
+        int8_t index = slots[CommandParser::hash(verb, seed) % SLOTS];
+        if (index < 0 || !CommandParser::equalsIgnoreCase(specs[index].verb, verb)) return nullptr;
+        return &specs[index];
+    }
+
+private:
+    const CommandSpec<Handler>* specs;
+    int8_t slots[SLOTS];
+    uint32_t seed;
+};
@@ -0,0 +1,156 @@
+// include/CommandScheduler.h
+#pragma once
+
+#include <stdint.h>
+
+// Shares the command slots fairly between clients. Each client has its own FIFO lane with a
+// depth limit, and every lane has one slot held back for it while it is empty, so however
+// many clients flood the device an idle one can still queue a command. The command task
+// takes commands by deficit round-robin: on its turn a lane earns `quantum` credit and runs
+// commands while their cost fits, so a lane of long jobs gets no more of the machine per
+// round than a lane of quick commands.
+//
+// Only slot indices are handed out; the caller owns the slot storage and the locking.
+template <int SLOTS, int LANES>
+class CommandScheduler {
+    static_assert(SLOTS > 0 && SLOTS < 128, "Slot indices must fit int8_t");
+    static_assert(LANES > 0, "At least one lane");
+    static_assert(SLOTS >= LANES, "Every lane needs its reserved slot");
+
+public:
+    static constexpr int NONE = -1;
+
+    CommandScheduler(int laneDepth, int quantum) : laneDepth(laneDepth), quantum(quantum > 0 ? quantum : 1) {
+        clear();
+    }
+
+    void clear() {
+        for (int i = 0; i < SLOTS; i++) {
+            link[i] = (int8_t)(i + 1 < SLOTS ? i + 1 : NONE);
+        }
+        freeHead = 0;
+        used = 0;
+        emptyLanes = LANES;
+        for (Lane& lane : lanes) lane = Lane();
+        urgent = Lane();
+        current = 0;
+        turnStarted = false;
+    }
+
+    int pending() const { return used; }
+    int pending(int lane) const { return lanes[lane].count; }
+
+    // Commands the lane can still take: its own depth limit or the free slots not held back
+    // for other empty lanes, whichever is less
+    int space(int lane) const {
+        int laneSpace = laneDepth - lanes[lane].count;
+        int free = SLOTS - used;
+        int shared = free - emptyLanes + (lanes[lane].count == 0 ? 1 : 0);
+        if (shared > free) shared = free;    // Urgent commands may have taken reserved slots
+        if (shared < laneSpace) laneSpace = shared;
+        return laneSpace > 0 ? laneSpace : 0;
+    }
+
+    // Slot for a new command at the back of its lane, NONE if the lane or the pool is full.
+    // Costs are clamped to 1..quantum, so every lane makes progress on each of its turns.
+    int push(int lane, int cost) {
+        if (lane < 0 || lane >= LANES || space(lane) <= 0) return NONE;
+        int slot = takeFree();
+        slotCost[slot] = (uint8_t)(cost < 1 ? 1 : (cost > quantum ? quantum : cost));
+        append(lanes[lane], slot);
+        return slot;
+    }
+
+    // Slot that runs before every lane, newest first; limited by the pool only
+    int pushUrgent() {
+        if (used == SLOTS) return NONE;
+        int slot = takeFree();
+        slotCost[slot] = 0;
+        link[slot] = urgent.head;
+        urgent.head = (int8_t)slot;
+        if (urgent.tail == NONE) urgent.tail = (int8_t)slot;
+        urgent.count++;
+        return slot;
+    }
+
+    // Next slot to run, NONE when nothing is queued. The slot is free again as soon as this
+    // returns, so the caller copies it out under the same lock.
+    int pop() {
+        if (urgent.head != NONE) return removeHead(urgent);
+        if (used == 0) return NONE;
+
+        while (true) {
+            Lane& lane = lanes[current];
+            if (lane.head != NONE) {
+                if (!turnStarted) {
+                    lane.deficit += quantum;
+                    turnStarted = true;
+                }
+                if (slotCost[lane.head] <= lane.deficit) {
+                    lane.deficit -= slotCost[lane.head];
+                    int slot = removeHead(lane);
+                    if (lane.head == NONE) {
+                        // An idle lane banks no credit
+                        lane.deficit = 0;
+                        nextLane();
+                    }
+                    return slot;
+                }
+            }
+            nextLane();
+        }
+    }
+
+private:
+    struct Lane {
+        int8_t head = NONE;
+        int8_t tail = NONE;
+        uint8_t count = 0;
+        int deficit = 0;
+    };
+
+    int laneDepth;
+    int quantum;
+    int8_t link[SLOTS];          // Next slot in the same lane, or in the free list
+    uint8_t slotCost[SLOTS];
+    int freeHead;
+    int used;
+    int emptyLanes;              // Lanes still owed their reserved slot
+    Lane lanes[LANES];
+    Lane urgent;
+    int current;                 // Lane whose turn it is
+    bool turnStarted;            // It already got this turn's quantum
+
+    int takeFree() {
+        int slot = freeHead;
+        freeHead = link[slot];
+        link[slot] = NONE;
+        used++;
+        return slot;
+    }
+
+    void append(Lane& lane, int slot) {
+        if (lane.count == 0) emptyLanes--;
+        if (lane.tail == NONE) lane.head = (int8_t)slot;
+        else link[lane.tail] = (int8_t)slot;
+        lane.tail = (int8_t)slot;
+        lane.count++;
+    }
+
+    int removeHead(Lane& lane) {
+        int slot = lane.head;
+        lane.head = link[slot];
+        if (lane.head == NONE) lane.tail = NONE;
+        lane.count--;
+        if (lane.count == 0 && &lane != &urgent) emptyLanes++;
+        link[slot] = (int8_t)freeHead;
+        freeHead = slot;
+        used--;
+        return slot;
+    }
+
+    void nextLane() {
+        current = (current + 1) % LANES;
+        turnStarted = false;
+    }
+};
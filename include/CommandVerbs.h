@@ -0,0 +1,82 @@
+// include/CommandVerbs.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <utility>
+#include "CommandParser.h"
+
+// The console verbs with their arity and usage. CommandHandler pairs each one with its
+// handler; the host tests look verbs up in the same list.
+
+enum class Verb : uint8_t {
+    RESET, TEST, FAST, ANGLE, STARTANGLE, PILL, MEASUREMENTS, SEQUENCE, EXECUTE, LIST, DELETE,
+    RESETDATA, THRESHOLD, CALIBRATE, LABEL, REPORT, EXPLAIN, MODEL, PROFILE, MULTI, SERVOCAL,
+    REFILL, STATS,
+    COUNT
+};
+
+struct VerbSpec {
+    Verb id;
+    std::string_view verb;
+    int8_t minArgs;
+    int8_t maxArgs;               // -1: no upper bound
+    const char* usage;
+};
+
+namespace CommandVerbs {
+    // In Verb order
+    constexpr VerbSpec SPECS[] = {
+        {Verb::RESET,        "RESET",        0,  0, "reset"},
+        {Verb::TEST,         "TEST",         0,  0, "test"},
+        {Verb::FAST,         "FAST",         1,  1, "FAST <servo>"},
+        {Verb::ANGLE,        "ANGLE",        1,  1, "ANGLE <0-180>"},
+        {Verb::STARTANGLE,   "STARTANGLE",   1,  1, "STARTANGLE <0-180>"},
+        {Verb::PILL,         "PILL",         1,  1, "PILL <servo>"},
+        {Verb::MEASUREMENTS, "MEASUREMENTS", 1,  1, "MEASUREMENTS <count>"},
+        {Verb::SEQUENCE,     "SEQUENCE",     3, -1, "SEQUENCE <device> <name> (1,1,0,2,0,6)"},
+        {Verb::EXECUTE,      "EXECUTE",      2, -1, "EXECUTE <device> <name>"},
+        {Verb::LIST,         "LIST",         1,  1, "LIST <device>"},
+        {Verb::DELETE,       "DELETE",       2, -1, "DELETE <device> <sequence_name>"},
+        {Verb::RESETDATA,    "RESETDATA",    1,  1, "RESETDATA <servo_number> or RESETDATA ALL"},
+        {Verb::THRESHOLD,    "THRESHOLD",    1,  4, "THRESHOLD GET [servo] | THRESHOLD SET [servo] <type> <value>"},
+        {Verb::CALIBRATE,    "CALIBRATE",    1,  2, "CALIBRATE <servo> [EXPORT] | CALIBRATE CANCEL"},
+        {Verb::LABEL,        "LABEL",        2,  2, "LABEL <servo> GOOD|FLAWED"},
+        {Verb::REPORT,       "REPORT",       1,  1, "REPORT <servo>"},
+        {Verb::EXPLAIN,      "EXPLAIN",      1,  1, "EXPLAIN <servo>"},
+        {Verb::MODEL,        "MODEL",        1,  1, "MODEL EXPORT | MODEL APPLY"},
+        {Verb::PROFILE,      "PROFILE",      1,  4, "PROFILE <servo> [<vel> <accel> [jerk] | OFF] | PROFILE TUNE <servo> [trials]"},
+        {Verb::MULTI,        "MULTI",        1, -1, "MULTI <servo> <servo> [...] | MULTI ON|OFF"},
+        {Verb::SERVOCAL,     "SERVOCAL",     1,  3, "SERVOCAL <servo> [<field> <value> | FIND [trials] | RESET]"},
+        {Verb::REFILL,       "REFILL",       0,  2, "REFILL [<servo> <count>|+<added>|OFF]"},
+        {Verb::STATS,        "STATS",        0,  1, "STATS [servo] | STATS RESET"},
+    };
+    constexpr size_t COUNT = sizeof(SPECS) / sizeof(SPECS[0]);
+    static_assert(COUNT == (size_t)Verb::COUNT, "Every Verb needs exactly one spec");
+
+    constexpr bool inVerbOrder() {
+        for (size_t i = 0; i < COUNT; i++) {
+            if (SPECS[i].id != (Verb)i) return false;
+        }
+        return true;
+    }
+    static_assert(inVerbOrder(), "SPECS must be listed in Verb order");
+
+    // A command table entry for one verb with the dispatcher's handler
+    template <typename Handler>
+    constexpr CommandSpec<Handler> spec(Verb verb, Handler handler) {
+        const VerbSpec& v = SPECS[(size_t)verb];
+        return {v.verb, handler, v.minArgs, v.maxArgs, v.usage};
+    }
+
+    // Every verb with the Verb itself as its handler, for lookups that only need to know which verb matched
+    struct VerbTable {
+        CommandSpec<Verb> specs[COUNT];
+
+        constexpr VerbTable() : VerbTable(std::make_index_sequence<COUNT>()) {}
+
+    private:
+        template <size_t... I>
+        constexpr explicit VerbTable(std::index_sequence<I...>) : specs{spec((Verb)I, (Verb)I)...} {}
+    };
+}
@@ -12,6 +12,15 @@ namespace Config {
     constexpr int LED_PIN = 2;
     constexpr int SERVO_PINS[] = {26, 25};  // Pin 26 confirmed working, pin 25 for expansion
     constexpr int NUM_SERVOS = sizeof(SERVO_PINS) / sizeof(SERVO_PINS[0]);
+    
+    // PWM backend: SERVO_PINS are GPIOs for LEDC, output indices (board * 16 + channel) for PCA9685
+    enum class PwmBackend { LEDC, PCA9685 };
+    constexpr PwmBackend PWM_BACKEND = PwmBackend::LEDC;
+    constexpr uint8_t PCA9685_ADDRESSES[] = {0x40, 0x41};
+    constexpr int I2C_SDA_PIN = 21;
+    constexpr int I2C_SCL_PIN = 22;
+    static_assert(NUM_SERVOS <= (PWM_BACKEND == PwmBackend::LEDC ? 16 : 16 * (int)sizeof(PCA9685_ADDRESSES)),
+                  "More servos than the PWM backend has channels");
     constexpr int PIEZO_PINS[] = {32,33};
     constexpr const char* PIEZO_NAMES[] = {"GREEN", "BLUE", "RED", "ORANGE", "PURPLE", "PINK"};
     constexpr int NUM_PIEZOS = sizeof(PIEZO_PINS) / sizeof(PIEZO_PINS[0]);
@@ -24,14 +33,40 @@ namespace Config {
     constexpr int DEFAULT_ANGLE = 70;        // Updated dispense angle
     constexpr int DEFAULT_START_ANGLE = 0;  // Updated start angle
     constexpr int SERVO_DELAY_MS = 500;
+    constexpr int SERVO_PWM_HZ = 50;
+    constexpr int SERVO_MIN_PULSE_US = 500;     // 0°
+    constexpr int SERVO_MAX_PULSE_US = 2500;    // 180°
+    constexpr int SERVO_PROFILE_TICK_MS = 20;   // One duty update per 50 Hz PWM frame
+    constexpr int SERVO_SETTLE_MS = 100;        // Hold after a profiled move arrives (travel is already timed)
+    constexpr int CONCURRENT_STAGGER_MS = 80;   // Gap between move starts in a concurrent window, keeps impacts apart
 
     //Piezo configuration
     constexpr int PIEZO_MEASUREMENTS = 1000;
     constexpr int TASK_TIMEOUT_MS = 1000;
+    constexpr int PIEZO_SETTLE_MS = 800;        // Sensor window: no new capture until the last trigger has rung out
+    constexpr int ANALYSIS_QUEUE_LENGTH = 4;    // Captures waiting for pattern analysis
+
+    // Inventory Configuration
+    constexpr int INVENTORY_LOW_PILLS = 5;      // Warn once a bottle is down to this many
+    constexpr int INVENTORY_FLUSH_MS = 10000;   // Dispense decrements are batched into one NVS write per period
 
     // Task Configuration
     constexpr int TASK_STACK_SIZE = 8192;  // Increased for stability
+    constexpr int CONTROL_TASK_STACK_SIZE = 6144;  // JOBS copies the job table onto it
     constexpr int TASK_DELAY_MS = 10;
+    constexpr int SERIAL_RX_BUFFER_SIZE = 1024;  // Room for several binary command frames from a host script
+    constexpr int COMMAND_QUEUE_LENGTH = 12;     // Command slots: one reserved per client lane, the rest shared
+    constexpr int COMMAND_CLIENT_DEPTH = 5;      // Slots one client may hold, so a flood leaves room for the others
+    constexpr int COMMAND_JOB_COST = 4;          // Scheduling weight of EXECUTE/PILL/FAST/MULTI against 1 for other commands
+    constexpr int COMMAND_MAX_LENGTH = 100;      // Longer commands are rejected at intake
+    constexpr int CONTROL_QUEUE_LENGTH = 4;      // STOP/RESET/STATUS/JOBS, served even while a command runs
+    constexpr int JOB_TABLE_SIZE = 16;           // Tracked EXECUTE/PILL/FAST/MULTI jobs, finished ones included
+    constexpr int BATCH_MAX_COMMANDS = COMMAND_CLIENT_DEPTH;  // A batch must fit its client's empty lane
+    constexpr int BATCH_TABLE_SIZE = 4;          // Batches still waiting for their completion response
+    constexpr int BATCH_ID_LENGTH = 16;          // Client-supplied request id: letters, digits, '-', '_', '.'
+    constexpr int JOURNAL_SIZE = 32;             // Idempotency keys remembered, oldest forgotten first
+    constexpr int JOURNAL_KEY_LENGTH = 24;       // "@<key>" in front of a command; same characters as a request id
+    constexpr int JOURNAL_FLUSH_DELAY_MS = 200;  // Changes within this window share one NVS write
 
     // Network Configuration
     constexpr int WEB_SERVER_PORT = 80;
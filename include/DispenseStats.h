@@ -0,0 +1,53 @@
+// include/DispenseStats.h
+#pragma once
+#include <Arduino.h>
+#include "Config.h"
+#include "LatencyHistogram.h"
+
+// Where a pill's time goes: per-servo latency histograms of each phase of a dispense,
+// recorded from the servo and analysis tasks and read by STATS and GET /stats.
+// Every phase has a single writer task, so recording takes no lock; reset() only bumps an
+// epoch, and each histogram is cleared by its own writer on its next record.
+class DispenseStats {
+public:
+    enum Phase : uint8_t {
+        SENSOR_WAIT = 0,   // Attempt start to sensor window free (previous capture ringing out)
+        ARM,               // Sampler start to sampling
+        MOVE,              // Move start to servo release
+        DROP,              // Move start to trigger
+        CAPTURE,           // Trigger to end of capture
+        ANALYSIS,          // End of capture to end of pattern analysis, queueing included, persistence excluded
+        PERSIST,           // SPIFFS writes made by that analysis
+        DISPENSE,          // Whole Dispense call, all attempts
+        PHASE_COUNT
+    };
+
+    static DispenseStats& getInstance();
+    static const char* phaseName(Phase phase);
+
+    void record(int servoIndex, Phase phase, uint32_t us);
+    const LatencyHistogram& get(int servoIndex, Phase phase) const;   // Empty until written since the last reset
+    void reset();                                                      // Any task
+
+    // Queue to dispatch of every command, written by the command task only
+    void recordCommandPickup(uint32_t us);
+    const LatencyHistogram& getCommandPickup() const;
+
+    String getReport(int servoIndex) const;   // One line per phase that has samples
+    String getCommandReport() const;
+    String toJson() const;
+
+private:
+    DispenseStats() : resetEpoch(0), epochs{}, commandPickupEpoch(0) {}
+    DispenseStats(const DispenseStats&) = delete;
+    DispenseStats& operator=(const DispenseStats&) = delete;
+
+    static LatencyHistogram& current(LatencyHistogram& histogram, uint32_t& epoch, uint32_t resetEpoch);   // Writer side
+    static const LatencyHistogram& view(const LatencyHistogram& histogram, uint32_t epoch, uint32_t resetEpoch);
+
+    LatencyHistogram histograms[Config::NUM_SERVOS][PHASE_COUNT];
+    LatencyHistogram commandPickup;
+    volatile uint32_t resetEpoch;                          // Bumped by reset()
+    uint32_t epochs[Config::NUM_SERVOS][PHASE_COUNT];      // Epoch each histogram was last cleared in, by its writer
+    uint32_t commandPickupEpoch;
+};
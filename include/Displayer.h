@@ -5,11 +5,17 @@
 #include <WebServer.h>
 #include <WebSocketsServer.h>
 #include <SPIFFS.h>
+#include <atomic>
 #include <map>
 #include <queue>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <string_view>
+#include <vector>
 #include "Config.h"
+#include "CommandScheduler.h"
+#include "ModelSnapshot.h"
 
 struct ConnectedDevice {
     uint8_t clientId;
@@ -23,34 +29,123 @@ struct ConnectedDevice {
     unsigned long throttleEndTime;     // When throttling ends
 };
 
+// One command slot, copied by value through the statically allocated command queue
+struct QueuedCommand {
+    static constexpr uint8_t SERIAL_CLIENT = 0xFF;    // Typed or framed on the serial console
+    static constexpr uint8_t LOCAL_CLIENT = 0xFE;     // Raised by the firmware itself (HTTP handlers)
+    
+    char text[Config::COMMAND_MAX_LENGTH + 1];        // Trimmed, NUL-terminated
+    uint8_t length;
+    uint8_t clientId;                                 // WebSocket client number, or one of the above
+    uint32_t receivedUs;                              // micros() at intake, for pickup latency
+    uint16_t jobId;                                   // JobTable id, 0 if not tracked as a job
+    uint32_t stopEpoch;                               // Flushes before pickup; a later flush stops it
+};
+static_assert(Config::COMMAND_MAX_LENGTH <= 255, "Command length must fit QueuedCommand::length");
+
+// Outcome of admitting a batch: either every command got a slot and a job, or none did
+struct BatchAdmission {
+    enum class Status : uint8_t {
+        ACCEPTED = 0,
+        EMPTY,
+        BAD_ID,
+        TOO_MANY,
+        TOO_LONG,
+        CONTROL,                                      // Control verbs are sent on their own
+        THROTTLED,
+        MALFORMED,                                    // Binary frame that does not decode
+        BUSY,                                         // Not enough free slots right now; resend later
+        DUPLICATE                                     // Idempotency key seen before; answered with [DUP]
+    };
+    
+    Status status;
+    uint8_t count;                                    // Commands in the batch
+    uint8_t line;                                     // 1-based line that was refused, 0 if none
+    uint8_t space;                                    // Free queue slots when BUSY
+    uint16_t jobIds[Config::BATCH_MAX_COMMANDS];      // In command order, when ACCEPTED
+    
+    static const char* statusName(Status status);
+};
+
 class Displayer {
 public:
     static Displayer& getInstance();
     void initialize();
     void handleClients();
     void logMessage(const String& msg);
+    void logLines(const String& text);  // logMessage() per line, so a long report is not cut at the broadcast limit
     void setWebSocketEventHandler();
     void broadcast(const String& message);
-    String getCommandBuffer();
-    void clearCommandBuffer();
+    bool waitForCommand(QueuedCommand& command, TickType_t timeout = portMAX_DELAY);  // Blocks until a command is queued
+    bool waitForControlCommand(QueuedCommand& command, TickType_t timeout = portMAX_DELAY);  // STOP, RESET, STATUS
+    bool queueCommandFront(const QueuedCommand& command);   // Runs next, ahead of everything queued
+    int flushCommands();                                     // Drops queued commands, returns how many
+    uint32_t getStopEpoch() const { return stopEpoch; }      // Counts flushes
     bool hasCommands();  // Check if there are queued commands
+    int getCommandSpace(uint8_t clientId);  // Command slots this client can still take
+    int pendingCommands();  // Queued commands of all clients
     void sendConnectedDevices();
     int getConnectedDeviceCount();
     bool isClientThrottled(uint8_t clientId);   // Check if client is rate limited
     void updateClientRateLimit(uint8_t clientId); // Update client's rate limit status
+    bool queueCommand(const char* text, size_t length, uint8_t clientId);  // Copy a command into a free slot (control verbs jump the queue), no heap work
+    BatchAdmission admitCommand(const char* text, size_t length, uint8_t clientId);  // queueCommand() with the outcome, "@<key>" prefix honoured
+    bool queueCommand(const String& command) { return queueCommand(command.c_str(), command.length(), QueuedCommand::LOCAL_CLIENT); }
+    BatchAdmission queueBatch(std::string_view requestId, const char* text, size_t length, uint8_t clientId);  // One command per line, all or nothing
+    BatchAdmission queueBatch(std::string_view requestId, const std::string_view* commands, int count, uint8_t clientId);
+    void reply(uint8_t clientId, const String& message);    // To the one client behind a request (serial for local ones)
+    void logEvent(const String& text, const uint8_t* frame, size_t frameLength);  // logMessage() with a binary form for binary clients
+    void broadcastGraph(int servoIndex, int triggerChannel, const std::vector<std::vector<int>>& channels);  // Piezo capture, to web clients only
 
 private:
-    Displayer() : server(Config::WEB_SERVER_PORT), webSocket(Config::WEBSOCKET_PORT) {
-        // Create command queue that can hold up to 10 commands
-        commandQueue = xQueueCreate(10, sizeof(char*));
+    static constexpr int MAX_CLIENTS = WEBSOCKETS_SERVER_CLIENT_MAX;
+    static constexpr int COMMAND_LANES = MAX_CLIENTS + 2;   // One per WebSocket client, then serial and local
+    static_assert(Config::COMMAND_QUEUE_LENGTH - COMMAND_LANES + 1 >= Config::BATCH_MAX_COMMANDS,
+                  "A full batch must fit one lane next to the other lanes' reserved slots");
+    
+    // How a WebSocket client is talked to; binary after a successful "PROTO 1"
+    enum class ClientMode : uint8_t {
+        NONE = 0,
+        TEXT,
+        BINARY
+    };
+    
+    Displayer() : server(Config::WEB_SERVER_PORT), webSocket(Config::WEBSOCKET_PORT),
+                  scheduler(Config::COMMAND_CLIENT_DEPTH, Config::COMMAND_JOB_COST), schedulerMux(portMUX_INITIALIZER_UNLOCKED),
+                  stopEpoch(0), clientModes(), modelImportReceived(0) {
+        // Command slots live in this singleton, so intake never touches the heap
+        commandReady = xSemaphoreCreateCountingStatic(Config::COMMAND_QUEUE_LENGTH, 0, &commandReadyBuffer);
+        controlQueue = xQueueCreateStatic(Config::CONTROL_QUEUE_LENGTH, sizeof(QueuedCommand), controlQueueStorage, &controlQueueBuffer);
+        intakeLock = xSemaphoreCreateMutexStatic(&intakeLockBuffer);
     }
     WebServer server;
     WebSocketsServer webSocket;
-    String commandBuffer;  // Keep for backward compatibility
-    QueueHandle_t commandQueue;  // FreeRTOS queue for commands
+    QueuedCommand commandSlots[Config::COMMAND_QUEUE_LENGTH];
+    CommandScheduler<Config::COMMAND_QUEUE_LENGTH, COMMAND_LANES> scheduler;  // Which slot runs next, per-client lanes
+    portMUX_TYPE schedulerMux;
+    volatile uint32_t stopEpoch;  // Bumped with each flush, under schedulerMux
+    SemaphoreHandle_t commandReady;  // Counts queued commands; the command task sleeps on it
+    StaticSemaphore_t commandReadyBuffer;
+    QueueHandle_t controlQueue;  // Priority lane, drained by the control task
+    StaticQueue_t controlQueueBuffer;
+    uint8_t controlQueueStorage[Config::CONTROL_QUEUE_LENGTH * sizeof(QueuedCommand)];
+    SemaphoreHandle_t intakeLock;  // Serializes producers, so free slots seen by a batch stay free
+    StaticSemaphore_t intakeLockBuffer;
     std::map<uint8_t, ConnectedDevice> connectedDevices;
+    std::atomic<ClientMode> clientModes[MAX_CLIENTS];  // Indexed by client number; set by the WebSocket task, read by every broadcasting task
     
     static void onWebSocketEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t length);
+    static int laneOf(uint8_t clientId);
+    bool enqueueCommand(const QueuedCommand& command, int cost);  // Back of its client's lane; caller holds intakeLock
+    int lanePending(uint8_t clientId);
+    void handleBatchRequest(uint8_t clientId, const char* text, size_t length);
+    void handleProtocolRequest(uint8_t clientId, const char* text, size_t length);
+    void handleBinaryMessage(uint8_t clientId, const uint8_t* payload, size_t length);
+    void sendAck(uint8_t clientId, uint16_t sequence, const BatchAdmission& admission);
+    int countClients(ClientMode mode) const;
+    void sendToClients(ClientMode mode, const uint8_t* frame, size_t length);
+    void broadcastText(const String& message);
+    static std::vector<uint8_t> encodeLog(const String& message);
     void connectToWiFi();
     void setupWebServer();
     void initSPIFFS();
@@ -60,4 +155,12 @@ private:
     void handleDeviceDisconnection(uint8_t clientId);
     void updateDeviceActivity(uint8_t clientId);
     void updateConnectedDevicesActivity();
+    
+    // Model snapshot transfer (GET/POST /model)
+    File modelImportFile;
+    size_t modelImportReceived;
+    String modelImportError;
+    void handleModelExport();
+    void handleModelUpload();
+    void handleModelUploadDone();
 };
\ No newline at end of file
@@ -0,0 +1,85 @@
+// include/DropAttributor.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Splits one shared sensor window into impacts and attributes each impact to one of
+// the servos that were moving.
+
+namespace DropAttributor {
+    constexpr int MAX_CHANNELS = 6;              // Capacity of Config::PIEZO_NAMES
+    constexpr int MAX_CANDIDATES = 8;            // Servos moving in one window
+    constexpr int MAX_IMPACTS = 8;
+    constexpr uint32_t MIN_SIGNATURE_SAMPLES = 8;
+}
+
+// One impact inside a capture, in sample units
+struct ImpactFeatures {
+    int onset;                                            // First sample above threshold on any channel
+    int end;                                              // Exclusive
+    int channelOnset[DropAttributor::MAX_CHANNELS];       // Relative to onset; -1 if the channel never crossed
+    float peak[DropAttributor::MAX_CHANNELS];
+};
+
+// Learned per-servo, per-channel arrival-time and amplitude signature
+struct DropSignature {
+    uint32_t samples;
+    float shareMean[DropAttributor::MAX_CHANNELS];        // Channel peak / sum of channel peaks
+    float shareVar[DropAttributor::MAX_CHANNELS];
+    float lagMean[DropAttributor::MAX_CHANNELS];          // Channel onset relative to the impact onset
+    float lagVar[DropAttributor::MAX_CHANNELS];
+
+    DropSignature() : samples(0), shareMean{}, shareVar{}, lagMean{}, lagVar{} {}
+    bool ready() const { return samples >= DropAttributor::MIN_SIGNATURE_SAMPLES; }
+};
+
+// A servo that moved during the window and where its pill is expected
+struct AttributionCandidate {
+    int servo;
+    float expectedOnset;                  // Samples from window start; < 0 when unknown
+    float onsetTolerance;                 // Samples, one "sigma"
+    const DropSignature* signature;       // May be null or not ready
+};
+
+enum class DropVerdict : uint8_t {
+    NOT_REQUESTED = 0,
+    DROPPED = 1,
+    MISSING = 2,                          // No impact matched this servo
+    MULTIPLE = 3,                         // More than one impact matched (possible double pill)
+    AMBIGUOUS = 4                         // Impact count is off and this servo could not be told apart
+};
+
+struct AttributionResult {
+    int impactCount;
+    ImpactFeatures impacts[DropAttributor::MAX_IMPACTS];
+    int assigned[DropAttributor::MAX_IMPACTS];            // Candidate index per impact
+    bool confident[DropAttributor::MAX_IMPACTS];          // Best candidate clearly beats the runner-up
+    DropVerdict verdicts[DropAttributor::MAX_CANDIDATES];
+};
+
+namespace DropAttributor {
+    constexpr float RETRIGGER_RATIO = 2.0f;       // A rise this far above the decaying envelope is a new impact
+    constexpr float ENVELOPE_DECAY = 0.995f;      // Per sample
+    constexpr float UNMATCHED_COST = 16.0f;       // Leaving an impact out of the 1:1 matching (4 sigma)
+    constexpr float AMBIGUITY_MARGIN = 4.0f;      // Cost gap below which two servos are indistinguishable
+
+    // Segment a capture into at most maxImpacts impacts. An impact ends after quietSamples
+    // with every channel at or below threshold, or when a channel rises sharply again.
+    int segmentImpacts(const std::vector<std::vector<int>>& channels, int channelCount, int threshold,
+                       int quietSamples, ImpactFeatures* out, int maxImpacts);
+
+    // Fold one isolated impact into a servo's signature
+    void updateSignature(DropSignature& signature, const ImpactFeatures& impact, int channelCount);
+
+    // Squared normalized distance of an impact from a candidate's expectation
+    float impactCost(const ImpactFeatures& impact, const AttributionCandidate& candidate, int channelCount);
+
+    // Minimum-cost one-to-one matching of impacts to candidates; surplus impacts go to their
+    // nearest candidate. Verdicts are indexed like candidates.
+    AttributionResult attribute(const ImpactFeatures* impacts, int impactCount,
+                                const AttributionCandidate* candidates, int candidateCount, int channelCount);
+
+    const char* verdictName(DropVerdict verdict);
+}
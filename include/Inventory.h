@@ -0,0 +1,44 @@
+// include/Inventory.h
+#pragma once
+#include <Arduino.h>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "Config.h"
+
+// Pills left per bottle. Counts live in RAM and are updated from the command task and the
+// analysis task; a background task writes them to NVS in batches, so a dispense never waits
+// on flash. A bottle that was never filled is untracked and never blocks anything.
+class Inventory {
+public:
+    static constexpr int UNTRACKED = -1;
+
+    static Inventory& getInstance();
+    void initialize();                            // Load counts and start the flush task
+
+    void refill(int servoIndex, int count);       // Set the count (UNTRACKED stops tracking)
+    void add(int servoIndex, int pills);
+    void consume(int servoIndex, int pills);      // Confirmed dispenses
+    void markEmpty(int servoIndex);               // The dispenser itself found the bottle empty
+    int getCount(int servoIndex) const;
+    
+    // Checks a whole plan before anything moves; lists every bottle that cannot cover it
+    bool checkPlan(const std::vector<int>& counts, String& problems) const;
+    String getReport() const;
+
+    void flush();                                 // Write now if anything changed
+
+private:
+    Inventory();
+    Inventory(const Inventory&) = delete;
+    Inventory& operator=(const Inventory&) = delete;
+
+    int16_t counts[Config::NUM_SERVOS];
+    bool dirty;
+    mutable portMUX_TYPE mux;
+    TaskHandle_t flushTask;
+
+    void load();
+    void changed(bool urgent);
+    static void flushTaskWrapper(void* parameter);
+};
@@ -0,0 +1,91 @@
+// include/JobTable.h
+#pragma once
+#include <Arduino.h>
+#include <string_view>
+#include <freertos/FreeRTOS.h>
+#include "Config.h"
+
+enum class JobState : uint8_t {
+    QUEUED = 0,
+    RUNNING,
+    DONE,
+    FAILED,
+    CANCELLED
+};
+
+struct Job {
+    uint16_t id;                                   // 0: free slot
+    JobState state;
+    uint8_t clientId;                              // QueuedCommand::clientId of the request
+    uint16_t done;                                 // Progress, in units of the command (pills for EXECUTE)
+    uint16_t total;
+    uint32_t queuedMs;
+    uint32_t startedMs;
+    uint32_t finishedMs;
+    char command[Config::COMMAND_MAX_LENGTH + 1];
+    char result[32];                               // Why a job failed
+    char key[Config::JOURNAL_KEY_LENGTH + 1];      // Idempotency key, empty if the client gave none
+
+    bool finished() const { return state == JobState::DONE || state == JobState::FAILED || state == JobState::CANCELLED; }
+};
+
+// The jobs of one batch request, collected until the last one finishes. Outcomes are copied
+// in as each job settles, so the response does not depend on the jobs still being in the table.
+struct JobBatch {
+    char requestId[Config::BATCH_ID_LENGTH + 1];   // Empty: free slot
+    uint8_t clientId;
+    uint8_t count;
+    uint8_t settled;
+    uint16_t jobIds[Config::BATCH_MAX_COMMANDS];
+    JobState states[Config::BATCH_MAX_COMMANDS];
+    char results[Config::BATCH_MAX_COMMANDS][sizeof(Job::result)];
+};
+
+// Long-running commands (EXECUTE, PILL, FAST, MULTI) are tracked as jobs: intake hands out
+// an id as soon as the command is queued, and every state change or progress step is
+// broadcast as a "[JOB] {json}" event. The table is bounded; a new job reuses the slot of
+// the oldest finished one. Every command of a batch is a job too, and once all of them have
+// finished the requesting client gets one "[BATCH] {json}" response with each outcome.
+class JobTable {
+public:
+    static_assert(Config::JOB_TABLE_SIZE > Config::COMMAND_QUEUE_LENGTH, "Every queued command plus the running one needs a job slot");
+
+    static JobTable& getInstance();
+    static bool isJobCommand(std::string_view verb);
+    static const char* stateName(JobState state);
+
+    // Intake: create() reserves a QUEUED job (0 if the table is full), publish() announces it
+    // once the command is really queued, discard() frees it if queueing failed
+    uint16_t create(std::string_view command, uint8_t clientId, std::string_view key = std::string_view());
+    void publish(uint16_t id);
+    void discard(uint16_t id);
+    void cancel(uint16_t id);                      // Dropped from the queue before it ran
+    bool openBatch(std::string_view requestId, uint8_t clientId, const uint16_t* jobIds, int count);  // Before any of them is queued
+
+    // Command task: the job being run, and what its handler reports
+    void start(uint16_t id);
+    void progress(uint16_t done, uint16_t total);
+    void fail(const char* reason);                 // Takes effect at finish()
+    void finish(bool cancelled);
+
+    bool get(uint16_t id, Job& out) const;
+    String getReport() const;                      // One line per job, newest last
+
+private:
+    JobTable();
+    JobTable(const JobTable&) = delete;
+    JobTable& operator=(const JobTable&) = delete;
+
+    Job jobs[Config::JOB_TABLE_SIZE];
+    JobBatch batches[Config::BATCH_TABLE_SIZE];
+    uint16_t nextId;
+    uint16_t runningId;
+    mutable portMUX_TYPE mux;
+
+    int indexOf(uint16_t id) const;
+    Job* find(uint16_t id);
+    void emit(uint16_t id);
+    void journal(uint16_t id);                     // A keyed job reports its new state to CommandJournal
+    bool settle(const Job& job, JobBatch& completed);   // Caller holds mux
+    static void respond(const JobBatch& batch);
+};
@@ -0,0 +1,79 @@
+// include/LatencyHistogram.h
+#pragma once
+
+#include <stdint.h>
+
+// Log-linear histogram of durations in microseconds: exact below 8 us, then 8 buckets per
+// power of two (at most 12.5% bucket width) up to ~16.7 s. Fixed memory, O(1) record.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 3;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr uint32_t MAX_VALUE = (1UL << 24) - 1;   // Longer samples land in the last bucket
+    static constexpr int BUCKETS = SUB_BUCKETS * (24 - SUB_BITS + 1);
+
+    LatencyHistogram() { reset(); }
+
+    void reset() {
+        for (int i = 0; i < BUCKETS; i++) counts[i] = 0;
+        total = 0;
+        maxSeen = 0;
+    }
+
+    void record(uint32_t us) {
+        if (us > maxSeen) maxSeen = us;
+        int index = bucketOf(us > MAX_VALUE ? MAX_VALUE : us);
+
+        // A full bucket halves the whole histogram: percentiles keep their shape and older
+        // samples gradually weigh less, without ever growing the memory
+        if (counts[index] == UINT16_MAX) {
+            total = 0;
+            for (int i = 0; i < BUCKETS; i++) {
+                counts[i] >>= 1;
+                total += counts[i];
+            }
+        }
+        counts[index]++;
+        total++;
+    }
+
+    uint32_t count() const { return total; }
+    uint32_t max() const { return maxSeen; }
+
+    // Midpoint of the bucket holding the given fraction (0..1] of samples; 0 when empty
+    uint32_t percentile(float fraction) const {
+        if (total == 0) return 0;
+        uint32_t target = (uint32_t)(fraction * total + 0.999f);
+        if (target < 1) target = 1;
+
+        uint32_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= target) return bucketLow(i) + bucketWidth(i) / 2;
+        }
+        return maxSeen;
+    }
+
+    static int bucketOf(uint32_t us) {
+        if (us < (uint32_t)SUB_BUCKETS) return (int)us;
+        int msb = 31 - __builtin_clz(us);
+        int octave = msb - SUB_BITS + 1;
+        int sub = (us >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return octave * SUB_BUCKETS + sub;
+    }
+
+    static uint32_t bucketLow(int index) {
+        if (index < SUB_BUCKETS) return index;
+        int octave = index / SUB_BUCKETS;
+        return (uint32_t)(SUB_BUCKETS + index % SUB_BUCKETS) << (octave - 1);
+    }
+
+    static uint32_t bucketWidth(int index) {
+        return index < SUB_BUCKETS ? 1 : 1UL << (index / SUB_BUCKETS - 1);
+    }
+
+private:
+    uint16_t counts[BUCKETS];
+    uint32_t total;
+    uint32_t maxSeen;
+};
@@ -0,0 +1,25 @@
+// include/ModelLock.h
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// Scoped lock over the learned model: PatternAnalyzer's recordings, parameters and score
+// history, and the SPIFFS files they are saved to. The analysis, command, calibration and
+// web tasks all reach them, so every read or write of either side holds this. Recursive,
+// because model operations call each other (a threshold setter saves progress).
+class ModelLock {
+public:
+    ModelLock() { xSemaphoreTakeRecursive(handle(), portMAX_DELAY); }
+    ~ModelLock() { xSemaphoreGiveRecursive(handle()); }
+    ModelLock(const ModelLock&) = delete;
+    ModelLock& operator=(const ModelLock&) = delete;
+
+private:
+    static SemaphoreHandle_t handle() {
+        // Static storage, created on first use by whichever task gets there first
+        static StaticSemaphore_t buffer;
+        static SemaphoreHandle_t mutex = xSemaphoreCreateRecursiveMutexStatic(&buffer);
+        return mutex;
+    }
+};
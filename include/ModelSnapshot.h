@@ -0,0 +1,75 @@
+// include/ModelSnapshot.h
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+#include "SPIFFS.h"
+#include "Config.h"
+
+// Single-file snapshot of every servo's learned model (progress file with recordings,
+// reference pattern and parameters) and drop signature, plus optional score history and drift state.
+// Export and import stream section by section so the blob never sits in RAM. Both go through
+// files on SPIFFS, and only touch the live model files under ModelLock.
+//
+// Layout: SnapshotHeader, then SectionHeader + raw file bytes for each section. From v3 the
+// header carries a CRC-32 of everything after it.
+class ModelSnapshot {
+public:
+    static constexpr uint32_t MAGIC = 0x4E534450;   // "PDSN"
+    static constexpr uint16_t VERSION = 3;           // v2 adds drop signatures, v3 the checksum; older snapshots still import
+    static constexpr const char* IMPORT_PATH = "/model_import.bin";
+    static constexpr const char* EXPORT_PATH = "/model_export.bin";
+    static constexpr size_t CHUNK_SIZE = 512;
+
+    enum SectionKind : uint8_t {
+        SECTION_PROGRESS = 1,
+        SECTION_HISTORY = 2,
+        SECTION_DRIFT = 3,
+        SECTION_SIGNATURE = 4,
+        SECTION_LAST = SECTION_SIGNATURE
+    };
+
+    struct SnapshotHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint8_t numServos;
+        uint8_t numPiezos;
+        uint8_t sizeofSizeT;       // Progress files store raw size_t/unsigned long values
+        uint8_t sizeofULong;
+        uint8_t includesHistory;
+        uint8_t sectionCount;
+        uint32_t checksum;         // v3+: CRC-32 of the sections; absent from older headers
+    };
+
+    struct SectionHeader {
+        uint8_t servo;
+        uint8_t kind;
+        uint16_t reserved;
+        uint32_t length;
+    };
+
+    using Sink = std::function<void(const uint8_t*, size_t)>;
+
+    // Write the snapshot to EXPORT_PATH in one go under ModelLock, so it is a consistent
+    // picture with an exact size however long the download of it takes
+    static bool exportToFile(bool includeHistory);
+    // Stream the snapshot to sink in CHUNK_SIZE pieces; caller holds ModelLock. The header goes
+    // out with a zero checksum, and the one to patch in is returned in checksum.
+    static bool exportTo(const Sink& sink, bool includeHistory, uint32_t& checksum);
+
+    // Check a snapshot header against this firmware's schema
+    static bool validateHeader(const SnapshotHeader& header, String& error);
+    // Validate IMPORT_PATH and replace the per-servo files with its sections; the caller holds
+    // ModelLock through this and the reload, so no dispense saves the old model in between
+    static bool applyImport(String& error);
+
+    static String sectionPath(int servoIndex, uint8_t kind);
+    static size_t headerSize(uint16_t version);     // Bytes of SnapshotHeader a snapshot of this version has
+
+private:
+    static SnapshotHeader makeHeader(bool includeHistory);
+    static bool isExported(uint8_t kind, bool includeHistory);
+    static bool copyBytes(File& from, File& to, uint32_t length);
+    static uint32_t maxSectionLength(uint8_t kind);   // Largest file of this kind the firmware writes
+    static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t length);
+};
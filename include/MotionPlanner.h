@@ -0,0 +1,35 @@
+// include/MotionPlanner.h
+#pragma once
+
+// Steps a profiled servo move one PWM frame at a time within its velocity, acceleration
+// and jerk limits.
+
+// Per-servo motion limits; maxVelocity 0 jumps straight to the target (legacy behaviour)
+struct MotionProfile {
+    float maxVelocity;     // deg/s
+    float acceleration;    // deg/s^2
+    float jerk;            // deg/s^3, 0 = trapezoidal
+
+    MotionProfile(float velocity = 0.0f, float accel = 0.0f, float jerkLimit = 0.0f)
+        : maxVelocity(velocity), acceleration(accel), jerk(jerkLimit) {}
+    bool isProfiled() const { return maxVelocity > 0.0f && acceleration > 0.0f; }
+    // A jerk below the acceleration would take over a second to reach it, and step() looks
+    // ahead over the whole ramp every frame
+    bool isValid() const {
+        return maxVelocity >= 0.0f && acceleration >= 0.0f && (jerk == 0.0f || jerk >= acceleration);
+    }
+};
+
+// Where a profiled move currently is
+struct MotionState {
+    float position;        // deg
+    float velocity;        // deg/s
+    float acceleration;    // deg/s^2
+};
+
+namespace MotionPlanner {
+    // Advance the state by dt towards target. Each frame takes the highest acceleration from
+    // which braking at the jerk limit still stops short of the target and easing off stays
+    // under maxVelocity. Returns true on arrival, with the state parked on the target.
+    bool step(const MotionProfile& profile, MotionState& state, float target, float dt);
+}
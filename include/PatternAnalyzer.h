@@ -6,6 +6,8 @@
 #include <functional>
 #include "SPIFFS.h"
 #include "Config.h"
+#include "ThresholdCalibrator.h"
+#include "DropAttributor.h"
 
 struct SignalEnvelope {
     std::vector<float> envelope;
@@ -30,20 +32,139 @@ struct DispensingRecord {
     }
 };
 
+// Per-servo analysis parameters (persisted with the servo's model)
+struct AnalysisParams {
+    float deviationThreshold;      // Average similarity threshold
+    float minChannelThreshold;     // Minimum similarity for any individual channel
+    int envelopePoints;            // Envelope resolution
+    int learningSize;              // Recordings collected before the model is built (odd)
+    SimilarityMode similarityMode;
+
+    AnalysisParams() {
+        deviationThreshold = 0.75f;
+        minChannelThreshold = 0.6f;
+        envelopePoints = 50;
+        learningSize = 9;
+        similarityMode = SimilarityMode::BEST_OF_BOTH;
+    }
+};
+
+// Numeric outcome of the last analyzed dispense; explainVerdict() turns it into text on demand
+struct DispenseVerdict {
+    bool analyzed;                 // False until a dispense has been compared against a reference
+    bool isNormal;
+    bool avgGood;
+    bool bestChannelExcellent;
+    bool allChannelsGood;
+    float avgSimilarity;
+    float bestChannelSim;
+    float worstChannelSim;
+    uint8_t bestChannel;
+    uint8_t worstChannel;
+    float channelSims[Config::NUM_PIEZOS];
+    uint8_t divergenceChannel;     // Channel and envelope point where the normalized envelopes differ most
+    int divergenceIndex;
+    float divergenceDelta;
+    float averageThreshold;        // Parameters in effect for this verdict
+    float channelThreshold;
+    SimilarityMode mode;
+
+    DispenseVerdict() : analyzed(false), isNormal(true) {}
+};
+
+// Streaming control chart over one similarity signal: EWMA plus a lower one-sided
+// CUSUM, both against a baseline learned from the first dispenses after the model is built
+struct DriftChart {
+    float mean;
+    float m2;           // Welford sum of squared deviations during warm-up
+    float ewma;
+    float cusum;        // Accumulates downward shifts only
+    uint32_t samples;
+
+    DriftChart() : mean(0.0f), m2(0.0f), ewma(0.0f), cusum(0.0f), samples(0) {}
+    void update(float x);
+    bool ready() const;
+    float sigma() const;
+    bool ewmaLow() const;
+    bool cusumLow() const;
+};
+
+enum class DriftState : uint8_t {
+    WARMUP = 0,
+    OK = 1,
+    WARNING = 2,        // EWMA below its lower control limit
+    DRIFT = 3           // CUSUM signalled a sustained downward shift - schedule relearning
+};
+
+struct DriftMonitor {
+    DriftChart average;
+    DriftChart best;
+    DriftState state;
+
+    DriftMonitor() : state(DriftState::WARMUP) {}
+};
+
 class PatternAnalyzer {
+public:
+    static constexpr int MIN_LEARNING_SIZE = 3;
+    static_assert(MIN_LEARNING_SIZE >= 2, "Learning compares size() against learningSize - 1");
+    static constexpr int MAX_LEARNING_SIZE = 15;
+    static constexpr int MIN_ENVELOPE_POINTS = 10;
+    static constexpr int MAX_ENVELOPE_POINTS = 200;
+
+    // Largest size each per-servo file can legitimately have; snapshot imports are checked against these
+    static constexpr size_t MAX_ENVELOPE_BYTES = sizeof(size_t) + MAX_ENVELOPE_POINTS * sizeof(float) +
+                                                 2 * sizeof(float) + sizeof(int) + sizeof(unsigned long) + 1 + 255;
+    static constexpr size_t MAX_PROGRESS_BYTES = sizeof(size_t) + sizeof(bool) + sizeof(int) +
+                                                 MAX_LEARNING_SIZE * (sizeof(unsigned long) + sizeof(bool) + Config::NUM_PIEZOS * MAX_ENVELOPE_BYTES) +
+                                                 Config::NUM_PIEZOS * (sizeof(size_t) + MAX_ENVELOPE_POINTS * sizeof(float) + 2 * sizeof(float) + sizeof(int)) +
+                                                 sizeof(uint32_t) + 2 * sizeof(float) + 2 * sizeof(int) + 1;
+    static constexpr size_t HISTORY_BYTES = 2 * sizeof(int) + ThresholdCalibrator::MAX_SAMPLES * sizeof(ScoreSample);
+    static constexpr size_t DRIFT_BYTES = sizeof(DriftMonitor);
+    static constexpr uint8_t SIGNATURE_VERSION = 1;                    // Bump when DropSignature changes
+    static constexpr size_t SIGNATURE_BYTES = 1 + sizeof(DropSignature);   // Version byte, then the struct
+
 private:
-    static constexpr int MAX_RECORDINGS = 9; // Odd number for cleaner majority voting
     static constexpr float SIMILARITY_THRESHOLD = 0.7f;
-    static float DEVIATION_THRESHOLD;      // Average similarity threshold (adjustable)
-    static float MIN_CHANNEL_THRESHOLD;    // Minimum similarity for any individual channel (adjustable)
-    static constexpr int ENVELOPE_POINTS = 50; // Reduced resolution for envelope
+    static constexpr int ENVELOPE_POINTS = 50; // Default resolution for envelope
+    static constexpr uint32_t PARAMS_MAGIC = 0x534D5250; // "PRMS" marks the parameter block in progress files
     
     std::vector<DispensingRecord> recordings[Config::NUM_SERVOS];
     DispensingRecord referencePattern[Config::NUM_SERVOS];
     bool hasReference[Config::NUM_SERVOS];
     int failedDispenses[Config::NUM_SERVOS];
+    AnalysisParams params[Config::NUM_SERVOS];
+    DriftMonitor driftMonitors[Config::NUM_SERVOS];
+    DispenseVerdict lastVerdict[Config::NUM_SERVOS];
+    DropSignature dropSignatures[Config::NUM_SERVOS];   // Used to attribute impacts in concurrent windows
+    
+    // Per-dispense score history (ring buffer) used for threshold calibration
+    ScoreSample scoreHistory[Config::NUM_SERVOS][ThresholdCalibrator::MAX_SAMPLES];
+    int historyHead[Config::NUM_SERVOS];
+    int historyCount[Config::NUM_SERVOS];
+    
+    // Background calibration job
+    volatile int calibrationServo;       // -1 when idle
+    volatile bool calibrationCancel;
+    ScoreSample calibrationSnapshot[ThresholdCalibrator::MAX_SAMPLES];
+    int calibrationSnapshotCount;
+    AnalysisParams calibrationParams;
+    CalibrationResult lastCalibration[Config::NUM_SERVOS];
     
     std::function<void(String)> logCallback;
+    volatile uint32_t persistMicros;     // SPIFFS write time since the last takePersistMicros()
+    
+    void recordScore(int servoIndex, float avgSimilarity, float bestSimilarity, float minSimilarity);
+    void clearServoMemory(int servoIndex, bool resetParams);
+    void updateDrift(int servoIndex, float avgSimilarity, float bestSimilarity);
+    void saveDrift(int servoIndex);
+    void loadDrift(int servoIndex);
+    void saveHistory(int servoIndex);
+    void loadHistory(int servoIndex);
+    void saveSignature(int servoIndex);
+    void loadSignature(int servoIndex);
+    static void calibrationTaskWrapper(void* parameter);
+    void calibrationTask();
 
 public:
     PatternAnalyzer();
@@ -72,21 +193,52 @@ public:
     
     // Progress persistence - saves ALL learning progress
     void saveAllProgress();           // Save all recordings and models to SPIFFS
-    void loadAllProgress();           // Load all recordings and models from SPIFFS
+    void loadAllProgress();           // Load all recordings and models from SPIFFS; caller holds ModelLock (or runs before the tasks start)
     void saveServoProgress(int servoIndex);  // Save progress for specific servo
-    bool loadServoProgress(int servoIndex);  // Load progress for specific servo
+    uint32_t takePersistMicros();            // Time spent writing since the last call, then reset
+    bool loadServoProgress(int servoIndex);  // Load progress for specific servo; same locking as loadAllProgress()
+    void reloadAllProgress();         // Discard in-memory state and reload from SPIFFS (after a model import)
     
     // Data management
     void resetServoData(int servoIndex);     // Reset all data for specific servo
     void resetAllData();                     // Reset all data for all servos
     
     // Threshold management (runtime adjustable)
-    void setDeviationThreshold(float threshold);       // Set average similarity threshold
-    void setMinChannelThreshold(float threshold);      // Set minimum individual channel threshold
-    float getDeviationThreshold() const;               // Get current average threshold
-    float getMinChannelThreshold() const;              // Get current individual channel threshold
+    void setDeviationThreshold(float threshold);       // Set average similarity threshold on all servos
+    void setMinChannelThreshold(float threshold);      // Set minimum individual channel threshold on all servos
+    float getDeviationThreshold(int servoIndex = 0) const;   // Get current average threshold
+    float getMinChannelThreshold(int servoIndex = 0) const;  // Get current individual channel threshold
+    
+    // Per-servo parameters (changing resolution or learning size requires empty learning data)
+    const AnalysisParams& getParams(int servoIndex) const;  // Defaults for an unknown servo
+    bool setDeviationThreshold(int servoIndex, float threshold);
+    bool setMinChannelThreshold(int servoIndex, float threshold);
+    bool setEnvelopePoints(int servoIndex, int points);
+    bool setLearningSize(int servoIndex, int size);
+    bool setSimilarityMode(int servoIndex, SimilarityMode mode);
+    static const char* similarityModeName(SimilarityMode mode);
+    
+    // Threshold calibration from labeled history
+    bool labelLastDispense(int servoIndex, bool flawed);
+    bool startCalibration(int servoIndex);     // Runs as a low-priority background task
+    void cancelCalibration();
+    bool isCalibrating() const { return calibrationServo >= 0; }
+    const CalibrationResult& getLastCalibration(int servoIndex) const { return lastCalibration[servoIndex]; }
+    String exportScoreHistory(int servoIndex) const;
+    
+    // Diagnostics for the last analyzed dispense
+    const DispenseVerdict& getLastVerdict(int servoIndex) const { return lastVerdict[servoIndex]; }
+    String explainVerdict(int servoIndex) const;
+    
+    // Drift monitoring
+    const DriftMonitor& getDriftMonitor(int servoIndex) const { return driftMonitors[servoIndex]; }
+    static const char* driftStateName(DriftState state);
     String exportRecordings(int servoIndex) const;
     
+    // Drop attribution signature, learned from single-servo captures
+    void updateDropSignature(int servoIndex, const std::vector<std::vector<int>>& channelData, int quietSamples);
+    const DropSignature& getDropSignature(int servoIndex) const { return dropSignatures[servoIndex]; }
+    
     // Model persistence
     bool saveReferenceModel(int servoIndex) const;
     bool loadReferenceModel(int servoIndex);
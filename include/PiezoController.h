@@ -6,64 +6,140 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include <freertos/queue.h>
+
+// One captured sensor window, handed from the piezo task to the analysis task
+struct CaptureJob {
+    int servoIndex;
+    int triggerChannel;
+    TickType_t triggerTick;
+    uint32_t captureEndUs;                 // micros() when the last sample was taken
+    bool attributed;                       // Sliced from a concurrent window; does not train the signature
+    std::vector<std::vector<int>> channelData;
+};
+
+// Where one servo of a concurrent window is expected to drop
+struct ConcurrentDrop {
+    int servoIndex;
+    TickType_t expectedTick;               // Move start plus the servo's typical drop latency
+    int toleranceMs;
+};
 
 class PiezoSensor {
 public:
     typedef void (*LogCallback)(const String& msg);
+    typedef void (*GraphCallback)(int servoIndex, int triggerChannel, const std::vector<std::vector<int>>& channels);
     
     PiezoSensor();
     void initialize();
     void startTask();
+    void startConcurrentTask(int captureSamples);   // One long window shared by several moving servos
+    AttributionResult attributeConcurrent(const ConcurrentDrop* drops, int count);
     bool isTriggered() const { return isPillDrop; }
     void setLogCallback(LogCallback logCallback) { this->logCallback = logCallback; }
-    void startRecording(int channel, int firstVal);
+    void setGraphCallback(GraphCallback graphCallback) { this->graphCallback = graphCallback; }   // Each analyzed capture, for the web graph
+    CaptureJob* startRecording(int channel, int firstVal);
     void setReadySemaphore(SemaphoreHandle_t semaphore) { readySemaphore = semaphore; }
     SemaphoreHandle_t getReadySemaphore() const { return readySemaphore; }
     SemaphoreHandle_t getFinishedSemaphore() const { return finishedSemaphore; }
     void setIsPillDrop(bool value) { isPillDrop = value; }
-    void startTimeout(); // Start the 1-second timeout timer
+    void startTimeout(int timeoutMs = Config::TASK_TIMEOUT_MS); // Start the detection timeout timer
+    SemaphoreHandle_t getDropSemaphore() const { return dropSemaphore; }   // Given the moment a drop triggers
+    TickType_t getLastTriggerTick() const { return lastTriggerTick; }
+    uint32_t getLastTriggerUs() const { return lastTriggerUs; }
     void setPiezoMeasurements(int measurements) { piezoMeasurements = measurements; }
     int getPiezoMeasurements() const { return piezoMeasurements; }
     
+    // Sensor window scheduling: a capture only blocks the sensor, analysis runs behind it
+    TickType_t getSensorFreeTick() const { return sensorFreeTick; }
+    bool waitForAnalysisIdle(TickType_t timeout = portMAX_DELAY);
+    uint32_t getLastCaptureMs() const { return lastCaptureMs; }
+    float getMsPerSample() const { return msPerSample; }
+    uint32_t getAnalysisTotalMs() const { return analysisTotalMs; }
+    uint32_t getAnalysisCount() const { return analysisCount; }
+    
     // Pattern analysis
     void setCurrentServo(int servoIndex) { currentServoIndex = servoIndex; }
     String getAnalysisReport(int servoIndex) const;
+    String explainLastDispense(int servoIndex) const;
     int getFailedCount(int servoIndex) const;
     
     // Data management
     void resetServoData(int servoIndex);
     void resetAllData();
+    bool applyModelImport(String& error);   // Install the uploaded snapshot (ModelSnapshot::IMPORT_PATH) and reload
     
     // Threshold management
     void setDeviationThreshold(float threshold);
     void setMinChannelThreshold(float threshold);
-    float getDeviationThreshold() const;
-    float getMinChannelThreshold() const;
+    float getDeviationThreshold(int servoIndex = 0) const;
+    float getMinChannelThreshold(int servoIndex = 0) const;
     
     // Command interface aliases
     bool setAverageThreshold(float threshold);
     bool setChannelThreshold(float threshold);
-    float getAverageThreshold() const;
-    float getChannelThreshold() const;
+    float getAverageThreshold(int servoIndex = 0) const;
+    float getChannelThreshold(int servoIndex = 0) const;
+    
+    // Per-servo analysis parameters
+    const AnalysisParams& getAnalysisParams(int servoIndex) const;
+    bool setAverageThreshold(int servoIndex, float threshold);
+    bool setChannelThreshold(int servoIndex, float threshold);
+    bool setEnvelopePoints(int servoIndex, int points);
+    bool setLearningSize(int servoIndex, int size);
+    bool setSimilarityMode(int servoIndex, SimilarityMode mode);
+    
+    // Threshold calibration
+    bool labelLastDispense(int servoIndex, bool flawed);
+    bool startCalibration(int servoIndex);
+    void cancelCalibration();
+    bool isCalibrating() const;
+    String exportScoreHistory(int servoIndex) const;
+    const DropSignature& getDropSignature(int servoIndex) const;
 
 private:
     volatile bool isPillDrop;
     int piezoMeasurements;
     int currentServoIndex;
-    String values[Config::NUM_PIEZOS];
     LogCallback logCallback;
+    GraphCallback graphCallback;
     PatternAnalyzer patternAnalyzer;
     
     // Timeout control
     volatile bool timeoutActive;
     volatile TickType_t timeoutStart;
+    volatile TickType_t timeoutTicks;
+    volatile TickType_t lastTriggerTick;
+    volatile uint32_t lastTriggerUs;
     
     // FreeRTOS synchronization
     SemaphoreHandle_t readySemaphore;      // Signals when a drop is detected
     SemaphoreHandle_t finishedSemaphore;
+    SemaphoreHandle_t dropSemaphore;       // Signals the trigger itself, before recording/analysis
     TaskHandle_t piezoTaskHandle;         // Handle to the piezo task
     
+    // Analysis pipeline
+    QueueHandle_t analysisQueue;           // CaptureJob* waiting for analysis
+    TaskHandle_t analysisTaskHandle;
+    portMUX_TYPE analysisMux;
+    volatile int pendingAnalyses;          // Queued plus in progress
+    volatile TickType_t sensorFreeTick;    // Earliest tick the next sensor window may open
+    volatile uint32_t lastCaptureMs;
+    volatile float msPerSample;            // Measured on every capture, 0 until the first one
+    volatile uint32_t analysisTotalMs;
+    volatile uint32_t analysisCount;
+    
+    // Concurrent window: the capture is held until the caller supplies the expectations
+    volatile bool concurrentWindow;
+    int windowSamples;
+    CaptureJob* heldCapture;
     
     static void piezoTaskWrapper(void* parameter);
     void piezoTask();
+    void createPiezoTask();
+    void enqueueAnalysis(CaptureJob* job);
+    int quietSamples() const { return std::max(1, piezoMeasurements / 20); }
+    static void analysisTaskWrapper(void* parameter);
+    void analysisTask();
+    void analyzeCapture(const CaptureJob& job);
 };
\ No newline at end of file
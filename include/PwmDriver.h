@@ -0,0 +1,81 @@
+// include/PwmDriver.h
+#pragma once
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "Config.h"
+
+// Servo PWM output behind one interface, so dispensers can live on the ESP32's own LEDC
+// channels or on PCA9685 boards. Pulses are given in microseconds at 50 Hz; 0 releases the output.
+//
+// Writes between beginBatch() and endBatch() are only staged and then sent together,
+// which for the PCA9685 means one auto-increment I2C transaction per board.
+class PwmDriver {
+public:
+    static constexpr uint32_t FRAME_US = 1000000 / Config::SERVO_PWM_HZ;
+
+    static PwmDriver& getInstance();   // Backend chosen by Config::PWM_BACKEND
+
+    virtual ~PwmDriver() {}
+    virtual bool begin() = 0;
+    virtual int attach(int output) = 0;            // Returns the channel, or -1 when none is left or the output is taken
+    virtual int capacity() const = 0;
+    virtual const char* name() const = 0;
+
+    void write(int channel, uint16_t pulseUs);
+    void beginBatch();
+    void endBatch();
+
+protected:
+    static constexpr int MAX_CHANNELS = 32;
+
+    PwmDriver();
+    virtual void flush(uint32_t dirtyMask) = 0;    // Send staged pulses for every set bit
+
+    uint16_t pulses[MAX_CHANNELS];                 // Staged pulse per channel, microseconds
+    uint32_t dirty;
+    int batchDepth;
+    SemaphoreHandle_t lock;                        // The motion task and callers write concurrently
+};
+
+// ESP32 LEDC peripheral: one channel per servo pin, 16 channels, 16-bit duty
+class LedcPwmDriver : public PwmDriver {
+public:
+    static constexpr int CHANNELS = 16;
+
+    LedcPwmDriver() : nextChannel(0), claimedPins(0) {}
+    bool begin() override { return true; }
+    int attach(int output) override;
+    int capacity() const override { return CHANNELS; }
+    const char* name() const override { return "LEDC"; }
+
+protected:
+    void flush(uint32_t dirtyMask) override;
+
+private:
+    int nextChannel;
+    uint64_t claimedPins;                          // GPIOs already attached, one bit per pin
+};
+
+// PCA9685 16-channel I2C PWM boards at Config::PCA9685_ADDRESSES; output n lives on
+// board n / 16, channel n % 16
+class Pca9685PwmDriver : public PwmDriver {
+public:
+    static constexpr int CHANNELS_PER_BOARD = 16;
+    static constexpr int BOARDS = sizeof(Config::PCA9685_ADDRESSES) / sizeof(Config::PCA9685_ADDRESSES[0]);
+    static_assert(BOARDS * CHANNELS_PER_BOARD <= MAX_CHANNELS, "Too many PCA9685 boards for the staging buffer");
+
+    Pca9685PwmDriver() : claimed(0) {}
+    bool begin() override;
+    int attach(int output) override;
+    int capacity() const override { return BOARDS * CHANNELS_PER_BOARD; }
+    const char* name() const override { return "PCA9685"; }
+
+protected:
+    void flush(uint32_t dirtyMask) override;
+
+private:
+    uint32_t claimed;                              // Outputs already attached, one bit per output
+
+    bool writeRegister(uint8_t address, uint8_t reg, uint8_t value);
+};
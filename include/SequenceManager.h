@@ -26,6 +26,10 @@ public:
     bool deleteSequence(const String& deviceId, const String& name);
     std::vector<String> getSequenceNames(const String& deviceId);
     
+    // Concurrent mode: servos with learned drop signatures dispense together, one pill each per round
+    void setConcurrent(bool enabled) { concurrent = enabled; }
+    bool isConcurrent() const { return concurrent; }
+    
     // Command parsing
     bool parseSequenceCommand(const String& command, String& deviceId, String& name, std::vector<int>& counts);
     
@@ -36,7 +40,9 @@ public:
 private:
     ServoController& servoController;
     std::map<String, std::vector<PillSequence>> deviceSequences;  // deviceId -> sequences
+    bool concurrent;
     
     String generateKey(const String& deviceId, const String& name);
     void executeServoSequence(const std::vector<int>& counts);
+    void executeConcurrentRounds(std::vector<int>& remaining, int& successfulPills, int& failedPills);
 };
@@ -0,0 +1,51 @@
+// include/SerialFramer.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Byte-at-a-time assembler for the serial console. Typed text becomes one command per line;
+// a host script can instead send checksummed binary frames carrying a batch of
+// newline-separated commands:
+//
+//   STX(0x02) seq len payload[len] crc8     crc8 (poly 0x07) over seq, len and payload
+//
+// A frame may only start at the beginning of a line. Everything lives in a fixed buffer.
+class SerialFramer {
+public:
+    static constexpr uint8_t FRAME_START = 0x02;
+    static constexpr size_t MAX_LINE = 100;            // Config::COMMAND_MAX_LENGTH, the command slot size
+    static constexpr size_t MAX_PAYLOAD = 255;
+    static constexpr uint32_t FRAME_TIMEOUT_MS = 500;  // A stalled frame is dropped, so the host can resend
+
+    enum class Event : uint8_t {
+        NONE,
+        LINE,            // data()/length(): one text command, without line ending
+        FRAME,           // data()/length(): frame payload, sequence(): its sequence number
+        BAD_FRAME,       // Checksum mismatch or timeout; sequence() names the frame
+        OVERFLOW         // Text line longer than MAX_LINE, dropped up to its newline
+    };
+
+    SerialFramer() : state(State::TEXT), used(0), expected(0), seq(0), crc(0), lastByteMs(0), overflowed(false), delivered(false) {}
+
+    Event feed(uint8_t byte, uint32_t nowMs);
+
+    const char* data() const { return buffer; }
+    size_t length() const { return used; }
+    uint8_t sequence() const { return seq; }
+
+    static uint8_t crc8(uint8_t crc, uint8_t byte);
+
+private:
+    enum class State : uint8_t { TEXT, SEQUENCE, LENGTH, PAYLOAD, CHECKSUM };
+
+    State state;
+    char buffer[MAX_PAYLOAD + 1];    // NUL-terminated once an event is returned
+    size_t used;
+    size_t expected;
+    uint8_t seq;
+    uint8_t crc;
+    uint32_t lastByteMs;
+    bool overflowed;                 // Rest of an over-long line is skipped
+    bool delivered;                  // buffer holds a returned LINE/FRAME until the next byte
+};
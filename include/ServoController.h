@@ -3,33 +3,129 @@
 #include <Arduino.h>
 #include "ServoMotor.h"
 #include "Config.h"
+#include "DropAttributor.h"
+#include <vector>
+#include <array>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 
 class PiezoSensor; // Forward declaration
 
+// Recent move-start-to-drop latencies for one servo; drives its hold time and detection timeout
+struct DropLatencyTracker {
+    static constexpr int CAPACITY = 64;
+    static constexpr int MIN_SAMPLES = 16;    // Use the fixed defaults until this many drops were seen
+
+    uint16_t samples[CAPACITY];
+    int head;
+    int count;
+    uint16_t p99Ms;                           // Cached on every add so reads are free
+    uint16_t p50Ms;
+    uint16_t minMs;
+
+    DropLatencyTracker() : head(0), count(0), p99Ms(0), p50Ms(0), minMs(0) {}
+    void add(uint16_t latencyMs);
+    bool ready() const { return count >= MIN_SAMPLES; }
+};
+
+// Stage timing of the last Dispense call, reported per sequence
+struct DispenseTiming {
+    uint32_t sensorWaitMs;    // Blocked on the previous capture's sensor window
+    uint32_t dropMs;          // Move start to trigger
+    uint32_t captureMs;       // Trigger to end of capture
+    uint32_t totalMs;
+    int attempts;
+
+    DispenseTiming() : sensorWaitMs(0), dropMs(0), captureMs(0), totalMs(0), attempts(0) {}
+};
+
+// Why the last Dispense call came back without a pill
+enum class DispenseFailure : uint8_t {
+    NONE = 0,
+    INVALID_REQUEST,        // Bad servo index or no sensor attached
+    NO_DROP,                // Every stroke and agitation timed out (jam, or the bottle just ran out)
+    PROBABLY_EMPTY,         // Too many consecutive timeouts; only a single probe stroke was tried
+    CANCELLED               // STOP arrived before a pill was seen
+};
+
+// Consecutive detection timeouts of one servo, carried across Dispense calls
+struct BottleState {
+    uint8_t consecutiveTimeouts;
+    bool probablyEmpty;     // Set after EMPTY_AFTER_TIMEOUTS; cleared by the next detected drop
+
+    BottleState() : consecutiveTimeouts(0), probablyEmpty(false) {}
+};
+
 class ServoController {
 public:
     ServoController();
     void initialize();
     void setPiezoSensor(PiezoSensor* piezoController);
+    PiezoSensor* getPiezoSensor() const { return piezoSensor; }
     void moveServo(int servoIndex, int targetAngle);
+    void moveServoAsync(int servoIndex, int targetAngle, ServoMotor::MotionCallback onComplete = nullptr);
+    void waitForAllServos();
     bool Dispense(int servoIndex, int maxAttempts = 5);
+    
+    // Several servos share one staggered sensor window; impacts are attributed per servo.
+    // Single attempt, returns how many servos dropped (DROPPED or MULTIPLE)
+    int DispenseConcurrent(const std::vector<int>& servoIndices, std::vector<DropVerdict>& verdicts);
+    bool canDispenseConcurrently(int servoIndex) const;   // Needs learned latency and drop signature
+    
+    // Failure reason of the last Dispense, and the per-servo empty-bottle state
+    DispenseFailure getLastFailure() const { return lastFailure; }
+    static const char* failureName(DispenseFailure failure);
+    bool isProbablyEmpty(int servoIndex) const { return bottles[servoIndex].probablyEmpty; }
+    void clearEmpty(int servoIndex);
     void resetAllServos();
+    
+    // Cooperative cancellation: STOP halts moving servos at once, and Dispense, sequences and
+    // tuning runs unwind at their next check. Cleared by the command task per command.
+    void requestStop();
+    void beginCommand(uint32_t stopEpoch) { commandStopEpoch = stopEpoch; }  // Epoch the running command was picked up in
+    bool isStopRequested() const;              // A flush since the running command was picked up
     void toggle();
-    void setAngle(int newAngle);
-    void setStartAngle(int newStartAngle);
-    int getAngle() const { return angle; }
-    int getStartAngle() const { return startAngle; }
+    bool setAngle(int newAngle);              // Dispense angle of every servo; false if any servo rejected it
+    bool setStartAngle(int newStartAngle);    // Start angle of every servo; false if any servo rejected it
+    
+    // Per-servo calibration (angles, pulse endpoints, hold, reverse), persisted in NVS
+    bool setCalibration(int servoIndex, const ServoCalibration& calibration);
+    const ServoCalibration& getCalibration(int servoIndex) const { return servos[servoIndex].getCalibration(); }
+    int findMinimumAngle(int servoIndex, int trials);   // Dispenses real pills; returns the new angle or -1
     int getCounter() const { return counter; }
     bool isAtStart() const { return atStart; }
     void resetCounter() { counter = 0; }
+    
+    // Closed-loop timing learned from observed drops
+    int getHoldMs(int servoIndex) const;
+    int getDetectionTimeoutMs(int servoIndex) const;
+    int getEarlyStartMs(int servoIndex) const;   // How far a move may precede the sensor window
+    const DropLatencyTracker& getDropLatency(int servoIndex) const { return dropLatency[servoIndex]; }
+    const DispenseTiming& getLastTiming() const { return lastTiming; }
+    
+    // Motion profiles
+    bool setMotionProfile(int servoIndex, const MotionProfile& profile);
+    const MotionProfile& getMotionProfile(int servoIndex) const { return servos[servoIndex].getProfile(); }
+    bool tuneMotionProfile(int servoIndex, int trialsPerCandidate);  // Dispenses real pills
 
 private:
-    ServoMotor servos[Config::NUM_SERVOS];
+    std::array<ServoMotor, Config::NUM_SERVOS> servos;   // One per Config::SERVO_PINS entry
     PiezoSensor* piezoSensor;
-    int angle;
-    int startAngle;
     int counter;
     bool atStart;
+    
+    DropLatencyTracker dropLatency[Config::NUM_SERVOS];
+    DispenseTiming lastTiming;
+    DispenseFailure lastFailure;
+    BottleState bottles[Config::NUM_SERVOS];
+    volatile uint32_t commandStopEpoch;        // Compared with Displayer::getStopEpoch()
+    
+    int runDispenseTrials(int servoIndex, int trials, int maxAttempts, unsigned long& totalMs);
+    int nextTarget(int servoIndex) const;
+    bool agitate(int servoIndex, SemaphoreHandle_t dropSemaphore);
+    bool takeUnlessStopped(SemaphoreHandle_t semaphore, TickType_t timeout);
+    bool noteTimeout(int servoIndex);
+    void loadSettings();
+    void saveCalibration(int servoIndex);
+    void saveProfile(int servoIndex);
 };
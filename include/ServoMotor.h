@@ -1,22 +1,101 @@
 // include/ServoMotor.h
 #pragma once
 #include <Arduino.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 #include "Config.h"
+#include "MotionPlanner.h"
+#include "PwmDriver.h"
+
+// Per-servo calibration, persisted in NVS by ServoController
+struct ServoCalibration {
+    static constexpr uint8_t VERSION = 1;
+
+    uint8_t version;
+    uint8_t startAngle;
+    uint8_t dispenseAngle;
+    uint8_t reversed;          // Mirror angles for a servo mounted the other way round
+    uint16_t minPulseUs;       // Pulse at 0°
+    uint16_t maxPulseUs;       // Pulse at 180°
+    uint16_t holdMs;           // Hold (and cap on the learned hold) before/after drops are timed
+
+    ServoCalibration()
+        : version(VERSION),
+          startAngle(Config::DEFAULT_START_ANGLE),
+          dispenseAngle(Config::DEFAULT_ANGLE),
+          reversed(0),
+          minPulseUs(Config::SERVO_MIN_PULSE_US),
+          maxPulseUs(Config::SERVO_MAX_PULSE_US),
+          holdMs(Config::SERVO_DELAY_MS) {}
+};
 
 class ServoMotor {
 public:
+    // Invoked from the servo motion task once the hold time has elapsed and PWM is released
+    using MotionCallback = std::function<void(ServoMotor&)>;
+
     ServoMotor(int servoPin);
     void initialize();
-    void moveTo(int targetAngle);
+    void moveTo(int targetAngle);                 // Blocking: start move and wait for completion
     void reset();
     int getCurrentAngle() const { return currentAngle; }
+
+    // Non-blocking motion: drive towards the target (instantly or along the profile),
+    // then release PWM from the motion task holdMs after arriving
+    void startMove(int targetAngle, MotionCallback onComplete = nullptr, int holdMs = Config::SERVO_DELAY_MS);
+    bool waitForMotion(TickType_t timeout = portMAX_DELAY);
+    void releaseNow();                            // End the hold early (e.g. drop already confirmed)
+    void halt();                                  // Stop where it is and release; a profiled move stops at its next step
+    bool isMoving() const { return moving; }
+    int getTargetAngle() const { return targetAngle; }
+    uint32_t getReleasedUs() const { return releasedUs; }   // micros() at the end of the last move
     
+    void setProfile(const MotionProfile& newProfile) { profile = newProfile; }
+    const MotionProfile& getProfile() const { return profile; }
+    void setCalibration(const ServoCalibration& newCalibration) { calibration = newCalibration; }
+    const ServoCalibration& getCalibration() const { return calibration; }
+
 private:
     int pin;
-    int currentAngle;
-    int pwmChannel;
-    static int channelCounter;  // Static counter for PWM channels
-    
-    void moveAndRelease(int target);
-    uint32_t angleToLEDC(int angle);
+    volatile int currentAngle;
+    volatile int targetAngle;
+    int pwmChannel;                               // Assigned by the PWM driver in initialize(); -1 if none left
+    ServoCalibration calibration;
+
+    volatile bool moving;
+    volatile bool haltRequested;                  // Consumed by the next profile step
+    volatile uint32_t releasedUs;
+    uint32_t dueUs;                               // micros() of the next profile step or of the release
+    SemaphoreHandle_t motionDone;
+    MotionCallback completionCallback;
+    MotionCallback finishedCallback;              // Handed from service() to runFinishedCallback(); motion task only
+    SemaphoreHandle_t motionLock;                 // Motion task and callers change the motion; a mutex, since PWM writes block
+
+    // Profiled motion state, advanced by the motion task once per PWM frame
+    enum class Phase : uint8_t { IDLE, PROFILE, HOLD };
+    MotionProfile profile;
+    volatile Phase phase;
+    MotionState motion;
+    int holdTimeMs;
+
+    // One task times every servo: it sleeps until the earliest deadline, and startMove() wakes
+    // it with a notification. Profile steps and PWM writes block, so they stay out of the
+    // esp_timer task that the rest of the system shares.
+    static constexpr int MAX_SERVOS = 32;
+    static_assert(Config::NUM_SERVOS <= MAX_SERVOS, "The motion task tracks at most 32 servos");
+    static constexpr int32_t IDLE = INT32_MAX;
+    static constexpr uint32_t PROFILE_TICK_US = Config::SERVO_PROFILE_TICK_MS * 1000;
+    static ServoMotor* registry[MAX_SERVOS];
+    static volatile int registered;
+    static TaskHandle_t motionTask;
+    static void motionTaskLoop(void* parameter);
+    static void wakeMotionTask();
+    static uint32_t nextFrameUs(uint32_t now);    // Start of the next profile frame on the shared grid
+
+    int32_t service(uint32_t now);                // Motion task: run what is due, return µs to the next deadline
+    void runFinishedCallback();                   // Motion task, after the frame's PWM writes are flushed
+    bool finishMove(MotionCallback& callback);    // Release PWM and complete; caller holds motionLock
+    uint16_t angleToPulseUs(float angle);
 };
@@ -0,0 +1,33 @@
+// include/StrokeSearch.h
+#pragma once
+
+#include <stdint.h>
+
+// Binary search for the shortest dispense stroke that still works reliably.
+
+namespace StrokeSearch {
+    enum class Probe : uint8_t { RELIABLE, UNRELIABLE, STOPPED };
+
+    constexpr int NOT_RELIABLE = -1;    // The longest stroke already failed
+    constexpr int STOPPED = -2;         // A probe was stopped
+
+    // Shortest stroke in (0, longest] that probes RELIABLE, to within resolution, assuming any
+    // stroke longer than a reliable one is reliable too. The longest stroke is probed first.
+    template <typename ProbeFn>
+    int shortestReliable(int longest, int resolution, ProbeFn probe) {
+        Probe result = probe(longest);
+        if (result != Probe::RELIABLE) return result == Probe::STOPPED ? STOPPED : NOT_RELIABLE;
+
+        // `reliable` always works, `unreliable` never did
+        int reliable = longest;
+        int unreliable = 0;
+        while (reliable - unreliable > resolution) {
+            int stroke = (reliable + unreliable) / 2;
+            result = probe(stroke);
+            if (result == Probe::STOPPED) return STOPPED;
+            if (result == Probe::RELIABLE) reliable = stroke;
+            else unreliable = stroke;
+        }
+        return reliable;
+    }
+}
@@ -0,0 +1,56 @@
+// include/ThresholdCalibrator.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Picks the similarity thresholds that best separate dispenses labeled GOOD from FLAWED.
+
+// How a dispense is judged against the reference pattern
+enum class SimilarityMode : uint8_t {
+    BEST_OF_BOTH = 0,   // Accept if the average OR the best single channel clears the average threshold
+    AVERAGE_ONLY = 1,   // Accept only if the average clears the average threshold
+    STRICT = 2          // Accept only if the average clears it AND every channel clears the channel threshold
+};
+
+// Labels attached to stored per-dispense scores
+enum : int8_t {
+    LABEL_UNKNOWN = -1,
+    LABEL_GOOD = 0,
+    LABEL_FLAWED = 1
+};
+
+// Similarity scores of one analyzed dispense
+struct ScoreSample {
+    float avgSimilarity;
+    float bestSimilarity;     // Highest single-channel similarity
+    float minSimilarity;      // Lowest single-channel similarity
+    int8_t label;
+};
+
+struct CalibrationResult {
+    bool valid;
+    float averageThreshold;
+    float channelThreshold;
+    float falseAcceptRate;    // Flawed dispenses accepted / flawed dispenses
+    float falseRejectRate;    // Good dispenses rejected / good dispenses
+    int goodSamples;
+    int flawedSamples;
+    int evaluatedPairs;
+};
+
+namespace ThresholdCalibrator {
+    constexpr int MAX_SAMPLES = 64;
+    constexpr int MIN_GOOD_SAMPLES = 3;
+    constexpr int MIN_FLAWED_SAMPLES = 1;
+    constexpr float SWEEP_MIN = 0.30f;
+    constexpr float SWEEP_STEP = 0.01f;
+    constexpr int SWEEP_POINTS = 70;            // 0.30 .. 0.99
+    constexpr float FALSE_ACCEPT_WEIGHT = 2.0f; // A double dispense costs more than a retry
+
+    // Sweep threshold pairs over labeled samples and return the lowest-cost operating point.
+    // Unlabeled samples are ignored. The channel threshold is only swept in STRICT mode;
+    // otherwise currentChannelThreshold is returned unchanged. Setting *cancel aborts the sweep.
+    CalibrationResult sweep(const ScoreSample* samples, int count, SimilarityMode mode,
+                            float currentChannelThreshold, volatile bool* cancel = nullptr);
+}
@@ -0,0 +1,111 @@
+// include/WireProtocol.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string_view>
+
+// Binary WebSocket protocol, used by clients that ask for it with "PROTO 1"; everyone else,
+// and the serial console, keeps the text protocol. Every message is one binary frame:
+//
+//   version(1) type(1) { tag(1) length(2, little endian) value[length] }*
+//
+// Integers are little endian. Readers skip tags they do not know, so fields can be added
+// without a version bump; the version only changes when a field changes meaning.
+// data/app.js encodes COMMAND and decodes the rest; test_wire_protocol pins the COMMAND bytes
+// it sends.
+namespace WireProtocol {
+    constexpr uint8_t VERSION = 1;
+    constexpr size_t HEADER_SIZE = 2;
+    constexpr size_t FIELD_HEADER_SIZE = 3;
+
+    enum class Type : uint8_t {
+        HELLO = 1,          // Server: VERSION, MAX_COMMAND, QUEUE - the client is now binary
+        COMMAND = 2,        // Client: SEQ, one TEXT per command (several: an atomic batch)
+        ACK = 3,            // Server: SEQ, STATUS, then JOB per command, LINE, SPACE as needed
+        LOG = 4,            // Server: TAG, TEXT - any message without a type of its own
+        JOB = 5,            // Server: JOB, STATE, CLIENT, TEXT, then KEY, DONE/TOTAL, MS, RESULT as needed
+        GRAPH = 6           // Server: SERVO, TRIGGER, then CHANNEL and SAMPLES per piezo
+    };
+
+    enum class Tag : uint8_t {
+        SEQ = 1,            // u16, chosen by the client
+        TEXT = 2,           // UTF-8
+        STATUS = 3,         // u8, BatchAdmission::Status
+        JOB = 4,            // u16 job id
+        LINE = 5,           // u8, 1-based command that was refused
+        SPACE = 6,          // u8, free command slots
+        TAG = 7,            // UTF-8 text prefix without brackets, e.g. "QUEUE"
+        STATE = 8,          // u8, JobState
+        CLIENT = 9,         // u8
+        DONE = 10,          // u16
+        TOTAL = 11,         // u16
+        MS = 12,            // u32
+        RESULT = 13,        // UTF-8
+        SERVO = 14,         // u8, 1-based
+        TRIGGER = 15,       // UTF-8 piezo name
+        CHANNEL = 16,       // UTF-8 piezo name; the SAMPLES that follow belong to it
+        SAMPLES = 17,       // u16 array
+        VERSION = 18,       // u8
+        MAX_COMMAND = 19,   // u16, longest accepted command
+        QUEUE = 20,         // u16, command slots one client may hold
+        KEY = 21            // UTF-8 idempotency key of the command
+    };
+
+    // Appends fields to a caller-owned buffer; a field that does not fit marks the writer as
+    // failed instead of writing past the end
+    class Writer {
+    public:
+        Writer(uint8_t* buffer, size_t capacity, Type type);
+
+        void putU8(Tag tag, uint8_t value);
+        void putU16(Tag tag, uint16_t value);
+        void putU32(Tag tag, uint32_t value);
+        void putText(Tag tag, std::string_view text);
+        void putSamples(Tag tag, const int* values, size_t count, size_t step);  // Every step-th value, clamped to u16
+
+        bool ok() const { return !overflow; }
+        const uint8_t* data() const { return buffer; }
+        size_t size() const { return used; }
+
+        static size_t fieldSize(size_t valueLength) { return FIELD_HEADER_SIZE + valueLength; }
+
+    private:
+        uint8_t* buffer;
+        size_t capacity;
+        size_t used;
+        bool overflow;
+
+        uint8_t* reserve(Tag tag, size_t length);
+    };
+
+    // One decoded field; the value points into the frame
+    struct Field {
+        Tag tag;
+        const uint8_t* value;
+        uint16_t length;
+
+        uint8_t u8() const { return length >= 1 ? value[0] : 0; }
+        uint16_t u16() const { return length >= 2 ? (uint16_t)(value[0] | (value[1] << 8)) : u8(); }
+        uint32_t u32() const;
+        std::string_view text() const { return std::string_view((const char*)value, length); }
+    };
+
+    class Reader {
+    public:
+        Reader(const uint8_t* data, size_t length);
+
+        bool valid() const { return headerValid; }   // Long enough and our version
+        Type type() const { return messageType; }
+        bool next(Field& field);                     // false at the end, or on a truncated field
+        bool malformed() const { return truncated; }
+
+    private:
+        const uint8_t* data;
+        size_t length;
+        size_t offset;
+        bool headerValid;
+        bool truncated;
+        Type messageType;
+    };
+}
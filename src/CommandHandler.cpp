@@ -1,19 +1,54 @@
 // src/CommandHandler.cpp
 #include "CommandHandler.h"
+#include "DispenseStats.h"
+#include "JobTable.h"
+#include "CommandVerbs.h"
+
+// Storage APIs (sequence names, device ids) still take Arduino Strings
+static String toString(std::string_view text) {
+    String out;
+    out.reserve(text.size());
+    for (char c : text) out += c;
+    return out;
+}
+
+// Servo argument: 1-based on the wire, 0-based in the controllers
+static bool parseServo(const CommandArgs& args, int i, int& servoIndex) {
+    int servoNum = 0;
+    if (!args.toInt(i, servoNum) || servoNum < 1 || servoNum > Config::NUM_SERVOS) return false;
+    servoIndex = servoNum - 1;
+    return true;
+}
 
 CommandHandler::CommandHandler(ServoController& servo, PiezoSensor& piezo, SequenceManager& sequenceManager)
-    : servoController(servo), piezoController(piezo), sequenceManager(sequenceManager) {
+    : servoController(servo), piezoController(piezo), sequenceManager(sequenceManager),
+      statusMux(portMUX_INITIALIZER_UNLOCKED), commandStartMs(0) {
+    currentCommand[0] = '\0';
 }
 
 void CommandHandler::initialize() {
     Displayer::getInstance().logMessage("Dispenser started");
     Displayer::getInstance().logMessage("Commands: reset | test | ANGLE <value> | STARTANGLE <value> | PILL <value> | MEASUREMENTS <value>");
+    Displayer::getInstance().logMessage("Control (served immediately, even during a sequence): STOP | RESET | STATUS | JOBS [id]");
+    Displayer::getInstance().logMessage("EXECUTE, PILL, FAST and MULTI run as jobs with [JOB] events");
+    Displayer::getInstance().logMessage("Batch (WebSocket): BATCH <request id> followed by one command per line, answered with [BATCH] responses");
+    Displayer::getInstance().logMessage("Protocol (WebSocket): PROTO 1 switches this client to binary frames, PROTO 0 back to text");
+    Displayer::getInstance().logMessage("Idempotency: @<key> <command> runs once per key; resending it returns the first outcome as [DUP]");
     Displayer::getInstance().logMessage("Fast dispense: FAST <servo_number> - test fast dispensing");
     Displayer::getInstance().logMessage("Sequence commands: SEQUENCE <device> <name> (1,1,0,2,0,6) | EXECUTE <device> <name> | LIST <device> | DELETE <device> <name>");
+    Displayer::getInstance().logMessage("Motion: PROFILE <servo> [<vel> <accel> [jerk]] | PROFILE TUNE <servo> [trials]");
+    Displayer::getInstance().logMessage("Servo calibration: SERVOCAL <servo> [START|DISPENSE|MINPULSE|MAXPULSE|HOLD|REVERSE <value> | FIND [trials] | RESET]");
+    Displayer::getInstance().logMessage("Timing: STATS [servo] | STATS RESET (JSON at /stats)");
+    Displayer::getInstance().logMessage("Inventory: REFILL | REFILL <servo> <count>|+<added>|OFF");
+    Displayer::getInstance().logMessage("Concurrent: MULTI <servo> <servo> [...] | MULTI ON|OFF (sequence mode)");
+    Displayer::getInstance().logMessage("Calibration: LABEL <servo> GOOD|FLAWED | CALIBRATE <servo> [EXPORT|CANCEL] | REPORT <servo> | EXPLAIN <servo>");
 }
 
 void CommandHandler::startTask() {
+    // Serial lines arrive through the UART driver's event task instead of being polled
+    Serial.onReceive(onSerialReceive);
     xTaskCreate(commandTaskWrapper, "Servo Control", Config::TASK_STACK_SIZE, this, 1, NULL);
+    xTaskCreate(controlTaskWrapper, "Control Lane", Config::CONTROL_TASK_STACK_SIZE, this, 2, NULL);
 }
 
 void CommandHandler::commandTaskWrapper(void* parameter) {
@@ -21,148 +56,490 @@ void CommandHandler::commandTaskWrapper(void* parameter) {
     handler->commandTask();
 }
 
-void CommandHandler::commandTask() {
+static_assert(SerialFramer::MAX_LINE <= Config::COMMAND_MAX_LENGTH, "A serial line must fit a command slot");
+
+void CommandHandler::controlTaskWrapper(void* parameter) {
+    CommandHandler* handler = static_cast<CommandHandler*>(parameter);
+    handler->controlTask();
+}
+
+void CommandHandler::controlTask() {
+    // Outranks the command task, so control commands never wait behind a sequence
     while (true) {
-        String command = "";
-        bool hasCommand = false;
-        
-        // Check Serial first
-        if (Serial.available() > 0) {
-            command = Serial.readStringUntil('\n');
-            hasCommand = true;
+        QueuedCommand queued;
+        if (Displayer::getInstance().waitForControlCommand(queued)) {
+            handleControlCommand(queued);
         }
+    }
+}
+
+void CommandHandler::handleControlCommand(const QueuedCommand& command) {
+    CommandArgs args(std::string_view(command.text, command.length));
+    
+    if (CommandParser::equalsIgnoreCase(args.verb(), "STATUS")) {
+        char running[Config::COMMAND_MAX_LENGTH + 1];
+        uint32_t startMs;
+        portENTER_CRITICAL(&statusMux);
+        memcpy(running, currentCommand, sizeof(running));
+        startMs = commandStartMs;
+        portEXIT_CRITICAL(&statusMux);
         
-        // Check WebSocket command buffer
-        if (!hasCommand) {
-            String webCommand = Displayer::getInstance().getCommandBuffer();
-            if (webCommand.length() > 0) {
-                command = webCommand;
-                hasCommand = true;
-                Displayer::getInstance().logMessage("[QUEUE] Processing: " + command + " (remaining: " + String(Displayer::getInstance().hasCommands() ? "yes" : "no") + ")");
-                Displayer::getInstance().clearCommandBuffer();
-            }
+        String status = running[0] ? "[STATUS] Running '" + String(running) + "' for " + String((millis() - startMs) / 1000.0f, 1) + " s" 
+                                   : String("[STATUS] Idle");
+        status += ", " + String(Displayer::getInstance().pendingCommands()) + " queued";
+        if (servoController.isStopRequested() && running[0]) status += ", stopping";
+        Displayer::getInstance().logMessage(status);
+        return;
+    }
+    
+    if (CommandParser::equalsIgnoreCase(args.verb(), "JOBS")) {
+        int id = 0;
+        Job job;
+        if (args.count() == 0) {
+            Displayer::getInstance().logMessage("[JOBS] " + JobTable::getInstance().getReport());
+        } else if (args.toInt(0, id) && id > 0 && id <= UINT16_MAX && JobTable::getInstance().get(id, job)) {
+            JobTable::getInstance().publish(id);
+        } else {
+            Displayer::getInstance().logMessage("[ERR] Unknown job: " + toString(args[0]));
+        }
+        return;
+    }
+    
+    // STOP and RESET both cancel the running command and everything queued behind it;
+    // moving servos halt right away, the command itself unwinds at its next check
+    bool reset = CommandParser::equalsIgnoreCase(args.verb(), "RESET");
+    int dropped = Displayer::getInstance().flushCommands();
+    servoController.requestStop();
+    Displayer::getInstance().logMessage(String(reset ? "[CMD] RESET" : "[CMD] STOP") + ": cancelling current command, " + 
+                                      String(dropped) + " queued command(s) dropped");
+    
+    if (reset) {
+        // Moving the servos home belongs to the command task; this runs as soon as it is free
+        if (!Displayer::getInstance().queueCommandFront(command)) {
+            Displayer::getInstance().logMessage("[ERR] Could not queue RESET");
         }
+    }
+}
+
+void CommandHandler::setCurrentCommand(const char* text) {
+    portENTER_CRITICAL(&statusMux);
+    strncpy(currentCommand, text, sizeof(currentCommand) - 1);
+    currentCommand[sizeof(currentCommand) - 1] = '\0';
+    commandStartMs = millis();
+    portEXIT_CRITICAL(&statusMux);
+}
 
-        // Process command if we have one
-        if (hasCommand && command.length() > 0) {
-            command.trim();
-            // Skip empty commands after trimming
-            if (command.length() > 0) {
-                Displayer::getInstance().logMessage("[CMD] About to process: " + command);
-                processCommand(command);
-                Displayer::getInstance().logMessage("[CMD] Finished processing: " + command);
+void CommandHandler::onSerialReceive() {
+    // Runs in the UART event task and only takes what the driver already buffered, so a
+    // half-typed line or frame never holds anything up
+    static SerialFramer framer;
+    while (Serial.available() > 0) {
+        switch (framer.feed((uint8_t)Serial.read(), millis())) {
+            case SerialFramer::Event::LINE: {
+                // A duplicate was already answered on serial with its [DUP] line
+                BatchAdmission admission = Displayer::getInstance().admitCommand(framer.data(), framer.length(), QueuedCommand::SERIAL_CLIENT);
+                if (admission.status == BatchAdmission::Status::BUSY) {
+                    Serial.printf("[ERROR] Command queue full! Dropping command: %s\n", framer.data());
+                } else if (admission.status == BatchAdmission::Status::BAD_ID || admission.status == BatchAdmission::Status::TOO_LONG) {
+                    Serial.printf("[ERROR] Command refused (%s): %s\n", BatchAdmission::statusName(admission.status), framer.data());
+                }
+                break;
             }
+            case SerialFramer::Event::FRAME:
+                queueSerialFrame(framer.sequence(), framer.data());
+                break;
+            case SerialFramer::Event::BAD_FRAME:
+                Serial.printf("[FRAME] NAK %u CRC\n", framer.sequence());
+                break;
+            case SerialFramer::Event::OVERFLOW:
+                Serial.printf("[ERROR] Serial line longer than %u chars, ignored\n", (unsigned)SerialFramer::MAX_LINE);
+                break;
+            default:
+                break;
         }
-
-        vTaskDelay(Config::TASK_DELAY_MS / portTICK_PERIOD_MS);
     }
 }
 
-void CommandHandler::processCommand(const String& command) {
-    if (command.equalsIgnoreCase("reset")) {
-        handleResetCommand();
-    }
-    else if (command.equalsIgnoreCase("test")) {
-        handleTestCommand();
-    }
-    else if (command.startsWith("FAST")) {
-        handleFastCommand(command);
+void CommandHandler::queueSerialFrame(uint8_t sequence, const char* payload) {
+    // A frame is a batch keyed by its sequence number: queued whole or not at all, so the
+    // host can simply resend it after a NAK, and answered with one [BATCH] line once it ran
+    char requestId[4];
+    snprintf(requestId, sizeof(requestId), "%u", sequence);
+    BatchAdmission admission = Displayer::getInstance().queueBatch(requestId, payload, strlen(payload), QueuedCommand::SERIAL_CLIENT);
+    
+    if (admission.status == BatchAdmission::Status::ACCEPTED || admission.status == BatchAdmission::Status::EMPTY) {
+        Serial.printf("[FRAME] ACK %u %u\n", sequence, admission.count);
+    } else {
+        Serial.printf("[FRAME] NAK %u %s\n", sequence, BatchAdmission::statusName(admission.status));
     }
-    else if (command.startsWith("ANGLE")) {
-        handleAngleCommand(command);
+}
+
+void CommandHandler::commandTask() {
+    while (true) {
+        // Block until serial or WebSocket input is queued; nothing runs while idle
+        QueuedCommand queued;
+        if (!Displayer::getInstance().waitForCommand(queued)) continue;
+        DispenseStats::getInstance().recordCommandPickup(micros() - queued.receivedUs);
+        
+        // A STOP only cancels what was running or queued when it arrived
+        servoController.beginCommand(queued.stopEpoch);
+        setCurrentCommand(queued.text);
+        JobTable& jobs = JobTable::getInstance();
+        if (queued.jobId) jobs.start(queued.jobId);
+        
+        // Intake already trimmed it and rejected empty commands; the slot copy is the only buffer
+        char line[Config::COMMAND_MAX_LENGTH + 48];
+        snprintf(line, sizeof(line), "[QUEUE] Processing: %s (remaining: %s)", queued.text, Displayer::getInstance().hasCommands() ? "yes" : "no");
+        Displayer::getInstance().logMessage(line);
+        processCommand(std::string_view(queued.text, queued.length));
+        snprintf(line, sizeof(line), "[CMD] Finished processing: %s", queued.text);
+        Displayer::getInstance().logMessage(line);
+        if (queued.jobId) jobs.finish(servoController.isStopRequested());
+        setCurrentCommand("");
     }
-    else if (command.startsWith("STARTANGLE")) {
-        handleStartAngleCommand(command);
+}
+
+// Argument parsers, one per argument struct. Each checks the whole grammar of its verbs,
+// so a handler only sees well-formed values. Arity is already checked against the table.
+
+static bool parseArgs(const CommandArgs&, NoArgs&) {
+    return true;
+}
+
+static bool parseArgs(const CommandArgs& args, ServoArgs& out) {
+    return parseServo(args, 0, out.servoIndex);
+}
+
+static bool parseArgs(const CommandArgs& args, AngleArgs& out) {
+    return args.toInt(0, out.angle) && out.angle >= 0 && out.angle <= 180;
+}
+
+static bool parseArgs(const CommandArgs& args, CountArgs& out) {
+    return args.toInt(0, out.count) && out.count >= 1;  // No upper limit
+}
+
+static bool parseArgs(const CommandArgs& args, SequenceArgs& out) {
+    out.definition = args.rest(0);
+    return true;
+}
+
+static bool parseArgs(const CommandArgs& args, DeviceArgs& out) {
+    out.deviceId = args[0];
+    out.name = args.rest(1);
+    return true;
+}
+
+static bool parseArgs(const CommandArgs& args, ResetDataArgs& out) {
+    out.all = args.is(0, "ALL");
+    out.servoIndex = 0;
+    return out.all || parseServo(args, 0, out.servoIndex);
+}
+
+static bool parseArgs(const CommandArgs& args, ThresholdArgs& out) {
+    // THRESHOLD GET [servo] | THRESHOLD SET AVERAGE|CHANNEL <value> (all servos)
+    // THRESHOLD SET <servo> AVERAGE|CHANNEL|ENVELOPE|LEARNING|MODE <value>
+    out.first = 0;
+    out.last = Config::NUM_SERVOS - 1;
+    if (args.is(0, "GET")) {
+        out.action = ThresholdArgs::Action::GET;
+        if (args.count() > 2) return false;
+        if (args.count() == 2) {
+            if (!parseServo(args, 1, out.first)) return false;
+            out.last = out.first;
+        }
+        return true;
     }
-    else if (command.startsWith("PILL")) {
-        handleIndividualPill(command);
+    if (!args.is(0, "SET")) return false;
+    
+    int field = 1;
+    if (args.count() == 4) {
+        out.action = ThresholdArgs::Action::SET_SERVO;
+        if (!parseServo(args, 1, out.first)) return false;
+        out.last = out.first;
+        field = 2;
+    } else if (args.count() == 3) {
+        out.action = ThresholdArgs::Action::SET_ALL;
+    } else {
+        return false;
     }
-    else if (command.startsWith("MEASUREMENTS")) {
-        handleMeasurementsCommand(command);
+    
+    bool servoOnly = out.action == ThresholdArgs::Action::SET_SERVO;
+    if (args.is(field, "AVERAGE")) out.field = ThresholdArgs::Field::AVERAGE;
+    else if (args.is(field, "CHANNEL")) out.field = ThresholdArgs::Field::CHANNEL;
+    else if (servoOnly && args.is(field, "ENVELOPE")) out.field = ThresholdArgs::Field::ENVELOPE;
+    else if (servoOnly && args.is(field, "LEARNING")) out.field = ThresholdArgs::Field::LEARNING;
+    else if (servoOnly && args.is(field, "MODE")) out.field = ThresholdArgs::Field::MODE;
+    else return false;
+    
+    int value = field + 1;
+    switch (out.field) {
+        case ThresholdArgs::Field::AVERAGE:
+        case ThresholdArgs::Field::CHANNEL:
+            return args.toFloat(value, out.value);
+        case ThresholdArgs::Field::ENVELOPE:
+        case ThresholdArgs::Field::LEARNING:
+            return args.toInt(value, out.count);
+        case ThresholdArgs::Field::MODE:
+            if (args.is(value, "BEST")) out.mode = SimilarityMode::BEST_OF_BOTH;
+            else if (args.is(value, "AVERAGE")) out.mode = SimilarityMode::AVERAGE_ONLY;
+            else if (args.is(value, "STRICT")) out.mode = SimilarityMode::STRICT;
+            else return false;
+            return true;
+    }
+    return false;
+}
+
+static bool parseArgs(const CommandArgs& args, CalibrateArgs& out) {
+    // CALIBRATE <servo> [EXPORT] | CALIBRATE CANCEL
+    out.servoIndex = 0;
+    if (args.is(0, "CANCEL")) {
+        out.action = CalibrateArgs::Action::CANCEL;
+        return args.count() == 1;
+    }
+    if (args.count() == 2 && !args.is(1, "EXPORT")) return false;
+    out.action = args.count() == 2 ? CalibrateArgs::Action::EXPORT : CalibrateArgs::Action::START;
+    return parseServo(args, 0, out.servoIndex);
+}
+
+static bool parseArgs(const CommandArgs& args, LabelArgs& out) {
+    out.flawed = args.is(1, "FLAWED");
+    return parseServo(args, 0, out.servoIndex) && (out.flawed || args.is(1, "GOOD"));
+}
+
+static bool parseArgs(const CommandArgs& args, ModelArgs& out) {
+    out.apply = args.is(0, "APPLY");
+    return out.apply || args.is(0, "EXPORT");
+}
+
+static bool parseArgs(const CommandArgs& args, ProfileArgs& out) {
+    // PROFILE <servo> [<vel> <accel> [jerk] | OFF] | PROFILE TUNE <servo> [trials]
+    out.velocity = out.acceleration = out.jerk = 0.0f;
+    out.trials = 5;
+    if (args.is(0, "TUNE")) {
+        out.action = ProfileArgs::Action::TUNE;
+        if (args.count() < 2 || args.count() > 3 || !parseServo(args, 1, out.servoIndex)) return false;
+        return args.count() == 2 || (args.toInt(2, out.trials) && out.trials >= 1);
+    }
+    if (!parseServo(args, 0, out.servoIndex)) return false;
+    
+    switch (args.count()) {
+        case 1:
+            out.action = ProfileArgs::Action::SHOW;
+            return true;
+        case 2:
+            out.action = ProfileArgs::Action::OFF;
+            return args.is(1, "OFF");
+        default:
+            out.action = ProfileArgs::Action::SET;
+            return args.toFloat(1, out.velocity) && args.toFloat(2, out.acceleration) &&
+                   (args.count() == 3 || args.toFloat(3, out.jerk));
     }
-    else if (command.startsWith("SEQUENCE")) {
-        handleSequenceCommand(command);
+}
+
+static bool parseArgs(const CommandArgs& args, MultiArgs& out) {
+    // MULTI <servo> <servo> [...] | MULTI ON|OFF
+    out.servoCount = 0;
+    out.setMode = args.count() == 1;
+    if (out.setMode) {
+        out.enabled = args.is(0, "ON");
+        return out.enabled || args.is(0, "OFF");
+    }
+    if (args.count() > DropAttributor::MAX_CANDIDATES) return false;
+    
+    for (int i = 0; i < args.count(); i++) {
+        int servoIndex = 0;
+        if (!parseServo(args, i, servoIndex)) return false;
+        for (int j = 0; j < out.servoCount; j++) {
+            if (out.servoIndices[j] == servoIndex) return false;  // Listed twice
+        }
+        out.servoIndices[out.servoCount++] = servoIndex;
     }
-    else if (command.startsWith("EXECUTE")) {
-        handleExecuteCommand(command);
+    return true;
+}
+
+static bool parseArgs(const CommandArgs& args, ServoCalArgs& out) {
+    // SERVOCAL <servo> [<field> <value> | FIND [trials] | RESET]
+    out.field = ServoCalArgs::Field::START;
+    out.value = 0;
+    if (!parseServo(args, 0, out.servoIndex)) return false;
+    if (args.count() == 1) {
+        out.action = ServoCalArgs::Action::SHOW;
+        return true;
+    }
+    if (args.is(1, "FIND")) {
+        out.action = ServoCalArgs::Action::FIND;
+        out.value = 3;
+        return args.count() == 2 || (args.toInt(2, out.value) && out.value >= 1);
+    }
+    if (args.is(1, "RESET")) {
+        out.action = ServoCalArgs::Action::RESET;
+        return args.count() == 2;
     }
-    else if (command.startsWith("LIST")) {
-        handleListCommand(command);
+    
+    out.action = ServoCalArgs::Action::SET;
+    if (args.count() != 3 || !args.toInt(2, out.value)) return false;
+    int limit = 65535;
+    if (args.is(1, "START")) {
+        out.field = ServoCalArgs::Field::START;
+        limit = 180;
+    } else if (args.is(1, "DISPENSE")) {
+        out.field = ServoCalArgs::Field::DISPENSE;
+        limit = 180;
+    } else if (args.is(1, "MINPULSE")) {
+        out.field = ServoCalArgs::Field::MINPULSE;
+    } else if (args.is(1, "MAXPULSE")) {
+        out.field = ServoCalArgs::Field::MAXPULSE;
+    } else if (args.is(1, "HOLD")) {
+        out.field = ServoCalArgs::Field::HOLD;
+    } else if (args.is(1, "REVERSE")) {
+        out.field = ServoCalArgs::Field::REVERSE;
+        return true;
+    } else {
+        return false;
     }
-    else if (command.startsWith("DELETE")) {
-        handleDeleteCommand(command);
+    // Angles may be 0, pulses and holds may not
+    int lowest = out.field == ServoCalArgs::Field::START || out.field == ServoCalArgs::Field::DISPENSE ? 0 : 1;
+    return out.value >= lowest && out.value <= limit;
+}
+
+static bool parseArgs(const CommandArgs& args, RefillArgs& out) {
+    // REFILL | REFILL <servo> <count>|+<added>|OFF
+    out.servoIndex = 0;
+    out.pills = 0;
+    if (args.count() == 0) {
+        out.action = RefillArgs::Action::REPORT;
+        return true;
+    }
+    if (args.count() != 2 || !parseServo(args, 0, out.servoIndex)) return false;
+    
+    std::string_view value = args[1];
+    if (args.is(1, "OFF")) {
+        out.action = RefillArgs::Action::OFF;
+        return true;
     }
-    else if (command.startsWith("RESETDATA")) {
-        handleResetDataCommand(command);
+    if (value[0] == '+') {
+        out.action = RefillArgs::Action::ADD;
+        return CommandArgs::parseInt(value.substr(1), out.pills) && out.pills > 0;
     }
-    else if (command.startsWith("THRESHOLD")) {
-        handleThresholdCommand(command);
+    out.action = RefillArgs::Action::SET;
+    return args.toInt(1, out.pills) && out.pills >= 0;
+}
+
+static bool parseArgs(const CommandArgs& args, StatsArgs& out) {
+    // STATS [servo] | STATS RESET
+    out.reset = args.is(0, "RESET");
+    out.first = 0;
+    out.last = Config::NUM_SERVOS - 1;
+    if (out.reset || args.count() == 0) return true;
+    if (!parseServo(args, 0, out.first)) return false;
+    out.last = out.first;
+    return true;
+}
+
+template <typename Args, void (CommandHandler::*Run)(const Args&)>
+bool CommandHandler::dispatch(CommandHandler& handler, const CommandArgs& args) {
+    Args parsed;
+    if (!parseArgs(args, parsed)) return false;
+    (handler.*Run)(parsed);
+    return true;
+}
+
+void CommandHandler::processCommand(std::string_view command) {
+    // Verbs match exactly (case-insensitive), so neither table order nor shared prefixes
+    // such as RESET/RESETDATA or ANGLE/STARTANGLE can route a command to the wrong handler
+    using Handler = bool (*)(CommandHandler&, const CommandArgs&);
+    static constexpr CommandSpec<Handler> SPECS[] = {
+        CommandVerbs::spec<Handler>(Verb::RESET,        &dispatch<NoArgs,        &CommandHandler::handleResetCommand>),
+        CommandVerbs::spec<Handler>(Verb::TEST,         &dispatch<NoArgs,        &CommandHandler::handleTestCommand>),
+        CommandVerbs::spec<Handler>(Verb::FAST,         &dispatch<ServoArgs,     &CommandHandler::handleFastCommand>),
+        CommandVerbs::spec<Handler>(Verb::ANGLE,        &dispatch<AngleArgs,     &CommandHandler::handleAngleCommand>),
+        CommandVerbs::spec<Handler>(Verb::STARTANGLE,   &dispatch<AngleArgs,     &CommandHandler::handleStartAngleCommand>),
+        CommandVerbs::spec<Handler>(Verb::PILL,         &dispatch<ServoArgs,     &CommandHandler::handleIndividualPill>),
+        CommandVerbs::spec<Handler>(Verb::MEASUREMENTS, &dispatch<CountArgs,     &CommandHandler::handleMeasurementsCommand>),
+        CommandVerbs::spec<Handler>(Verb::SEQUENCE,     &dispatch<SequenceArgs,  &CommandHandler::handleSequenceCommand>),
+        CommandVerbs::spec<Handler>(Verb::EXECUTE,      &dispatch<DeviceArgs,    &CommandHandler::handleExecuteCommand>),
+        CommandVerbs::spec<Handler>(Verb::LIST,         &dispatch<DeviceArgs,    &CommandHandler::handleListCommand>),
+        CommandVerbs::spec<Handler>(Verb::DELETE,       &dispatch<DeviceArgs,    &CommandHandler::handleDeleteCommand>),
+        CommandVerbs::spec<Handler>(Verb::RESETDATA,    &dispatch<ResetDataArgs, &CommandHandler::handleResetDataCommand>),
+        CommandVerbs::spec<Handler>(Verb::THRESHOLD,    &dispatch<ThresholdArgs, &CommandHandler::handleThresholdCommand>),
+        CommandVerbs::spec<Handler>(Verb::CALIBRATE,    &dispatch<CalibrateArgs, &CommandHandler::handleCalibrateCommand>),
+        CommandVerbs::spec<Handler>(Verb::LABEL,        &dispatch<LabelArgs,     &CommandHandler::handleLabelCommand>),
+        CommandVerbs::spec<Handler>(Verb::REPORT,       &dispatch<ServoArgs,     &CommandHandler::handleReportCommand>),
+        CommandVerbs::spec<Handler>(Verb::EXPLAIN,      &dispatch<ServoArgs,     &CommandHandler::handleExplainCommand>),
+        CommandVerbs::spec<Handler>(Verb::MODEL,        &dispatch<ModelArgs,     &CommandHandler::handleModelCommand>),
+        CommandVerbs::spec<Handler>(Verb::PROFILE,      &dispatch<ProfileArgs,   &CommandHandler::handleProfileCommand>),
+        CommandVerbs::spec<Handler>(Verb::MULTI,        &dispatch<MultiArgs,     &CommandHandler::handleMultiCommand>),
+        CommandVerbs::spec<Handler>(Verb::SERVOCAL,     &dispatch<ServoCalArgs,  &CommandHandler::handleServoCalCommand>),
+        CommandVerbs::spec<Handler>(Verb::REFILL,       &dispatch<RefillArgs,    &CommandHandler::handleRefillCommand>),
+        CommandVerbs::spec<Handler>(Verb::STATS,        &dispatch<StatsArgs,     &CommandHandler::handleStatsCommand>),
+    };
+    static constexpr CommandTable<Handler, sizeof(SPECS) / sizeof(SPECS[0])> COMMANDS(SPECS);
+    static_assert(COMMANDS.size() == CommandVerbs::COUNT, "Every verb in CommandVerbs needs a handler");
+    static_assert(COMMANDS.valid(), "No hash seed separates all command verbs - enlarge the table");
+    
+    CommandArgs args(command);
+    const CommandSpec<Handler>* spec = COMMANDS.find(args.verb());
+    if (!spec) {
+        Displayer::getInstance().logMessage("[ERR] Unknown command: " + toString(command));
+        JobTable::getInstance().fail("unknown command");
+        return;
     }
-    else {
-        Displayer::getInstance().logMessage("[ERR] Unknown command: " + command);
+    if (args.count() < spec->minArgs || (spec->maxArgs >= 0 && args.count() > spec->maxArgs) || !spec->handler(*this, args)) {
+        Displayer::getInstance().logMessage("[ERR] Use: " + String(spec->usage));
+        JobTable::getInstance().fail("bad arguments");
     }
 }
 
-void CommandHandler::handleResetCommand() {
+void CommandHandler::handleResetCommand(const NoArgs&) {
     servoController.resetAllServos();
     Displayer::getInstance().logMessage("[CMD] Servo reset.");
 }
 
-void CommandHandler::handleTestCommand() {
+void CommandHandler::handleTestCommand(const NoArgs&) {
     servoController.resetCounter();
     Displayer::getInstance().logMessage("[CMD] Servo counter reset.");
 }
 
-void CommandHandler::handleAngleCommand(const String& command) {
-    int value = command.substring(6).toInt();
-    if (value >= 0 && value <= 180) {
-        servoController.setAngle(value);
-        Displayer::getInstance().logMessage("[CMD] Angle updated to " + String(value) + "°");
+void CommandHandler::handleAngleCommand(const AngleArgs& args) {
+    if (servoController.setAngle(args.angle)) {
+        Displayer::getInstance().logMessage("[CMD] Angle updated to " + String(args.angle) + "°");
     } else {
-        Displayer::getInstance().logMessage("[ERR] Invalid ANGLE value. Must be 0–180.");
+        Displayer::getInstance().logMessage("[ERR] ANGLE " + String(args.angle) + " not applied to every servo");
     }
 }
 
-void CommandHandler::handleIndividualPill(const String& command) {
-    int value = command.substring(5).toInt();
+void CommandHandler::handleIndividualPill(const ServoArgs& args) {
+    int value = args.servoIndex + 1;
+    Displayer::getInstance().logMessage("[CMD] Dispensing pill from servo " + String(value));
     
-    if (value >= 1 && value <= 6) {
-        int servoIndex = value - 1; // Convert to 0-based index
-        Displayer::getInstance().logMessage("[CMD] Dispensing pill from servo " + String(value));
-        
-        if (servoController.Dispense(servoIndex)) {
-            Displayer::getInstance().logMessage("[CMD] Pill successfully dispensed from servo " + String(value));
-        } else {
-            Displayer::getInstance().logMessage("[CMD] Failed to dispense pill from servo " + String(value) + " - check if bottle is empty");
-        }
+    if (servoController.Dispense(args.servoIndex)) {
+        Displayer::getInstance().logMessage("[CMD] Pill successfully dispensed from servo " + String(value));
+    } else {
+        Displayer::getInstance().logMessage("[CMD] Failed to dispense pill from servo " + String(value) + " (" + 
+                                          String(ServoController::failureName(servoController.getLastFailure())) + ")");
+        JobTable::getInstance().fail(ServoController::failureName(servoController.getLastFailure()));
     }
 }
 
-void CommandHandler::handleMeasurementsCommand(const String& command) {
-    int value = command.substring(12).toInt(); // Remove "MEASUREMENTS "
-    if (value >= 1) {  // No upper limit
-        piezoController.setPiezoMeasurements(value);
-        Displayer::getInstance().logMessage("[CMD] Piezo measurements updated to " + String(value));
-    } else {
-        Displayer::getInstance().logMessage("[ERR] Invalid MEASUREMENTS value. Must be >= 1.");
-    }
+void CommandHandler::handleMeasurementsCommand(const CountArgs& args) {
+    piezoController.setPiezoMeasurements(args.count);
+    Displayer::getInstance().logMessage("[CMD] Piezo measurements updated to " + String(args.count));
 }
 
-void CommandHandler::handleStartAngleCommand(const String& command) {
-    int value = command.substring(11).toInt();
-    if (value >= 0 && value <= 180) {
-        servoController.setStartAngle(value);
-        Displayer::getInstance().logMessage("[CMD] Start angle updated to " + String(value) + "°");
+void CommandHandler::handleStartAngleCommand(const AngleArgs& args) {
+    if (servoController.setStartAngle(args.angle)) {
+        Displayer::getInstance().logMessage("[CMD] Start angle updated to " + String(args.angle) + "°");
     } else {
-        Displayer::getInstance().logMessage("[ERR] Invalid START value. Must be 0–180.");
+        Displayer::getInstance().logMessage("[ERR] START " + String(args.angle) + " not applied to every servo");
     }
 }
 
-void CommandHandler::handleSequenceCommand(const String& command) {
+void CommandHandler::handleSequenceCommand(const SequenceArgs& args) {
     String deviceId, name;
     std::vector<int> counts;
     
-    if (sequenceManager.parseSequenceCommand(command, deviceId, name, counts)) {
+    // The sequence parser owns the "<device> <name> (counts)" grammar, names may contain spaces
+    if (sequenceManager.parseSequenceCommand("SEQUENCE " + toString(args.definition), deviceId, name, counts)) {
         if (sequenceManager.storeSequence(deviceId, name, counts)) {
             Displayer::getInstance().logMessage("[CMD] Sequence stored successfully");
         } else {
@@ -173,31 +550,19 @@ void CommandHandler::handleSequenceCommand(const String& command) {
     }
 }
 
-void CommandHandler::handleExecuteCommand(const String& command) {
+void CommandHandler::handleExecuteCommand(const DeviceArgs& args) {
     // Expected format: "EXECUTE device123 morning"
-    String params = command.substring(8); // Remove "EXECUTE "
-    int spaceIndex = params.indexOf(' ');
-    
-    if (spaceIndex == -1) {
-        Displayer::getInstance().logMessage("[ERR] Invalid execute format. Use: EXECUTE <device> <name>");
-        return;
-    }
-    
-    String deviceId = params.substring(0, spaceIndex);
-    String name = params.substring(spaceIndex + 1);
-    name.trim();
-    
-    if (sequenceManager.executeSequence(deviceId, name)) {
+    if (sequenceManager.executeSequence(toString(args.deviceId), toString(args.name))) {
         Displayer::getInstance().logMessage("[CMD] Sequence executed successfully");
     } else {
         Displayer::getInstance().logMessage("[ERR] Failed to execute sequence");
+        JobTable::getInstance().fail("not started");
     }
 }
 
-void CommandHandler::handleListCommand(const String& command) {
+void CommandHandler::handleListCommand(const DeviceArgs& args) {
     // Expected format: "LIST device123"
-    String deviceId = command.substring(5); // Remove "LIST "
-    deviceId.trim();
+    String deviceId = toString(args.deviceId);
     
     auto sequences = sequenceManager.getSequenceNames(deviceId);
     if (sequences.empty()) {
@@ -210,20 +575,10 @@ void CommandHandler::handleListCommand(const String& command) {
     }
 }
 
-void CommandHandler::handleDeleteCommand(const String& command) {
+void CommandHandler::handleDeleteCommand(const DeviceArgs& args) {
     // Expected format: "DELETE device123 sequenceName"
-    String params = command.substring(7); // Remove "DELETE "
-    int spaceIndex = params.indexOf(' ');
-    
-    if (spaceIndex == -1) {
-        Displayer::getInstance().logMessage("[ERR] Invalid DELETE format. Use: DELETE <device> <sequence_name>");
-        return;
-    }
-    
-    String deviceId = params.substring(0, spaceIndex);
-    String sequenceName = params.substring(spaceIndex + 1);
-    deviceId.trim();
-    sequenceName.trim();
+    String deviceId = toString(args.deviceId);
+    String sequenceName = toString(args.name);
     
     if (sequenceManager.deleteSequence(deviceId, sequenceName)) {
         Displayer::getInstance().logMessage("[CMD] Sequence '" + sequenceName + "' deleted successfully");
@@ -232,107 +587,286 @@ void CommandHandler::handleDeleteCommand(const String& command) {
     }
 }
 
-void CommandHandler::handleFastCommand(const String& command) {
+void CommandHandler::handleFastCommand(const ServoArgs& args) {
     // Expected format: "FAST 1" (servo number 1-6)
-    String params = command.substring(5); // Remove "FAST "
-    params.trim();
+    Displayer::getInstance().logMessage("[CMD] Testing fast dispense on servo " + String(args.servoIndex + 1));
+    
+    if (servoController.Dispense(args.servoIndex, 5)) {
+        Displayer::getInstance().logMessage("[CMD] Fast dispense test successful");
+    } else {
+        Displayer::getInstance().logMessage("[CMD] Fast dispense test failed (" + 
+                                          String(ServoController::failureName(servoController.getLastFailure())) + ")");
+        JobTable::getInstance().fail(ServoController::failureName(servoController.getLastFailure()));
+    }
+}
+
+void CommandHandler::handleResetDataCommand(const ResetDataArgs& args) {
+    // Expected format: "RESETDATA N" or "RESETDATA ALL"
+    if (args.all) {
+        piezoController.resetAllData();
+        Displayer::getInstance().logMessage("[CMD] All learning data has been reset for all dispensers");
+    } else {
+        piezoController.resetServoData(args.servoIndex);
+        Displayer::getInstance().logMessage("[CMD] Learning data reset for dispenser " + String(args.servoIndex + 1));
+    }
+}
+
+void CommandHandler::handleThresholdCommand(const ThresholdArgs& args) {
+    using Action = ThresholdArgs::Action;
+    using Field = ThresholdArgs::Field;
     
-    int servoNum = params.toInt();
-    if (servoNum < 1 || servoNum > Config::NUM_SERVOS) {
-        Displayer::getInstance().logMessage("[ERR] Invalid servo number. Use: FAST <1-" + String(Config::NUM_SERVOS) + ">");
+    if (args.action == Action::GET) {
+        for (int i = args.first; i <= args.last; i++) {
+            const AnalysisParams& params = piezoController.getAnalysisParams(i);
+            Displayer::getInstance().logMessage("[THRESH] Servo " + String(i + 1) + 
+                                              ": Average: " + String(params.deviationThreshold, 3) + 
+                                              ", Channel: " + String(params.minChannelThreshold, 3) + 
+                                              ", Envelope: " + String(params.envelopePoints) + 
+                                              ", Learning: " + String(params.learningSize) + 
+                                              ", Mode: " + PatternAnalyzer::similarityModeName(params.similarityMode));
+        }
         return;
     }
     
-    int servoIndex = servoNum - 1; // Convert to 0-based index
-    Displayer::getInstance().logMessage("[CMD] Testing fast dispense on servo " + String(servoNum));
+    // "SET AVERAGE 0.85" covers every servo, "SET 2 AVERAGE 0.85" only servo 2
+    bool all = args.action == Action::SET_ALL;
+    int servoIndex = args.first;
+    String target = all ? String(" on all servos") : String(" on servo ") + String(servoIndex + 1);
     
-    if (servoController.Dispense(servoIndex, 5)) {
-        Displayer::getInstance().logMessage("[CMD] Fast dispense test successful");
+    switch (args.field) {
+        case Field::AVERAGE:
+            if (all ? piezoController.setAverageThreshold(args.value) : piezoController.setAverageThreshold(servoIndex, args.value)) {
+                Displayer::getInstance().logMessage("[THRESH] Average threshold set to " + String(args.value, 3) + target);
+            } else {
+                Displayer::getInstance().logMessage("[ERR] Invalid average threshold value (must be 0.0-1.0)");
+            }
+            break;
+        case Field::CHANNEL:
+            if (all ? piezoController.setChannelThreshold(args.value) : piezoController.setChannelThreshold(servoIndex, args.value)) {
+                Displayer::getInstance().logMessage("[THRESH] Channel threshold set to " + String(args.value, 3) + target);
+            } else {
+                Displayer::getInstance().logMessage("[ERR] Invalid channel threshold value (must be 0.0-1.0)");
+            }
+            break;
+        case Field::ENVELOPE:
+            if (piezoController.setEnvelopePoints(servoIndex, args.count)) {
+                Displayer::getInstance().logMessage("[THRESH] Envelope points set to " + String(args.count) + target);
+            } else {
+                Displayer::getInstance().logMessage("[ERR] Invalid envelope points (" + String(PatternAnalyzer::MIN_ENVELOPE_POINTS) + "-" + 
+                                                  String(PatternAnalyzer::MAX_ENVELOPE_POINTS) + ", servo data must be reset first)");
+            }
+            break;
+        case Field::LEARNING:
+            if (piezoController.setLearningSize(servoIndex, args.count)) {
+                Displayer::getInstance().logMessage("[THRESH] Learning size set to " + String(args.count) + target);
+            } else {
+                Displayer::getInstance().logMessage("[ERR] Invalid learning size (odd, " + String(PatternAnalyzer::MIN_LEARNING_SIZE) + "-" + 
+                                                  String(PatternAnalyzer::MAX_LEARNING_SIZE) + ", servo data must be reset first)");
+            }
+            break;
+        case Field::MODE:
+            piezoController.setSimilarityMode(servoIndex, args.mode);
+            Displayer::getInstance().logMessage("[THRESH] Similarity mode set to " + String(PatternAnalyzer::similarityModeName(args.mode)) + target);
+            break;
+    }
+}
+
+void CommandHandler::handleLabelCommand(const LabelArgs& args) {
+    // Expected format: "LABEL 1 GOOD" or "LABEL 1 FLAWED" - labels the servo's most recent dispense
+    if (piezoController.labelLastDispense(args.servoIndex, args.flawed)) {
+        Displayer::getInstance().logMessage("[CALIB] Last dispense of servo " + String(args.servoIndex + 1) + " labeled " + (args.flawed ? "FLAWED" : "GOOD"));
     } else {
-        Displayer::getInstance().logMessage("[CMD] Fast dispense test failed");
+        Displayer::getInstance().logMessage("[ERR] No analyzed dispense to label for servo " + String(args.servoIndex + 1));
     }
 }
 
-void CommandHandler::handleResetDataCommand(const String& command) {
-    // Extract parameter: "RESETDATA N" or "RESETDATA ALL"
-    int spaceIndex = command.indexOf(' ');
-    if (spaceIndex == -1) {
-        Displayer::getInstance().logMessage("[ERR] Usage: RESETDATA <servo_number> or RESETDATA ALL");
+void CommandHandler::handleCalibrateCommand(const CalibrateArgs& args) {
+    // Expected format: "CALIBRATE 1", "CALIBRATE 1 EXPORT" or "CALIBRATE CANCEL"
+    if (args.action == CalibrateArgs::Action::CANCEL) {
+        piezoController.cancelCalibration();
+        Displayer::getInstance().logMessage("[CALIB] Cancel requested");
         return;
     }
     
-    String parameter = command.substring(spaceIndex + 1);
-    parameter.trim();
-    parameter.toUpperCase();
+    if (args.action == CalibrateArgs::Action::EXPORT) {
+        // One line per sample so the log stays under the broadcast limit
+        String csv = piezoController.exportScoreHistory(args.servoIndex);
+        int lineStart = 0;
+        while (lineStart < csv.length()) {
+            int lineEnd = csv.indexOf('\n', lineStart);
+            if (lineEnd == -1) lineEnd = csv.length();
+            Displayer::getInstance().logMessage("[CALIB] " + csv.substring(lineStart, lineEnd));
+            lineStart = lineEnd + 1;
+        }
+        return;
+    }
     
-    if (parameter.equals("ALL")) {
-        // Reset all servo data
-        piezoController.resetAllData();
-        Displayer::getInstance().logMessage("[CMD] All learning data has been reset for all dispensers");
+    if (piezoController.startCalibration(args.servoIndex)) {
+        Displayer::getInstance().logMessage("[CALIB] Calibration started for servo " + String(args.servoIndex + 1));
     } else {
-        // Try to parse servo number
-        int servoNum = parameter.toInt();
-        if (servoNum >= 1 && servoNum <= Config::NUM_SERVOS) {
-            int servoIndex = servoNum - 1; // Convert to 0-based index
-            piezoController.resetServoData(servoIndex);
-            Displayer::getInstance().logMessage("[CMD] Learning data reset for dispenser " + String(servoNum));
+        Displayer::getInstance().logMessage("[ERR] Calibration already running or could not be started");
+    }
+}
+
+void CommandHandler::handleReportCommand(const ServoArgs& args) {
+    // Expected format: "REPORT 1"
+    Displayer::getInstance().logLines(piezoController.getAnalysisReport(args.servoIndex));
+}
+
+void CommandHandler::handleExplainCommand(const ServoArgs& args) {
+    // Expected format: "EXPLAIN 1" - detailed diagnostics for the servo's last analyzed dispense
+    Displayer::getInstance().logMessage(piezoController.explainLastDispense(args.servoIndex));
+}
+
+void CommandHandler::handleModelCommand(const ModelArgs& args) {
+    // Expected format: "MODEL APPLY" (queued by POST /model) or "MODEL EXPORT"
+    if (args.apply) {
+        String error;
+        if (piezoController.applyModelImport(error)) {
+            Displayer::getInstance().logMessage("[MODEL] Snapshot imported and models reloaded");
         } else {
-            Displayer::getInstance().logMessage("[ERR] Invalid servo number. Use 1-" + String(Config::NUM_SERVOS) + " or ALL");
+            Displayer::getInstance().logMessage("[ERR] Model import failed: " + error);
         }
+    } else {
+        Displayer::getInstance().logMessage("[MODEL] Download the snapshot from http://" + WiFi.localIP().toString() + 
+                                          "/model (add ?history=1 to include score history)");
     }
 }
 
-void CommandHandler::handleThresholdCommand(const String& command) {
-    // Command format: THRESHOLD GET or THRESHOLD SET AVERAGE <value> or THRESHOLD SET CHANNEL <value>
-    int firstSpace = command.indexOf(' ');
-    if (firstSpace == -1) {
-        Displayer::getInstance().logMessage("[ERR] Invalid threshold command format");
-        return;
+void CommandHandler::handleProfileCommand(const ProfileArgs& args) {
+    // Expected format: "PROFILE 1", "PROFILE 1 360 1440 [11520]" (deg/s, deg/s^2, deg/s^3),
+    // "PROFILE 1 OFF" or "PROFILE TUNE 1 [trials]"
+    int servoIndex = args.servoIndex;
+    int servoNum = servoIndex + 1;
+    
+    switch (args.action) {
+        case ProfileArgs::Action::TUNE:
+            Displayer::getInstance().logMessage("[PROFILE] Tuning servo " + String(servoNum) + " with " + String(args.trials) + 
+                                              " dispenses per candidate - load a test bottle");
+            servoController.tuneMotionProfile(servoIndex, args.trials);
+            return;
+        case ProfileArgs::Action::OFF:
+            servoController.setMotionProfile(servoIndex, MotionProfile());
+            break;
+        case ProfileArgs::Action::SET:
+            if (!servoController.setMotionProfile(servoIndex, MotionProfile(args.velocity, args.acceleration, args.jerk))) {
+                Displayer::getInstance().logMessage("[ERR] Profile limits must be >= 0, with jerk 0 or >= accel");
+                return;
+            }
+            break;
+        case ProfileArgs::Action::SHOW:
+            break;
     }
     
-    String subCommand = command.substring(firstSpace + 1);
+    const MotionProfile& profile = servoController.getMotionProfile(servoIndex);
+    if (profile.isProfiled()) {
+        Displayer::getInstance().logMessage("[PROFILE] Servo " + String(servoNum) + ": " + String(profile.maxVelocity, 0) + " deg/s, " + 
+                                          String(profile.acceleration, 0) + " deg/s^2, jerk " + 
+                                          (profile.jerk > 0 ? String(profile.jerk, 0) + " deg/s^3" : String("off (trapezoidal)")));
+    } else {
+        Displayer::getInstance().logMessage("[PROFILE] Servo " + String(servoNum) + ": unprofiled (direct jump)");
+    }
     
-    if (subCommand.startsWith("GET")) {
-        float avgThreshold = piezoController.getAverageThreshold();
-        float chanThreshold = piezoController.getChannelThreshold();
-        
-        Displayer::getInstance().logMessage("[THRESH] Average: " + String(avgThreshold, 3) + 
-                                          ", Channel: " + String(chanThreshold, 3));
+    const DropLatencyTracker& latency = servoController.getDropLatency(servoIndex);
+    Displayer::getInstance().logMessage("[PROFILE] Drop latency p99: " + 
+                                      (latency.ready() ? String(latency.p99Ms) + " ms" : String("learning (") + String(latency.count) + " drops)") + 
+                                      ", hold " + String(servoController.getHoldMs(servoIndex)) + " ms, timeout " + 
+                                      String(servoController.getDetectionTimeoutMs(servoIndex)) + " ms");
+}
+
+void CommandHandler::handleMultiCommand(const MultiArgs& args) {
+    // Expected format: "MULTI 1 2 [3 ...]" (one pill from each, one shared sensor window)
+    // or "MULTI ON" / "MULTI OFF" (concurrent rounds in sequences)
+    if (args.setMode) {
+        sequenceManager.setConcurrent(args.enabled);
+        Displayer::getInstance().logMessage("[CMD] Concurrent sequence dispensing " + String(args.enabled ? "enabled" : "disabled"));
+        return;
     }
-    else if (subCommand.startsWith("SET")) {
-        // Parse "SET AVERAGE 0.85" or "SET CHANNEL 0.75"
-        String setParams = subCommand.substring(4); // Remove "SET "
-        int spacePos = setParams.indexOf(' ');
-        
-        if (spacePos == -1) {
-            Displayer::getInstance().logMessage("[ERR] Invalid threshold SET format");
+    
+    std::vector<int> servoIndices(args.servoIndices, args.servoIndices + args.servoCount);
+    for (int servoIndex : servoIndices) {
+        if (!servoController.canDispenseConcurrently(servoIndex)) {
+            Displayer::getInstance().logMessage("[ERR] Servo " + String(servoIndex + 1) + 
+                " has no learned drop latency/signature yet - dispense it alone a few times first");
+            JobTable::getInstance().fail("not learned");
             return;
         }
-        
-        String thresholdType = setParams.substring(0, spacePos);
-        String valueStr = setParams.substring(spacePos + 1);
-        
-        float value = valueStr.toFloat();
-        
-        if (thresholdType == "AVERAGE") {
-            if (piezoController.setAverageThreshold(value)) {
-                Displayer::getInstance().logMessage("[THRESH] Average threshold set to " + String(value, 3));
-            } else {
-                Displayer::getInstance().logMessage("[ERR] Invalid average threshold value (must be 0.0-1.0)");
+    }
+    
+    std::vector<DropVerdict> verdicts;
+    int dropped = servoController.DispenseConcurrent(servoIndices, verdicts);
+    Displayer::getInstance().logMessage("[CMD] Concurrent dispense: " + String(dropped) + "/" + String((int)servoIndices.size()) + " servos dropped");
+    if (dropped < (int)servoIndices.size()) {
+        JobTable::getInstance().fail(dropped == 0 ? "NO_DROP" : "partial");
+    }
+}
+
+void CommandHandler::handleServoCalCommand(const ServoCalArgs& args) {
+    // Expected format: "SERVOCAL 1", "SERVOCAL 1 DISPENSE 28", "SERVOCAL 1 REVERSE 1",
+    // "SERVOCAL 1 FIND [trials]" or "SERVOCAL 1 RESET"
+    int servoIndex = args.servoIndex;
+    int servoNum = servoIndex + 1;
+    
+    if (args.action == ServoCalArgs::Action::FIND) {
+        Displayer::getInstance().logMessage("[CALIB] Searching minimum dispense angle for servo " + String(servoNum) + 
+                                          " with " + String(args.value) + " dispenses per angle - load a test bottle");
+        servoController.findMinimumAngle(servoIndex, args.value);
+    } else if (args.action != ServoCalArgs::Action::SHOW) {
+        ServoCalibration calibration = servoController.getCalibration(servoIndex);
+        if (args.action == ServoCalArgs::Action::RESET) {
+            calibration = ServoCalibration();
+        } else {
+            switch (args.field) {
+                case ServoCalArgs::Field::START:    calibration.startAngle = args.value; break;
+                case ServoCalArgs::Field::DISPENSE: calibration.dispenseAngle = args.value; break;
+                case ServoCalArgs::Field::MINPULSE: calibration.minPulseUs = args.value; break;
+                case ServoCalArgs::Field::MAXPULSE: calibration.maxPulseUs = args.value; break;
+                case ServoCalArgs::Field::HOLD:     calibration.holdMs = args.value; break;
+                case ServoCalArgs::Field::REVERSE:  calibration.reversed = args.value != 0; break;
             }
         }
-        else if (thresholdType == "CHANNEL") {
-            if (piezoController.setChannelThreshold(value)) {
-                Displayer::getInstance().logMessage("[THRESH] Channel threshold set to " + String(value, 3));
-            } else {
-                Displayer::getInstance().logMessage("[ERR] Invalid channel threshold value (must be 0.0-1.0)");
-            }
+        
+        if (!servoController.setCalibration(servoIndex, calibration)) {
+            Displayer::getInstance().logMessage("[ERR] Rejected: angles 0-180 and distinct, pulses 300-2700 us at least 500 us apart, hold 50-2000 ms");
+            return;
         }
-        else {
-            Displayer::getInstance().logMessage("[ERR] Unknown threshold type: " + thresholdType);
+    }
+    
+    const ServoCalibration& calibration = servoController.getCalibration(servoIndex);
+    Displayer::getInstance().logMessage("[CALIB] Servo " + String(servoNum) + ": start " + String(calibration.startAngle) + "°, dispense " + 
+                                      String(calibration.dispenseAngle) + "°, pulse " + String(calibration.minPulseUs) + "-" + 
+                                      String(calibration.maxPulseUs) + " us, hold " + String(calibration.holdMs) + " ms" + 
+                                      (calibration.reversed ? ", reversed" : ""));
+}
+
+void CommandHandler::handleRefillCommand(const RefillArgs& args) {
+    // Expected format: "REFILL" (report), "REFILL 1 60" (set), "REFILL 1 +30" (add) or "REFILL 1 OFF" (untrack)
+    if (args.action != RefillArgs::Action::REPORT) {
+        switch (args.action) {
+            case RefillArgs::Action::OFF: Inventory::getInstance().refill(args.servoIndex, Inventory::UNTRACKED); break;
+            case RefillArgs::Action::ADD: Inventory::getInstance().add(args.servoIndex, args.pills); break;
+            default:                      Inventory::getInstance().refill(args.servoIndex, args.pills); break;
+        }
+        
+        // Fresh pills: the next dispense gets the full recovery plan again
+        if (Inventory::getInstance().getCount(args.servoIndex) != 0) {
+            servoController.clearEmpty(args.servoIndex);
         }
     }
-    else {
-        Displayer::getInstance().logMessage("[ERR] Unknown threshold command: " + subCommand);
+    
+    Displayer::getInstance().logMessage("[INV] " + Inventory::getInstance().getReport());
+}
+
+void CommandHandler::handleStatsCommand(const StatsArgs& args) {
+    // Expected format: "STATS" (all servos), "STATS 1" or "STATS RESET"
+    if (args.reset) {
+        DispenseStats::getInstance().reset();
+        Displayer::getInstance().logMessage("[STATS] Timing histograms cleared");
+        return;
+    }
+    
+    for (int servoIndex = args.first; servoIndex <= args.last; servoIndex++) {
+        Displayer::getInstance().logMessage("[STATS] " + DispenseStats::getInstance().getReport(servoIndex));
     }
+    Displayer::getInstance().logMessage("[STATS] " + DispenseStats::getInstance().getCommandReport());
 }
@@ -0,0 +1,209 @@
+// src/CommandJournal.cpp
+#include "CommandJournal.h"
+#include "Displayer.h"
+#include <Preferences.h>
+
+static constexpr const char* JOURNAL_NAMESPACE = "journal";
+static constexpr const char* ENTRIES_KEY = "entries";
+static constexpr const char* OLDEST_KEY = "oldest";
+
+CommandJournal& CommandJournal::getInstance() {
+    static CommandJournal instance;
+    return instance;
+}
+
+CommandJournal::CommandJournal() : oldest(0), dirty(false), mux(portMUX_INITIALIZER_UNLOCKED), flushTask(nullptr) {
+    memset(entries, 0, sizeof(entries));
+    memset(index, -1, sizeof(index));
+}
+
+void CommandJournal::initialize() {
+    load();
+    xTaskCreate(flushTaskWrapper, "Journal", 3072, this, 1, &flushTask);
+    if (dirty) xTaskNotifyGive(flushTask);     // Entries settled by load()
+}
+
+bool CommandJournal::isValidKey(std::string_view key) {
+    if (key.empty() || key.size() > Config::JOURNAL_KEY_LENGTH) return false;
+    for (char c : key) {
+        if (!isalnum((uint8_t)c) && c != '-' && c != '_' && c != '.') return false;
+    }
+    return true;
+}
+
+uint32_t CommandJournal::hashKey(std::string_view key) {
+    // FNV-1a; keys are case-sensitive, unlike verbs
+    uint32_t h = 2166136261u;
+    for (char c : key) {
+        h = (h ^ (uint8_t)c) * 16777619u;
+    }
+    return h;
+}
+
+int CommandJournal::find(std::string_view key, uint32_t hash) const {
+    for (int probe = 0, slot = hash & (INDEX_SLOTS - 1); probe < INDEX_SLOTS; probe++, slot = (slot + 1) & (INDEX_SLOTS - 1)) {
+        int entry = index[slot];
+        if (entry < 0) return -1;
+        if (entries[entry].hash == hash && key == entries[entry].key) return entry;
+    }
+    return -1;
+}
+
+void CommandJournal::insertIndex(int entry) {
+    int slot = entries[entry].hash & (INDEX_SLOTS - 1);
+    while (index[slot] >= 0) {
+        slot = (slot + 1) & (INDEX_SLOTS - 1);
+    }
+    index[slot] = (int8_t)entry;
+}
+
+void CommandJournal::removeIndex(int entry) {
+    int hole = entries[entry].hash & (INDEX_SLOTS - 1);
+    while (index[hole] != entry) {
+        if (index[hole] < 0) return;
+        hole = (hole + 1) & (INDEX_SLOTS - 1);
+    }
+    
+    // Backward-shift deletion: pull later members of the probe run into the hole, so
+    // lookups never need tombstones
+    for (int next = (hole + 1) & (INDEX_SLOTS - 1); index[next] >= 0; next = (next + 1) & (INDEX_SLOTS - 1)) {
+        int home = entries[index[next]].hash & (INDEX_SLOTS - 1);
+        if (((next - home) & (INDEX_SLOTS - 1)) >= ((next - hole) & (INDEX_SLOTS - 1))) {
+            index[hole] = index[next];
+            hole = next;
+        }
+    }
+    index[hole] = -1;
+}
+
+void CommandJournal::rebuildIndex() {
+    memset(index, -1, sizeof(index));
+    for (int i = 0; i < Config::JOURNAL_SIZE; i++) {
+        if (entries[i].key[0]) insertIndex(i);
+    }
+}
+
+bool CommandJournal::lookup(std::string_view key, JournalEntry& out) const {
+    uint32_t hash = hashKey(key);
+    portENTER_CRITICAL(&mux);
+    int entry = find(key, hash);
+    if (entry >= 0) out = entries[entry];
+    portEXIT_CRITICAL(&mux);
+    return entry >= 0;
+}
+
+void CommandJournal::record(std::string_view key, uint16_t jobId) {
+    if (!isValidKey(key)) return;
+    uint32_t hash = hashKey(key);
+    
+    portENTER_CRITICAL(&mux);
+    int entry = find(key, hash);
+    if (entry < 0) {
+        // The oldest entry goes; at most a queue's worth of keyed commands are unfinished,
+        // far fewer than the journal holds
+        entry = oldest;
+        oldest = (oldest + 1) % Config::JOURNAL_SIZE;
+        if (entries[entry].key[0]) removeIndex(entry);
+    
+        memset(&entries[entry], 0, sizeof(JournalEntry));
+        memcpy(entries[entry].key, key.data(), key.size());
+        entries[entry].hash = hash;
+        insertIndex(entry);
+    }
+    entries[entry].jobId = jobId;
+    entries[entry].state = JobState::QUEUED;
+    entries[entry].result[0] = '\0';
+    portEXIT_CRITICAL(&mux);
+    changed();
+}
+
+void CommandJournal::update(std::string_view key, JobState state, const char* result) {
+    if (key.empty()) return;
+    uint32_t hash = hashKey(key);
+    
+    portENTER_CRITICAL(&mux);
+    int entry = find(key, hash);
+    if (entry >= 0) {
+        entries[entry].state = state;
+        strncpy(entries[entry].result, result ? result : "", sizeof(entries[entry].result) - 1);
+        entries[entry].result[sizeof(entries[entry].result) - 1] = '\0';
+    }
+    portEXIT_CRITICAL(&mux);
+    if (entry >= 0) changed();
+}
+
+String CommandJournal::describe(const JournalEntry& entry) const {
+    // Keys and results never contain quotes: keys are checked at intake, results are ours
+    String json = "[DUP] {\"key\":\"" + String(entry.key) + "\",\"job\":" + String(entry.jobId) +
+                  ",\"state\":\"" + JobTable::stateName(entry.state) + "\"";
+    if (entry.result[0]) json += ",\"result\":\"" + String(entry.result) + "\"";
+    return json + "}";
+}
+
+void CommandJournal::load() {
+    Preferences prefs;
+    prefs.begin(JOURNAL_NAMESPACE, true);
+    bool found = prefs.getBytesLength(ENTRIES_KEY) == sizeof(entries);
+    if (found) {
+        prefs.getBytes(ENTRIES_KEY, entries, sizeof(entries));
+        oldest = prefs.getUChar(OLDEST_KEY, 0) % Config::JOURNAL_SIZE;
+    }
+    prefs.end();
+    if (!found) return;
+    
+    // Whatever was in flight when power went is settled now, so a resend cannot repeat it:
+    // a queued command never ran, a running one may have dispensed part of its pills
+    int settled = 0;
+    for (JournalEntry& entry : entries) {
+        entry.key[Config::JOURNAL_KEY_LENGTH] = '\0';
+        if (entry.state == JobState::QUEUED) {
+            entry.state = JobState::CANCELLED;
+            strncpy(entry.result, "not run (restart)", sizeof(entry.result) - 1);
+            settled++;
+        } else if (entry.state == JobState::RUNNING) {
+            entry.state = JobState::FAILED;
+            strncpy(entry.result, "interrupted by restart", sizeof(entry.result) - 1);
+            settled++;
+        }
+    }
+    rebuildIndex();
+    if (settled > 0) {
+        dirty = true;
+        Serial.println("[JOURNAL] " + String(settled) + " commands were in flight at restart");
+    }
+}
+
+void CommandJournal::changed() {
+    portENTER_CRITICAL(&mux);
+    dirty = true;
+    portEXIT_CRITICAL(&mux);
+    if (flushTask) xTaskNotifyGive(flushTask);
+}
+
+void CommandJournal::flush() {
+    // Static so the flush task's stack does not have to hold a copy of the journal
+    static JournalEntry snapshot[Config::JOURNAL_SIZE];
+    portENTER_CRITICAL(&mux);
+    bool wasDirty = dirty;
+    dirty = false;
+    memcpy(snapshot, entries, sizeof(snapshot));
+    uint8_t snapshotOldest = (uint8_t)oldest;
+    portEXIT_CRITICAL(&mux);
+    if (!wasDirty) return;
+    
+    Preferences prefs;
+    prefs.begin(JOURNAL_NAMESPACE, false);
+    prefs.putBytes(ENTRIES_KEY, snapshot, sizeof(snapshot));
+    prefs.putUChar(OLDEST_KEY, snapshotOldest);
+    prefs.end();
+}
+
+void CommandJournal::flushTaskWrapper(void* parameter) {
+    CommandJournal* journal = static_cast<CommandJournal*>(parameter);
+    while (true) {
+        // Intake, start and finish of one command arrive close together and share a write
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(Config::JOURNAL_FLUSH_DELAY_MS));
+        journal->flush();
+    }
+}
@@ -0,0 +1,105 @@
+// src/DispenseStats.cpp
+#include "DispenseStats.h"
+
+static String formatMs(uint32_t us) {
+    return String(us / 1000.0f, us < 10000 ? 2 : 0);
+}
+
+DispenseStats& DispenseStats::getInstance() {
+    static DispenseStats instance;
+    return instance;
+}
+
+const char* DispenseStats::phaseName(Phase phase) {
+    switch (phase) {
+        case SENSOR_WAIT: return "sensor_wait";
+        case ARM:         return "arm";
+        case MOVE:        return "move";
+        case DROP:        return "drop";
+        case CAPTURE:     return "capture";
+        case ANALYSIS:    return "analysis";
+        case PERSIST:     return "persist";
+        case DISPENSE:    return "dispense";
+        default:          return "-";
+    }
+}
+
+LatencyHistogram& DispenseStats::current(LatencyHistogram& histogram, uint32_t& epoch, uint32_t resetEpoch) {
+    if (epoch != resetEpoch) {
+        histogram.reset();
+        epoch = resetEpoch;
+    }
+    return histogram;
+}
+
+const LatencyHistogram& DispenseStats::view(const LatencyHistogram& histogram, uint32_t epoch, uint32_t resetEpoch) {
+    static const LatencyHistogram empty;
+    return epoch == resetEpoch ? histogram : empty;
+}
+
+void DispenseStats::record(int servoIndex, Phase phase, uint32_t us) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || phase >= PHASE_COUNT) return;
+    current(histograms[servoIndex][phase], epochs[servoIndex][phase], resetEpoch).record(us);
+}
+
+const LatencyHistogram& DispenseStats::get(int servoIndex, Phase phase) const {
+    return view(histograms[servoIndex][phase], epochs[servoIndex][phase], resetEpoch);
+}
+
+void DispenseStats::recordCommandPickup(uint32_t us) {
+    current(commandPickup, commandPickupEpoch, resetEpoch).record(us);
+}
+
+const LatencyHistogram& DispenseStats::getCommandPickup() const {
+    return view(commandPickup, commandPickupEpoch, resetEpoch);
+}
+
+void DispenseStats::reset() {
+    // Clearing here would race the writers; a histogram reads as empty until its writer clears it
+    resetEpoch = resetEpoch + 1;
+}
+
+String DispenseStats::getReport(int servoIndex) const {
+    String report = "Servo " + String(servoIndex + 1) + " (ms, p50/p95/p99/max):";
+    bool any = false;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        const LatencyHistogram& histogram = get(servoIndex, (Phase)phase);
+        if (histogram.count() == 0) continue;
+        
+        report += "\n  " + String(phaseName((Phase)phase)) + " n=" + String(histogram.count()) + ": " + 
+                  formatMs(histogram.percentile(0.50f)) + " / " + formatMs(histogram.percentile(0.95f)) + " / " + 
+                  formatMs(histogram.percentile(0.99f)) + " / " + formatMs(histogram.max());
+        any = true;
+    }
+    if (!any) report += " no dispenses yet";
+    return report;
+}
+
+String DispenseStats::getCommandReport() const {
+    const LatencyHistogram& pickup = getCommandPickup();
+    if (pickup.count() == 0) return "Command pickup: no commands yet";
+    return "Command pickup (ms, p50/p95/p99/max) n=" + String(pickup.count()) + ": " + 
+           formatMs(pickup.percentile(0.50f)) + " / " + formatMs(pickup.percentile(0.95f)) + " / " + 
+           formatMs(pickup.percentile(0.99f)) + " / " + formatMs(pickup.max());
+}
+
+String DispenseStats::toJson() const {
+    // Microseconds throughout, one object per servo keyed by phase
+    String json = "{\"unit\":\"us\",\"servos\":[";
+    for (int servo = 0; servo < Config::NUM_SERVOS; servo++) {
+        if (servo > 0) json += ",";
+        json += "{\"servo\":" + String(servo + 1);
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            const LatencyHistogram& histogram = get(servo, (Phase)phase);
+            json += ",\"" + String(phaseName((Phase)phase)) + "\":{\"n\":" + String(histogram.count()) + 
+                    ",\"p50\":" + String(histogram.percentile(0.50f)) + ",\"p95\":" + String(histogram.percentile(0.95f)) + 
+                    ",\"p99\":" + String(histogram.percentile(0.99f)) + ",\"max\":" + String(histogram.max()) + "}";
+        }
+        json += "}";
+    }
+    const LatencyHistogram& pickup = getCommandPickup();
+    json += "],\"command_pickup\":{\"n\":" + String(pickup.count()) + 
+            ",\"p50\":" + String(pickup.percentile(0.50f)) + ",\"p95\":" + String(pickup.percentile(0.95f)) + 
+            ",\"p99\":" + String(pickup.percentile(0.99f)) + ",\"max\":" + String(pickup.max()) + "}}";
+    return json;
+}
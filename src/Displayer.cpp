@@ -1,5 +1,86 @@
 // src/Displayer.cpp
 #include "Displayer.h"
+#include "DispenseStats.h"
+#include "CommandParser.h"
+#include "JobTable.h"
+#include "WireProtocol.h"
+#include "CommandJournal.h"
+#include <algorithm>
+
+using WireProtocol::Tag;
+
+// Every 10th measurement keeps graph frames small
+static constexpr size_t GRAPH_SAMPLE_STEP = 10;
+
+// Verbs that bypass the command queue, so they are served while a sequence runs
+static constexpr std::string_view CONTROL_VERBS[] = {"STOP", "RESET", "STATUS", "JOBS"};
+
+// Strip surrounding whitespace from a payload that is not NUL-terminated
+static void trimCommand(const char*& text, size_t& length) {
+    while (length > 0 && isspace((uint8_t)text[0])) {
+        text++;
+        length--;
+    }
+    while (length > 0 && isspace((uint8_t)text[length - 1])) {
+        length--;
+    }
+}
+
+static bool isControlCommand(const char* text, size_t length) {
+    CommandArgs args(std::string_view(text, length));
+    for (std::string_view verb : CONTROL_VERBS) {
+        if (CommandParser::equalsIgnoreCase(args.verb(), verb)) return true;
+    }
+    return false;
+}
+
+// "BATCH <request id>" on the first line of a WebSocket frame, commands on the lines after it
+static bool isBatchRequest(const char* text, size_t length) {
+    return length > 5 && CommandParser::equalsIgnoreCase(std::string_view(text, 5), "BATCH") && isspace((uint8_t)text[5]);
+}
+
+// "PROTO <version>" switches a WebSocket client between the text and binary protocols
+static bool isProtocolRequest(const char* text, size_t length) {
+    return CommandParser::equalsIgnoreCase(CommandArgs(std::string_view(text, length)).verb(), "PROTO");
+}
+
+// "@<key> " in front of a command: split it off, leaving the command. False for a malformed key.
+static bool takeIdempotencyKey(const char*& text, size_t& length, std::string_view& key) {
+    key = std::string_view();
+    if (length == 0 || text[0] != '@') return true;
+    
+    size_t end = 1;
+    while (end < length && !isspace((uint8_t)text[end])) end++;
+    key = std::string_view(text + 1, end - 1);
+    text += end;
+    length -= end;
+    trimCommand(text, length);
+    return CommandJournal::isValidKey(key);
+}
+
+static bool isValidRequestId(std::string_view id) {
+    if (id.empty() || id.size() > Config::BATCH_ID_LENGTH) return false;
+    for (char c : id) {
+        if (!isalnum((uint8_t)c) && c != '-' && c != '_' && c != '.') return false;
+    }
+    return true;
+}
+
+const char* BatchAdmission::statusName(Status status) {
+    switch (status) {
+        case Status::ACCEPTED:  return "ACCEPTED";
+        case Status::EMPTY:     return "EMPTY";
+        case Status::BAD_ID:    return "BAD_ID";
+        case Status::TOO_MANY:  return "TOO_MANY";
+        case Status::TOO_LONG:  return "TOO_LONG";
+        case Status::CONTROL:   return "CONTROL";
+        case Status::THROTTLED: return "THROTTLED";
+        case Status::MALFORMED: return "MALFORMED";
+        case Status::BUSY:      return "BUSY";
+        case Status::DUPLICATE: return "DUPLICATE";
+        default:                return "-";
+    }
+}
 
 Displayer& Displayer::getInstance() {
     static Displayer instance;
@@ -43,6 +124,15 @@ void Displayer::setupWebServer() {
         server.send(200, "text/html", "<html><body><h1>ESP32 Web Server Test</h1><p>Server is working!</p></body></html>");
     });
     
+    // Model snapshot: GET streams all servo models, POST (multipart upload) provisions this unit
+    server.on("/model", HTTP_GET, [this]() { handleModelExport(); });
+    server.on("/model", HTTP_POST, [this]() { handleModelUploadDone(); }, [this]() { handleModelUpload(); });
+    
+    // Dispense phase latency histograms (p50/p95/p99 per servo and phase, microseconds)
+    server.on("/stats", HTTP_GET, [this]() {
+        server.send(200, "application/json", DispenseStats::getInstance().toJson());
+    });
+    
     // Handle other static files
     server.onNotFound([this]() {
         Serial.println("File not found: " + server.uri());
@@ -63,9 +153,25 @@ void Displayer::setWebSocketEventHandler() {
 
 void Displayer::onWebSocketEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t length) {
     if (type == WStype_TEXT) {
+        // Work on the payload in place; it stays valid for the duration of this callback
+        const char* text = (const char*)payload;
+        size_t textLength = payload != nullptr ? length : 0;
+        trimCommand(text, textLength);
+        bool batch = isBatchRequest(text, textLength);
+        
+        // Protocol negotiation is not a command: it is neither rate limited nor queued
+        if (isProtocolRequest(text, textLength)) {
+            getInstance().handleProtocolRequest(num, text, textLength);
+            return;
+        }
+        
         // Check rate limiting first
         if (getInstance().isClientThrottled(num)) {
             Serial.println("[THROTTLE] Blocking command from throttled client " + String(num));
+            if (batch) {
+                getInstance().handleBatchRequest(num, nullptr, 0);
+                return;
+            }
             
             // Send throttle reminder every 5 seconds so user knows they're still blocked
             ConnectedDevice& device = getInstance().connectedDevices[num];
@@ -75,96 +181,83 @@ void Displayer::onWebSocketEvent(uint8_t num, WStype_t type, uint8_t *payload, s
             if (currentTime - lastThrottleReminder > 5000) {  // Every 5 seconds
                 unsigned long timeLeft = (device.throttleEndTime - currentTime) / 1000;
                 String reminderMsg = "[THROTTLE] ⏳ Still cooling down! " + String(timeLeft) + " seconds remaining...";
-                getInstance().webSocket.sendTXT(num, reminderMsg.c_str());
+                getInstance().reply(num, reminderMsg);
                 lastThrottleReminder = currentTime;
             }
             return;  // Drop commands from throttled clients
         }
         
-        // Properly handle payload with known length
-        String incoming = "";
-        if (length > 0 && payload != nullptr) {
-            // Create a null-terminated string from payload
-            char* buffer = (char*)malloc(length + 1);
-            memcpy(buffer, payload, length);
-            buffer[length] = '\0';
-            incoming = String(buffer);
-            free(buffer);
-        }
-        
         // Skip empty commands
-        incoming.trim();
-        if (incoming.length() == 0) {
+        if (textLength == 0) {
             Serial.println("[WS] Ignoring empty command");
             return;
         }
         
-        // Update rate limiting for this client
+        // Update rate limiting for this client; a batch counts once, however many commands it carries
         getInstance().updateClientRateLimit(num);
         
         // Check if client got throttled by this command
         if (getInstance().isClientThrottled(num)) {
-            Serial.println("[THROTTLE] Client " + String(num) + " throttled after command: " + incoming);
+            Serial.printf("[THROTTLE] Client %u throttled after command: %.*s\n", num, (int)textLength, text);
+            if (batch) getInstance().handleBatchRequest(num, nullptr, 0);
             return;  // Don't process this command
         }
         
-        Serial.println("[WS] Received: " + incoming);
+        if (batch) {
+            getInstance().handleBatchRequest(num, text, textLength);
+            return;
+        }
+        
+        Serial.printf("[WS] Received: %.*s\n", (int)textLength, text);
         
-        // Check queue size before sending ACK
-        UBaseType_t currentQueueSize = uxQueueMessagesWaiting(getInstance().commandQueue);
+        // Check this client's own backlog before sending ACK
+        int currentQueueSize = getInstance().lanePending(num);
         
         // Stricter throttling for PILL commands to prevent crashes
-        if (incoming.startsWith("PILL ")) {
-            // Only send ACK for first command, throttle the rest more aggressively
-            if (currentQueueSize == 0) {
-                String ackMsg = "[ACK] Received: " + incoming;
-                getInstance().webSocket.sendTXT(num, ackMsg.c_str());
-            } else {
-                // For all subsequent PILL commands, just log to serial
-                Serial.println("[ACK] Received (throttled): " + incoming);
-            }
+        char reply[Config::COMMAND_MAX_LENGTH + 48];
+        if (textLength > 5 && strncmp(text, "PILL ", 5) == 0 && currentQueueSize > 0) {
+            // For all subsequent PILL commands, just log to serial
+            Serial.printf("[ACK] Received (throttled): %.*s\n", (int)textLength, text);
         } else {
-            // Send ACK for non-PILL commands
-            String ackMsg = "[ACK] Received: " + incoming;
-            getInstance().webSocket.sendTXT(num, ackMsg.c_str());
-        }
-        
-        // Add command to queue (thread-safe) with bounds checking
-        if (incoming.length() > 100) {  // Sanity check for reasonable command length
-            Serial.println("[ERROR] Command too long, ignoring: " + String(incoming.length()) + " chars");
-            return;
-        }
-        
-        char* commandCopy = (char*)malloc(incoming.length() + 1);
-        if (commandCopy == NULL) {
-            Serial.println("[ERROR] Failed to allocate memory for command");
-            return;
+            // ACK every other command, and the first PILL
+            snprintf(reply, sizeof(reply), "[ACK] Received: %.*s", (int)std::min(textLength, (size_t)Config::COMMAND_MAX_LENGTH), text);
+            getInstance().reply(num, reply);
         }
-        strcpy(commandCopy, incoming.c_str());
         
-        BaseType_t result = xQueueSend(getInstance().commandQueue, &commandCopy, 0);
-        if (result != pdTRUE) {
-            Serial.println("[ERROR] Command queue full! Dropping command: " + incoming);
-            free(commandCopy);  // Free memory if queue send failed
+        BatchAdmission admission = getInstance().admitCommand(text, textLength, num);
+        if (admission.status == BatchAdmission::Status::DUPLICATE) {
+            // Already answered with the first outcome
+            Serial.printf("[DUP] Client %u resent job %u: %.*s\n", num, admission.jobIds[0], (int)textLength, text);
+        } else if (admission.status == BatchAdmission::Status::EMPTY) {
+            Serial.printf("[ERROR] Empty command from client %u, ignoring\n", num);
+            getInstance().reply(num, "[ERROR] Empty command, nothing queued.");
+        } else if (admission.status == BatchAdmission::Status::TOO_LONG) {
+            Serial.printf("[ERROR] Command too long, ignoring: %u chars\n", (unsigned)textLength);
+            getInstance().reply(num, "[ERROR] Command too long (max " + String(Config::COMMAND_MAX_LENGTH) + " chars), dropped.");
+        } else if (admission.status == BatchAdmission::Status::BAD_ID) {
+            getInstance().reply(num, "[ERROR] Bad idempotency key, command dropped.");
+        } else if (admission.status != BatchAdmission::Status::ACCEPTED) {
+            Serial.printf("[ERROR] Command queue full! Dropping command: %.*s\n", (int)textLength, text);
             
             // Send error message safely
-            String errorMsg = "[ERROR] QUEUE FULL! Command dropped.";
-            getInstance().webSocket.sendTXT(num, errorMsg.c_str());
-            getInstance().logMessage("[QUEUE] Queue full! Dropped command (Queue limit: 10)");
+            getInstance().reply(num, "[ERROR] QUEUE FULL! Command dropped.");
+            getInstance().logMessage("[QUEUE] Queue full! Dropped command (client " + String(num) + " limit: " + String(Config::COMMAND_CLIENT_DEPTH) + ")");
         } else {
-            UBaseType_t queueSize = uxQueueMessagesWaiting(getInstance().commandQueue);
+            int queueSize = getInstance().pendingCommands();
             // Only send queue status for every 3rd queued command to reduce WebSocket spam
             static int queueMessageCounter = 0;
             queueMessageCounter++;
             
             if (queueMessageCounter % 3 == 0 || queueSize <= 1) {
-                String queueMsg = "[QUEUE] Processing: " + incoming + " (remaining: " + String(queueSize - 1) + ")";
-                getInstance().logMessage(queueMsg);
+                snprintf(reply, sizeof(reply), "[QUEUE] Processing: %.*s (remaining: %u)", (int)textLength, text, (unsigned)(queueSize - 1));
+                getInstance().logMessage(reply);
             }
             
             // Always log to serial for debugging
-            Serial.println("[QUEUE] Processing: " + incoming + " (remaining: " + String(queueSize - 1) + ")");
+            Serial.printf("[QUEUE] Processing: %.*s (remaining: %u)\n", (int)textLength, text, (unsigned)(queueSize - 1));
         }
+    } else if (type == WStype_BIN) {
+        getInstance().handleBinaryMessage(num, payload, payload != nullptr ? length : 0);
     } else if (type == WStype_CONNECTED) {
         getInstance().handleDeviceConnection(num);
     } else if (type == WStype_DISCONNECTED) {
@@ -173,6 +266,18 @@ void Displayer::onWebSocketEvent(uint8_t num, WStype_t type, uint8_t *payload, s
 }
 
 void Displayer::broadcast(const String& message) {
+    // Binary clients get the message as a LOG record, text clients as it is
+    if (countClients(ClientMode::BINARY) > 0) {
+        std::vector<uint8_t> frame = encodeLog(message);
+        sendToClients(ClientMode::BINARY, frame.data(), frame.size());
+    }
+    if (countClients(ClientMode::TEXT) > 0) {
+        broadcastText(message);
+    }
+    updateConnectedDevicesActivity();
+}
+
+void Displayer::broadcastText(const String& message) {
     // Validate UTF-8 encoding before sending
     bool isValidUTF8 = true;
     for (int i = 0; i < message.length(); i++) {
@@ -194,40 +299,644 @@ void Displayer::broadcast(const String& message) {
     // Allow larger messages for graph data, smaller for other messages
     int maxLength = message.startsWith("[GRAPH]") ? 8000 : 500;
     
+    String truncated;
+    const String* out = &message;
     if (message.length() > maxLength) {
         Serial.println("[WARN] Message too long for broadcast, truncating");
-        String truncated = message.substring(0, maxLength) + "...";
-        webSocket.broadcastTXT(truncated.c_str());
-    } else {
-        webSocket.broadcastTXT(message.c_str());
+        truncated = message.substring(0, maxLength) + "...";
+        out = &truncated;
+    }
+    
+    if (countClients(ClientMode::BINARY) == 0) {
+        webSocket.broadcastTXT(out->c_str());
+        return;
+    }
+    for (int client = 0; client < MAX_CLIENTS; client++) {
+        if (clientModes[client] == ClientMode::TEXT) webSocket.sendTXT(client, out->c_str());
+    }
+}
+
+int Displayer::countClients(ClientMode mode) const {
+    int count = 0;
+    for (ClientMode clientMode : clientModes) {
+        if (clientMode == mode) count++;
+    }
+    return count;
+}
+
+void Displayer::sendToClients(ClientMode mode, const uint8_t* frame, size_t length) {
+    for (int client = 0; client < MAX_CLIENTS; client++) {
+        if (clientModes[client] == mode) webSocket.sendBIN(client, frame, length);
+    }
+}
+
+std::vector<uint8_t> Displayer::encodeLog(const String& message) {
+    // "[TAG] text" travels as TAG and TEXT fields, so clients dispatch on the tag
+    // instead of matching prefixes
+    std::string_view text(message.c_str(), message.length());
+    std::string_view tag;
+    size_t close = text.find(']');
+    if (!text.empty() && text[0] == '[' && close != std::string_view::npos && close <= 16) {
+        tag = text.substr(1, close - 1);
+        text.remove_prefix(close + 1);
+        if (!text.empty() && text[0] == ' ') text.remove_prefix(1);
+    }
+    
+    std::vector<uint8_t> frame(WireProtocol::HEADER_SIZE + WireProtocol::Writer::fieldSize(tag.size()) + WireProtocol::Writer::fieldSize(text.size()));
+    WireProtocol::Writer writer(frame.data(), frame.size(), WireProtocol::Type::LOG);
+    writer.putText(Tag::TAG, tag);
+    writer.putText(Tag::TEXT, text);
+    return frame;
+}
+
+void Displayer::logEvent(const String& text, const uint8_t* frame, size_t frameLength) {
+    Serial.println(text);
+    if (countClients(ClientMode::BINARY) > 0) {
+        sendToClients(ClientMode::BINARY, frame, frameLength);
+    }
+    if (countClients(ClientMode::TEXT) > 0) {
+        broadcastText(text);
     }
     updateConnectedDevicesActivity();
 }
 
-String Displayer::getCommandBuffer() {
-    char* command = nullptr;
+void Displayer::broadcastGraph(int servoIndex, int triggerChannel, const std::vector<std::vector<int>>& channels) {
+    const char* triggerName = Config::PIEZO_NAMES[triggerChannel];
+    int channelCount = std::min((int)channels.size(), Config::NUM_PIEZOS);
+    
+    // Binary: the same decimated samples as u16 arrays, a fraction of the JSON size
+    if (countClients(ClientMode::BINARY) > 0) {
+        size_t size = WireProtocol::HEADER_SIZE + WireProtocol::Writer::fieldSize(1) + WireProtocol::Writer::fieldSize(strlen(triggerName));
+        for (int i = 0; i < channelCount; i++) {
+            size_t kept = (channels[i].size() + GRAPH_SAMPLE_STEP - 1) / GRAPH_SAMPLE_STEP;
+            size += WireProtocol::Writer::fieldSize(strlen(Config::PIEZO_NAMES[i])) + WireProtocol::Writer::fieldSize(kept * 2);
+        }
+        
+        std::vector<uint8_t> frame(size);
+        WireProtocol::Writer writer(frame.data(), frame.size(), WireProtocol::Type::GRAPH);
+        writer.putU8(Tag::SERVO, (uint8_t)(servoIndex + 1));
+        writer.putText(Tag::TRIGGER, triggerName);
+        for (int i = 0; i < channelCount; i++) {
+            writer.putText(Tag::CHANNEL, Config::PIEZO_NAMES[i]);
+            writer.putSamples(Tag::SAMPLES, channels[i].data(), channels[i].size(), GRAPH_SAMPLE_STEP);
+        }
+        if (writer.ok()) {
+            sendToClients(ClientMode::BINARY, writer.data(), writer.size());
+        }
+    }
     
-    // Try to receive command from queue with no wait
-    if (xQueueReceive(commandQueue, &command, 0) == pdTRUE && command != nullptr) {
-        String result = String(command);
-        UBaseType_t queueSize = uxQueueMessagesWaiting(commandQueue);
-        Serial.println("[QUEUE] Command retrieved: " + result + ". Remaining: " + String(queueSize));
+    if (countClients(ClientMode::TEXT) == 0) return;
+    
+    // Send graph data in JSON format for visualization (compressed for WebSocket stability)
+    String graphData = "[GRAPH] {";
+    graphData += "\"trigger\":\"" + String(triggerName) + "\",";
+    graphData += "\"servo\":" + String(servoIndex + 1) + ",";
+    graphData += "\"channels\":[";
+    for (int i = 0; i < channelCount; i++) {
+        if (i > 0) graphData += ",";
+        graphData += "{\"name\":\"" + String(Config::PIEZO_NAMES[i]) + "\",";
+        
+        const std::vector<int>& samples = channels[i];
+        String compressedData = "";
+        for (size_t j = 0; j < samples.size(); j += GRAPH_SAMPLE_STEP) {
+            if (j > 0) compressedData += ",";
+            compressedData += String(samples[j]);
+        }
         
-        free(command);  // Free the malloc'd memory
-        return result;
+        graphData += "\"data\":[" + compressedData + "]}";
     }
+    graphData += "]}";
     
-    return "";  // Return empty string if no commands available
+    if (graphData.length() < 8000) {
+        broadcastText(graphData);
+    } else {
+        Serial.println("[WARN] Oversized graph data, skipping");
+    }
 }
 
-void Displayer::clearCommandBuffer() {
-    // This method is no longer needed since getCommandBuffer() 
-    // already removes the command from the queue
-    // Do nothing - queue automatically manages itself
+void Displayer::handleProtocolRequest(uint8_t clientId, const char* text, size_t length) {
+    if (clientId >= MAX_CLIENTS) return;
+    
+    CommandArgs args(std::string_view(text, length));
+    int version = -1;
+    if (args.count() != 1 || !args.toInt(0, version) || (version != 0 && version != WireProtocol::VERSION)) {
+        char message[80];
+        snprintf(message, sizeof(message), "[PROTO] Unsupported, staying on text (PROTO %u for binary, PROTO 0 for text)", WireProtocol::VERSION);
+        reply(clientId, message);
+        return;
+    }
+    
+    if (version == 0) {
+        clientModes[clientId] = ClientMode::TEXT;
+        webSocket.sendTXT(clientId, "[PROTO] Text protocol");
+        Serial.printf("[PROTO] Client %u uses text\n", clientId);
+        return;
+    }
+    
+    // Everything from here on goes to this client as binary frames
+    clientModes[clientId] = ClientMode::BINARY;
+    uint8_t buffer[32];
+    WireProtocol::Writer writer(buffer, sizeof(buffer), WireProtocol::Type::HELLO);
+    writer.putU8(Tag::VERSION, WireProtocol::VERSION);
+    writer.putU16(Tag::MAX_COMMAND, Config::COMMAND_MAX_LENGTH);
+    writer.putU16(Tag::QUEUE, Config::COMMAND_CLIENT_DEPTH);
+    webSocket.sendBIN(clientId, writer.data(), writer.size());
+    Serial.printf("[PROTO] Client %u uses binary v%u\n", clientId, WireProtocol::VERSION);
+}
+
+void Displayer::handleBinaryMessage(uint8_t clientId, const uint8_t* payload, size_t length) {
+    if (clientId >= MAX_CLIENTS || clientModes[clientId] != ClientMode::BINARY) {
+        Serial.printf("[PROTO] Binary frame from text client %u ignored\n", clientId);
+        return;
+    }
+    
+    // Commands stay in the frame; queueing copies them into their slots
+    WireProtocol::Reader reader(payload, length);
+    WireProtocol::Field field;
+    std::string_view commands[Config::BATCH_MAX_COMMANDS];
+    int count = 0;
+    bool tooMany = false;
+    uint16_t sequence = 0;
+    while (reader.next(field)) {
+        if (field.tag == Tag::SEQ) {
+            sequence = field.u16();
+        } else if (field.tag == Tag::TEXT) {
+            if (count < Config::BATCH_MAX_COMMANDS) commands[count++] = field.text();
+            else tooMany = true;
+        }
+    }
+    
+    BatchAdmission admission = {};
+    admission.count = (uint8_t)count;
+    if (!reader.valid() || reader.malformed() || reader.type() != WireProtocol::Type::COMMAND) {
+        admission.status = BatchAdmission::Status::MALFORMED;
+    } else if (isClientThrottled(clientId)) {
+        admission.status = BatchAdmission::Status::THROTTLED;
+    } else {
+        // One frame counts once against the rate limit, however many commands it carries
+        updateClientRateLimit(clientId);
+        if (isClientThrottled(clientId)) {
+            admission.status = BatchAdmission::Status::THROTTLED;
+        } else if (tooMany) {
+            admission.status = BatchAdmission::Status::TOO_MANY;
+            admission.line = Config::BATCH_MAX_COMMANDS + 1;
+        } else if (count == 1) {
+            // A lone command takes the normal path, control lane included
+            admission = admitCommand(commands[0].data(), commands[0].size(), clientId);
+        } else {
+            char requestId[6];
+            snprintf(requestId, sizeof(requestId), "%u", sequence);
+            admission = queueBatch(requestId, commands, count, clientId);
+        }
+    }
+    
+    sendAck(clientId, sequence, admission);
+    Serial.printf("[WS] Binary command frame %u from client %u: %s, %d commands\n",
+                  sequence, clientId, BatchAdmission::statusName(admission.status), count);
+}
+
+void Displayer::sendAck(uint8_t clientId, uint16_t sequence, const BatchAdmission& admission) {
+    uint8_t buffer[WireProtocol::HEADER_SIZE + 4 * 5 + Config::BATCH_MAX_COMMANDS * 5];
+    WireProtocol::Writer writer(buffer, sizeof(buffer), WireProtocol::Type::ACK);
+    writer.putU16(Tag::SEQ, sequence);
+    writer.putU8(Tag::STATUS, (uint8_t)admission.status);
+    for (int i = 0; i < admission.count && i < Config::BATCH_MAX_COMMANDS; i++) {
+        if (admission.jobIds[i]) writer.putU16(Tag::JOB, admission.jobIds[i]);
+    }
+    if (admission.line > 0) writer.putU8(Tag::LINE, admission.line);
+    if (admission.status == BatchAdmission::Status::BUSY) writer.putU8(Tag::SPACE, admission.space);
+    webSocket.sendBIN(clientId, writer.data(), writer.size());
+}
+
+// Scheduling weight: long-running jobs use up a lane's turn, quick commands share one
+static int commandCost(const char* text, size_t length) {
+    return JobTable::isJobCommand(CommandArgs(std::string_view(text, length)).verb()) ? Config::COMMAND_JOB_COST : 1;
+}
+
+// Filled on the stack and copied into a static slot by the scheduler
+static void fillCommand(QueuedCommand& queued, const char* text, size_t length, uint8_t clientId, uint16_t jobId) {
+    memcpy(queued.text, text, length);
+    queued.text[length] = '\0';
+    queued.length = (uint8_t)length;
+    queued.clientId = clientId;
+    queued.receivedUs = micros();
+    queued.jobId = jobId;
+}
+
+bool Displayer::queueCommand(const char* text, size_t length, uint8_t clientId) {
+    return admitCommand(text, length, clientId).status == BatchAdmission::Status::ACCEPTED;
+}
+
+BatchAdmission Displayer::admitCommand(const char* text, size_t length, uint8_t clientId) {
+    BatchAdmission admission = {};
+    admission.count = 1;
+    admission.line = 1;
+    trimCommand(text, length);
+    std::string_view key;
+    if (!takeIdempotencyKey(text, length, key)) {
+        admission.status = BatchAdmission::Status::BAD_ID;
+        return admission;
+    }
+    if (length == 0 || length > Config::COMMAND_MAX_LENGTH) {
+        admission.status = length == 0 ? BatchAdmission::Status::EMPTY : BatchAdmission::Status::TOO_LONG;
+        return admission;
+    }
+    
+    QueuedCommand queued;
+    if (isControlCommand(text, length)) {
+        // Control verbs act on the present moment and are safe to repeat, so a key is ignored
+        fillCommand(queued, text, length, clientId, 0);
+        bool sent = xQueueSend(controlQueue, &queued, 0) == pdTRUE;
+        admission.status = sent ? BatchAdmission::Status::ACCEPTED : BatchAdmission::Status::BUSY;
+        admission.line = 0;
+        return admission;
+    }
+    
+    // Long commands get their job id now, so the client can follow them from the start;
+    // the job is only created once the slot is certain. A keyed command is always a job,
+    // so the journal can record how it ended.
+    JobTable& jobs = JobTable::getInstance();
+    CommandJournal& journal = CommandJournal::getInstance();
+    xSemaphoreTake(intakeLock, portMAX_DELAY);
+    JournalEntry previous;
+    if (!key.empty() && journal.lookup(key, previous)) {
+        xSemaphoreGive(intakeLock);
+        reply(clientId, journal.describe(previous));
+        admission.status = BatchAdmission::Status::DUPLICATE;
+        admission.jobIds[0] = previous.jobId;
+        return admission;
+    }
+    
+    bool queuedOk = getCommandSpace(clientId) > 0;
+    uint16_t id = 0;
+    if (queuedOk && (!key.empty() || JobTable::isJobCommand(CommandArgs(std::string_view(text, length)).verb()))) {
+        id = jobs.create(std::string_view(text, length), clientId, key);
+        queuedOk = id != 0 || key.empty();
+    }
+    if (queuedOk) {
+        if (id != 0) {
+            if (!key.empty()) journal.record(key, id);
+            jobs.publish(id);
+        }
+        fillCommand(queued, text, length, clientId, id);
+        queuedOk = enqueueCommand(queued, commandCost(text, length));
+    }
+    admission.space = (uint8_t)getCommandSpace(clientId);
+    xSemaphoreGive(intakeLock);
+    
+    admission.status = queuedOk ? BatchAdmission::Status::ACCEPTED : BatchAdmission::Status::BUSY;
+    admission.jobIds[0] = id;
+    if (queuedOk) admission.line = 0;
+    return admission;
+}
+
+BatchAdmission Displayer::queueBatch(std::string_view requestId, const char* text, size_t length, uint8_t clientId) {
+    // Split into lines; blank ones are skipped but still counted for error positions
+    std::string_view commands[Config::BATCH_MAX_COMMANDS];
+    uint8_t lineNumbers[Config::BATCH_MAX_COMMANDS];
+    int count = 0;
+    int lineNumber = 0;
+    const char* end = text + length;
+    for (const char* line = text; line < end; ) {
+        const char* newline = (const char*)memchr(line, '\n', end - line);
+        const char* command = line;
+        size_t commandLength = (newline ? newline : end) - line;
+        line = newline ? newline + 1 : end;
+        lineNumber++;
+        
+        trimCommand(command, commandLength);
+        if (commandLength == 0) continue;
+        if (count == Config::BATCH_MAX_COMMANDS) {
+            BatchAdmission admission = {};
+            admission.status = BatchAdmission::Status::TOO_MANY;
+            admission.line = (uint8_t)std::min(lineNumber, 255);
+            return admission;
+        }
+        commands[count] = std::string_view(command, commandLength);
+        lineNumbers[count++] = (uint8_t)std::min(lineNumber, 255);
+    }
+    
+    BatchAdmission admission = queueBatch(requestId, commands, count, clientId);
+    if (admission.line > 0) admission.line = lineNumbers[admission.line - 1];
+    return admission;
+}
+
+BatchAdmission Displayer::queueBatch(std::string_view requestId, const std::string_view* commands, int count, uint8_t clientId) {
+    BatchAdmission admission = {};
+    if (count > Config::BATCH_MAX_COMMANDS) {
+        admission.status = BatchAdmission::Status::TOO_MANY;
+        admission.line = Config::BATCH_MAX_COMMANDS + 1;
+        return admission;
+    }
+    
+    // Check every command before anything is queued
+    const char* texts[Config::BATCH_MAX_COMMANDS];
+    size_t lengths[Config::BATCH_MAX_COMMANDS];
+    std::string_view keys[Config::BATCH_MAX_COMMANDS];
+    for (int i = 0; i < count; i++) {
+        texts[i] = commands[i].data();
+        lengths[i] = commands[i].size();
+        trimCommand(texts[i], lengths[i]);
+        
+        admission.line = (uint8_t)(i + 1);
+        bool keyValid = takeIdempotencyKey(texts[i], lengths[i], keys[i]);
+        for (int j = 0; j < i && keyValid && !keys[i].empty(); j++) {
+            keyValid = keys[j] != keys[i];
+        }
+        if (!keyValid) {
+            admission.status = BatchAdmission::Status::BAD_ID;
+            return admission;
+        }
+        if (lengths[i] == 0) {
+            admission.status = BatchAdmission::Status::EMPTY;
+            return admission;
+        }
+        if (lengths[i] > Config::COMMAND_MAX_LENGTH) {
+            admission.status = BatchAdmission::Status::TOO_LONG;
+            return admission;
+        }
+        if (isControlCommand(texts[i], lengths[i])) {
+            admission.status = BatchAdmission::Status::CONTROL;
+            return admission;
+        }
+    }
+    admission.line = 0;
+    admission.count = (uint8_t)count;
+    if (count == 0) {
+        admission.status = BatchAdmission::Status::EMPTY;
+        return admission;
+    }
+    
+    // Every command becomes a job, so the batch can report each outcome. No other producer
+    // runs while the lock is held and the command task only frees slots, so once the
+    // client's lane has room for the whole batch every send below succeeds.
+    JobTable& jobs = JobTable::getInstance();
+    CommandJournal& journal = CommandJournal::getInstance();
+    xSemaphoreTake(intakeLock, portMAX_DELAY);
+    
+    // A batch with any command seen before is refused whole: the client gets a [DUP] for each
+    // such command and can resend the others on their own
+    JournalEntry previous;
+    for (int i = 0; i < count; i++) {
+        if (keys[i].empty() || !journal.lookup(keys[i], previous)) continue;
+        reply(clientId, journal.describe(previous));
+        if (admission.status != BatchAdmission::Status::DUPLICATE) {
+            admission.status = BatchAdmission::Status::DUPLICATE;
+            admission.line = (uint8_t)(i + 1);
+        }
+    }
+    if (admission.status == BatchAdmission::Status::DUPLICATE) {
+        xSemaphoreGive(intakeLock);
+        return admission;
+    }
+    
+    admission.space = (uint8_t)getCommandSpace(clientId);
+    bool admitted = admission.space >= count;
+    for (int i = 0; i < count && admitted; i++) {
+        admission.jobIds[i] = jobs.create(std::string_view(texts[i], lengths[i]), clientId, keys[i]);
+        admitted = admission.jobIds[i] != 0;
+    }
+    admitted = admitted && jobs.openBatch(requestId, clientId, admission.jobIds, count);
+    
+    if (admitted) {
+        QueuedCommand queued;
+        for (int i = 0; i < count; i++) {
+            if (!keys[i].empty()) journal.record(keys[i], admission.jobIds[i]);
+            jobs.publish(admission.jobIds[i]);
+            fillCommand(queued, texts[i], lengths[i], clientId, admission.jobIds[i]);
+            enqueueCommand(queued, commandCost(texts[i], lengths[i]));
+        }
+    } else {
+        for (int i = 0; i < count; i++) jobs.discard(admission.jobIds[i]);
+        memset(admission.jobIds, 0, sizeof(admission.jobIds));
+    }
+    xSemaphoreGive(intakeLock);
+    
+    admission.status = admitted ? BatchAdmission::Status::ACCEPTED : BatchAdmission::Status::BUSY;
+    return admission;
+}
+
+void Displayer::handleBatchRequest(uint8_t clientId, const char* text, size_t length) {
+    // No text: the batch was refused before it was read (throttled client)
+    BatchAdmission admission = {};
+    admission.status = BatchAdmission::Status::THROTTLED;
+    std::string_view requestId;
+    
+    if (text != nullptr) {
+        const char* newline = (const char*)memchr(text, '\n', length);
+        size_t headerLength = newline ? (size_t)(newline - text) : length;
+        CommandArgs header(std::string_view(text, headerLength));
+        if (header.count() == 1 && isValidRequestId(header[0])) {
+            requestId = header[0];
+            const char* body = newline ? newline + 1 : text + length;
+            admission = queueBatch(requestId, body, text + length - body, clientId);
+        } else {
+            admission.status = BatchAdmission::Status::BAD_ID;
+        }
+    }
+    
+    // One response per request, correlated by the client's id; per-command outcomes follow
+    // in a second "complete" response once the last job has finished
+    char id[Config::BATCH_ID_LENGTH + 1] = "";
+    if (!requestId.empty()) memcpy(id, requestId.data(), requestId.size());
+    String json = "[BATCH] {\"id\":\"" + String(id) + "\"";
+    if (admission.status == BatchAdmission::Status::ACCEPTED) {
+        json += ",\"status\":\"accepted\",\"jobs\":[";
+        for (int i = 0; i < admission.count; i++) {
+            if (i > 0) json += ",";
+            json += String(admission.jobIds[i]);
+        }
+        json += "]}";
+    } else {
+        json += ",\"status\":\"rejected\",\"reason\":\"" + String(BatchAdmission::statusName(admission.status)) + "\"";
+        if (admission.line > 0) json += ",\"line\":" + String(admission.line);
+        if (admission.status == BatchAdmission::Status::BUSY) {
+            json += ",\"count\":" + String(admission.count) + ",\"space\":" + String(admission.space);
+        }
+        json += "}";
+    }
+    reply(clientId, json);
+    Serial.printf("[BATCH] Client %u: %s, %u commands\n", clientId, BatchAdmission::statusName(admission.status), admission.count);
+}
+
+void Displayer::reply(uint8_t clientId, const String& message) {
+    if (clientId == QueuedCommand::SERIAL_CLIENT || clientId == QueuedCommand::LOCAL_CLIENT) {
+        Serial.println(message);
+        return;
+    }
+    if (clientId < MAX_CLIENTS && clientModes[clientId] == ClientMode::BINARY) {
+        std::vector<uint8_t> frame = encodeLog(message);
+        webSocket.sendBIN(clientId, frame.data(), frame.size());
+        return;
+    }
+    webSocket.sendTXT(clientId, message.c_str());
+}
+
+int Displayer::laneOf(uint8_t clientId) {
+    if (clientId < MAX_CLIENTS) return clientId;
+    return clientId == QueuedCommand::SERIAL_CLIENT ? MAX_CLIENTS : MAX_CLIENTS + 1;
+}
+
+bool Displayer::enqueueCommand(const QueuedCommand& command, int cost) {
+    portENTER_CRITICAL(&schedulerMux);
+    int slot = scheduler.push(laneOf(command.clientId), cost);
+    if (slot != scheduler.NONE) commandSlots[slot] = command;
+    portEXIT_CRITICAL(&schedulerMux);
+    if (slot == scheduler.NONE) return false;
+    xSemaphoreGive(commandReady);
+    return true;
+}
+
+bool Displayer::queueCommandFront(const QueuedCommand& command) {
+    xSemaphoreTake(intakeLock, portMAX_DELAY);
+    portENTER_CRITICAL(&schedulerMux);
+    int slot = scheduler.pushUrgent();
+    if (slot != scheduler.NONE) commandSlots[slot] = command;
+    portEXIT_CRITICAL(&schedulerMux);
+    xSemaphoreGive(intakeLock);
+    if (slot == scheduler.NONE) return false;
+    xSemaphoreGive(commandReady);
+    return true;
+}
+
+int Displayer::flushCommands() {
+    uint16_t dropped[Config::COMMAND_QUEUE_LENGTH];
+    int count = 0;
+    portENTER_CRITICAL(&schedulerMux);
+    for (int slot; count < Config::COMMAND_QUEUE_LENGTH && (slot = scheduler.pop()) != scheduler.NONE; ) {
+        dropped[count++] = commandSlots[slot].jobId;
+    }
+    stopEpoch = stopEpoch + 1;  // Whatever was already picked up is now stopped
+    portEXIT_CRITICAL(&schedulerMux);
+    
+    // Their wake-ups go too, so the command task does not spin on empty lanes
+    for (int i = 0; i < count; i++) {
+        xSemaphoreTake(commandReady, 0);
+        JobTable::getInstance().cancel(dropped[i]);
+    }
+    return count;
+}
+
+void Displayer::handleModelExport() {
+    bool includeHistory = server.hasArg("history") && server.arg("history") != "0";
+    
+    // Snapshot first, then send: the model can change while a slow client downloads
+    File file;
+    if (ModelSnapshot::exportToFile(includeHistory)) file = SPIFFS.open(ModelSnapshot::EXPORT_PATH, "r");
+    if (!file) {
+        server.send(500, "text/plain", "Snapshot export failed (flash full?)");
+        Serial.println("[MODEL] Snapshot export failed");
+        return;
+    }
+    
+    server.sendHeader("Content-Disposition", "attachment; filename=\"model.bin\"");
+    size_t sent = server.streamFile(file, "application/octet-stream");
+    bool ok = sent == file.size();
+    file.close();
+    SPIFFS.remove(ModelSnapshot::EXPORT_PATH);
+    
+    Serial.println(ok ? "[MODEL] Snapshot exported" : "[MODEL] Snapshot export failed");
+}
+
+void Displayer::handleModelUpload() {
+    HTTPUpload& upload = server.upload();
+    
+    if (upload.status == UPLOAD_FILE_START) {
+        modelImportReceived = 0;
+        modelImportError = "";
+        modelImportFile = SPIFFS.open(ModelSnapshot::IMPORT_PATH, "w");
+        if (!modelImportFile) modelImportError = "cannot open import file";
+    }
+    else if (upload.status == UPLOAD_FILE_WRITE) {
+        if (modelImportError.length() > 0) return;
+        
+        // Reject a foreign or incompatible blob as soon as its header has arrived
+        if (modelImportReceived == 0 && upload.currentSize >= sizeof(ModelSnapshot::SnapshotHeader)) {
+            ModelSnapshot::SnapshotHeader header;
+            memcpy(&header, upload.buf, sizeof(header));
+            if (!ModelSnapshot::validateHeader(header, modelImportError)) {
+                modelImportFile.close();
+                SPIFFS.remove(ModelSnapshot::IMPORT_PATH);
+                return;
+            }
+        }
+        
+        if (modelImportFile.write(upload.buf, upload.currentSize) != upload.currentSize) {
+            modelImportError = "flash full";
+        }
+        modelImportReceived += upload.currentSize;
+    }
+    else if (upload.status == UPLOAD_FILE_END || upload.status == UPLOAD_FILE_ABORTED) {
+        if (modelImportFile) modelImportFile.close();
+        if (upload.status == UPLOAD_FILE_ABORTED) modelImportError = "upload aborted";
+    }
+}
+
+void Displayer::handleModelUploadDone() {
+    if (modelImportError.length() > 0) {
+        SPIFFS.remove(ModelSnapshot::IMPORT_PATH);
+        server.send(400, "text/plain", "Import rejected: " + modelImportError);
+        logMessage("[MODEL] Import rejected: " + modelImportError);
+        return;
+    }
+    
+    // Apply from the command task so it never races a dispense writing the same files
+    if (!queueCommand("MODEL APPLY")) {
+        server.send(503, "text/plain", "Command queue full, retry");
+        return;
+    }
+    server.send(200, "text/plain", "Received " + String(modelImportReceived) + " bytes, applying");
+}
+
+bool Displayer::waitForCommand(QueuedCommand& command, TickType_t timeout) {
+    // The command task sleeps here until serial or WebSocket input arrives
+    if (xSemaphoreTake(commandReady, timeout) != pdTRUE) {
+        return false;
+    }
+    
+    // Clients take turns: the scheduler picks the lane, not arrival order
+    portENTER_CRITICAL(&schedulerMux);
+    int slot = scheduler.pop();
+    if (slot != scheduler.NONE) {
+        command = commandSlots[slot];
+        // Stamped with the pop, so a STOP either flushed this command or stops it
+        command.stopEpoch = stopEpoch;
+    }
+    int queueSize = scheduler.pending();
+    portEXIT_CRITICAL(&schedulerMux);
+    if (slot == scheduler.NONE) return false;
+    
+    Serial.printf("[QUEUE] Command retrieved: %s (client %u). Remaining: %d\n", command.text, command.clientId, queueSize);
+    return true;
+}
+
+bool Displayer::waitForControlCommand(QueuedCommand& command, TickType_t timeout) {
+    return xQueueReceive(controlQueue, &command, timeout) == pdTRUE;
 }
 
 bool Displayer::hasCommands() {
-    return uxQueueMessagesWaiting(commandQueue) > 0;
+    return pendingCommands() > 0;
+}
+
+int Displayer::pendingCommands() {
+    portENTER_CRITICAL(&schedulerMux);
+    int pending = scheduler.pending();
+    portEXIT_CRITICAL(&schedulerMux);
+    return pending;
+}
+
+int Displayer::lanePending(uint8_t clientId) {
+    portENTER_CRITICAL(&schedulerMux);
+    int pending = scheduler.pending(laneOf(clientId));
+    portEXIT_CRITICAL(&schedulerMux);
+    return pending;
+}
+
+int Displayer::getCommandSpace(uint8_t clientId) {
+    portENTER_CRITICAL(&schedulerMux);
+    int space = scheduler.space(laneOf(clientId));
+    portEXIT_CRITICAL(&schedulerMux);
+    return space;
 }
 
 void Displayer::initSPIFFS() {
@@ -306,6 +1015,7 @@ void Displayer::handleDeviceConnection(uint8_t clientId) {
     device.isThrottled = false;      // Not throttled initially
     device.throttleEndTime = 0;      // No throttle end time
     connectedDevices[clientId] = device;
+    if (clientId < MAX_CLIENTS) clientModes[clientId] = ClientMode::TEXT;  // Until it asks for binary
     
     String message = "[CONNECT] Client " + String(clientId) + " connected";
     Serial.println(message);
@@ -314,6 +1024,7 @@ void Displayer::handleDeviceConnection(uint8_t clientId) {
 
 void Displayer::handleDeviceDisconnection(uint8_t clientId) {
     connectedDevices.erase(clientId);
+    if (clientId < MAX_CLIENTS) clientModes[clientId] = ClientMode::NONE;
     
     String message = "[DISCONNECT] Client " + String(clientId) + " disconnected";
     Serial.println(message);
@@ -344,6 +1055,16 @@ void Displayer::logMessage(const String& msg) {
     }
 }
 
+void Displayer::logLines(const String& text) {
+    int start = 0;
+    while (start < (int)text.length()) {
+        int end = text.indexOf('\n', start);
+        if (end < 0) end = text.length();
+        if (end > start) logMessage(text.substring(start, end));
+        start = end + 1;
+    }
+}
+
 void Displayer::handleClients() {
     server.handleClient();  // Process HTTP requests
     webSocket.loop();       // Process WebSocket connections
@@ -366,7 +1087,7 @@ bool Displayer::isClientThrottled(uint8_t clientId) {
         
         // Send "unblocked" notification to client
         String unblockedMsg = "[THROTTLE] ✅ Cooldown finished! You can now use the system again.";
-        getInstance().webSocket.sendTXT(clientId, unblockedMsg.c_str());
+        reply(clientId, unblockedMsg);
     }
     
     return device.isThrottled;
@@ -402,7 +1123,7 @@ void Displayer::updateClientRateLimit(uint8_t clientId) {
     // Warn user when approaching rate limit
     if (device.commandCount == MAX_COMMANDS - 2) {  // 2 commands before limit
         String warningMsg = "[THROTTLE] ⚠️ Warning: Slow down! Only " + String(MAX_COMMANDS - device.commandCount) + " commands left before cooldown.";
-        getInstance().webSocket.sendTXT(clientId, warningMsg.c_str());
+        reply(clientId, warningMsg);
     }
     
     // Check if rate limit exceeded
@@ -417,10 +1138,10 @@ void Displayer::updateClientRateLimit(uint8_t clientId) {
         throttleMsg += "You sent too many commands too quickly.\n";
         throttleMsg += "Commands are blocked for " + String(THROTTLE_DURATION/1000) + " seconds.\n";
         throttleMsg += "Please wait before trying again...";
-        webSocket.sendTXT(clientId, throttleMsg.c_str());
+        reply(clientId, throttleMsg);
         
         // Also send a countdown notification
         String countdownMsg = "[THROTTLE] ⏰ Cooldown: " + String(THROTTLE_DURATION/1000) + " seconds remaining";
-        webSocket.sendTXT(clientId, countdownMsg.c_str());
+        reply(clientId, countdownMsg);
     }
 }
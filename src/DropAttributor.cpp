@@ -0,0 +1,234 @@
+// src/DropAttributor.cpp
+#include "DropAttributor.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+    constexpr float SIGNATURE_MIN_ALPHA = 0.05f;   // Signature keeps following slow mechanical changes
+    constexpr float MIN_SHARE_SIGMA = 0.05f;
+    constexpr float MIN_LAG_SIGMA = 2.0f;          // Samples
+    constexpr float INF_COST = 1e30f;
+
+    float channelShare(const ImpactFeatures& impact, int channel, int channelCount) {
+        float sum = 0.0f;
+        for (int c = 0; c < channelCount; c++) sum += impact.peak[c];
+        return sum > 0.0f ? impact.peak[channel] / sum : 1.0f / channelCount;
+    }
+
+    float channelLag(const ImpactFeatures& impact, int channel) {
+        // A channel that never crossed is treated as arriving at the very end of the impact
+        return impact.channelOnset[channel] >= 0 ? (float)impact.channelOnset[channel] : (float)(impact.end - impact.onset);
+    }
+
+    void updateMoments(float& mean, float& var, float x, float alpha, bool first) {
+        if (first) {
+            mean = x;
+            var = 0.0f;
+            return;
+        }
+        float delta = x - mean;
+        mean += alpha * delta;
+        var = (1.0f - alpha) * (var + alpha * delta * delta);
+    }
+}
+
+int DropAttributor::segmentImpacts(const std::vector<std::vector<int>>& channels, int channelCount, int threshold,
+                                   int quietSamples, ImpactFeatures* out, int maxImpacts) {
+    channelCount = std::min(channelCount, std::min((int)channels.size(), MAX_CHANNELS));
+    if (channelCount <= 0 || maxImpacts <= 0) return 0;
+
+    size_t sampleCount = channels[0].size();
+    for (int c = 1; c < channelCount; c++) sampleCount = std::min(sampleCount, channels[c].size());
+
+    float envelope[MAX_CHANNELS] = {};
+    ImpactFeatures* current = nullptr;
+    int count = 0;
+    int quiet = 0;
+
+    for (size_t i = 0; i < sampleCount; i++) {
+        bool active = false;
+        bool rise = false;
+        for (int c = 0; c < channelCount; c++) {
+            int x = channels[c][i];
+            if (x > threshold) {
+                active = true;
+                // Only a channel that already rang in this impact can signal a second one
+                if (current && (int)i - current->onset >= quietSamples &&
+                    envelope[c] > threshold && x > RETRIGGER_RATIO * envelope[c]) {
+                    rise = true;
+                }
+            }
+            envelope[c] = std::max((float)x, envelope[c] * ENVELOPE_DECAY);
+        }
+
+        if (active && (!current || rise)) {
+            if (current) current->end = (int)i;
+            if (count == maxImpacts) return count;
+
+            current = &out[count++];
+            current->onset = (int)i;
+            current->end = (int)sampleCount;
+            for (int c = 0; c < MAX_CHANNELS; c++) {
+                current->channelOnset[c] = -1;
+                current->peak[c] = 0.0f;
+            }
+            quiet = 0;
+        }
+        if (!current) continue;
+
+        for (int c = 0; c < channelCount; c++) {
+            int x = channels[c][i];
+            if (x > threshold && current->channelOnset[c] < 0) {
+                current->channelOnset[c] = (int)i - current->onset;
+            }
+            current->peak[c] = std::max(current->peak[c], (float)x);
+        }
+
+        quiet = active ? 0 : quiet + 1;
+        if (quiet >= quietSamples) {
+            current->end = (int)i - quiet + 1;
+            current = nullptr;
+        }
+    }
+    return count;
+}
+
+void DropAttributor::updateSignature(DropSignature& signature, const ImpactFeatures& impact, int channelCount) {
+    channelCount = std::min(channelCount, MAX_CHANNELS);
+    bool first = signature.samples == 0;
+    float alpha = std::max(1.0f / (signature.samples + 1), SIGNATURE_MIN_ALPHA);
+
+    for (int c = 0; c < channelCount; c++) {
+        updateMoments(signature.shareMean[c], signature.shareVar[c], channelShare(impact, c, channelCount), alpha, first);
+        updateMoments(signature.lagMean[c], signature.lagVar[c], channelLag(impact, c), alpha, first);
+    }
+    signature.samples++;
+}
+
+float DropAttributor::impactCost(const ImpactFeatures& impact, const AttributionCandidate& candidate, int channelCount) {
+    channelCount = std::min(channelCount, MAX_CHANNELS);
+    float cost = 0.0f;
+
+    if (candidate.expectedOnset >= 0.0f && candidate.onsetTolerance > 0.0f) {
+        float d = (impact.onset - candidate.expectedOnset) / candidate.onsetTolerance;
+        cost += d * d;
+    }
+
+    const DropSignature* signature = candidate.signature;
+    if (signature && signature->ready()) {
+        for (int c = 0; c < channelCount; c++) {
+            float shareSigma = std::max(sqrtf(signature->shareVar[c]), MIN_SHARE_SIGMA);
+            float ds = (channelShare(impact, c, channelCount) - signature->shareMean[c]) / shareSigma;
+            float lagSigma = std::max(sqrtf(signature->lagVar[c]), MIN_LAG_SIGMA);
+            float dl = (channelLag(impact, c) - signature->lagMean[c]) / lagSigma;
+            cost += ds * ds + dl * dl;
+        }
+    }
+    return cost;
+}
+
+AttributionResult DropAttributor::attribute(const ImpactFeatures* impacts, int impactCount,
+                                            const AttributionCandidate* candidates, int candidateCount, int channelCount) {
+    AttributionResult result = {};
+    const int n = std::max(0, std::min(impactCount, MAX_IMPACTS));
+    const int m = std::max(0, std::min(candidateCount, MAX_CANDIDATES));
+    result.impactCount = n;
+
+    for (int s = 0; s < MAX_CANDIDATES; s++) {
+        result.verdicts[s] = s < m ? DropVerdict::MISSING : DropVerdict::NOT_REQUESTED;
+    }
+    if (n == 0 || m == 0) return result;
+
+    float cost[MAX_IMPACTS][MAX_CANDIDATES];
+    for (int i = 0; i < n; i++) {
+        result.impacts[i] = impacts[i];
+        for (int s = 0; s < m; s++) {
+            cost[i][s] = impactCost(impacts[i], candidates[s], channelCount);
+        }
+    }
+
+    // DP over impacts in time order and the set of candidates already matched;
+    // at most 8 x 256 states, so an exact matching is cheap
+    const int fullMask = 1 << m;
+    std::vector<float> dp((n + 1) * fullMask, INF_COST);
+    std::vector<int8_t> choice((n + 1) * fullMask, -1);
+    dp[0] = 0.0f;
+    for (int i = 0; i < n; i++) {
+        for (int mask = 0; mask < fullMask; mask++) {
+            float base = dp[i * fullMask + mask];
+            if (base >= INF_COST) continue;
+
+            float& skip = dp[(i + 1) * fullMask + mask];
+            if (base + UNMATCHED_COST < skip) {
+                skip = base + UNMATCHED_COST;
+                choice[(i + 1) * fullMask + mask] = -1;
+            }
+            for (int s = 0; s < m; s++) {
+                if (mask & (1 << s)) continue;
+                int next = mask | (1 << s);
+                float& take = dp[(i + 1) * fullMask + next];
+                if (base + cost[i][s] < take) {
+                    take = base + cost[i][s];
+                    choice[(i + 1) * fullMask + next] = (int8_t)s;
+                }
+            }
+        }
+    }
+
+    int bestMask = 0;
+    for (int mask = 1; mask < fullMask; mask++) {
+        if (dp[n * fullMask + mask] < dp[n * fullMask + bestMask]) bestMask = mask;
+    }
+    for (int i = n, mask = bestMask; i > 0; i--) {
+        int s = choice[i * fullMask + mask];
+        result.assigned[i - 1] = s;
+        if (s >= 0) mask &= ~(1 << s);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (result.assigned[i] >= 0) result.verdicts[result.assigned[i]] = DropVerdict::DROPPED;
+    }
+
+    // Surplus impacts join their nearest candidate
+    for (int i = 0; i < n; i++) {
+        if (result.assigned[i] >= 0) continue;
+        int nearest = 0;
+        for (int s = 1; s < m; s++) {
+            if (cost[i][s] < cost[i][nearest]) nearest = s;
+        }
+        result.assigned[i] = nearest;
+        result.verdicts[nearest] = result.verdicts[nearest] == DropVerdict::MISSING ? DropVerdict::DROPPED : DropVerdict::MULTIPLE;
+    }
+
+    bool countsMatch = true;
+    for (int s = 0; s < m; s++) {
+        if (result.verdicts[s] != DropVerdict::DROPPED) countsMatch = false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int s = result.assigned[i];
+        int runnerUp = -1;
+        for (int r = 0; r < m; r++) {
+            if (r != s && (runnerUp < 0 || cost[i][r] < cost[i][runnerUp])) runnerUp = r;
+        }
+        result.confident[i] = runnerUp < 0 || cost[i][runnerUp] - cost[i][s] >= AMBIGUITY_MARGIN;
+
+        // With one pill per servo every servo dropped regardless of which impact is whose;
+        // otherwise a close call leaves it open which servo missed or doubled
+        if (!result.confident[i] && !countsMatch) {
+            result.verdicts[s] = DropVerdict::AMBIGUOUS;
+            if (result.verdicts[runnerUp] == DropVerdict::MISSING) result.verdicts[runnerUp] = DropVerdict::AMBIGUOUS;
+        }
+    }
+    return result;
+}
+
+const char* DropAttributor::verdictName(DropVerdict verdict) {
+    switch (verdict) {
+        case DropVerdict::DROPPED:   return "DROPPED";
+        case DropVerdict::MISSING:   return "MISSING";
+        case DropVerdict::MULTIPLE:  return "MULTIPLE";
+        case DropVerdict::AMBIGUOUS: return "AMBIGUOUS";
+        default:                     return "-";
+    }
+}
@@ -0,0 +1,150 @@
+// src/Inventory.cpp
+#include "Inventory.h"
+#include "Displayer.h"
+#include <Preferences.h>
+
+static constexpr const char* INVENTORY_NAMESPACE = "inventory";
+static constexpr const char* COUNTS_KEY = "counts";
+static constexpr int MAX_PILLS = 10000;
+
+Inventory& Inventory::getInstance() {
+    static Inventory instance;
+    return instance;
+}
+
+Inventory::Inventory() : dirty(false), mux(portMUX_INITIALIZER_UNLOCKED), flushTask(nullptr) {
+    for (int i = 0; i < Config::NUM_SERVOS; i++) {
+        counts[i] = UNTRACKED;
+    }
+}
+
+void Inventory::initialize() {
+    load();
+    xTaskCreate(flushTaskWrapper, "Inventory", 3072, this, 1, &flushTask);
+    Displayer::getInstance().logMessage("[INV] " + getReport());
+}
+
+void Inventory::load() {
+    Preferences prefs;
+    prefs.begin(INVENTORY_NAMESPACE, true);
+    if (prefs.getBytesLength(COUNTS_KEY) == sizeof(counts)) {
+        prefs.getBytes(COUNTS_KEY, counts, sizeof(counts));
+    }
+    prefs.end();
+}
+
+void Inventory::refill(int servoIndex, int count) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return;
+    
+    portENTER_CRITICAL(&mux);
+    counts[servoIndex] = count < 0 ? UNTRACKED : std::min(count, MAX_PILLS);
+    portEXIT_CRITICAL(&mux);
+    changed(true);
+}
+
+void Inventory::add(int servoIndex, int pills) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || pills <= 0) return;
+    
+    portENTER_CRITICAL(&mux);
+    int current = counts[servoIndex] == UNTRACKED ? 0 : counts[servoIndex];
+    counts[servoIndex] = std::min(current + pills, MAX_PILLS);
+    portEXIT_CRITICAL(&mux);
+    changed(true);
+}
+
+void Inventory::consume(int servoIndex, int pills) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || pills <= 0) return;
+    
+    portENTER_CRITICAL(&mux);
+    int before = counts[servoIndex];
+    if (before != UNTRACKED) {
+        counts[servoIndex] = std::max(before - pills, 0);
+    }
+    portEXIT_CRITICAL(&mux);
+    if (before == UNTRACKED) return;
+    
+    changed(false);
+    
+    int after = std::max(before - pills, 0);
+    if (before < pills) {
+        Displayer::getInstance().logMessage("[INV] Servo " + String(servoIndex + 1) + " dispensed more than its count - refill to correct");
+    } else if (after <= Config::INVENTORY_LOW_PILLS && before > Config::INVENTORY_LOW_PILLS) {
+        Displayer::getInstance().logMessage("[INV] ⚠️  Servo " + String(servoIndex + 1) + " is running low: " + String(after) + " left");
+    }
+}
+
+void Inventory::markEmpty(int servoIndex) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return;
+    
+    portENTER_CRITICAL(&mux);
+    bool wasEmpty = counts[servoIndex] == 0;
+    counts[servoIndex] = 0;
+    portEXIT_CRITICAL(&mux);
+    if (!wasEmpty) changed(false);
+}
+
+int Inventory::getCount(int servoIndex) const {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return UNTRACKED;
+    return counts[servoIndex];
+}
+
+bool Inventory::checkPlan(const std::vector<int>& plan, String& problems) const {
+    problems = "";
+    for (int i = 0; i < Config::NUM_SERVOS && i < (int)plan.size(); i++) {
+        int count = getCount(i);
+        if (plan[i] <= 0 || count == UNTRACKED) continue;
+        
+        if (count < plan[i]) {
+            if (problems.length() > 0) problems += ", ";
+            problems += "servo " + String(i + 1) + " needs " + String(plan[i]) + " but has " + String(count);
+        } else if (count - plan[i] <= Config::INVENTORY_LOW_PILLS) {
+            // Enough for this plan, but the next one will likely come up short
+            Displayer::getInstance().logMessage("[INV] Servo " + String(i + 1) + " will be down to " + String(count - plan[i]) + 
+                                              " after this sequence");
+        }
+    }
+    return problems.length() == 0;
+}
+
+String Inventory::getReport() const {
+    String report = "Inventory:";
+    for (int i = 0; i < Config::NUM_SERVOS; i++) {
+        int count = getCount(i);
+        report += " S" + String(i + 1) + "=" + (count == UNTRACKED ? String("?") : String(count));
+    }
+    return report;
+}
+
+void Inventory::changed(bool urgent) {
+    portENTER_CRITICAL(&mux);
+    dirty = true;
+    portEXIT_CRITICAL(&mux);
+    
+    // Refills are rare and deliberate, so they are written right away; dispenses wait for the batch
+    if (urgent && flushTask) {
+        xTaskNotifyGive(flushTask);
+    }
+}
+
+void Inventory::flush() {
+    int16_t snapshot[Config::NUM_SERVOS];
+    portENTER_CRITICAL(&mux);
+    bool wasDirty = dirty;
+    dirty = false;
+    memcpy(snapshot, counts, sizeof(snapshot));
+    portEXIT_CRITICAL(&mux);
+    if (!wasDirty) return;
+    
+    Preferences prefs;
+    prefs.begin(INVENTORY_NAMESPACE, false);
+    prefs.putBytes(COUNTS_KEY, snapshot, sizeof(snapshot));
+    prefs.end();
+}
+
+void Inventory::flushTaskWrapper(void* parameter) {
+    Inventory* inventory = static_cast<Inventory*>(parameter);
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(Config::INVENTORY_FLUSH_MS));
+        inventory->flush();
+    }
+}
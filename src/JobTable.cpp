@@ -0,0 +1,329 @@
+// src/JobTable.cpp
+#include "JobTable.h"
+#include "Displayer.h"
+#include "CommandParser.h"
+#include "WireProtocol.h"
+#include "CommandJournal.h"
+#include <algorithm>
+
+// Commands that run long enough to be worth tracking
+static constexpr std::string_view JOB_VERBS[] = {"EXECUTE", "PILL", "FAST", "MULTI"};
+
+static void appendJsonString(String& json, const char* text) {
+    json += '"';
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') json += '\\';
+        json += *c;
+    }
+    json += '"';
+}
+
+JobTable& JobTable::getInstance() {
+    static JobTable instance;
+    return instance;
+}
+
+JobTable::JobTable() : nextId(1), runningId(0), mux(portMUX_INITIALIZER_UNLOCKED) {
+    memset(jobs, 0, sizeof(jobs));
+    memset(batches, 0, sizeof(batches));
+}
+
+bool JobTable::isJobCommand(std::string_view verb) {
+    for (std::string_view jobVerb : JOB_VERBS) {
+        if (CommandParser::equalsIgnoreCase(verb, jobVerb)) return true;
+    }
+    return false;
+}
+
+const char* JobTable::stateName(JobState state) {
+    switch (state) {
+        case JobState::QUEUED:    return "queued";
+        case JobState::RUNNING:   return "running";
+        case JobState::DONE:      return "done";
+        case JobState::FAILED:    return "failed";
+        case JobState::CANCELLED: return "cancelled";
+        default:                  return "-";
+    }
+}
+
+int JobTable::indexOf(uint16_t id) const {
+    if (id == 0) return -1;
+    for (int i = 0; i < Config::JOB_TABLE_SIZE; i++) {
+        if (jobs[i].id == id) return i;
+    }
+    return -1;
+}
+
+Job* JobTable::find(uint16_t id) {
+    int index = indexOf(id);
+    return index >= 0 ? &jobs[index] : nullptr;
+}
+
+uint16_t JobTable::create(std::string_view command, uint8_t clientId, std::string_view key) {
+    portENTER_CRITICAL(&mux);
+    
+    // A free slot, else the job that finished longest ago
+    Job* slot = nullptr;
+    for (Job& job : jobs) {
+        if (job.id == 0) {
+            slot = &job;
+            break;
+        }
+        if (job.finished() && (!slot || (int32_t)(job.finishedMs - slot->finishedMs) < 0)) {
+            slot = &job;
+        }
+    }
+    
+    uint16_t id = 0;
+    if (slot) {
+        id = nextId;
+        nextId = nextId == UINT16_MAX ? 1 : nextId + 1;
+        memset(slot, 0, sizeof(Job));
+        slot->id = id;
+        slot->state = JobState::QUEUED;
+        slot->clientId = clientId;
+        slot->queuedMs = millis();
+        memcpy(slot->command, command.data(), std::min(command.size(), sizeof(slot->command) - 1));
+        memcpy(slot->key, key.data(), std::min(key.size(), sizeof(slot->key) - 1));
+    }
+    portEXIT_CRITICAL(&mux);
+    return id;
+}
+
+void JobTable::publish(uint16_t id) {
+    emit(id);
+}
+
+void JobTable::discard(uint16_t id) {
+    portENTER_CRITICAL(&mux);
+    Job* job = find(id);
+    if (job) job->id = 0;
+    portEXIT_CRITICAL(&mux);
+}
+
+void JobTable::cancel(uint16_t id) {
+    JobBatch completed;
+    bool batchDone = false;
+    portENTER_CRITICAL(&mux);
+    Job* job = find(id);
+    bool changed = job && !job->finished();
+    if (changed) {
+        job->state = JobState::CANCELLED;
+        job->finishedMs = millis();
+        batchDone = settle(*job, completed);
+    }
+    portEXIT_CRITICAL(&mux);
+    if (changed) {
+        emit(id);
+        journal(id);
+    }
+    if (batchDone) respond(completed);
+}
+
+bool JobTable::openBatch(std::string_view requestId, uint8_t clientId, const uint16_t* jobIds, int count) {
+    if (requestId.empty() || requestId.size() > Config::BATCH_ID_LENGTH || count <= 0 || count > Config::BATCH_MAX_COMMANDS) {
+        return false;
+    }
+    
+    portENTER_CRITICAL(&mux);
+    JobBatch* slot = nullptr;
+    for (JobBatch& batch : batches) {
+        if (batch.requestId[0] == '\0') {
+            slot = &batch;
+            break;
+        }
+    }
+    if (slot) {
+        memset(slot, 0, sizeof(JobBatch));
+        memcpy(slot->requestId, requestId.data(), requestId.size());
+        slot->clientId = clientId;
+        slot->count = (uint8_t)count;
+        memcpy(slot->jobIds, jobIds, count * sizeof(uint16_t));
+    }
+    portEXIT_CRITICAL(&mux);
+    return slot != nullptr;
+}
+
+bool JobTable::settle(const Job& job, JobBatch& completed) {
+    for (JobBatch& batch : batches) {
+        if (batch.requestId[0] == '\0') continue;
+        for (int i = 0; i < batch.count; i++) {
+            if (batch.jobIds[i] != job.id) continue;
+            
+            batch.states[i] = job.state;
+            memcpy(batch.results[i], job.result, sizeof(job.result));
+            if (++batch.settled < batch.count) return false;
+            
+            // Last one in: hand the batch out and free its slot
+            completed = batch;
+            batch.requestId[0] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobTable::respond(const JobBatch& batch) {
+    int counts[3] = {0, 0, 0};                     // done, failed, cancelled
+    String results;
+    for (int i = 0; i < batch.count; i++) {
+        JobState state = batch.states[i];
+        counts[state == JobState::DONE ? 0 : (state == JobState::FAILED ? 1 : 2)]++;
+        
+        if (i > 0) results += ",";
+        results += "{\"job\":" + String(batch.jobIds[i]) + ",\"state\":\"" + stateName(state) + "\"";
+        if (batch.results[i][0]) {
+            results += ",\"result\":";
+            appendJsonString(results, batch.results[i]);
+        }
+        results += "}";
+    }
+    
+    String json = "[BATCH] {\"id\":\"" + String(batch.requestId) + "\",\"status\":\"complete\"";
+    json += ",\"done\":" + String(counts[0]) + ",\"failed\":" + String(counts[1]) + ",\"cancelled\":" + String(counts[2]);
+    json += ",\"results\":[" + results + "]}";
+    Displayer::getInstance().reply(batch.clientId, json);
+}
+
+void JobTable::start(uint16_t id) {
+    portENTER_CRITICAL(&mux);
+    Job* job = find(id);
+    if (job) {
+        job->state = JobState::RUNNING;
+        job->startedMs = millis();
+    }
+    runningId = job ? id : 0;
+    portEXIT_CRITICAL(&mux);
+    if (job) {
+        emit(id);
+        journal(id);
+    }
+}
+
+void JobTable::progress(uint16_t done, uint16_t total) {
+    portENTER_CRITICAL(&mux);
+    Job* job = find(runningId);
+    if (job) {
+        job->done = done;
+        job->total = total;
+    }
+    uint16_t id = job ? runningId : 0;
+    portEXIT_CRITICAL(&mux);
+    if (id) emit(id);
+}
+
+void JobTable::fail(const char* reason) {
+    portENTER_CRITICAL(&mux);
+    Job* job = find(runningId);
+    if (job) {
+        strncpy(job->result, reason, sizeof(job->result) - 1);
+        job->result[sizeof(job->result) - 1] = '\0';
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+void JobTable::finish(bool cancelled) {
+    JobBatch completed;
+    bool batchDone = false;
+    portENTER_CRITICAL(&mux);
+    Job* job = find(runningId);
+    uint16_t id = runningId;
+    if (job) {
+        job->state = cancelled ? JobState::CANCELLED : (job->result[0] ? JobState::FAILED : JobState::DONE);
+        job->finishedMs = millis();
+        batchDone = settle(*job, completed);
+    }
+    runningId = 0;
+    portEXIT_CRITICAL(&mux);
+    if (job) {
+        emit(id);
+        journal(id);
+    }
+    if (batchDone) respond(completed);
+}
+
+bool JobTable::get(uint16_t id, Job& out) const {
+    portENTER_CRITICAL(&mux);
+    int index = indexOf(id);
+    if (index >= 0) out = jobs[index];
+    portEXIT_CRITICAL(&mux);
+    return index >= 0;
+}
+
+void JobTable::emit(uint16_t id) {
+    Job job;
+    if (!get(id, job)) return;
+    
+    uint32_t endMs = job.finished() ? job.finishedMs : millis();
+    String json = "[JOB] {\"id\":" + String(job.id) + ",\"state\":\"" + stateName(job.state) + "\",\"command\":";
+    appendJsonString(json, job.command);
+    json += ",\"client\":" + String(job.clientId);
+    if (job.key[0]) {
+        json += ",\"key\":\"" + String(job.key) + "\"";
+    }
+    if (job.total > 0) {
+        json += ",\"done\":" + String(job.done) + ",\"total\":" + String(job.total);
+    }
+    if (job.state != JobState::QUEUED) {
+        json += ",\"ms\":" + String(job.startedMs ? endMs - job.startedMs : 0);
+    }
+    if (job.result[0]) {
+        json += ",\"result\":";
+        appendJsonString(json, job.result);
+    }
+    json += "}";
+    
+    // The same fields for binary clients
+    uint8_t frame[WireProtocol::HEADER_SIZE + 9 * WireProtocol::FIELD_HEADER_SIZE + 16 + sizeof(job.command) + sizeof(job.result) + sizeof(job.key)];
+    WireProtocol::Writer writer(frame, sizeof(frame), WireProtocol::Type::JOB);
+    writer.putU16(WireProtocol::Tag::JOB, job.id);
+    writer.putU8(WireProtocol::Tag::STATE, (uint8_t)job.state);
+    writer.putU8(WireProtocol::Tag::CLIENT, job.clientId);
+    writer.putText(WireProtocol::Tag::TEXT, job.command);
+    if (job.key[0]) {
+        writer.putText(WireProtocol::Tag::KEY, job.key);
+    }
+    if (job.total > 0) {
+        writer.putU16(WireProtocol::Tag::DONE, job.done);
+        writer.putU16(WireProtocol::Tag::TOTAL, job.total);
+    }
+    if (job.state != JobState::QUEUED) {
+        writer.putU32(WireProtocol::Tag::MS, job.startedMs ? endMs - job.startedMs : 0);
+    }
+    if (job.result[0]) {
+        writer.putText(WireProtocol::Tag::RESULT, job.result);
+    }
+    Displayer::getInstance().logEvent(json, writer.data(), writer.size());
+}
+
+void JobTable::journal(uint16_t id) {
+    // Only state changes, not progress, so NVS sees a handful of writes per command
+    Job job;
+    if (!get(id, job) || !job.key[0]) return;
+    CommandJournal::getInstance().update(job.key, job.state, job.result);
+}
+
+String JobTable::getReport() const {
+    Job snapshot[Config::JOB_TABLE_SIZE];
+    portENTER_CRITICAL(&mux);
+    memcpy(snapshot, jobs, sizeof(snapshot));
+    portEXIT_CRITICAL(&mux);
+    
+    // Oldest first
+    uint8_t order[Config::JOB_TABLE_SIZE];
+    for (int i = 0; i < Config::JOB_TABLE_SIZE; i++) order[i] = i;
+    std::sort(order, order + Config::JOB_TABLE_SIZE, [&](uint8_t a, uint8_t b) { return snapshot[a].queuedMs < snapshot[b].queuedMs; });
+    
+    String report = "Jobs:";
+    bool any = false;
+    for (uint8_t index : order) {
+        const Job& job = snapshot[index];
+        if (job.id == 0) continue;
+        report += "\n  #" + String(job.id) + " " + String(job.command) + ": " + stateName(job.state);
+        if (job.total > 0) report += " " + String(job.done) + "/" + String(job.total);
+        if (job.result[0]) report += " (" + String(job.result) + ")";
+        any = true;
+    }
+    if (!any) report += " none";
+    return report;
+}
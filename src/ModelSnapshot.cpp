@@ -0,0 +1,262 @@
+// src/ModelSnapshot.cpp
+#include "ModelSnapshot.h"
+#include "ModelLock.h"
+#include "PatternAnalyzer.h"
+
+String ModelSnapshot::sectionPath(int servoIndex, uint8_t kind) {
+    String base = "/servo" + String(servoIndex);
+    switch (kind) {
+        case SECTION_HISTORY:   return base + "_history.dat";
+        case SECTION_DRIFT:     return base + "_drift.dat";
+        case SECTION_SIGNATURE: return base + "_signature.dat";
+        default:                return base + "_progress.dat";
+    }
+}
+
+size_t ModelSnapshot::headerSize(uint16_t version) {
+    return version >= 3 ? sizeof(SnapshotHeader) : offsetof(SnapshotHeader, checksum);
+}
+
+uint32_t ModelSnapshot::maxSectionLength(uint8_t kind) {
+    switch (kind) {
+        case SECTION_HISTORY:   return PatternAnalyzer::HISTORY_BYTES;
+        case SECTION_DRIFT:     return PatternAnalyzer::DRIFT_BYTES;
+        case SECTION_SIGNATURE: return PatternAnalyzer::SIGNATURE_BYTES;
+        default:                return PatternAnalyzer::MAX_PROGRESS_BYTES;
+    }
+}
+
+uint32_t ModelSnapshot::crc32(uint32_t crc, const uint8_t* data, size_t length) {
+    // Reflected CRC-32 (as zlib), chained across calls starting from 0
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+bool ModelSnapshot::isExported(uint8_t kind, bool includeHistory) {
+    // History and drift are optional; the signature is part of the model like the progress file
+    return includeHistory || kind == SECTION_PROGRESS || kind == SECTION_SIGNATURE;
+}
+
+ModelSnapshot::SnapshotHeader ModelSnapshot::makeHeader(bool includeHistory) {
+    SnapshotHeader header = {};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.numServos = Config::NUM_SERVOS;
+    header.numPiezos = Config::NUM_PIEZOS;
+    header.sizeofSizeT = sizeof(size_t);
+    header.sizeofULong = sizeof(unsigned long);
+    header.includesHistory = includeHistory ? 1 : 0;
+    
+    for (int servo = 0; servo < Config::NUM_SERVOS; servo++) {
+        for (uint8_t kind = SECTION_PROGRESS; kind <= SECTION_LAST; kind++) {
+            if (!isExported(kind, includeHistory)) continue;
+            if (SPIFFS.exists(sectionPath(servo, kind))) header.sectionCount++;
+        }
+    }
+    return header;
+}
+
+bool ModelSnapshot::exportToFile(bool includeHistory) {
+    File out = SPIFFS.open(EXPORT_PATH, "w");
+    if (!out) return false;
+    
+    bool written = true;
+    bool ok;
+    uint32_t checksum = 0;
+    {
+        ModelLock lock;
+        ok = exportTo([&out, &written](const uint8_t* data, size_t length) {
+            written = written && out.write(data, length) == length;
+        }, includeHistory, checksum);
+    }
+    
+    // The checksum is only known once every section is out; patch it into the header
+    if (ok && written) {
+        written = out.seek(offsetof(SnapshotHeader, checksum)) &&
+                  out.write((const uint8_t*)&checksum, sizeof(checksum)) == sizeof(checksum);
+    }
+    out.close();
+    
+    if (!ok || !written) {
+        SPIFFS.remove(EXPORT_PATH);
+        return false;
+    }
+    return true;
+}
+
+bool ModelSnapshot::exportTo(const Sink& sink, bool includeHistory, uint32_t& checksum) {
+    SnapshotHeader header = makeHeader(includeHistory);
+    sink((const uint8_t*)&header, sizeof(header));
+    checksum = 0;
+    
+    uint8_t buffer[CHUNK_SIZE];
+    for (int servo = 0; servo < Config::NUM_SERVOS; servo++) {
+        for (uint8_t kind = SECTION_PROGRESS; kind <= SECTION_LAST; kind++) {
+            if (!isExported(kind, includeHistory)) continue;
+            File file = SPIFFS.open(sectionPath(servo, kind), "r");
+            if (!file) continue;
+            
+            SectionHeader section = {};
+            section.servo = servo;
+            section.kind = kind;
+            section.length = file.size();
+            sink((const uint8_t*)&section, sizeof(section));
+            checksum = crc32(checksum, (const uint8_t*)&section, sizeof(section));
+            
+            size_t remaining = section.length;
+            while (remaining > 0) {
+                size_t n = file.read(buffer, std::min(remaining, CHUNK_SIZE));
+                if (n == 0) {
+                    file.close();
+                    return false;
+                }
+                sink(buffer, n);
+                checksum = crc32(checksum, buffer, n);
+                remaining -= n;
+            }
+            file.close();
+        }
+    }
+    return true;
+}
+
+bool ModelSnapshot::validateHeader(const SnapshotHeader& header, String& error) {
+    if (header.magic != MAGIC) {
+        error = "not a model snapshot";
+        return false;
+    }
+    if (header.version < 1 || header.version > VERSION) {
+        error = "unsupported snapshot version " + String(header.version) + " (expected " + String(VERSION) + ")";
+        return false;
+    }
+    if (header.numServos != Config::NUM_SERVOS || header.numPiezos != Config::NUM_PIEZOS) {
+        error = "schema mismatch: snapshot has " + String(header.numServos) + " servos/" + String(header.numPiezos) + 
+                " piezos, this unit has " + String(Config::NUM_SERVOS) + "/" + String(Config::NUM_PIEZOS);
+        return false;
+    }
+    if (header.sizeofSizeT != sizeof(size_t) || header.sizeofULong != sizeof(unsigned long)) {
+        error = "snapshot was written by an incompatible firmware build";
+        return false;
+    }
+    return true;
+}
+
+bool ModelSnapshot::copyBytes(File& from, File& to, uint32_t length) {
+    uint8_t buffer[CHUNK_SIZE];
+    while (length > 0) {
+        size_t n = from.read(buffer, std::min((size_t)length, CHUNK_SIZE));
+        if (n == 0 || to.write(buffer, n) != n) return false;
+        length -= n;
+    }
+    return true;
+}
+
+bool ModelSnapshot::applyImport(String& error) {
+    File file = SPIFFS.open(IMPORT_PATH, "r");
+    if (!file) {
+        error = "no pending import";
+        return false;
+    }
+    
+    // A failed import leaves nothing behind: neither the upload nor the temp files written so far
+    bool imported[Config::NUM_SERVOS][SECTION_LAST + 1] = {};
+    auto discard = [&]() {
+        file.close();
+        for (int servo = 0; servo < Config::NUM_SERVOS; servo++) {
+            for (uint8_t kind = SECTION_PROGRESS; kind <= SECTION_LAST; kind++) {
+                if (imported[servo][kind]) SPIFFS.remove(sectionPath(servo, kind) + ".tmp");
+            }
+        }
+        SPIFFS.remove(IMPORT_PATH);
+        return false;
+    };
+    
+    // The fields up to the checksum are the same in every version
+    SnapshotHeader header = {};
+    const size_t commonSize = headerSize(1);
+    if (file.read((uint8_t*)&header, commonSize) != commonSize) {
+        error = "truncated header";
+        return discard();
+    }
+    if (!validateHeader(header, error)) return discard();
+    const size_t headerBytes = headerSize(header.version);
+    if (file.read((uint8_t*)&header + commonSize, headerBytes - commonSize) != headerBytes - commonSize) {
+        error = "truncated header";
+        return discard();
+    }
+    
+    // First pass: every section must be well-formed, no larger than the firmware itself writes
+    // (the loaders allocate from these files), and the sections must cover the file exactly
+    uint8_t buffer[CHUNK_SIZE];
+    uint32_t checksum = 0;
+    size_t offset = headerBytes;
+    for (int i = 0; i < header.sectionCount; i++) {
+        SectionHeader section;
+        if (file.read((uint8_t*)&section, sizeof(section)) != sizeof(section) ||
+            section.servo >= Config::NUM_SERVOS || section.kind < SECTION_PROGRESS || section.kind > SECTION_LAST ||
+            section.length > maxSectionLength(section.kind) || offset + sizeof(section) + section.length > file.size()) {
+            error = "corrupt section " + String(i);
+            return discard();
+        }
+        checksum = crc32(checksum, (const uint8_t*)&section, sizeof(section));
+        for (uint32_t remaining = section.length; remaining > 0; ) {
+            size_t n = file.read(buffer, std::min((size_t)remaining, CHUNK_SIZE));
+            if (n == 0) {
+                error = "truncated section " + String(i);
+                return discard();
+            }
+            checksum = crc32(checksum, buffer, n);
+            remaining -= n;
+        }
+        offset += sizeof(section) + section.length;
+    }
+    if (offset != file.size()) {
+        error = "trailing data after last section";
+        return discard();
+    }
+    if (header.version >= 3 && checksum != header.checksum) {
+        error = "checksum mismatch";
+        return discard();
+    }
+    
+    // Second pass: write each section to a temp file, then swap them all in
+    file.seek(headerBytes);
+    for (int i = 0; i < header.sectionCount; i++) {
+        SectionHeader section;
+        file.read((uint8_t*)&section, sizeof(section));
+        
+        File out = SPIFFS.open(sectionPath(section.servo, section.kind) + ".tmp", "w");
+        imported[section.servo][section.kind] = true;    // Even a partly written temp file gets removed
+        bool ok = out && copyBytes(file, out, section.length);
+        if (out) out.close();
+        if (!ok) {
+            error = "flash write failed";
+            return discard();
+        }
+    }
+    file.close();
+    SPIFFS.remove(IMPORT_PATH);
+    
+    for (int servo = 0; servo < Config::NUM_SERVOS; servo++) {
+        if (!imported[servo][SECTION_PROGRESS]) {
+            // Servo not in snapshot - leave it untouched and drop any orphaned sections
+            for (uint8_t kind = SECTION_HISTORY; kind <= SECTION_LAST; kind++) {
+                if (imported[servo][kind]) SPIFFS.remove(sectionPath(servo, kind) + ".tmp");
+            }
+            continue;
+        }
+        
+        for (uint8_t kind = SECTION_PROGRESS; kind <= SECTION_LAST; kind++) {
+            String path = sectionPath(servo, kind);
+            if (SPIFFS.exists(path)) SPIFFS.remove(path);  // History/drift/signature of the old model are stale either way
+            if (imported[servo][kind]) SPIFFS.rename(path + ".tmp", path);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+// src/MotionPlanner.cpp
+#include "MotionPlanner.h"
+#include <cmath>
+
+namespace {
+    constexpr float ARRIVAL_DISTANCE = 0.5f;    // deg; closer than this at crawl speed snaps onto the target
+
+    // Distance covered while braking the way step() brakes: the acceleration drops by
+    // jerkStep per frame down to -maxAccel, and each frame moves at its new speed
+    float brakingDistance(float speed, float accel, float maxAccel, float jerkStep, float dt) {
+        float distance = 0.0f;
+        while (speed > 0.0f && accel > -maxAccel) {
+            accel = fmaxf(accel - jerkStep, -maxAccel);
+            speed += accel * dt;
+            if (speed > 0.0f) distance += speed * dt;
+        }
+        if (speed <= 0.0f) return distance;
+        
+        // Constant deceleration: the frames that still move are speed - i * delta for i = 1 .. frames
+        float delta = maxAccel * dt;
+        float frames = fmaxf(ceilf(speed / delta) - 1.0f, 0.0f);
+        return distance + (frames * speed - delta * frames * (frames + 1.0f) * 0.5f) * dt;
+    }
+
+    // Top speed reached while a positive acceleration ramps down at the jerk limit
+    float peakSpeed(float speed, float accel, float jerkStep, float dt) {
+        for (accel -= jerkStep; accel > 0.0f; accel -= jerkStep) speed += accel * dt;
+        return speed;
+    }
+}
+
+bool MotionPlanner::step(const MotionProfile& profile, MotionState& state, float target, float dt) {
+    // Work along the direction of the target
+    float remaining = target - state.position;
+    float direction = remaining >= 0.0f ? 1.0f : -1.0f;
+    float distance = fabsf(remaining);
+    float speed = direction * state.velocity;
+    float accel = direction * state.acceleration;
+    
+    const float maxAccel = profile.acceleration;
+    const float jerkStep = profile.jerk > 0.0f ? profile.jerk * dt : INFINITY;
+    
+    auto safe = [&](float next) {
+        float nextSpeed = speed + next * dt;
+        return brakingDistance(nextSpeed, next, maxAccel, jerkStep, dt) <= distance - nextSpeed * dt + 1e-4f &&
+               peakSpeed(nextSpeed, next, jerkStep, dt) <= profile.maxVelocity + 1e-3f;
+    };
+    
+    // Head for cruise speed within the jerk limit; if that leaves no room to stop, take the highest
+    // safe acceleration above braking as hard as the jerk allows, which is always safe once the move is
+    float lowest = fmaxf(accel - jerkStep, -maxAccel);
+    float next = fmaxf(lowest, fminf((profile.maxVelocity - speed) / dt, fminf(accel + jerkStep, maxAccel)));
+    if (!safe(next)) {
+        float high = next;
+        next = lowest;
+        for (int i = 0; i < 8; i++) {
+            float mid = 0.5f * (next + high);
+            if (safe(mid)) next = mid;
+            else high = mid;
+        }
+    }
+    
+    speed = fmaxf(-profile.maxVelocity, fminf(speed + next * dt, profile.maxVelocity));
+    distance -= speed * dt;
+    
+    // Arrived, or crossed the target after a move was redirected behind the servo
+    if (distance <= 0.0f || (distance < ARRIVAL_DISTANCE && fabsf(speed) <= maxAccel * dt)) {
+        state = {target, 0.0f, 0.0f};
+        return true;
+    }
+    state = {target - direction * distance, direction * speed, direction * next};
+    return false;
+}
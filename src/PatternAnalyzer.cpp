@@ -1,19 +1,76 @@
 // src/PatternAnalyzer.cpp
 #include "PatternAnalyzer.h"
+#include "ModelLock.h"
 #include "Config.h"
 #include <algorithm>
 #include <numeric>
 #include <cmath>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
-// Initialize static threshold variables
-float PatternAnalyzer::DEVIATION_THRESHOLD = 0.75f;     // Default average threshold
-float PatternAnalyzer::MIN_CHANNEL_THRESHOLD = 0.6f;    // Default individual channel threshold
+// Drift monitor tuning (classic SPC defaults)
+static constexpr uint32_t DRIFT_BASELINE_SAMPLES = 10;  // Dispenses used to learn the in-control baseline
+static constexpr float DRIFT_EWMA_LAMBDA = 0.2f;
+static constexpr float DRIFT_EWMA_L = 3.0f;             // Control limit width in sigmas
+static constexpr float DRIFT_CUSUM_K = 0.5f;            // Slack, in sigmas
+static constexpr float DRIFT_CUSUM_H = 5.0f;            // Decision interval, in sigmas
+static constexpr float DRIFT_MIN_SIGMA = 0.01f;         // Keeps a very consistent baseline from alarming on noise
+static constexpr uint32_t DRIFT_SAVE_INTERVAL = 8;
+static constexpr uint32_t SIGNATURE_SAVE_INTERVAL = 8;
 
-PatternAnalyzer::PatternAnalyzer() {
+// Adds the lifetime of a save to the analyzer's persistence time
+struct PersistTimer {
+    volatile uint32_t& total;
+    uint32_t start;
+    explicit PersistTimer(volatile uint32_t& total) : total(total), start(micros()) {}
+    ~PersistTimer() { total += micros() - start; }
+};
+
+void DriftChart::update(float x) {
+    samples++;
+    if (samples <= DRIFT_BASELINE_SAMPLES) {
+        float delta = x - mean;
+        mean += delta / samples;
+        m2 += delta * (x - mean);
+        ewma = mean;
+        return;
+    }
+    
+    ewma = DRIFT_EWMA_LAMBDA * x + (1.0f - DRIFT_EWMA_LAMBDA) * ewma;
+    cusum = std::max(0.0f, cusum + (mean - x) / sigma() - DRIFT_CUSUM_K);
+}
+
+bool DriftChart::ready() const {
+    return samples > DRIFT_BASELINE_SAMPLES;
+}
+
+float DriftChart::sigma() const {
+    float variance = samples > 1 ? m2 / (std::min(samples, DRIFT_BASELINE_SAMPLES) - 1) : 0.0f;
+    return std::max(DRIFT_MIN_SIGMA, sqrtf(variance));
+}
+
+bool DriftChart::ewmaLow() const {
+    float limit = mean - DRIFT_EWMA_L * sigma() * sqrtf(DRIFT_EWMA_LAMBDA / (2.0f - DRIFT_EWMA_LAMBDA));
+    return ready() && ewma < limit;
+}
+
+bool DriftChart::cusumLow() const {
+    return ready() && cusum > DRIFT_CUSUM_H;
+}
+
+PatternAnalyzer::PatternAnalyzer()
+    : calibrationServo(-1),
+      calibrationCancel(false),
+      calibrationSnapshotCount(0),
+      persistMicros(0)
+{
     for (int i = 0; i < Config::NUM_SERVOS; i++) {
-        recordings[i].reserve(MAX_RECORDINGS);
+        recordings[i].reserve(params[i].learningSize);
         hasReference[i] = false;
         failedDispenses[i] = 0;
+        historyHead[i] = 0;
+        historyCount[i] = 0;
+        lastCalibration[i] = CalibrationResult();
         
         // Initialize reference pattern with correct number of channels
         referencePattern[i].channelEnvelopes.resize(Config::NUM_PIEZOS);
@@ -101,14 +158,18 @@ bool PatternAnalyzer::analyzeDispensing(
                                         int servoIndex, 
                                         const std::vector<std::vector<int>>& channelData, 
                                        String triggerChannel) {
-    if (servoIndex >= Config::NUM_SERVOS || channelData.size() != Config::NUM_PIEZOS) return false;
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || channelData.size() != Config::NUM_PIEZOS) return false;
+    
+    const AnalysisParams& servoParams = params[servoIndex];
+    const int learningSize = servoParams.learningSize;
     
     // Create envelopes for all channels
     DispensingRecord record;
     record.channelEnvelopes.resize(Config::NUM_PIEZOS);
     
     for (int i = 0; i < Config::NUM_PIEZOS; i++) {
-        record.channelEnvelopes[i] = createEnvelope(channelData[i]);
+        record.channelEnvelopes[i] = createEnvelope(channelData[i], servoParams.envelopePoints);
         record.channelEnvelopes[i].triggerChannel = triggerChannel;
     }
     
@@ -117,8 +178,8 @@ bool PatternAnalyzer::analyzeDispensing(
     
     auto& servoRecordings = recordings[servoIndex];
     
-    // LEARNING PHASE: Collect first 8 dispenses
-    if (servoRecordings.size() < MAX_RECORDINGS - 1) {
+    // LEARNING PHASE: Collect the first learningSize - 1 dispenses
+    if ((int)servoRecordings.size() < learningSize - 1) {
         servoRecordings.push_back(record);
         
         // Save progress immediately after each recording
@@ -126,18 +187,18 @@ bool PatternAnalyzer::analyzeDispensing(
         
         if (logCallback) {
             logCallback("[PATTERN] Learning phase: " + String(servoRecordings.size()) + 
-                       "/" + String(MAX_RECORDINGS) + " recordings collected (trigger: " + triggerChannel + ")");
+                       "/" + String(learningSize) + " recordings collected (trigger: " + triggerChannel + ")");
         }
         return true; // Always return "normal" during learning
     }
     
-    // BUILD MODEL: On 9th recording, build reference pattern and analyze it
-    if (servoRecordings.size() == MAX_RECORDINGS - 1 && !hasReference[servoIndex]) {
-        servoRecordings.push_back(record); // Add the 9th recording
+    // BUILD MODEL: On the last learning recording, build reference pattern and analyze it
+    if ((int)servoRecordings.size() == learningSize - 1 && !hasReference[servoIndex]) {
+        servoRecordings.push_back(record); // Add the final learning recording
         
         if (logCallback) {
             logCallback("[PATTERN] Learning complete! Building reference model from " + 
-                       String(MAX_RECORDINGS) + " recordings...");
+                       String(learningSize) + " recordings...");
         }
         
         buildReferenceFromMajority(servoIndex);
@@ -145,78 +206,79 @@ bool PatternAnalyzer::analyzeDispensing(
         // Save complete model immediately
         saveServoProgress(servoIndex);
         
-        // Now analyze the 9th recording against the newly built model
+        // Now analyze the final learning recording against the newly built model
         // Fall through to analysis phase below
     }
     
-    // ANALYSIS PHASE: Compare against model (dispense 11+)
+    // ANALYSIS PHASE: Compare against model
     if (hasReference[servoIndex]) {
+        // Numeric results only - the explanation is formatted on demand by explainVerdict()
+        DispenseVerdict& verdict = lastVerdict[servoIndex];
+        verdict.analyzed = true;
+        verdict.allChannelsGood = true;
+        verdict.bestChannelSim = 0.0f;
+        verdict.worstChannelSim = 1.0f;
+        verdict.bestChannel = 0;
+        verdict.worstChannel = 0;
+        verdict.divergenceDelta = 0.0f;
+        verdict.divergenceChannel = 0;
+        verdict.divergenceIndex = 0;
+        verdict.averageThreshold = servoParams.deviationThreshold;
+        verdict.channelThreshold = servoParams.minChannelThreshold;
+        verdict.mode = servoParams.similarityMode;
         float totalSimilarity = 0.0f;
-        bool allChannelsGood = true;
-        float lowestChannelSim = 1.0f;
-        String problematicChannel = "";
         
-        // Calculate similarity for all channels
+        // Calculate similarity for all channels once
         for (int i = 0; i < Config::NUM_PIEZOS; i++) {
-            float channelSim = calculateSimilarity(record.channelEnvelopes[i], 
-                                                 referencePattern[servoIndex].channelEnvelopes[i]);
+            const SignalEnvelope& current = record.channelEnvelopes[i];
+            const SignalEnvelope& reference = referencePattern[servoIndex].channelEnvelopes[i];
+            float channelSim = calculateSimilarity(current, reference);
+            verdict.channelSims[i] = channelSim;
             totalSimilarity += channelSim;
             
             // Check individual channel threshold
-            if (channelSim < MIN_CHANNEL_THRESHOLD) {
-                allChannelsGood = false;
-                if (channelSim < lowestChannelSim) {
-                    lowestChannelSim = channelSim;
-                    problematicChannel = String(Config::PIEZO_NAMES[i]);
+            if (channelSim < servoParams.minChannelThreshold) {
+                verdict.allChannelsGood = false;
+            }
+            if (channelSim > verdict.bestChannelSim) {
+                verdict.bestChannelSim = channelSim;
+                verdict.bestChannel = i;
+            }
+            if (channelSim < verdict.worstChannelSim) {
+                verdict.worstChannelSim = channelSim;
+                verdict.worstChannel = i;
+            }
+            
+            // Locate where the normalized envelopes diverge most
+            float maxCur = current.maxValue > 0 ? current.maxValue : 1.0f;
+            float maxRef = reference.maxValue > 0 ? reference.maxValue : 1.0f;
+            size_t points = std::min(current.envelope.size(), reference.envelope.size());
+            for (size_t p = 0; p < points; p++) {
+                float delta = fabsf(current.envelope[p] / maxCur - reference.envelope[p] / maxRef);
+                if (delta > verdict.divergenceDelta) {
+                    verdict.divergenceDelta = delta;
+                    verdict.divergenceChannel = i;
+                    verdict.divergenceIndex = p;
                 }
             }
         }
         
-        float avgSimilarity = totalSimilarity / Config::NUM_PIEZOS;
-        bool avgGood = avgSimilarity >= DEVIATION_THRESHOLD;
+        verdict.avgSimilarity = totalSimilarity / Config::NUM_PIEZOS;
+        recordScore(servoIndex, verdict.avgSimilarity, verdict.bestChannelSim, verdict.worstChannelSim);
+        verdict.avgGood = verdict.avgSimilarity >= servoParams.deviationThreshold;
         
-        // BEST-OF-BOTH APPROACH: Accept if either the average is good OR any single channel is excellent
+        // BEST-OF-BOTH: accept if either the average is good OR any single channel is excellent.
         // This handles cases where pill drops to one side and primarily hits one sensor
-        float maxChannelSim = 0.0f;
-        String bestChannel = "";
-        for (int i = 0; i < Config::NUM_PIEZOS; i++) {
-            float channelSim = calculateSimilarity(record.channelEnvelopes[i], 
-                                                 referencePattern[servoIndex].channelEnvelopes[i]);
-            if (channelSim > maxChannelSim) {
-                maxChannelSim = channelSim;
-                bestChannel = String(Config::PIEZO_NAMES[i]);
-            }
+        verdict.bestChannelExcellent = verdict.bestChannelSim >= servoParams.deviationThreshold;
+        switch (servoParams.similarityMode) {
+            case SimilarityMode::AVERAGE_ONLY: verdict.isNormal = verdict.avgGood; break;
+            case SimilarityMode::STRICT:       verdict.isNormal = verdict.avgGood && verdict.allChannelsGood; break;
+            default:                           verdict.isNormal = verdict.avgGood || verdict.bestChannelExcellent; break;
         }
+        bool isNormal = verdict.isNormal;
         
-        bool bestChannelExcellent = maxChannelSim >= DEVIATION_THRESHOLD;
-        bool isNormal = avgGood || bestChannelExcellent;  // Accept if EITHER condition is met
-        
-        if (logCallback) {
-            String simDetails = "Similarities: ";
-            for (int i = 0; i < Config::NUM_PIEZOS; i++) {
-                if (i > 0) simDetails += ", ";
-                float channelSim = calculateSimilarity(record.channelEnvelopes[i], 
-                                                     referencePattern[servoIndex].channelEnvelopes[i]);
-                simDetails += String(Config::PIEZO_NAMES[i]) + ": " + String(channelSim, 3);
-            }
-            
-            String reasonStr = "";
-            if (!avgGood && !bestChannelExcellent) {
-                reasonStr += "Both average (" + String(avgSimilarity, 3) + " < " + String(DEVIATION_THRESHOLD, 2) + 
-                           ") and best channel " + bestChannel + " (" + String(maxChannelSim, 3) + " < " + String(DEVIATION_THRESHOLD, 2) + ") below threshold";
-            }
-            
-            logCallback("[PATTERN] Avg similarity: " + String(avgSimilarity, 3) + 
-                       ", Best: " + bestChannel + " " + String(maxChannelSim, 3) + 
-                       " (" + simDetails + ") - " + (isNormal ? "NORMAL" : "ABNORMAL"));
-            
-            if (isNormal && !avgGood && bestChannelExcellent) {
-                logCallback("[PATTERN] Accepted via best-of-both: " + bestChannel + " sensor shows good similarity");
-            }
-            
-            if (!isNormal) {
-                logCallback("[PATTERN] Rejection reason: " + reasonStr);
-            }
+        if (!isNormal && logCallback) {
+            logCallback(explainVerdict(servoIndex));
         }
         
         if (!isNormal) {
@@ -235,8 +297,10 @@ bool PatternAnalyzer::analyzeDispensing(
 }
 
 bool PatternAnalyzer::buildReferenceFromMajority(int servoIndex) {
+    ModelLock lock;
     auto& servoRecordings = recordings[servoIndex];
-    if (servoRecordings.size() < MAX_RECORDINGS) return false;
+    const int learningSize = params[servoIndex].learningSize;
+    if ((int)servoRecordings.size() < learningSize) return false;
     
     // Calculate similarity matrix
     std::vector<std::vector<float>> similarityMatrix(servoRecordings.size());
@@ -295,8 +359,8 @@ bool PatternAnalyzer::buildReferenceFromMajority(int servoIndex) {
     }
     
     // Need at least majority of the recordings to be similar to build reliable reference
-    int minSimilarRecordings = (MAX_RECORDINGS + 1) / 2; // 5 out of 9 (true majority)
-    if (bestGroup.size() < minSimilarRecordings) {
+    int minSimilarRecordings = (learningSize + 1) / 2; // e.g. 5 out of 9 (true majority)
+    if ((int)bestGroup.size() < minSimilarRecordings) {
         if (logCallback) {
             logCallback("[PATTERN] Not enough similar recordings to build reference (found " + 
                        String(bestGroup.size()) + ", need " + String(minSimilarRecordings) + "+)");
@@ -333,6 +397,7 @@ bool PatternAnalyzer::buildReferenceFromMajority(int servoIndex) {
     }
     
     hasReference[servoIndex] = true;
+    driftMonitors[servoIndex] = DriftMonitor(); // New model, new baseline
     
     if (logCallback) {
         logCallback("[PATTERN] Built reference pattern for servo " + String(servoIndex + 1) + 
@@ -349,10 +414,12 @@ int PatternAnalyzer::getFailedCount(int servoIndex) const {
 }
 
 int PatternAnalyzer::getRecordingCount(int servoIndex) const {
+    ModelLock lock;
     return servoIndex < Config::NUM_SERVOS ? recordings[servoIndex].size() : 0;
 }
 
 float PatternAnalyzer::getReferenceQuality(int servoIndex) const {
+    ModelLock lock;
     if (servoIndex >= Config::NUM_SERVOS || !hasReference[servoIndex]) return 0.0f;
     
     // Calculate average similarity of all recordings to reference across all channels
@@ -376,21 +443,55 @@ float PatternAnalyzer::getReferenceQuality(int servoIndex) const {
 }
 
 String PatternAnalyzer::getAnalysisReport(int servoIndex) const {
+    ModelLock lock;
     if (servoIndex >= Config::NUM_SERVOS) return "Invalid servo index";
     
     String report = "[ANALYSIS] Servo " + String(servoIndex + 1) + " Report:\n";
-    report += "  Recordings: " + String(getRecordingCount(servoIndex)) + "/" + String(MAX_RECORDINGS) + "\n";
+    const AnalysisParams& servoParams = params[servoIndex];
+    report += "  Recordings: " + String(getRecordingCount(servoIndex)) + "/" + String(servoParams.learningSize) + "\n";
     report += "  Failed dispenses: " + String(getFailedCount(servoIndex)) + "\n";
     report += "  Has reference: " + String(hasReference[servoIndex] ? "Yes" : "No") + "\n";
     
     if (hasReference[servoIndex]) {
         report += "  Reference quality: " + String(getReferenceQuality(servoIndex), 3) + "\n";
     }
+    report += "  Thresholds: average " + String(servoParams.deviationThreshold, 3) + 
+              ", channel " + String(servoParams.minChannelThreshold, 3) + "\n";
+    report += "  Envelope points: " + String(servoParams.envelopePoints) + 
+              ", mode: " + similarityModeName(servoParams.similarityMode) + "\n";
+    
+    const DriftMonitor& drift = driftMonitors[servoIndex];
+    report += "  Drift: " + String(driftStateName(drift.state)) + 
+              " (EWMA " + String(drift.average.ewma, 3) + 
+              ", baseline " + String(drift.average.mean, 3) + " +/- " + String(drift.average.sigma(), 3) + 
+              ", CUSUM " + String(std::max(drift.average.cusum, drift.best.cusum), 2) + ")\n";
+    
+    const DropSignature& signature = dropSignatures[servoIndex];
+    report += "  Drop signature: " + String(signature.samples) + " impacts" + (signature.ready() ? "" : " (learning)");
+    for (int c = 0; c < Config::NUM_PIEZOS && signature.samples > 0; c++) {
+        report += String(c == 0 ? " - " : ", ") + Config::PIEZO_NAMES[c] + " share " + String(signature.shareMean[c], 2) + 
+                  " lag " + String(signature.lagMean[c], 1);
+    }
+    report += "\n";
+    
+    const CalibrationResult& calibration = lastCalibration[servoIndex];
+    if (calibration.valid) {
+        report += "  Last calibration: FAR " + String(calibration.falseAcceptRate, 3) + 
+                  ", FRR " + String(calibration.falseRejectRate, 3) + 
+                  " over " + String(calibration.goodSamples + calibration.flawedSamples) + " labeled dispenses\n";
+    }
     
     return report;
 }
 
+uint32_t PatternAnalyzer::takePersistMicros() {
+    uint32_t elapsed = persistMicros;
+    persistMicros = 0;
+    return elapsed;
+}
+
 void PatternAnalyzer::saveAllProgress() {
+    ModelLock lock;
     if (logCallback) {
         logCallback("[PATTERN] Saving all learning progress to SPIFFS...");
     }
@@ -407,10 +508,15 @@ void PatternAnalyzer::loadAllProgress() {
     
     for (int servoIndex = 0; servoIndex < Config::NUM_SERVOS; servoIndex++) {
         loadServoProgress(servoIndex);
+        loadHistory(servoIndex);
+        loadDrift(servoIndex);
+        loadSignature(servoIndex);
     }
 }
 
 void PatternAnalyzer::saveServoProgress(int servoIndex) {
+    ModelLock lock;
+    PersistTimer timer(persistMicros);
     if (servoIndex >= Config::NUM_SERVOS) return;
     
     String filename = "/servo" + String(servoIndex) + "_progress.dat";
@@ -476,6 +582,16 @@ void PatternAnalyzer::saveServoProgress(int servoIndex) {
         }
     }
     
+    // Write per-servo analysis parameters (trailing block, absent in older files)
+    const AnalysisParams& servoParams = params[servoIndex];
+    uint8_t mode = (uint8_t)servoParams.similarityMode;
+    file.write((uint8_t*)&PARAMS_MAGIC, sizeof(uint32_t));
+    file.write((uint8_t*)&servoParams.deviationThreshold, sizeof(float));
+    file.write((uint8_t*)&servoParams.minChannelThreshold, sizeof(float));
+    file.write((uint8_t*)&servoParams.envelopePoints, sizeof(int));
+    file.write((uint8_t*)&servoParams.learningSize, sizeof(int));
+    file.write(&mode, 1);
+    
     file.close();
     
     if (logCallback) {
@@ -510,6 +626,17 @@ bool PatternAnalyzer::loadServoProgress(int servoIndex) {
     file.read((uint8_t*)&hasRef, sizeof(bool));
     file.read((uint8_t*)&failedCount, sizeof(int));
     
+    // Counts come from flash (or an imported snapshot), so bound them before allocating
+    auto discardCorrupt = [&]() {
+        file.close();
+        clearServoMemory(servoIndex, false);
+        if (logCallback) {
+            logCallback("[PATTERN] Ignoring corrupt progress file for servo " + String(servoIndex + 1));
+        }
+        return false;
+    };
+    if (numRecordings > (size_t)MAX_LEARNING_SIZE) return discardCorrupt();
+    
     hasReference[servoIndex] = hasRef;
     failedDispenses[servoIndex] = failedCount;
     
@@ -527,8 +654,9 @@ bool PatternAnalyzer::loadServoProgress(int servoIndex) {
             auto& envelope = record.channelEnvelopes[ch];
             
             // Read envelope size and data
-            size_t envelopeSize;
+            size_t envelopeSize = 0;
             file.read((uint8_t*)&envelopeSize, sizeof(size_t));
+            if (envelopeSize > (size_t)MAX_ENVELOPE_POINTS) return discardCorrupt();
             envelope.envelope.resize(envelopeSize);
             file.read((uint8_t*)envelope.envelope.data(), envelopeSize * sizeof(float));
             
@@ -558,8 +686,9 @@ bool PatternAnalyzer::loadServoProgress(int servoIndex) {
             auto& refEnvelope = referencePattern[servoIndex].channelEnvelopes[ch];
             
             // Read reference envelope
-            size_t refSize;
+            size_t refSize = 0;
             file.read((uint8_t*)&refSize, sizeof(size_t));
+            if (refSize > (size_t)MAX_ENVELOPE_POINTS) return discardCorrupt();
             refEnvelope.envelope.resize(refSize);
             file.read((uint8_t*)refEnvelope.envelope.data(), refSize * sizeof(float));
             
@@ -570,6 +699,30 @@ bool PatternAnalyzer::loadServoProgress(int servoIndex) {
         }
     }
     
+    // Read per-servo analysis parameters if present, keep defaults otherwise
+    uint32_t magic = 0;
+    if (file.read((uint8_t*)&magic, sizeof(uint32_t)) == sizeof(uint32_t) && magic == PARAMS_MAGIC) {
+        AnalysisParams loaded;
+        uint8_t mode = 0;
+        file.read((uint8_t*)&loaded.deviationThreshold, sizeof(float));
+        file.read((uint8_t*)&loaded.minChannelThreshold, sizeof(float));
+        file.read((uint8_t*)&loaded.envelopePoints, sizeof(int));
+        file.read((uint8_t*)&loaded.learningSize, sizeof(int));
+        file.read(&mode, 1);
+        loaded.similarityMode = (SimilarityMode)mode;
+        
+        bool valid = loaded.deviationThreshold >= 0.0f && loaded.deviationThreshold <= 1.0f &&
+                     loaded.minChannelThreshold >= 0.0f && loaded.minChannelThreshold <= 1.0f &&
+                     loaded.envelopePoints >= MIN_ENVELOPE_POINTS && loaded.envelopePoints <= MAX_ENVELOPE_POINTS &&
+                     loaded.learningSize >= MIN_LEARNING_SIZE && loaded.learningSize <= MAX_LEARNING_SIZE &&
+                     mode <= (uint8_t)SimilarityMode::STRICT;
+        if (valid) {
+            params[servoIndex] = loaded;
+        } else if (logCallback) {
+            logCallback("[PATTERN] Ignoring invalid saved parameters for servo " + String(servoIndex + 1));
+        }
+    }
+    
     file.close();
     
     if (logCallback) {
@@ -582,9 +735,36 @@ bool PatternAnalyzer::loadServoProgress(int servoIndex) {
 }
 
 void PatternAnalyzer::resetServoData(int servoIndex) {
+    ModelLock lock;
     if (servoIndex >= Config::NUM_SERVOS) return;
     
-    // Clear all in-memory data
+    clearServoMemory(servoIndex, false);
+    
+    // Overwrite saved file so only the servo's parameters survive the reset
+    saveServoProgress(servoIndex);
+    
+    // Score history and drift baseline belong to the old model
+    String historyFile = "/servo" + String(servoIndex) + "_history.dat";
+    if (SPIFFS.exists(historyFile)) {
+        SPIFFS.remove(historyFile);
+    }
+    
+    String driftFile = "/servo" + String(servoIndex) + "_drift.dat";
+    if (SPIFFS.exists(driftFile)) {
+        SPIFFS.remove(driftFile);
+    }
+    
+    String signatureFile = "/servo" + String(servoIndex) + "_signature.dat";
+    if (SPIFFS.exists(signatureFile)) {
+        SPIFFS.remove(signatureFile);
+    }
+    
+    if (logCallback) {
+        logCallback("[PATTERN] RESET: All data cleared for servo " + String(servoIndex + 1));
+    }
+}
+
+void PatternAnalyzer::clearServoMemory(int servoIndex, bool resetParams) {
     recordings[servoIndex].clear();
     hasReference[servoIndex] = false;
     failedDispenses[servoIndex] = 0;
@@ -593,18 +773,27 @@ void PatternAnalyzer::resetServoData(int servoIndex) {
     referencePattern[servoIndex].channelEnvelopes.clear();
     referencePattern[servoIndex].channelEnvelopes.resize(Config::NUM_PIEZOS);
     
-    // Delete saved file
-    String filename = "/servo" + String(servoIndex) + "_progress.dat";
-    if (SPIFFS.exists(filename)) {
-        SPIFFS.remove(filename);
-    }
+    historyHead[servoIndex] = 0;
+    historyCount[servoIndex] = 0;
+    lastVerdict[servoIndex] = DispenseVerdict();
+    driftMonitors[servoIndex] = DriftMonitor();
+    dropSignatures[servoIndex] = DropSignature();
     
-    if (logCallback) {
-        logCallback("[PATTERN] RESET: All data cleared for servo " + String(servoIndex + 1));
+    if (resetParams) {
+        params[servoIndex] = AnalysisParams();
     }
 }
 
+void PatternAnalyzer::reloadAllProgress() {
+    ModelLock lock;
+    for (int servoIndex = 0; servoIndex < Config::NUM_SERVOS; servoIndex++) {
+        clearServoMemory(servoIndex, true);
+    }
+    loadAllProgress();
+}
+
 void PatternAnalyzer::resetAllData() {
+    ModelLock lock;
     if (logCallback) {
         logCallback("[PATTERN] RESET: Clearing all data for all servos...");
     }
@@ -619,8 +808,12 @@ void PatternAnalyzer::resetAllData() {
 }
 
 void PatternAnalyzer::setDeviationThreshold(float threshold) {
+    ModelLock lock;
     if (threshold >= 0.0f && threshold <= 1.0f) {
-        DEVIATION_THRESHOLD = threshold;
+        for (int i = 0; i < Config::NUM_SERVOS; i++) {
+            params[i].deviationThreshold = threshold;
+            saveServoProgress(i);
+        }
         if (logCallback) {
             logCallback("[PATTERN] Average similarity threshold set to: " + String(threshold, 3));
         }
@@ -632,8 +825,12 @@ void PatternAnalyzer::setDeviationThreshold(float threshold) {
 }
 
 void PatternAnalyzer::setMinChannelThreshold(float threshold) {
+    ModelLock lock;
     if (threshold >= 0.0f && threshold <= 1.0f) {
-        MIN_CHANNEL_THRESHOLD = threshold;
+        for (int i = 0; i < Config::NUM_SERVOS; i++) {
+            params[i].minChannelThreshold = threshold;
+            saveServoProgress(i);
+        }
         if (logCallback) {
             logCallback("[PATTERN] Individual channel threshold set to: " + String(threshold, 3));
         }
@@ -644,10 +841,387 @@ void PatternAnalyzer::setMinChannelThreshold(float threshold) {
     }
 }
 
-float PatternAnalyzer::getDeviationThreshold() const {
-    return DEVIATION_THRESHOLD;
+float PatternAnalyzer::getDeviationThreshold(int servoIndex) const {
+    return servoIndex >= 0 && servoIndex < Config::NUM_SERVOS ? params[servoIndex].deviationThreshold : 0.0f;
+}
+
+float PatternAnalyzer::getMinChannelThreshold(int servoIndex) const {
+    return servoIndex >= 0 && servoIndex < Config::NUM_SERVOS ? params[servoIndex].minChannelThreshold : 0.0f;
+}
+
+bool PatternAnalyzer::setDeviationThreshold(int servoIndex, float threshold) {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || threshold < 0.0f || threshold > 1.0f) return false;
+    
+    params[servoIndex].deviationThreshold = threshold;
+    saveServoProgress(servoIndex);
+    return true;
+}
+
+bool PatternAnalyzer::setMinChannelThreshold(int servoIndex, float threshold) {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || threshold < 0.0f || threshold > 1.0f) return false;
+    
+    params[servoIndex].minChannelThreshold = threshold;
+    saveServoProgress(servoIndex);
+    return true;
+}
+
+bool PatternAnalyzer::setEnvelopePoints(int servoIndex, int points) {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return false;
+    if (points < MIN_ENVELOPE_POINTS || points > MAX_ENVELOPE_POINTS) return false;
+    
+    // Existing recordings were built at the old resolution and would no longer compare
+    if (!recordings[servoIndex].empty()) {
+        if (logCallback) {
+            logCallback("[PATTERN] Servo " + String(servoIndex + 1) + " has learning data - RESETDATA before changing resolution");
+        }
+        return false;
+    }
+    
+    params[servoIndex].envelopePoints = points;
+    saveServoProgress(servoIndex);
+    return true;
+}
+
+const AnalysisParams& PatternAnalyzer::getParams(int servoIndex) const {
+    static const AnalysisParams defaults;
+    return servoIndex >= 0 && servoIndex < Config::NUM_SERVOS ? params[servoIndex] : defaults;
+}
+
+bool PatternAnalyzer::setLearningSize(int servoIndex, int size) {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return false;
+    if (size < MIN_LEARNING_SIZE || size > MAX_LEARNING_SIZE || size % 2 == 0) return false;
+    
+    if (!recordings[servoIndex].empty()) {
+        if (logCallback) {
+            logCallback("[PATTERN] Servo " + String(servoIndex + 1) + " has learning data - RESETDATA before changing learning size");
+        }
+        return false;
+    }
+    
+    params[servoIndex].learningSize = size;
+    recordings[servoIndex].reserve(size);
+    saveServoProgress(servoIndex);
+    return true;
+}
+
+bool PatternAnalyzer::setSimilarityMode(int servoIndex, SimilarityMode mode) {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return false;
+    
+    params[servoIndex].similarityMode = mode;
+    saveServoProgress(servoIndex);
+    return true;
+}
+
+const char* PatternAnalyzer::similarityModeName(SimilarityMode mode) {
+    switch (mode) {
+        case SimilarityMode::AVERAGE_ONLY: return "AVERAGE";
+        case SimilarityMode::STRICT:       return "STRICT";
+        default:                           return "BEST";
+    }
+}
+
+void PatternAnalyzer::recordScore(int servoIndex, float avgSimilarity, float bestSimilarity, float minSimilarity) {
+    ScoreSample& sample = scoreHistory[servoIndex][historyHead[servoIndex]];
+    sample.avgSimilarity = avgSimilarity;
+    sample.bestSimilarity = bestSimilarity;
+    sample.minSimilarity = minSimilarity;
+    sample.label = LABEL_UNKNOWN;
+    
+    historyHead[servoIndex] = (historyHead[servoIndex] + 1) % ThresholdCalibrator::MAX_SAMPLES;
+    if (historyCount[servoIndex] < ThresholdCalibrator::MAX_SAMPLES) {
+        historyCount[servoIndex]++;
+    }
+    
+    updateDrift(servoIndex, avgSimilarity, bestSimilarity);
+}
+
+void PatternAnalyzer::updateDrift(int servoIndex, float avgSimilarity, float bestSimilarity) {
+    DriftMonitor& monitor = driftMonitors[servoIndex];
+    monitor.average.update(avgSimilarity);
+    monitor.best.update(bestSimilarity);
+    
+    DriftState state = DriftState::OK;
+    if (!monitor.average.ready()) {
+        state = DriftState::WARMUP;
+    } else if (monitor.average.cusumLow() || monitor.best.cusumLow()) {
+        state = DriftState::DRIFT;
+    } else if (monitor.average.ewmaLow() || monitor.best.ewmaLow()) {
+        state = DriftState::WARNING;
+    }
+    
+    bool changed = state != monitor.state;
+    monitor.state = state;
+    
+    if (changed && logCallback) {
+        logCallback("[DRIFT] {\"servo\":" + String(servoIndex + 1) + 
+                   ",\"state\":\"" + driftStateName(state) + "\"" + 
+                   ",\"ewma\":" + String(monitor.average.ewma, 3) + 
+                   ",\"baseline\":" + String(monitor.average.mean, 3) + 
+                   ",\"cusum\":" + String(std::max(monitor.average.cusum, monitor.best.cusum), 2) + "}");
+    }
+    
+    if (changed || monitor.average.samples % DRIFT_SAVE_INTERVAL == 0) {
+        saveDrift(servoIndex);
+    }
+}
+
+void PatternAnalyzer::saveDrift(int servoIndex) {
+    PersistTimer timer(persistMicros);
+    String filename = "/servo" + String(servoIndex) + "_drift.dat";
+    File file = SPIFFS.open(filename, "w");
+    if (!file) return;
+    
+    file.write((uint8_t*)&driftMonitors[servoIndex], sizeof(DriftMonitor));
+    file.close();
+}
+
+void PatternAnalyzer::loadDrift(int servoIndex) {
+    String filename = "/servo" + String(servoIndex) + "_drift.dat";
+    File file = SPIFFS.open(filename, "r");
+    if (!file) return;
+    
+    DriftMonitor loaded;
+    if (file.read((uint8_t*)&loaded, sizeof(DriftMonitor)) == sizeof(DriftMonitor) &&
+        (uint8_t)loaded.state <= (uint8_t)DriftState::DRIFT) {
+        driftMonitors[servoIndex] = loaded;
+    }
+    file.close();
 }
 
-float PatternAnalyzer::getMinChannelThreshold() const {
-    return MIN_CHANNEL_THRESHOLD;
+void PatternAnalyzer::updateDropSignature(int servoIndex, const std::vector<std::vector<int>>& channelData, int quietSamples) {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return;
+    
+    // Only a capture with exactly one impact says cleanly how this servo's drop looks
+    ImpactFeatures impacts[2];
+    int count = DropAttributor::segmentImpacts(channelData, Config::NUM_PIEZOS, Config::PIEZO_THRESHOLD, 
+                                               quietSamples, impacts, 2);
+    if (count != 1) return;
+    
+    DropSignature& signature = dropSignatures[servoIndex];
+    bool wasReady = signature.ready();
+    DropAttributor::updateSignature(signature, impacts[0], Config::NUM_PIEZOS);
+    
+    if (!wasReady && signature.ready() && logCallback) {
+        logCallback("[PATTERN] Servo " + String(servoIndex + 1) + " drop signature learned - concurrent dispensing available");
+    }
+    if (signature.samples % SIGNATURE_SAVE_INTERVAL == 0 || (!wasReady && signature.ready())) {
+        saveSignature(servoIndex);
+    }
+}
+
+void PatternAnalyzer::saveSignature(int servoIndex) {
+    PersistTimer timer(persistMicros);
+    String filename = "/servo" + String(servoIndex) + "_signature.dat";
+    File file = SPIFFS.open(filename, "w");
+    if (!file) return;
+    
+    file.write(SIGNATURE_VERSION);
+    file.write((uint8_t*)&dropSignatures[servoIndex], sizeof(DropSignature));
+    file.close();
+}
+
+void PatternAnalyzer::loadSignature(int servoIndex) {
+    String filename = "/servo" + String(servoIndex) + "_signature.dat";
+    File file = SPIFFS.open(filename, "r");
+    if (!file) return;
+    
+    // Files from before the version byte, or from another DropSignature layout, are relearned
+    DropSignature loaded;
+    if (file.size() == SIGNATURE_BYTES && file.read() == SIGNATURE_VERSION &&
+        file.read((uint8_t*)&loaded, sizeof(DropSignature)) == sizeof(DropSignature)) {
+        dropSignatures[servoIndex] = loaded;
+    }
+    file.close();
+}
+
+const char* PatternAnalyzer::driftStateName(DriftState state) {
+    switch (state) {
+        case DriftState::OK:      return "OK";
+        case DriftState::WARNING: return "WARNING";
+        case DriftState::DRIFT:   return "DRIFT";
+        default:                  return "WARMUP";
+    }
+}
+
+bool PatternAnalyzer::labelLastDispense(int servoIndex, bool flawed) {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || historyCount[servoIndex] == 0) return false;
+    
+    int last = (historyHead[servoIndex] + ThresholdCalibrator::MAX_SAMPLES - 1) % ThresholdCalibrator::MAX_SAMPLES;
+    scoreHistory[servoIndex][last].label = flawed ? LABEL_FLAWED : LABEL_GOOD;
+    
+    // Only labeled samples are worth the flash write
+    saveHistory(servoIndex);
+    return true;
+}
+
+void PatternAnalyzer::saveHistory(int servoIndex) {
+    PersistTimer timer(persistMicros);
+    String filename = "/servo" + String(servoIndex) + "_history.dat";
+    File file = SPIFFS.open(filename, "w");
+    if (!file) return;
+    
+    file.write((uint8_t*)&historyHead[servoIndex], sizeof(int));
+    file.write((uint8_t*)&historyCount[servoIndex], sizeof(int));
+    file.write((uint8_t*)scoreHistory[servoIndex], sizeof(scoreHistory[servoIndex]));
+    file.close();
+}
+
+void PatternAnalyzer::loadHistory(int servoIndex) {
+    String filename = "/servo" + String(servoIndex) + "_history.dat";
+    File file = SPIFFS.open(filename, "r");
+    if (!file) return;
+    
+    int head = 0, count = 0;
+    file.read((uint8_t*)&head, sizeof(int));
+    file.read((uint8_t*)&count, sizeof(int));
+    if (head >= 0 && head < ThresholdCalibrator::MAX_SAMPLES && count >= 0 && count <= ThresholdCalibrator::MAX_SAMPLES &&
+        file.read((uint8_t*)scoreHistory[servoIndex], sizeof(scoreHistory[servoIndex])) == sizeof(scoreHistory[servoIndex])) {
+        historyHead[servoIndex] = head;
+        historyCount[servoIndex] = count;
+    }
+    file.close();
+}
+
+String PatternAnalyzer::exportScoreHistory(int servoIndex) const {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return "";
+    
+    // CSV, oldest first: avg,best,min,label
+    String csv = "avg,best,min,label\n";
+    int count = historyCount[servoIndex];
+    int start = (historyHead[servoIndex] + ThresholdCalibrator::MAX_SAMPLES - count) % ThresholdCalibrator::MAX_SAMPLES;
+    for (int i = 0; i < count; i++) {
+        const ScoreSample& sample = scoreHistory[servoIndex][(start + i) % ThresholdCalibrator::MAX_SAMPLES];
+        csv += String(sample.avgSimilarity, 3) + "," + String(sample.bestSimilarity, 3) + "," + 
+               String(sample.minSimilarity, 3) + "," + String((int)sample.label) + "\n";
+    }
+    return csv;
+}
+
+bool PatternAnalyzer::startCalibration(int servoIndex) {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || isCalibrating()) return false;
+    
+    // Snapshot the history so dispenses can keep recording while the sweep runs
+    calibrationSnapshotCount = historyCount[servoIndex];
+    memcpy(calibrationSnapshot, scoreHistory[servoIndex], sizeof(calibrationSnapshot));
+    calibrationParams = params[servoIndex];
+    calibrationCancel = false;
+    calibrationServo = servoIndex;
+    
+    // Idle priority: the command and piezo tasks preempt the sweep whenever they have work
+    if (xTaskCreate(calibrationTaskWrapper, "Calibrate", Config::TASK_STACK_SIZE, this, 0, NULL) != pdPASS) {
+        calibrationServo = -1;
+        return false;
+    }
+    return true;
+}
+
+void PatternAnalyzer::cancelCalibration() {
+    calibrationCancel = true;
+}
+
+void PatternAnalyzer::calibrationTaskWrapper(void* parameter) {
+    PatternAnalyzer* analyzer = static_cast<PatternAnalyzer*>(parameter);
+    analyzer->calibrationTask();
+}
+
+void PatternAnalyzer::calibrationTask() {
+    int servoIndex = calibrationServo;
+    unsigned long startTime = micros();
+    
+    CalibrationResult result = ThresholdCalibrator::sweep(calibrationSnapshot, calibrationSnapshotCount,
+                                                          calibrationParams.similarityMode,
+                                                          calibrationParams.minChannelThreshold,
+                                                          &calibrationCancel);
+    unsigned long elapsed = micros() - startTime;
+    
+    if (calibrationCancel) {
+        if (logCallback) logCallback("[CALIB] Servo " + String(servoIndex + 1) + " calibration cancelled");
+    } else if (!result.valid) {
+        if (logCallback) {
+            logCallback("[CALIB] Servo " + String(servoIndex + 1) + " needs at least " + 
+                       String(ThresholdCalibrator::MIN_GOOD_SAMPLES) + " GOOD and " + 
+                       String(ThresholdCalibrator::MIN_FLAWED_SAMPLES) + " FLAWED labels (have " + 
+                       String(result.goodSamples) + "/" + String(result.flawedSamples) + ")");
+        }
+    } else {
+        // The sweep ran on a snapshot without the lock; only applying its result takes it,
+        // so a dispense saving the same servo's progress waits a moment instead of tearing it
+        {
+            ModelLock lock;
+            lastCalibration[servoIndex] = result;
+            setDeviationThreshold(servoIndex, result.averageThreshold);
+            setMinChannelThreshold(servoIndex, result.channelThreshold);
+        }
+        
+        if (logCallback) {
+            logCallback("[CALIB] Servo " + String(servoIndex + 1) + ": average " + String(result.averageThreshold, 2) + 
+                       ", channel " + String(result.channelThreshold, 2) + 
+                       " (FAR " + String(result.falseAcceptRate, 3) + ", FRR " + String(result.falseRejectRate, 3) + 
+                       ", " + String(result.evaluatedPairs) + " pairs in " + String(elapsed) + " us)");
+        }
+    }
+    
+    calibrationServo = -1;
+    vTaskDelete(NULL);
+}
+
+String PatternAnalyzer::explainVerdict(int servoIndex) const {
+    ModelLock lock;
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return "Invalid servo index";
+    
+    const DispenseVerdict& verdict = lastVerdict[servoIndex];
+    if (!verdict.analyzed) {
+        return "[PATTERN] Servo " + String(servoIndex + 1) + ": no analyzed dispense yet";
+    }
+    
+    String bestChannel = String(Config::PIEZO_NAMES[verdict.bestChannel]);
+    String text = "[PATTERN] Servo " + String(servoIndex + 1) + " - " + (verdict.isNormal ? "NORMAL" : "ABNORMAL") + 
+                  " (mode " + similarityModeName(verdict.mode) + ")\n";
+    text += "  Avg similarity: " + String(verdict.avgSimilarity, 3) + " (threshold " + String(verdict.averageThreshold, 2) + 
+            "), Best: " + bestChannel + " " + String(verdict.bestChannelSim, 3) + "\n";
+    
+    // Per-channel similarity and distance to the channel threshold
+    text += "  Channels:";
+    for (int i = 0; i < Config::NUM_PIEZOS; i++) {
+        float delta = verdict.channelSims[i] - verdict.channelThreshold;
+        text += " " + String(Config::PIEZO_NAMES[i]) + " " + String(verdict.channelSims[i], 3) + 
+                " (" + (delta >= 0 ? "+" : "") + String(delta, 3) + ")";
+    }
+    text += "\n";
+    
+    text += "  Max divergence: " + String(Config::PIEZO_NAMES[verdict.divergenceChannel]) + 
+            " at envelope point " + String(verdict.divergenceIndex) + 
+            " (normalized delta " + String(verdict.divergenceDelta, 3) + ")\n";
+    text += "  Matched prototype: servo " + String(servoIndex + 1) + " reference (quality " + 
+            String(getReferenceQuality(servoIndex), 3) + ")";
+    
+    if (verdict.isNormal && !verdict.avgGood && verdict.bestChannelExcellent) {
+        text += "\n  Accepted via best-of-both: " + bestChannel + " sensor shows good similarity";
+    }
+    
+    if (!verdict.isNormal) {
+        String reasonStr;
+        if (!verdict.avgGood && !verdict.bestChannelExcellent) {
+            reasonStr = "Both average (" + String(verdict.avgSimilarity, 3) + " < " + String(verdict.averageThreshold, 2) + 
+                        ") and best channel " + bestChannel + " (" + String(verdict.bestChannelSim, 3) + " < " + 
+                        String(verdict.averageThreshold, 2) + ") below threshold";
+        } else if (!verdict.avgGood) {
+            reasonStr = "Average (" + String(verdict.avgSimilarity, 3) + " < " + String(verdict.averageThreshold, 2) + ") below threshold";
+        } else {
+            reasonStr = String(Config::PIEZO_NAMES[verdict.worstChannel]) + " (" + String(verdict.worstChannelSim, 3) + 
+                        ") below the channel threshold (" + String(verdict.channelThreshold, 2) + ")";
+        }
+        text += "\n  Rejection reason: " + reasonStr;
+    }
+    
+    return text;
 }
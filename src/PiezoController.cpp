@@ -1,22 +1,38 @@
 // src/PiezoController.cpp
 #include "PiezoController.h"
+#include "Inventory.h"
+#include "DispenseStats.h"
+#include "ModelSnapshot.h"
+#include "ModelLock.h"
 
 PiezoSensor::PiezoSensor()
     : isPillDrop(false),
       logCallback(nullptr),
+      graphCallback(nullptr),
       piezoMeasurements(Config::PIEZO_MEASUREMENTS),
       currentServoIndex(0),
       piezoTaskHandle(NULL),
       timeoutActive(false),
-      timeoutStart(0)
+      timeoutStart(0),
+      timeoutTicks(pdMS_TO_TICKS(Config::TASK_TIMEOUT_MS)),
+      lastTriggerTick(0),
+      lastTriggerUs(0),
+      analysisQueue(NULL),
+      analysisTaskHandle(NULL),
+      analysisMux(portMUX_INITIALIZER_UNLOCKED),
+      pendingAnalyses(0),
+      sensorFreeTick(0),
+      lastCaptureMs(0),
+      msPerSample(0.0f),
+      analysisTotalMs(0),
+      analysisCount(0),
+      concurrentWindow(false),
+      windowSamples(Config::PIEZO_MEASUREMENTS),
+      heldCapture(nullptr)
 {
-    // Initialize array
-    for (int i = 0; i < Config::NUM_PIEZOS; i++) {
-        values[i] = "";
-    }
-
     readySemaphore = xSemaphoreCreateBinary();
     finishedSemaphore = xSemaphoreCreateBinary();
+    dropSemaphore = xSemaphoreCreateBinary();
     
     // Set up pattern analyzer
     patternAnalyzer.setLogCallback([this](String msg) {
@@ -29,15 +45,36 @@ void PiezoSensor::initialize() {
     for (int i = 0; i < Config::NUM_PIEZOS; i++) {
         pinMode(Config::PIEZO_PINS[i], INPUT);
     }
+    
+    // Analysis runs in its own task so the next servo can move while a capture is analyzed
+    analysisQueue = xQueueCreate(Config::ANALYSIS_QUEUE_LENGTH, sizeof(CaptureJob*));
+    xTaskCreate(analysisTaskWrapper, "Piezo Analyze", Config::TASK_STACK_SIZE, this, 1, &analysisTaskHandle);
 }
 
 void PiezoSensor::startTask() {
+    concurrentWindow = false;
+    windowSamples = piezoMeasurements;
+    createPiezoTask();
+}
+
+void PiezoSensor::startConcurrentTask(int captureSamples) {
+    if (heldCapture) {
+        delete heldCapture;  // Never attributed
+        heldCapture = nullptr;
+    }
+    concurrentWindow = true;
+    windowSamples = std::max(captureSamples, piezoMeasurements);
+    createPiezoTask();
+}
+
+void PiezoSensor::createPiezoTask() {
     xTaskCreate(piezoTaskWrapper, "Piezo Read", Config::TASK_STACK_SIZE, this, 1, &piezoTaskHandle);
 }
 
-void PiezoSensor::startTimeout() {
-    timeoutActive = true;
+void PiezoSensor::startTimeout(int timeoutMs) {
+    timeoutTicks = pdMS_TO_TICKS(timeoutMs);
     timeoutStart = xTaskGetTickCount();
+    timeoutActive = true;
 }
 
 void PiezoSensor::piezoTaskWrapper(void* parameter) {
@@ -55,8 +92,25 @@ void PiezoSensor::piezoTask() {
 
             if (val > Config::PIEZO_THRESHOLD) {
                 isPillDrop = true;
+                lastTriggerTick = xTaskGetTickCount();
+                lastTriggerUs = micros();
+                xSemaphoreGive(dropSemaphore);  // Lets the servo end its hold while we record
                 digitalWrite(Config::LED_PIN, HIGH);
-                startRecording(i, val); 
+                CaptureJob* job = startRecording(i, val);
+                job->captureEndUs = micros();
+                lastCaptureMs = (xTaskGetTickCount() - lastTriggerTick) * portTICK_PERIOD_MS;
+                msPerSample = (float)lastCaptureMs / job->channelData[i].size();
+                
+                // The sensor stays reserved until the drop has rung out; analysis does not hold it
+                if (concurrentWindow) {
+                    // The last impact may sit at the very end of a long window
+                    sensorFreeTick = xTaskGetTickCount() + pdMS_TO_TICKS(Config::PIEZO_SETTLE_MS);
+                    heldCapture = job;
+                } else {
+                    sensorFreeTick = lastTriggerTick + pdMS_TO_TICKS(Config::PIEZO_SETTLE_MS);
+                    DispenseStats::getInstance().record(job->servoIndex, DispenseStats::CAPTURE, job->captureEndUs - lastTriggerUs);
+                    enqueueAnalysis(job);
+                }
                 
                 // Reset timeout after successful detection
                 timeoutActive = false;
@@ -67,7 +121,7 @@ void PiezoSensor::piezoTask() {
         }
 
         // Check timeout only if timeout is active
-        if (timeoutActive && (xTaskGetTickCount() - timeoutStart > pdMS_TO_TICKS(Config::TASK_TIMEOUT_MS))) {
+        if (timeoutActive && (xTaskGetTickCount() - timeoutStart > timeoutTicks)) {
             // Timeout occurred - reset and signal
             timeoutActive = false;
             digitalWrite(Config::LED_PIN, LOW);  // Turn off LED
@@ -80,150 +134,220 @@ void PiezoSensor::piezoTask() {
     }
 }
 
-void PiezoSensor::startRecording(int channel, int firstVal) {
-    TickType_t startTime = xTaskGetTickCount(); // Record start time
+CaptureJob* PiezoSensor::startRecording(int channel, int firstVal) {
+    CaptureJob* job = new CaptureJob();
+    job->servoIndex = currentServoIndex;
+    job->triggerChannel = channel;
+    job->triggerTick = lastTriggerTick;
+    job->captureEndUs = 0;
+    job->attributed = false;
+    job->channelData.resize(Config::NUM_PIEZOS);
+    
+    // Samples go straight into the analysis buffers, no text round trip
+    for (int i = 0; i < Config::NUM_PIEZOS; i++) {
+        job->channelData[i].reserve(windowSamples + 1);
+    }
     
     // Record the first value for the triggering channel
-    values[channel] = String(firstVal);
+    job->channelData[channel].push_back(firstVal);
     
     // Record initial values for all other channels
     for (int i = 0; i < Config::NUM_PIEZOS; i++) {
         if (i != channel) {
-            int val = analogRead(Config::PIEZO_PINS[i]);
-            values[i] = String(val);
+            job->channelData[i].push_back(analogRead(Config::PIEZO_PINS[i]));
         }
     }
     
     // Record subsequent measurements from all channels as fast as possible
-    for (int j = 0; j < piezoMeasurements; j++) {
+    for (int j = 0; j < windowSamples; j++) {
         for (int i = 0; i < Config::NUM_PIEZOS; i++) {
-            int val = analogRead(Config::PIEZO_PINS[i]);
-            values[i] += ", " + String(val);
+            job->channelData[i].push_back(analogRead(Config::PIEZO_PINS[i]));
         }
     }
     
-    //Muted loging of raw values
-    // // Log all channels
-    // for (int i = 0; i < Config::NUM_PIEZOS; i++) {
-    //     String msg = String("[PIEZO] ") + Config::PIEZO_NAMES[i] + " -> (";
-    //     msg += values[i] + ")";
-                
-    //     if (logCallback) {
-    //         logCallback(msg);
-    //     }
-    // }
+    return job;
+}
+
+void PiezoSensor::enqueueAnalysis(CaptureJob* job) {
+    portENTER_CRITICAL(&analysisMux);
+    pendingAnalyses++;
+    portEXIT_CRITICAL(&analysisMux);
+    xQueueSend(analysisQueue, &job, portMAX_DELAY);  // Blocks only if analysis falls behind
+}
 
-    // Convert string data to vectors for pattern analysis
-    std::vector<std::vector<int>> channelData(Config::NUM_PIEZOS);
+AttributionResult PiezoSensor::attributeConcurrent(const ConcurrentDrop* drops, int count) {
+    CaptureJob* job = heldCapture;
+    heldCapture = nullptr;
+    concurrentWindow = false;
+    count = std::min(count, DropAttributor::MAX_CANDIDATES);
     
-    // Parse data for all channels
-    for (int ch = 0; ch < Config::NUM_PIEZOS; ch++) {
-        String channelStr = values[ch];
-        std::vector<int>& channelVector = channelData[ch];
+    if (!job) {
+        // Nothing crossed the threshold, so every servo missed
+        return DropAttributor::attribute(nullptr, 0, nullptr, count, Config::NUM_PIEZOS);
+    }
+    
+    // Expected arrivals relative to the window start, in samples
+    AttributionCandidate candidates[DropAttributor::MAX_CANDIDATES];
+    for (int i = 0; i < count; i++) {
+        candidates[i].servo = drops[i].servoIndex;
+        candidates[i].signature = &patternAnalyzer.getDropSignature(drops[i].servoIndex);
+        candidates[i].expectedOnset = -1.0f;
+        candidates[i].onsetTolerance = 0.0f;
+        if (msPerSample > 0.0f) {
+            int32_t offsetTicks = (int32_t)(drops[i].expectedTick - job->triggerTick);
+            candidates[i].expectedOnset = std::max(0.0f, offsetTicks * portTICK_PERIOD_MS / msPerSample);
+            candidates[i].onsetTolerance = drops[i].toleranceMs / msPerSample;
+        }
+    }
+    
+    ImpactFeatures impacts[DropAttributor::MAX_IMPACTS];
+    int impactCount = DropAttributor::segmentImpacts(job->channelData, Config::NUM_PIEZOS, Config::PIEZO_THRESHOLD,
+                                                     quietSamples(), impacts, DropAttributor::MAX_IMPACTS);
+    AttributionResult result = DropAttributor::attribute(impacts, impactCount, candidates, count, Config::NUM_PIEZOS);
+    
+    // Confidently attributed impacts with a clean slice still feed their servo's pattern model
+    int sampleCount = job->channelData[0].size();
+    int sliceLength = piezoMeasurements + 1;
+    for (int i = 0; i < result.impactCount; i++) {
+        int start = impacts[i].onset;
+        int stop = start + sliceLength;
+        if (!result.confident[i] || stop > sampleCount) continue;
+        if ((i > 0 && impacts[i - 1].end > start) || (i + 1 < result.impactCount && impacts[i + 1].onset < stop)) continue;
         
-        int startPos = 0;
-        while (true) {
-            int commaPos = channelStr.indexOf(", ", startPos);
-            if (commaPos == -1) {
-                channelVector.push_back(channelStr.substring(startPos).toInt());
+        CaptureJob* slice = new CaptureJob();
+        slice->servoIndex = drops[result.assigned[i]].servoIndex;
+        slice->triggerChannel = 0;
+        for (int c = 0; c < Config::NUM_PIEZOS; c++) {
+            if (impacts[i].channelOnset[c] == 0) {
+                slice->triggerChannel = c;
                 break;
             }
-            channelVector.push_back(channelStr.substring(startPos, commaPos).toInt());
-            startPos = commaPos + 2;
         }
+        slice->triggerTick = job->triggerTick + pdMS_TO_TICKS((uint32_t)(start * msPerSample));
+        slice->captureEndUs = job->captureEndUs;
+        slice->attributed = true;
+        slice->channelData.resize(Config::NUM_PIEZOS);
+        for (int c = 0; c < Config::NUM_PIEZOS; c++) {
+            slice->channelData[c].assign(job->channelData[c].begin() + start, job->channelData[c].begin() + stop);
+        }
+        enqueueAnalysis(slice);
     }
     
+    delete job;
+    return result;
+}
+
+void PiezoSensor::analysisTaskWrapper(void* parameter) {
+    PiezoSensor* controller = static_cast<PiezoSensor*>(parameter);
+    controller->analysisTask();
+}
 
+void PiezoSensor::analysisTask() {
+    CaptureJob* job = nullptr;
+    while (true) {
+        if (xQueueReceive(analysisQueue, &job, portMAX_DELAY) != pdTRUE) continue;
+        
+        TickType_t start = xTaskGetTickCount();
+        patternAnalyzer.takePersistMicros();  // Writes made outside this analysis are not its cost
+        analyzeCapture(*job);
+        
+        // Queueing counts toward analysis, the SPIFFS writes it triggered are reported apart
+        uint32_t persistUs = patternAnalyzer.takePersistMicros();
+        uint32_t sinceCaptureUs = micros() - job->captureEndUs;
+        DispenseStats::getInstance().record(job->servoIndex, DispenseStats::ANALYSIS, sinceCaptureUs - std::min(persistUs, sinceCaptureUs));
+        if (persistUs > 0) {
+            DispenseStats::getInstance().record(job->servoIndex, DispenseStats::PERSIST, persistUs);
+        }
+        delete job;
+        
+        uint32_t elapsedMs = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+        portENTER_CRITICAL(&analysisMux);
+        analysisTotalMs += elapsedMs;
+        analysisCount++;
+        pendingAnalyses--;
+        portEXIT_CRITICAL(&analysisMux);
+    }
+}
+
+void PiezoSensor::analyzeCapture(const CaptureJob& job) {
+    const char* triggerName = Config::PIEZO_NAMES[job.triggerChannel];
+    
     // Analyze pattern
     bool isNormalDispense = patternAnalyzer.analyzeDispensing(
-        currentServoIndex, channelData, String(Config::PIEZO_NAMES[channel])
+        job.servoIndex, job.channelData, String(triggerName)
     );
     
     if (!isNormalDispense) {
         if (logCallback) {
             logCallback("[PATTERN] ⚠️  ABNORMAL DISPENSING DETECTED - possible multiple pills!");
         }
-    }
-
-    // Send graph data in JSON format for visualization (compressed for WebSocket stability)
-    if (logCallback) {
-        String graphData = "[GRAPH] {";
-        graphData += "\"trigger\":\"" + String(Config::PIEZO_NAMES[channel]) + "\",";
-        graphData += "\"channels\":[";
-        for (int i = 0; i < Config::NUM_PIEZOS; i++) {
-            if (i > 0) graphData += ",";
-            graphData += "{\"name\":\"" + String(Config::PIEZO_NAMES[i]) + "\",";
-            
-            // Compress data much more aggressively - send every 10th measurement instead of 5th
-            String compressedData = "";
-            String fullData = values[i];
-            int commaCount = 0;
-            int lastComma = -1;
-            
-            for (int pos = 0; pos < fullData.length(); pos++) {
-                if (fullData[pos] == ',') {
-                    commaCount++;
-                    if (commaCount % 10 == 0) { // Every 10th measurement for smaller data
-                        if (compressedData.length() > 0) compressedData += ",";
-                        compressedData += fullData.substring(lastComma + 1, pos);
-                    }
-                    lastComma = pos;
-                }
-            }
-            // Add the last value
-            if (commaCount % 5 == 0) {
-                if (compressedData.length() > 0) compressedData += ",";
-                compressedData += fullData.substring(lastComma + 1);
-            }
-            
-            graphData += "\"data\":[" + compressedData + "]}";
-        }
-        graphData += "]}";
         
-        // Validate that the JSON contains only valid UTF-8 characters
-        bool isValidUTF8 = true;
-        for (int i = 0; i < graphData.length(); i++) {
-            char c = graphData.charAt(i);
-            // Check for control characters or invalid UTF-8
-            if (c < 32 && c != '\n' && c != '\r' && c != '\t') {
-                isValidUTF8 = false;
-                break;
+        // The dispenser already counted one pill; separate impacts in the window are the extra ones
+        if (!job.attributed) {
+            ImpactFeatures impacts[DropAttributor::MAX_IMPACTS];
+            int impactCount = DropAttributor::segmentImpacts(job.channelData, Config::NUM_PIEZOS, Config::PIEZO_THRESHOLD,
+                                                             quietSamples(), impacts, DropAttributor::MAX_IMPACTS);
+            if (impactCount > 1) {
+                Inventory::getInstance().consume(job.servoIndex, impactCount - 1);
+                if (logCallback) {
+                    logCallback("[INV] " + String(impactCount) + " impacts from servo " + String(job.servoIndex + 1) + " - counted as " + 
+                                String(impactCount) + " pills");
+                }
             }
         }
-        
-        if (isValidUTF8 && graphData.length() < 8000) {
-            // Send graph data but with additional safety measures
-            logCallback(graphData);
-        } else {
-            Serial.println("[WARN] Invalid UTF-8 or oversized graph data, skipping");
-        }
+    } else if (!job.attributed) {
+        patternAnalyzer.updateDropSignature(job.servoIndex, job.channelData, quietSamples());
     }
 
-    // Calculate elapsed time and ensure total time is at least 1000ms
-    TickType_t elapsedTime = xTaskGetTickCount() - startTime;
-    TickType_t targetTime = pdMS_TO_TICKS(Config::TASK_TIMEOUT_MS*0.8);
-    
-    if (elapsedTime < targetTime) {
-        vTaskDelay(targetTime - elapsedTime); // Sleep for remaining time
+    // Raw capture for the web graph; encoding depends on who is listening
+    if (graphCallback) {
+        graphCallback(job.servoIndex, job.triggerChannel, job.channelData);
+    }
+}
+
+bool PiezoSensor::waitForAnalysisIdle(TickType_t timeout) {
+    TickType_t start = xTaskGetTickCount();
+    while (pendingAnalyses > 0) {
+        if (timeout != portMAX_DELAY && xTaskGetTickCount() - start >= timeout) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(Config::TASK_DELAY_MS));
     }
+    return true;
 }
 
 String PiezoSensor::getAnalysisReport(int servoIndex) const {
     return patternAnalyzer.getAnalysisReport(servoIndex);
 }
 
+String PiezoSensor::explainLastDispense(int servoIndex) const {
+    return patternAnalyzer.explainVerdict(servoIndex);
+}
+
 int PiezoSensor::getFailedCount(int servoIndex) const {
     return patternAnalyzer.getFailedCount(servoIndex);
 }
 
 void PiezoSensor::resetServoData(int servoIndex) {
+    waitForAnalysisIdle();  // A queued capture would otherwise land in the cleared model
     patternAnalyzer.resetServoData(servoIndex);
 }
 
 void PiezoSensor::resetAllData() {
+    waitForAnalysisIdle();
     patternAnalyzer.resetAllData();
 }
 
+bool PiezoSensor::applyModelImport(String& error) {
+    waitForAnalysisIdle();
+    
+    // Swap the files and reload under one lock, so nothing saves the old model in between
+    ModelLock lock;
+    if (!ModelSnapshot::applyImport(error)) return false;
+    patternAnalyzer.reloadAllProgress();
+    return true;
+}
+
 void PiezoSensor::setDeviationThreshold(float threshold) {
     patternAnalyzer.setDeviationThreshold(threshold);
 }
@@ -232,12 +356,12 @@ void PiezoSensor::setMinChannelThreshold(float threshold) {
     patternAnalyzer.setMinChannelThreshold(threshold);
 }
 
-float PiezoSensor::getDeviationThreshold() const {
-    return patternAnalyzer.getDeviationThreshold();
+float PiezoSensor::getDeviationThreshold(int servoIndex) const {
+    return patternAnalyzer.getDeviationThreshold(servoIndex);
 }
 
-float PiezoSensor::getMinChannelThreshold() const {
-    return patternAnalyzer.getMinChannelThreshold();
+float PiezoSensor::getMinChannelThreshold(int servoIndex) const {
+    return patternAnalyzer.getMinChannelThreshold(servoIndex);
 }
 
 // Command interface aliases
@@ -257,10 +381,58 @@ bool PiezoSensor::setChannelThreshold(float threshold) {
     return false;
 }
 
-float PiezoSensor::getAverageThreshold() const {
-    return getDeviationThreshold();
+float PiezoSensor::getAverageThreshold(int servoIndex) const {
+    return getDeviationThreshold(servoIndex);
+}
+
+float PiezoSensor::getChannelThreshold(int servoIndex) const {
+    return getMinChannelThreshold(servoIndex);
+}
+
+const AnalysisParams& PiezoSensor::getAnalysisParams(int servoIndex) const {
+    return patternAnalyzer.getParams(servoIndex);
+}
+
+bool PiezoSensor::setAverageThreshold(int servoIndex, float threshold) {
+    return patternAnalyzer.setDeviationThreshold(servoIndex, threshold);
+}
+
+bool PiezoSensor::setChannelThreshold(int servoIndex, float threshold) {
+    return patternAnalyzer.setMinChannelThreshold(servoIndex, threshold);
+}
+
+bool PiezoSensor::setEnvelopePoints(int servoIndex, int points) {
+    return patternAnalyzer.setEnvelopePoints(servoIndex, points);
+}
+
+bool PiezoSensor::setLearningSize(int servoIndex, int size) {
+    return patternAnalyzer.setLearningSize(servoIndex, size);
+}
+
+bool PiezoSensor::setSimilarityMode(int servoIndex, SimilarityMode mode) {
+    return patternAnalyzer.setSimilarityMode(servoIndex, mode);
+}
+
+bool PiezoSensor::labelLastDispense(int servoIndex, bool flawed) {
+    return patternAnalyzer.labelLastDispense(servoIndex, flawed);
+}
+
+bool PiezoSensor::startCalibration(int servoIndex) {
+    return patternAnalyzer.startCalibration(servoIndex);
+}
+
+void PiezoSensor::cancelCalibration() {
+    patternAnalyzer.cancelCalibration();
+}
+
+bool PiezoSensor::isCalibrating() const {
+    return patternAnalyzer.isCalibrating();
+}
+
+String PiezoSensor::exportScoreHistory(int servoIndex) const {
+    return patternAnalyzer.exportScoreHistory(servoIndex);
 }
 
-float PiezoSensor::getChannelThreshold() const {
-    return getMinChannelThreshold();
+const DropSignature& PiezoSensor::getDropSignature(int servoIndex) const {
+    return patternAnalyzer.getDropSignature(servoIndex);
 }
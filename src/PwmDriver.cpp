@@ -0,0 +1,151 @@
+// src/PwmDriver.cpp
+#include "PwmDriver.h"
+#include <Wire.h>
+
+// PCA9685 registers
+static constexpr uint8_t PCA_MODE1 = 0x00;
+static constexpr uint8_t PCA_MODE2 = 0x01;
+static constexpr uint8_t PCA_LED0_ON_L = 0x06;      // 4 registers per channel: ON_L, ON_H, OFF_L, OFF_H
+static constexpr uint8_t PCA_PRESCALE = 0xFE;
+static constexpr uint8_t MODE1_SLEEP = 0x10;
+static constexpr uint8_t MODE1_AUTO_INCREMENT = 0x20;
+static constexpr uint8_t MODE1_RESTART = 0x80;
+static constexpr uint8_t MODE2_TOTEM_POLE = 0x04;
+static constexpr uint8_t LED_FULL_OFF = 0x10;       // Bit 4 of OFF_H
+static constexpr uint32_t PCA_OSCILLATOR_HZ = 25000000;
+static constexpr uint32_t I2C_CLOCK_HZ = 400000;
+
+PwmDriver& PwmDriver::getInstance() {
+    if (Config::PWM_BACKEND == Config::PwmBackend::PCA9685) {
+        static Pca9685PwmDriver pca9685;
+        return pca9685;
+    }
+    static LedcPwmDriver ledc;
+    return ledc;
+}
+
+PwmDriver::PwmDriver() : dirty(0), batchDepth(0) {
+    memset(pulses, 0, sizeof(pulses));
+    lock = xSemaphoreCreateMutex();
+}
+
+void PwmDriver::write(int channel, uint16_t pulseUs) {
+    if (channel < 0 || channel >= MAX_CHANNELS) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    pulses[channel] = pulseUs;
+    dirty |= 1UL << channel;
+    if (batchDepth == 0) {
+        flush(dirty);
+        dirty = 0;
+    }
+    xSemaphoreGive(lock);
+}
+
+void PwmDriver::beginBatch() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    batchDepth++;
+    xSemaphoreGive(lock);
+}
+
+void PwmDriver::endBatch() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (batchDepth > 0 && --batchDepth == 0 && dirty) {
+        flush(dirty);
+        dirty = 0;
+    }
+    xSemaphoreGive(lock);
+}
+
+// ---- LEDC ----
+
+int LedcPwmDriver::attach(int output) {
+    if (output < 0 || output >= 64 || nextChannel >= CHANNELS) return -1;
+    if (claimedPins & (1ULL << output)) {
+        Serial.println("[ERR] Pin " + String(output) + " already drives a servo");
+        return -1;
+    }
+    claimedPins |= 1ULL << output;
+
+    // 16-bit resolution for maximum precision
+    int channel = nextChannel++;
+    ledcSetup(channel, Config::SERVO_PWM_HZ, 16);
+    ledcAttachPin(output, channel);
+    return channel;
+}
+
+void LedcPwmDriver::flush(uint32_t dirtyMask) {
+    for (int channel = 0; channel < CHANNELS; channel++) {
+        if (dirtyMask & (1UL << channel)) {
+            ledcWrite(channel, (uint32_t)pulses[channel] * 65536 / FRAME_US);
+        }
+    }
+}
+
+// ---- PCA9685 ----
+
+bool Pca9685PwmDriver::begin() {
+    Wire.begin(Config::I2C_SDA_PIN, Config::I2C_SCL_PIN);
+    Wire.setClock(I2C_CLOCK_HZ);
+
+    uint8_t prescale = (uint8_t)(PCA_OSCILLATOR_HZ / (4096UL * Config::SERVO_PWM_HZ) - 1);
+    bool ok = true;
+    for (int board = 0; board < BOARDS; board++) {
+        uint8_t address = Config::PCA9685_ADDRESSES[board];
+
+        // The prescaler only takes effect while the oscillator sleeps
+        ok = writeRegister(address, PCA_MODE1, MODE1_SLEEP) && ok;
+        ok = writeRegister(address, PCA_PRESCALE, prescale) && ok;
+        ok = writeRegister(address, PCA_MODE2, MODE2_TOTEM_POLE) && ok;
+        ok = writeRegister(address, PCA_MODE1, MODE1_AUTO_INCREMENT) && ok;
+        delay(1);  // Oscillator start-up
+        ok = writeRegister(address, PCA_MODE1, MODE1_AUTO_INCREMENT | MODE1_RESTART) && ok;
+    }
+
+    if (!ok) {
+        Serial.println("[ERR] PCA9685 board not responding on I2C");
+    }
+    return ok;
+}
+
+int Pca9685PwmDriver::attach(int output) {
+    // Outputs map straight onto channels; there is nothing to configure per channel
+    if (output < 0 || output >= capacity()) return -1;
+    if (claimed & (1UL << output)) {
+        Serial.println("[ERR] PCA9685 output " + String(output) + " already drives a servo");
+        return -1;
+    }
+    claimed |= 1UL << output;
+    return output;
+}
+
+bool Pca9685PwmDriver::writeRegister(uint8_t address, uint8_t reg, uint8_t value) {
+    Wire.beginTransmission(address);
+    Wire.write(reg);
+    Wire.write(value);
+    return Wire.endTransmission() == 0;
+}
+
+void Pca9685PwmDriver::flush(uint32_t dirtyMask) {
+    for (int board = 0; board < BOARDS; board++) {
+        uint32_t boardMask = (dirtyMask >> (board * CHANNELS_PER_BOARD)) & 0xFFFF;
+        if (!boardMask) continue;
+
+        // One auto-increment write covering the first to the last dirty channel;
+        // clean channels in between are rewritten with their unchanged staged value
+        int first = __builtin_ctz(boardMask);
+        int last = 31 - __builtin_clz(boardMask);
+
+        Wire.beginTransmission(Config::PCA9685_ADDRESSES[board]);
+        Wire.write(PCA_LED0_ON_L + 4 * first);
+        for (int channel = first; channel <= last; channel++) {
+            uint16_t pulseUs = pulses[board * CHANNELS_PER_BOARD + channel];
+            uint16_t offCount = (uint32_t)pulseUs * 4096 / FRAME_US;
+            Wire.write(0);                         // ON at the start of the frame
+            Wire.write(0);
+            Wire.write(offCount & 0xFF);
+            Wire.write((offCount >> 8) | (pulseUs == 0 ? LED_FULL_OFF : 0));
+        }
+        Wire.endTransmission();
+    }
+}
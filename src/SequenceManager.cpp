@@ -1,11 +1,14 @@
 // src/SequenceManager.cpp
 #include "SequenceManager.h"
 #include "ServoController.h"
+#include "PiezoController.h"
 #include "Displayer.h"
+#include "Inventory.h"
+#include "JobTable.h"
 #include <Preferences.h>
 
 SequenceManager::SequenceManager(ServoController& servoController) 
-    : servoController(servoController) {
+    : servoController(servoController), concurrent(false) {
 }
 
 void SequenceManager::initialize() {
@@ -82,6 +85,12 @@ bool SequenceManager::executeSequence(const String& deviceId, const String& name
     
     for (const auto& sequence : deviceIter->second) {
         if (sequence.name == name) {
+            // Refuse the whole plan up front rather than finding the empty bottle halfway through
+            String shortages;
+            if (!Inventory::getInstance().checkPlan(sequence.servoCounts, shortages)) {
+                Displayer::getInstance().logMessage("[ERR] Sequence '" + name + "' not started - " + shortages + " (REFILL <servo> <count>)");
+                return false;
+            }
             Displayer::getInstance().logMessage("[SEQ] Executing sequence '" + name + "' for device " + deviceId);
             executeServoSequence(sequence.servoCounts);
             return true;
@@ -96,23 +105,153 @@ void SequenceManager::executeServoSequence(const std::vector<int>& counts) {
     int totalPills = 0;
     int successfulPills = 0;
     int failedPills = 0;
-
+    
+    // Pipelined: each Dispense returns once its capture is done, so the next servo moves
+    // while the previous capture is analyzed; stage sums show where the time goes
+    PiezoSensor* piezo = servoController.getPiezoSensor();
+    uint32_t analysisMsBefore = piezo ? piezo->getAnalysisTotalMs() : 0;
+    uint32_t analysisCountBefore = piezo ? piezo->getAnalysisCount() : 0;
+    uint32_t sensorWaitMs = 0;
+    uint32_t dropMs = 0;
+    uint32_t captureMs = 0;
+    int timedPills = 0;      // Serial dispenses; concurrent rounds have no per-pill stages
+    int timedDrops = 0;
+    unsigned long sequenceStart = millis();
+    
+    std::vector<int> remaining(Config::NUM_SERVOS, 0);
+    int plannedPills = 0;
     for (int servoIndex = 0; servoIndex < Config::NUM_SERVOS && servoIndex < counts.size(); servoIndex++) {
-        int runCount = counts[servoIndex];
+        remaining[servoIndex] = counts[servoIndex];
+        plannedPills += std::max(counts[servoIndex], 0);
+    }
+    JobTable& jobs = JobTable::getInstance();
+    jobs.progress(0, plannedPills);
+    if (concurrent) {
+        executeConcurrentRounds(remaining, successfulPills, failedPills);
+        totalPills = successfulPills + failedPills;
+        jobs.progress(totalPills, plannedPills);
+    }
+
+    int notStarted = 0;      // Left over by a STOP
+    for (int servoIndex = 0; servoIndex < Config::NUM_SERVOS; servoIndex++) {
+        int runCount = remaining[servoIndex];
         
         for (int run = 0; run < runCount; run++) {
+            if (servoController.isStopRequested()) {
+                notStarted += runCount - run;
+                break;
+            }
             totalPills++;
             Displayer::getInstance().logMessage("[SEQ] Dispensing pill " + String(totalPills) + " from servo " + String(servoIndex + 1) + " (run " + String(run + 1) + "/" + String(runCount) + ")");
             
 
-            if (servoController.Dispense(servoIndex)) {
+            bool dropped = servoController.Dispense(servoIndex);
+            if (!dropped && servoController.getLastFailure() == DispenseFailure::CANCELLED) {
+                totalPills--;
+                notStarted += runCount - run;
+                break;
+            }
+            if (dropped) {
                 successfulPills++;
+                timedDrops++;
             } else {
                 failedPills++;
             }
+            
+            timedPills++;
+            jobs.progress(successfulPills + failedPills, plannedPills);
+            const DispenseTiming& timing = servoController.getLastTiming();
+            sensorWaitMs += timing.sensorWaitMs;
+            dropMs += timing.dropMs;
+            captureMs += timing.captureMs;
+            
+            // An empty bottle stays empty for the rest of the sequence
+            if (!dropped && servoController.getLastFailure() == DispenseFailure::PROBABLY_EMPTY) {
+                int skipped = runCount - run - 1;
+                if (skipped > 0) {
+                    totalPills += skipped;
+                    failedPills += skipped;
+                    Displayer::getInstance().logMessage("[SEQ] ⚠️  Servo " + String(servoIndex + 1) + " probably empty - skipping " + 
+                                                      String(skipped) + " remaining pill(s)");
+                }
+                break;
+            }
+        }
+    }
+    unsigned long dispenseMs = millis() - sequenceStart;
+    
+    // Verdicts of the last captures are still in flight
+    if (piezo) piezo->waitForAnalysisIdle();
+    unsigned long totalMs = millis() - sequenceStart;
+    
+    if (failedPills > 0) {
+        String reason = String(failedPills) + " of " + String(plannedPills) + " pills failed";
+        jobs.fail(reason.c_str());
+    }
+    if (notStarted > 0) {
+        Displayer::getInstance().logMessage("[SEQ] Sequence stopped: " + String(successfulPills) + " pills dispensed, " + String(failedPills) + 
+                                          " failures, " + String(notStarted) + " not dispensed");
+    } else {
+        Displayer::getInstance().logMessage("[SEQ] Sequence complete: " + String(successfulPills) + " pills dispensed, " + String(failedPills) + " failures");
+    }
+    if (timedPills > 0 && piezo) {
+        uint32_t analyses = piezo->getAnalysisCount() - analysisCountBefore;
+        uint32_t analysisMs = piezo->getAnalysisTotalMs() - analysisMsBefore;
+        Displayer::getInstance().logMessage("[SEQ] Stage timing (avg ms/pill): sensor wait " + String(sensorWaitMs / timedPills) +
+            ", move->drop " + String(timedDrops ? dropMs / timedDrops : 0) +
+            ", capture " + String(timedDrops ? captureMs / timedDrops : 0) +
+            ", analysis " + String(analyses ? analysisMs / analyses : 0) + " (overlapped)");
+    }
+    if (totalPills > 0) {
+        Displayer::getInstance().logMessage("[SEQ] Total " + String(totalMs) + " ms (" + String(dispenseMs) + " ms dispensing, " + String(totalMs - dispenseMs) + " ms draining analysis)");
+    }
+}
+
+void SequenceManager::executeConcurrentRounds(std::vector<int>& remaining, int& successfulPills, int& failedPills) {
+    // Each round takes one pill from every eligible servo that still owes pills;
+    // whatever is left (unlearned servos, the last single servo) runs serially afterwards
+    while (!servoController.isStopRequested()) {
+        std::vector<int> batch;
+        for (int servoIndex = 0; servoIndex < Config::NUM_SERVOS; servoIndex++) {
+            if (remaining[servoIndex] > 0 && servoController.canDispenseConcurrently(servoIndex)) {
+                batch.push_back(servoIndex);
+            }
+        }
+        if (batch.size() < 2) return;
+        
+        Displayer::getInstance().logMessage("[SEQ] Concurrent round over " + String((int)batch.size()) + " servos");
+        std::vector<DropVerdict> verdicts;
+        servoController.DispenseConcurrent(batch, verdicts);
+        
+        for (size_t i = 0; i < batch.size(); i++) {
+            int servoIndex = batch[i];
+            remaining[servoIndex]--;
+            switch (verdicts[i]) {
+                case DropVerdict::DROPPED:
+                    successfulPills++;
+                    break;
+                case DropVerdict::MULTIPLE:
+                    successfulPills++;
+                    Displayer::getInstance().logMessage("[SEQ] ⚠️  Servo " + String(servoIndex + 1) + " may have dropped more than one pill");
+                    break;
+                case DropVerdict::AMBIGUOUS:
+                    // Retrying could double-dispense, so count it and leave the check to the user
+                    successfulPills++;
+                    Displayer::getInstance().logMessage("[SEQ] ⚠️  Servo " + String(servoIndex + 1) + " drop could not be attributed - please verify");
+                    break;
+                default:
+                    // Nothing from this servo in the window: safe to retry on its own
+                    if (servoController.Dispense(servoIndex)) {
+                        successfulPills++;
+                    } else if (servoController.getLastFailure() == DispenseFailure::CANCELLED) {
+                        remaining[servoIndex]++;  // Still owed; reported as not dispensed
+                    } else {
+                        failedPills++;
+                    }
+                    break;
+            }
         }
     }
-    Displayer::getInstance().logMessage("[SEQ] Sequence complete: " + String(successfulPills) + " pills dispensed, " + String(failedPills) + " failures");
 }
 
 bool SequenceManager::deleteSequence(const String& deviceId, const String& name) {
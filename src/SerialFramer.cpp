@@ -0,0 +1,83 @@
+// src/SerialFramer.cpp
+#include "SerialFramer.h"
+
+uint8_t SerialFramer::crc8(uint8_t crc, uint8_t byte) {
+    crc ^= byte;
+    for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+SerialFramer::Event SerialFramer::feed(uint8_t byte, uint32_t nowMs) {
+    // The caller has consumed the previous line or frame by now
+    if (delivered) {
+        used = 0;
+        delivered = false;
+    }
+    
+    // A frame that stopped arriving is abandoned; this byte is then read as text
+    Event stale = Event::NONE;
+    if (state != State::TEXT && nowMs - lastByteMs > FRAME_TIMEOUT_MS) {
+        state = State::TEXT;
+        used = 0;
+        stale = Event::BAD_FRAME;
+    }
+    lastByteMs = nowMs;
+    
+    switch (state) {
+        case State::TEXT:
+            if (byte == FRAME_START && used == 0 && !overflowed) {
+                state = State::SEQUENCE;
+                crc = 0;
+                return stale;
+            }
+            if (byte == '\r') return stale;
+            if (byte == '\n') {
+                if (overflowed) {
+                    overflowed = false;
+                    used = 0;
+                    return Event::OVERFLOW;
+                }
+                if (used == 0) return stale;
+                buffer[used] = '\0';
+                delivered = true;
+                return Event::LINE;
+            }
+            if (used < MAX_LINE) {
+                buffer[used++] = (char)byte;
+            } else {
+                overflowed = true;
+            }
+            return stale;
+        
+        case State::SEQUENCE:
+            seq = byte;
+            crc = crc8(crc, byte);
+            state = State::LENGTH;
+            return Event::NONE;
+        
+        case State::LENGTH:
+            expected = byte;
+            crc = crc8(crc, byte);
+            state = expected > 0 ? State::PAYLOAD : State::CHECKSUM;
+            return Event::NONE;
+        
+        case State::PAYLOAD:
+            buffer[used++] = (char)byte;
+            crc = crc8(crc, byte);
+            if (used == expected) state = State::CHECKSUM;
+            return Event::NONE;
+        
+        case State::CHECKSUM:
+            state = State::TEXT;
+            if (byte != crc) {
+                used = 0;
+                return Event::BAD_FRAME;
+            }
+            buffer[used] = '\0';
+            delivered = true;
+            return Event::FRAME;
+    }
+    return Event::NONE;
+}
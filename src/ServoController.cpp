@@ -2,21 +2,108 @@
 #include "ServoController.h"
 #include "PiezoController.h"
 #include "Displayer.h"
+#include "PwmDriver.h"
+#include "Inventory.h"
+#include "DispenseStats.h"
+#include "StrokeSearch.h"
+#include <Preferences.h>
+#include <algorithm>
+#include <utility>
+
+// Margins on top of the learned p99 drop latency
+static constexpr int HOLD_MARGIN_MS = 50;
+static constexpr int MIN_HOLD_MS = 150;
+static constexpr int TIMEOUT_MARGIN_MS = 150;
+static constexpr int MIN_ONSET_TOLERANCE_MS = 20;   // Arrival-time sigma floor for drop attribution
+
+// Calibration limits
+static constexpr int PULSE_LIMIT_MIN_US = 300;
+static constexpr int PULSE_LIMIT_MAX_US = 2700;
+static constexpr int MIN_PULSE_SPAN_US = 500;
+static constexpr int MIN_CALIBRATED_HOLD_MS = 50;
+static constexpr int MAX_CALIBRATED_HOLD_MS = 2000;
+
+// Minimum-angle search
+static constexpr int ANGLE_SEARCH_RESOLUTION = 2;   // Degrees
+static constexpr int ANGLE_SAFETY_MARGIN = 3;       // Added on top of the smallest reliable angle
+static constexpr int ANGLE_TRIAL_ATTEMPTS = 2;      // Out and back may both be needed for one pill
+
+// Jam recovery: what each attempt of Dispense does, in order; the last entry repeats
+enum class RecoveryStep : uint8_t { STROKE, AGITATE_THEN_STROKE };
+static constexpr RecoveryStep RECOVERY_PLAN[] = {
+    RecoveryStep::STROKE, RecoveryStep::STROKE, RecoveryStep::AGITATE_THEN_STROKE,
+    RecoveryStep::STROKE, RecoveryStep::AGITATE_THEN_STROKE
+};
+static constexpr int RECOVERY_PLAN_LENGTH = sizeof(RECOVERY_PLAN) / sizeof(RECOVERY_PLAN[0]);
+static constexpr int AGITATE_AMPLITUDE = 8;         // Degrees, toward the other end of travel
+static constexpr int AGITATE_CYCLES = 3;
+static constexpr int AGITATE_STEP_MS = 60;          // Hold at each end of a wiggle
+// Consecutive timeouts before a bottle counts as empty: a whole recovery plan without a drop,
+// so the plan's last agitation still runs before the bottle is given up on
+static constexpr int EMPTY_AFTER_TIMEOUTS = RECOVERY_PLAN_LENGTH;
+
+static constexpr const char* SETTINGS_NAMESPACE = "servocal";
+
+// NVS layout of a "prof<i>" entry; older firmware stored the bare MotionProfile
+struct StoredProfile {
+    static constexpr uint8_t VERSION = 1;
+
+    uint8_t version;
+    MotionProfile profile;
+};
+
+void DropLatencyTracker::add(uint16_t latencyMs) {
+    samples[head] = latencyMs;
+    head = (head + 1) % CAPACITY;
+    if (count < CAPACITY) count++;
+    
+    uint16_t sorted[CAPACITY];
+    memcpy(sorted, samples, count * sizeof(uint16_t));
+    std::sort(sorted, sorted + count);
+    int index = (count * 99 + 99) / 100 - 1;  // ceil(0.99 * count) - 1
+    p99Ms = sorted[std::max(0, index)];
+    p50Ms = sorted[count / 2];
+    minMs = sorted[0];
+}
+
+// Waits until the given tick, tolerating tick counter wrap-around
+static void delayUntilTick(TickType_t target) {
+    int32_t remaining = (int32_t)(target - xTaskGetTickCount());
+    if (remaining > 0) {
+        vTaskDelay((TickType_t)remaining);
+    }
+}
+
+// Expands to one ServoMotor per entry of Config::SERVO_PINS
+template <size_t... I>
+static std::array<ServoMotor, sizeof...(I)> makeServos(std::index_sequence<I...>) {
+    return {{ServoMotor(Config::SERVO_PINS[I])...}};
+}
 
 ServoController::ServoController() 
-    : servos{ServoMotor(Config::SERVO_PINS[0]), ServoMotor(Config::SERVO_PINS[1])},
+    : servos(makeServos(std::make_index_sequence<Config::NUM_SERVOS>())),
       piezoSensor(nullptr),
-      angle(Config::DEFAULT_ANGLE), 
-      startAngle(Config::DEFAULT_START_ANGLE), 
       counter(0), 
-      atStart(true) {
+      atStart(true),
+      lastFailure(DispenseFailure::NONE),
+      commandStopEpoch(0) {
 }
 
 void ServoController::initialize() {
+    PwmDriver& pwm = PwmDriver::getInstance();
+    pwm.begin();
+    Serial.println("[SERVO] " + String(Config::NUM_SERVOS) + " servos on " + String(pwm.name()) + 
+                   " (" + String(pwm.capacity()) + " channels)");
+    
+    // Calibration first, so each servo starts out at its own start angle
+    loadSettings();
+    
+    pwm.beginBatch();
     for (int i = 0; i < Config::NUM_SERVOS; i++) {
         servos[i].initialize();
-        servos[i].moveTo(startAngle);
     }
+    pwm.endBatch();
+    waitForAllServos();
 }
 
 void ServoController::moveServo(int servoIndex, int targetAngle) {
@@ -25,62 +112,558 @@ void ServoController::moveServo(int servoIndex, int targetAngle) {
     }
 }
 
+void ServoController::moveServoAsync(int servoIndex, int targetAngle, ServoMotor::MotionCallback onComplete) {
+    if (servoIndex >= 0 && servoIndex < Config::NUM_SERVOS) {
+        servos[servoIndex].startMove(targetAngle, onComplete);
+    }
+}
+
+void ServoController::waitForAllServos() {
+    for (int i = 0; i < Config::NUM_SERVOS; i++) {
+        servos[i].waitForMotion();
+    }
+}
+
+bool ServoController::canDispenseConcurrently(int servoIndex) const {
+    return piezoSensor && servoIndex >= 0 && servoIndex < Config::NUM_SERVOS && !bottles[servoIndex].probablyEmpty &&
+           dropLatency[servoIndex].ready() && piezoSensor->getDropSignature(servoIndex).ready();
+}
+
+int ServoController::DispenseConcurrent(const std::vector<int>& servoIndices, std::vector<DropVerdict>& verdicts) {
+    int count = servoIndices.size();
+    verdicts.assign(count, DropVerdict::NOT_REQUESTED);
+    if (!piezoSensor || count == 0 || count > DropAttributor::MAX_CANDIDATES || isStopRequested()) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (servoIndices[i] < 0 || servoIndices[i] >= Config::NUM_SERVOS) return 0;
+        for (int j = 0; j < i; j++) {
+            if (servoIndices[j] == servoIndices[i]) return 0;
+        }
+    }
+    
+    // The window covers every servo's latency spread across the stagger, plus one full capture
+    int earliestMs = INT32_MAX;
+    int latestMs = 0;
+    int timeoutMs = 0;
+    for (int i = 0; i < count; i++) {
+        const DropLatencyTracker& tracker = dropLatency[servoIndices[i]];
+        int offsetMs = i * Config::CONCURRENT_STAGGER_MS;
+        earliestMs = std::min(earliestMs, offsetMs + (tracker.ready() ? tracker.minMs : 0));
+        latestMs = std::max(latestMs, offsetMs + (tracker.ready() ? tracker.p99Ms : getHoldMs(servoIndices[i])));
+        timeoutMs = std::max(timeoutMs, offsetMs + getDetectionTimeoutMs(servoIndices[i]));
+    }
+    int measurements = piezoSensor->getPiezoMeasurements();
+    float msPerSample = piezoSensor->getMsPerSample();
+    int extraSamples = msPerSample > 0.0f ? (int)((latestMs - earliestMs) / msPerSample) : measurements * (count - 1);
+    
+    delayUntilTick(piezoSensor->getSensorFreeTick());
+    piezoSensor->startConcurrentTask(measurements + extraSamples);
+    xSemaphoreTake(piezoSensor->getReadySemaphore(), portMAX_DELAY);
+    piezoSensor->startTimeout(timeoutMs);
+    
+    TickType_t moveStart[DropAttributor::MAX_CANDIDATES];
+    for (int i = 0; i < count; i++) {
+        int servoIndex = servoIndices[i];
+        int targetPos = nextTarget(servoIndex);
+        moveStart[i] = xTaskGetTickCount();
+        servos[servoIndex].startMove(targetPos, nullptr, getHoldMs(servoIndex));
+        if (i + 1 < count) {
+            vTaskDelay(pdMS_TO_TICKS(Config::CONCURRENT_STAGGER_MS));
+        }
+    }
+    waitForAllServos();
+    xSemaphoreTake(piezoSensor->getFinishedSemaphore(), portMAX_DELAY);
+    piezoSensor->setIsPillDrop(false);
+    
+    // Latencies are not learned here: which impact belongs to which servo is an estimate
+    ConcurrentDrop drops[DropAttributor::MAX_CANDIDATES];
+    for (int i = 0; i < count; i++) {
+        const DropLatencyTracker& tracker = dropLatency[servoIndices[i]];
+        drops[i].servoIndex = servoIndices[i];
+        drops[i].expectedTick = moveStart[i] + pdMS_TO_TICKS(tracker.p50Ms);
+        drops[i].toleranceMs = std::max(MIN_ONSET_TOLERANCE_MS, (tracker.p99Ms - tracker.minMs) / 2);
+    }
+    AttributionResult result = piezoSensor->attributeConcurrent(drops, count);
+    
+    int dropped = 0;
+    String summary = "[MULTI] " + String(result.impactCount) + " impact(s) for " + String(count) + " servo(s):";
+    for (int i = 0; i < count; i++) {
+        verdicts[i] = result.verdicts[i];
+        if (verdicts[i] == DropVerdict::DROPPED || verdicts[i] == DropVerdict::MULTIPLE) {
+            dropped++;
+            clearEmpty(servoIndices[i]);
+        }
+        
+        // Every impact is one pill of the servo it was attributed to, ambiguous ones included
+        int pills = 0;
+        for (int k = 0; k < result.impactCount; k++) {
+            if (result.assigned[k] == i) pills++;
+        }
+        Inventory::getInstance().consume(servoIndices[i], pills);
+        summary += " servo " + String(servoIndices[i] + 1) + " " + DropAttributor::verdictName(verdicts[i]);
+    }
+    Displayer::getInstance().logMessage(summary);
+    return dropped;
+}
+
 void ServoController::resetAllServos() {
+    // All servos move at once, so a reset costs one hold instead of one per servo
+    PwmDriver::getInstance().beginBatch();
+    for (int i = 0; i < Config::NUM_SERVOS; i++) {
+        servos[i].startMove(Config::RESET_ANGLE);
+    }
+    PwmDriver::getInstance().endBatch();
+    waitForAllServos();
+}
+
+bool ServoController::isStopRequested() const {
+    return Displayer::getInstance().getStopEpoch() != commandStopEpoch;
+}
+
+void ServoController::requestStop() {
     for (int i = 0; i < Config::NUM_SERVOS; i++) {
-        servos[i].reset();
+        servos[i].halt();
     }
 }
 
-void ServoController::setAngle(int newAngle) {
-    if (newAngle >= 0 && newAngle <= 180) {
-        angle = newAngle;
+bool ServoController::takeUnlessStopped(SemaphoreHandle_t semaphore, TickType_t timeout) {
+    // Waits in profile-tick slices so a STOP is noticed within one motion step
+    TickType_t end = xTaskGetTickCount() + timeout;
+    while (!isStopRequested()) {
+        int32_t left = (int32_t)(end - xTaskGetTickCount());
+        TickType_t slice = std::min<TickType_t>(left > 0 ? left : 0, pdMS_TO_TICKS(Config::SERVO_PROFILE_TICK_MS));
+        if (xSemaphoreTake(semaphore, slice) == pdTRUE) return true;
+        if (left <= 0) return false;
+    }
+    return false;
+}
+
+bool ServoController::setAngle(int newAngle) {
+    if (newAngle < 0 || newAngle > 180) return false;
+    
+    bool allApplied = true;
+    for (int i = 0; i < Config::NUM_SERVOS; i++) {
+        ServoCalibration calibration = servos[i].getCalibration();
+        calibration.dispenseAngle = newAngle;
+        if (!setCalibration(i, calibration)) {
+            Displayer::getInstance().logMessage("[ERR] Servo " + String(i + 1) + " kept dispense angle " + 
+                                              String(servos[i].getCalibration().dispenseAngle) + "° (equals its start angle)");
+            allApplied = false;
+        }
     }
+    return allApplied;
 }
 
-void ServoController::setStartAngle(int newStartAngle) {
-    if (newStartAngle >= 0 && newStartAngle <= 180) {
-        startAngle = newStartAngle;
-        for (int i = 0; i < Config::NUM_SERVOS; i++) {
-            servos[i].moveTo(startAngle);
+bool ServoController::setStartAngle(int newStartAngle) {
+    if (newStartAngle < 0 || newStartAngle > 180) return false;
+    
+    bool allApplied = true;
+    PwmDriver::getInstance().beginBatch();
+    for (int i = 0; i < Config::NUM_SERVOS; i++) {
+        ServoCalibration calibration = servos[i].getCalibration();
+        calibration.startAngle = newStartAngle;
+        if (!setCalibration(i, calibration)) {
+            // Rejected servos stay where their own calibration puts them
+            Displayer::getInstance().logMessage("[ERR] Servo " + String(i + 1) + " kept start angle " + 
+                                              String(servos[i].getCalibration().startAngle) + "° (equals its dispense angle)");
+            allApplied = false;
+            continue;
+        }
+        servos[i].startMove(newStartAngle);
+    }
+    PwmDriver::getInstance().endBatch();
+    waitForAllServos();
+    return allApplied;
+}
+
+bool ServoController::setCalibration(int servoIndex, const ServoCalibration& calibration) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return false;
+    if (calibration.startAngle > 180 || calibration.dispenseAngle > 180 || calibration.startAngle == calibration.dispenseAngle) {
+        return false;
+    }
+    if (calibration.minPulseUs < PULSE_LIMIT_MIN_US || calibration.maxPulseUs > PULSE_LIMIT_MAX_US ||
+        calibration.maxPulseUs < calibration.minPulseUs + MIN_PULSE_SPAN_US) {
+        return false;
+    }
+    if (calibration.holdMs < MIN_CALIBRATED_HOLD_MS || calibration.holdMs > MAX_CALIBRATED_HOLD_MS) {
+        return false;
+    }
+    
+    ServoCalibration applied = calibration;
+    applied.version = ServoCalibration::VERSION;
+    applied.reversed = calibration.reversed ? 1 : 0;
+    servos[servoIndex].setCalibration(applied);
+    saveCalibration(servoIndex);
+    return true;
+}
+
+int ServoController::nextTarget(int servoIndex) const {
+    // Each attempt is a single stroke to the other end of this servo's travel
+    const ServoCalibration& calibration = servos[servoIndex].getCalibration();
+    return servos[servoIndex].getCurrentAngle() == calibration.startAngle ? calibration.dispenseAngle : calibration.startAngle;
+}
+
+void ServoController::loadSettings() {
+    Preferences prefs;
+    prefs.begin(SETTINGS_NAMESPACE, true);
+    
+    for (int i = 0; i < Config::NUM_SERVOS; i++) {
+        String calibrationKey = "cal" + String(i);
+        ServoCalibration calibration;
+        if (prefs.getBytesLength(calibrationKey.c_str()) == sizeof(ServoCalibration) &&
+            prefs.getBytes(calibrationKey.c_str(), &calibration, sizeof(ServoCalibration)) == sizeof(ServoCalibration) &&
+            calibration.version == ServoCalibration::VERSION) {
+            servos[i].setCalibration(calibration);
+        }
+        
+        String profileKey = "prof" + String(i);
+        StoredProfile stored = {};
+        size_t storedLength = prefs.getBytesLength(profileKey.c_str());
+        bool loaded = false;
+        if (storedLength == sizeof(StoredProfile)) {
+            loaded = prefs.getBytes(profileKey.c_str(), &stored, sizeof(StoredProfile)) == sizeof(StoredProfile) &&
+                     stored.version == StoredProfile::VERSION;
+        } else if (storedLength == sizeof(MotionProfile)) {
+            loaded = prefs.getBytes(profileKey.c_str(), &stored.profile, sizeof(MotionProfile)) == sizeof(MotionProfile);
+        }
+        if (loaded && stored.profile.isValid()) {
+            servos[i].setProfile(stored.profile);
         }
     }
+    
+    prefs.end();
+}
+
+void ServoController::saveCalibration(int servoIndex) {
+    Preferences prefs;
+    prefs.begin(SETTINGS_NAMESPACE, false);
+    String key = "cal" + String(servoIndex);
+    prefs.putBytes(key.c_str(), &servos[servoIndex].getCalibration(), sizeof(ServoCalibration));
+    prefs.end();
+}
+
+void ServoController::saveProfile(int servoIndex) {
+    Preferences prefs;
+    prefs.begin(SETTINGS_NAMESPACE, false);
+    String key = "prof" + String(servoIndex);
+    StoredProfile stored = {StoredProfile::VERSION, servos[servoIndex].getProfile()};
+    prefs.putBytes(key.c_str(), &stored, sizeof(StoredProfile));
+    prefs.end();
 }
 
 void ServoController::setPiezoSensor(PiezoSensor* piezoController) {
     this->piezoSensor = piezoController;
 }
 
+int ServoController::getHoldMs(int servoIndex) const {
+    const DropLatencyTracker& tracker = dropLatency[servoIndex];
+    int calibratedHold = servos[servoIndex].getCalibration().holdMs;
+    if (!tracker.ready()) return calibratedHold;
+    return constrain(tracker.p99Ms + HOLD_MARGIN_MS, std::min(MIN_HOLD_MS, calibratedHold), calibratedHold);
+}
+
+int ServoController::getDetectionTimeoutMs(int servoIndex) const {
+    // Measured from move start, so the unlearned default covers the old hold plus the old timeout
+    const DropLatencyTracker& tracker = dropLatency[servoIndex];
+    int fallback = servos[servoIndex].getCalibration().holdMs + Config::TASK_TIMEOUT_MS;
+    if (!tracker.ready()) return fallback;
+    return std::min(fallback, tracker.p99Ms + TIMEOUT_MARGIN_MS);
+}
+
+int ServoController::getEarlyStartMs(int servoIndex) const {
+    // Half the fastest drop seen, so the pill can never beat the sensor window opening
+    const DropLatencyTracker& tracker = dropLatency[servoIndex];
+    if (!tracker.ready()) return 0;
+    return tracker.minMs / 2;
+}
+
 bool ServoController::Dispense(int servoIndex, int maxAttempts) {
     if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || !piezoSensor) {
+        lastFailure = DispenseFailure::INVALID_REQUEST;
         return false;
     }
     
     // Set which servo is currently dispensing for pattern analysis
     piezoSensor->setCurrentServo(servoIndex);
+    lastTiming = DispenseTiming();
+    lastFailure = DispenseFailure::NONE;
+    TickType_t dispenseStart = xTaskGetTickCount();
+    uint32_t dispenseStartUs = micros();
+    DispenseStats& stats = DispenseStats::getInstance();
+    
+    // A bottle that already looked empty gets one plain probe stroke instead of the full recovery
+    bool probing = bottles[servoIndex].probablyEmpty;
+    if (probing) {
+        maxAttempts = 1;
+        Displayer::getInstance().logMessage("[SERVO] Servo " + String(servoIndex + 1) + " probably empty - single probe stroke");
+    }
     
     for (int attempt = 1; attempt <= maxAttempts; attempt++) {
+        if (isStopRequested()) {
+            lastFailure = DispenseFailure::CANCELLED;
+            break;
+        }
+        lastTiming.attempts = attempt;
+        RecoveryStep step = probing ? RecoveryStep::STROKE : RECOVERY_PLAN[std::min(attempt, RECOVERY_PLAN_LENGTH) - 1];
+        bool agitating = step == RecoveryStep::AGITATE_THEN_STROKE;
+        Displayer::getInstance().logMessage("[SERVO] Attempt " + String(attempt) + "/" + String(maxAttempts) + (agitating ? " (agitate)" : ""));
         
+        // The previous capture may still be ringing out. The move may start early by a margin
+        // the pill cannot cover, but the detection window itself never overlaps the last one.
+        // Agitation needs the sensor armed first, so it never starts early.
+        TickType_t sensorFree = piezoSensor->getSensorFreeTick();
+        TickType_t waitStart = xTaskGetTickCount();
+        uint32_t attemptStartUs = micros();
+        delayUntilTick(sensorFree - (agitating ? 0 : pdMS_TO_TICKS(getEarlyStartMs(servoIndex))));
+        if (isStopRequested()) {
+            // Last exit before anything moves or the sensor is armed
+            lastFailure = DispenseFailure::CANCELLED;
+            break;
+        }
+        
+        int holdMs = getHoldMs(servoIndex);
+        SemaphoreHandle_t dropSemaphore = piezoSensor->getDropSemaphore();
+        xSemaphoreTake(dropSemaphore, 0);  // Clear a stale trigger
+        TickType_t moveStart = xTaskGetTickCount();
+        uint32_t moveStartUs = micros();
+        if (!agitating) {
+            servos[servoIndex].startMove(nextTarget(servoIndex), nullptr, holdMs);
+        }
+        
+        delayUntilTick(sensorFree);
+        lastTiming.sensorWaitMs += (xTaskGetTickCount() - waitStart) * portTICK_PERIOD_MS;
+        uint32_t armStartUs = micros();
+        stats.record(servoIndex, DispenseStats::SENSOR_WAIT, armStartUs - attemptStartUs);
         piezoSensor->startTask();
-        SemaphoreHandle_t readySemaphore = piezoSensor->getReadySemaphore();
-        xSemaphoreTake(readySemaphore, portMAX_DELAY);
-
-        Displayer::getInstance().logMessage("[SERVO] Attempt " + String(attempt) + "/" + String(maxAttempts));
-        // Determine which position to move to based on current position
-        int currentPos = servos[servoIndex].getCurrentAngle();
-        int targetPos = (currentPos == startAngle) ? angle : startAngle;
+        xSemaphoreTake(piezoSensor->getReadySemaphore(), portMAX_DELAY);
+        stats.record(servoIndex, DispenseStats::ARM, micros() - armStartUs);
         
-        // Single movement per attempt
-        servos[servoIndex].moveTo(targetPos);
+        // A pill loosened by the wiggle drops inside the armed window and ends the attempt
+        bool droppedWhileAgitating = agitating && agitate(servoIndex, dropSemaphore);
+        if (agitating && !droppedWhileAgitating && !isStopRequested()) {
+            moveStart = xTaskGetTickCount();
+            moveStartUs = micros();
+            servos[servoIndex].startMove(nextTarget(servoIndex), nullptr, holdMs);
+        }
+        piezoSensor->startTimeout(getDetectionTimeoutMs(servoIndex));
         
-        // Start the 1-second timeout timer for piezo detection
-        piezoSensor->startTimeout();
+        // Single movement per attempt; release the hold as soon as the drop is seen
+        if (!droppedWhileAgitating) {
+            TickType_t holdEnd = moveStart + pdMS_TO_TICKS(holdMs);
+            int32_t holdLeft = (int32_t)(holdEnd - xTaskGetTickCount());
+            if (takeUnlessStopped(dropSemaphore, holdLeft > 0 ? (TickType_t)holdLeft : 0)) {
+                servos[servoIndex].releaseNow();
+            }
+        }
+        servos[servoIndex].waitForMotion();
+        if (!droppedWhileAgitating) {
+            stats.record(servoIndex, DispenseStats::MOVE, servos[servoIndex].getReleasedUs() - moveStartUs);
+        }
         
+        // Only the capture is waited for; its analysis continues in the background
         xSemaphoreTake(piezoSensor->getFinishedSemaphore(), portMAX_DELAY);
         if (piezoSensor->isTriggered()) {
+            // Late drops (after the hold) count too, otherwise the learned p99 would only shrink.
+            // A drop shaken loose has no stroke to time against.
+            TickType_t latency = piezoSensor->getLastTriggerTick() - moveStart;
+            if (!droppedWhileAgitating) {
+                dropLatency[servoIndex].add((uint16_t)std::min<TickType_t>(latency * portTICK_PERIOD_MS, UINT16_MAX));
+                lastTiming.dropMs = latency * portTICK_PERIOD_MS;
+                stats.record(servoIndex, DispenseStats::DROP, piezoSensor->getLastTriggerUs() - moveStartUs);
+            }
+            lastTiming.captureMs = piezoSensor->getLastCaptureMs();
+            lastTiming.totalMs = (xTaskGetTickCount() - dispenseStart) * portTICK_PERIOD_MS;
             piezoSensor->setIsPillDrop(false);
+            clearEmpty(servoIndex);
+            Inventory::getInstance().consume(servoIndex, 1);
+            stats.record(servoIndex, DispenseStats::DISPENSE, micros() - dispenseStartUs);
             return true;
-        } 
+        }
+        
+        // A cancelled attempt says nothing about the bottle
+        if (isStopRequested()) {
+            lastFailure = DispenseFailure::CANCELLED;
+            break;
+        }
+        if (noteTimeout(servoIndex)) {
+            lastFailure = DispenseFailure::PROBABLY_EMPTY;
+            break;
+        }
     }
 
+    if (lastFailure == DispenseFailure::NONE) {
+        lastFailure = DispenseFailure::NO_DROP;
+    } else if (lastFailure == DispenseFailure::PROBABLY_EMPTY) {
+        Inventory::getInstance().markEmpty(servoIndex);
+    }
+    lastTiming.totalMs = (xTaskGetTickCount() - dispenseStart) * portTICK_PERIOD_MS;
+    stats.record(servoIndex, DispenseStats::DISPENSE, micros() - dispenseStartUs);
+    Displayer::getInstance().logMessage("[SERVO] Servo " + String(servoIndex + 1) + " failed: " + failureName(lastFailure) + 
+                                      " after " + String(lastTiming.attempts) + " attempt(s), " + String(lastTiming.totalMs) + " ms");
+    return false;
+}
+
+bool ServoController::agitate(int servoIndex, SemaphoreHandle_t dropSemaphore) {
+    // Short wiggles at the current end loosen a bridged or wedged pill. They swing toward
+    // the other end, so the servo never leaves its calibrated travel.
+    const ServoCalibration& calibration = servos[servoIndex].getCalibration();
+    int base = servos[servoIndex].getCurrentAngle();
+    int other = base == calibration.startAngle ? calibration.dispenseAngle : calibration.startAngle;
+    int swing = constrain(other - base, -AGITATE_AMPLITUDE, AGITATE_AMPLITUDE);
+    
+    for (int cycle = 0; cycle < AGITATE_CYCLES && !isStopRequested(); cycle++) {
+        servos[servoIndex].startMove(base + swing, nullptr, AGITATE_STEP_MS);
+        servos[servoIndex].waitForMotion();
+        servos[servoIndex].startMove(base, nullptr, AGITATE_STEP_MS);
+        servos[servoIndex].waitForMotion();
+        
+        if (xSemaphoreTake(dropSemaphore, 0) == pdTRUE) {
+            return true;
+        }
+    }
     return false;
-}
\ No newline at end of file
+}
+
+bool ServoController::noteTimeout(int servoIndex) {
+    BottleState& bottle = bottles[servoIndex];
+    if (bottle.consecutiveTimeouts < UINT8_MAX) {
+        bottle.consecutiveTimeouts++;
+    }
+    if (!bottle.probablyEmpty && bottle.consecutiveTimeouts >= EMPTY_AFTER_TIMEOUTS) {
+        bottle.probablyEmpty = true;
+        Displayer::getInstance().logMessage("[SERVO] Servo " + String(servoIndex + 1) + " marked probably empty after " + 
+                                          String(bottle.consecutiveTimeouts) + " consecutive timeouts");
+    }
+    return bottle.probablyEmpty;
+}
+
+void ServoController::clearEmpty(int servoIndex) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return;
+    bottles[servoIndex] = BottleState();
+}
+
+const char* ServoController::failureName(DispenseFailure failure) {
+    switch (failure) {
+        case DispenseFailure::NONE:            return "NONE";
+        case DispenseFailure::INVALID_REQUEST: return "INVALID_REQUEST";
+        case DispenseFailure::NO_DROP:         return "NO_DROP";
+        case DispenseFailure::PROBABLY_EMPTY:  return "PROBABLY_EMPTY";
+        case DispenseFailure::CANCELLED:       return "CANCELLED";
+        default:                               return "-";
+    }
+}
+
+bool ServoController::setMotionProfile(int servoIndex, const MotionProfile& profile) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS) return false;
+    if (!profile.isValid()) return false;
+    
+    servos[servoIndex].setProfile(profile);
+    saveProfile(servoIndex);
+    return true;
+}
+
+int ServoController::runDispenseTrials(int servoIndex, int trials, int maxAttempts, unsigned long& totalMs) {
+    int failures = 0;
+    totalMs = 0;
+    
+    for (int t = 0; t < trials && !isStopRequested(); t++) {
+        clearEmpty(servoIndex);  // Trials judge the motion, so misses must not switch to fast-fail probing
+        int flawedBefore = piezoSensor->getFailedCount(servoIndex);
+        unsigned long start = millis();
+        bool dropped = Dispense(servoIndex, maxAttempts);
+        totalMs += millis() - start;
+        piezoSensor->waitForAnalysisIdle();  // The verdict arrives after Dispense returns
+        
+        // A missed drop or an abnormal pattern (e.g. jam, double pill) both count
+        if (!dropped || piezoSensor->getFailedCount(servoIndex) > flawedBefore) {
+            failures++;
+        }
+    }
+    return failures;
+}
+
+bool ServoController::tuneMotionProfile(int servoIndex, int trialsPerCandidate) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || !piezoSensor || trialsPerCandidate < 1) {
+        return false;
+    }
+    
+    // Candidate cruise velocities (deg/s), fastest first; acceleration and jerk scale with them
+    static const float candidateVelocities[] = {720.0f, 540.0f, 360.0f, 270.0f, 180.0f, 90.0f};
+    
+    MotionProfile original = servos[servoIndex].getProfile();
+    unsigned long baselineMs = 0;
+    int baselineFailures = runDispenseTrials(servoIndex, trialsPerCandidate, 1, baselineMs);
+    Displayer::getInstance().logMessage("[PROFILE] Baseline: " + String(baselineFailures) + "/" + String(trialsPerCandidate) + 
+                                      " failed, " + String(baselineMs / trialsPerCandidate) + " ms/pill");
+    
+    for (float velocity : candidateVelocities) {
+        MotionProfile candidate(velocity, velocity * 4.0f, velocity * 32.0f);
+        servos[servoIndex].setProfile(candidate);
+        
+        unsigned long candidateMs = 0;
+        int failures = runDispenseTrials(servoIndex, trialsPerCandidate, 1, candidateMs);
+        if (isStopRequested()) break;
+        Displayer::getInstance().logMessage("[PROFILE] " + String(velocity, 0) + " deg/s: " + String(failures) + "/" + 
+                                          String(trialsPerCandidate) + " failed, " + String(candidateMs / trialsPerCandidate) + " ms/pill");
+        
+        if (failures <= baselineFailures && candidateMs < baselineMs) {
+            Displayer::getInstance().logMessage("[PROFILE] Servo " + String(servoIndex + 1) + " tuned to " + String(velocity, 0) + 
+                                              " deg/s (" + String((long)(baselineMs - candidateMs) / trialsPerCandidate) + " ms/pill faster)");
+            saveProfile(servoIndex);
+            return true;
+        }
+    }
+    
+    servos[servoIndex].setProfile(original);
+    Displayer::getInstance().logMessage(isStopRequested() ? "[PROFILE] Tuning stopped - profile unchanged" : 
+                                                        "[PROFILE] No faster profile kept the failure rate - profile unchanged");
+    return false;
+}
+
+int ServoController::findMinimumAngle(int servoIndex, int trials) {
+    if (servoIndex < 0 || servoIndex >= Config::NUM_SERVOS || !piezoSensor || trials < 1) {
+        return -1;
+    }
+    
+    ServoCalibration calibration = servos[servoIndex].getCalibration();
+    const int originalAngle = calibration.dispenseAngle;
+    const int direction = originalAngle > calibration.startAngle ? 1 : -1;
+    
+    // Every probe starts from the start angle so it covers the full candidate stroke
+    auto probe = [&](int stroke) {
+        int candidate = calibration.startAngle + direction * stroke;
+        calibration.dispenseAngle = candidate;
+        servos[servoIndex].setCalibration(calibration);
+        if (servos[servoIndex].getCurrentAngle() != calibration.startAngle) {
+            servos[servoIndex].moveTo(calibration.startAngle);
+        }
+        unsigned long elapsedMs = 0;
+        int failures = runDispenseTrials(servoIndex, trials, ANGLE_TRIAL_ATTEMPTS, elapsedMs);
+        if (isStopRequested()) return StrokeSearch::Probe::STOPPED;
+        Displayer::getInstance().logMessage("[CALIB] Servo " + String(servoIndex + 1) + " at " + String(candidate) + "°: " + 
+                                          String(failures) + "/" + String(trials) + " failed");
+        return failures == 0 ? StrokeSearch::Probe::RELIABLE : StrokeSearch::Probe::UNRELIABLE;
+    };
+    
+    const int trustedStroke = abs(originalAngle - calibration.startAngle);
+    int reliable = StrokeSearch::shortestReliable(trustedStroke, ANGLE_SEARCH_RESOLUTION, probe);
+    if (reliable < 0) {
+        calibration.dispenseAngle = originalAngle;
+        servos[servoIndex].setCalibration(calibration);
+        Displayer::getInstance().logMessage("[CALIB] Servo " + String(servoIndex + 1) + 
+                                          (reliable == StrokeSearch::STOPPED ? " search stopped - kept " : " unreliable at its current angle - kept ") + 
+                                          String(originalAngle) + "°");
+        return -1;
+    }
+    
+    // Margin for wear and pill variation, never beyond the angle that was already trusted
+    int stroke = std::min(reliable + ANGLE_SAFETY_MARGIN, trustedStroke);
+    calibration.dispenseAngle = calibration.startAngle + direction * stroke;
+    servos[servoIndex].setCalibration(calibration);
+    saveCalibration(servoIndex);
+    
+    Displayer::getInstance().logMessage("[CALIB] Servo " + String(servoIndex + 1) + " dispense angle " + String(originalAngle) + 
+                                      "° -> " + String(calibration.dispenseAngle) + "°");
+    return calibration.dispenseAngle;
+}
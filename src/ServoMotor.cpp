@@ -1,69 +1,249 @@
 // src/ServoMotor.cpp
 #include "ServoMotor.h"
 
-// Static channel counter to assign unique PWM channels
-int ServoMotor::channelCounter = 0;
+ServoMotor* ServoMotor::registry[MAX_SERVOS] = {};
+volatile int ServoMotor::registered = 0;
+TaskHandle_t ServoMotor::motionTask = NULL;
 
-ServoMotor::ServoMotor(int servoPin) : pin(servoPin), currentAngle(0) {
-    pwmChannel = channelCounter++;
-    if (channelCounter > 15) {  // ESP32 has 16 LEDC channels
-        channelCounter = 0;  // Wrap around if needed
-    }
+ServoMotor::ServoMotor(int servoPin)
+    : pin(servoPin),
+      currentAngle(0),
+      targetAngle(0),
+      pwmChannel(-1),
+      moving(false),
+      haltRequested(false),
+      releasedUs(0),
+      dueUs(0),
+      motionDone(NULL),
+      completionCallback(nullptr),
+      finishedCallback(nullptr),
+      motionLock(NULL),
+      phase(Phase::IDLE),
+      motion{0.0f, 0.0f, 0.0f},
+      holdTimeMs(Config::SERVO_DELAY_MS) {
 }
 
 void ServoMotor::initialize() {
-    // Setup LEDC channel for this servo
-    // 50Hz frequency, 16-bit resolution for maximum precision
-    ledcSetup(pwmChannel, 50, 16);
-    ledcAttachPin(pin, pwmChannel);
-    
-    Serial.println("[SERVO] Initialized pin " + String(pin) + " on PWM channel " + String(pwmChannel));
+    // Claim an output on the configured PWM backend; running out or sharing one is a wiring/config error
+    PwmDriver& pwm = PwmDriver::getInstance();
+    pwmChannel = pwm.attach(pin);
+    if (pwmChannel < 0) {
+        Serial.println("[ERR] No " + String(pwm.name()) + " PWM channel for servo on pin " + String(pin));
+    }
     
-    // Move to default position
-    moveAndRelease(Config::DEFAULT_START_ANGLE);
-}
-
-uint32_t ServoMotor::angleToLEDC(int angle) {
-    // Convert angle (0-180°) to LEDC duty cycle
-    // Many servos need wider range than standard 1ms-2ms
-    // For 20ms period at 16-bit resolution (65535 counts):
+    motionDone = xSemaphoreCreateBinary();
+    motionLock = xSemaphoreCreateMutex();
     
-    // Wider pulse range for better servo compatibility
-    uint32_t minPulse = 1638;   // 0.5ms pulse width (0°)
-    uint32_t maxPulse = 8192;   // 2.5ms pulse width (180°)
+    // The motion task drives profile steps and the release at the end of each hold;
+    // above the command tasks, so a busy command never delays a release
+    registry[registered] = this;
+    registered = registered + 1;
+    if (motionTask == NULL) {
+        xTaskCreate(motionTaskLoop, "Servo Motion", 4096, nullptr, 3, &motionTask);
+    }
     
-    // Linear interpolation for precise positioning
-    uint32_t dutyCycle = minPulse + ((angle * (maxPulse - minPulse)) / 180);
+    Serial.println("[SERVO] Initialized pin " + String(pin) + " on " + String(pwm.name()) + " channel " + String(pwmChannel));
     
-    return dutyCycle;
+    // Move to the calibrated start position without waiting, so all servos initialize together
+    startMove(calibration.startAngle);
 }
 
-void ServoMotor::moveAndRelease(int target) {
+uint16_t ServoMotor::angleToPulseUs(float angle) {
+    // Linear interpolation between this servo's calibrated endpoints
+    if (calibration.reversed) {
+        angle = 180.0f - angle;
+    }
+    return calibration.minPulseUs + (uint16_t)((angle * (calibration.maxPulseUs - calibration.minPulseUs)) / 180.0f);
+}
+
+void ServoMotor::startMove(int target, MotionCallback onComplete, int holdMs) {
     // Constrain angle to valid range
     target = constrain(target, 0, 180);
     
-    // Calculate precise duty cycle
-    uint32_t dutyCycle = angleToLEDC(target);
+    // A new command supersedes a move that is still in progress; a profiled
+    // move continues from wherever it currently is. The lock keeps the motion
+    // task from stepping or releasing the old move in the middle of this.
+    xSemaphoreTake(motionLock, portMAX_DELAY);
+    if (!moving) {
+        motion = {(float)currentAngle, 0.0f, 0.0f};
+    }
+    xSemaphoreTake(motionDone, 0);  // Clear a stale completion
+    
+    targetAngle = target;
+    haltRequested = false;
+    completionCallback = onComplete;
+    holdTimeMs = holdMs;
+    moving = true;
+    
+    if (profile.isProfiled()) {
+        // Duty updates once per PWM frame until the profile arrives, then settle briefly;
+        // the fixed hold of a direct jump only exists to cover unknown travel time
+        phase = Phase::PROFILE;
+        holdTimeMs = std::min(holdMs, Config::SERVO_SETTLE_MS);
+        dueUs = nextFrameUs(micros());
+        xSemaphoreGive(motionLock);
+        wakeMotionTask();
+        Serial.println("[SERVO] Pin " + String(pin) + " profiled move to " + String(target) + "°");
+        return;
+    }
+    
+    // Calculate precise pulse width
+    uint16_t pulseUs = angleToPulseUs(target);
+    
+    // Send PWM signal, the motion task releases it after the hold
+    phase = Phase::HOLD;
+    motion.position = target;
+    PwmDriver::getInstance().write(pwmChannel, pulseUs);
+    dueUs = micros() + (uint32_t)holdMs * 1000;
+    xSemaphoreGive(motionLock);
+    wakeMotionTask();
+    
+    Serial.println("[SERVO] Pin " + String(pin) + " moving to " + String(target) + "° (pulse: " + String(pulseUs) + " us)");
+}
+
+void ServoMotor::wakeMotionTask() {
+    if (motionTask != NULL) xTaskNotifyGive(motionTask);
+}
+
+uint32_t ServoMotor::nextFrameUs(uint32_t now) {
+    return now - now % PROFILE_TICK_US + PROFILE_TICK_US;
+}
+
+void ServoMotor::motionTaskLoop(void* parameter) {
+    PwmDriver& pwm = PwmDriver::getInstance();
+    while (true) {
+        // Profile steps share one frame grid, so every servo stepping this frame goes out
+        // in a single flush (one I2C transaction per PCA9685 board)
+        uint32_t now = micros();
+        int32_t wait = IDLE;
+        pwm.beginBatch();
+        for (int i = 0; i < registered; i++) {
+            wait = std::min(wait, registry[i]->service(now));
+        }
+        pwm.endBatch();
+        
+        // After the flush and outside every lock, so a callback may start the next move
+        for (int i = 0; i < registered; i++) {
+            registry[i]->runFinishedCallback();
+        }
+        
+        // Sleep until the earliest deadline; startMove() cuts the sleep short for a new one
+        TickType_t ticks = wait == IDLE ? portMAX_DELAY : pdMS_TO_TICKS((std::max(wait, (int32_t)0) + 999) / 1000);
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+
+void ServoMotor::runFinishedCallback() {
+    if (!finishedCallback) return;
+    MotionCallback callback = std::move(finishedCallback);
+    finishedCallback = nullptr;
+    callback(*this);
+}
+
+int32_t ServoMotor::service(uint32_t now) {
+    MotionCallback callback;
+    bool finished = false;
+    xSemaphoreTake(motionLock, portMAX_DELAY);
     
-    // Send PWM signal
-    ledcWrite(pwmChannel, dutyCycle);
+    // Deadlines only ever come from this servo's current move, under this lock, so nothing
+    // left over from a superseded move can act on the new one
+    if (moving && (int32_t)(now - dueUs) >= 0) {
+        if (phase == Phase::PROFILE) {
+            if (haltRequested) {
+                // Stop where the profile got to instead of finishing the stroke
+                haltRequested = false;
+                targetAngle = (int)lroundf(motion.position);
+                motion = {(float)targetAngle, 0.0f, 0.0f};
+                phase = Phase::HOLD;
+                finished = finishMove(callback);
+            } else {
+                bool arrived = MotionPlanner::step(profile, motion, targetAngle, Config::SERVO_PROFILE_TICK_MS / 1000.0f);
+                PwmDriver::getInstance().write(pwmChannel, angleToPulseUs(motion.position));
+                
+                if (arrived) {
+                    phase = Phase::HOLD;
+                    dueUs = now + (uint32_t)holdTimeMs * 1000;
+                } else {
+                    // One step per PWM frame; a late wake-up does not make the next step early
+                    dueUs += PROFILE_TICK_US;
+                    if ((int32_t)(dueUs - now) <= 0) dueUs = nextFrameUs(now);
+                }
+            }
+        } else {
+            finished = finishMove(callback);
+        }
+    }
+    int32_t wait = moving ? (int32_t)(dueUs - now) : IDLE;
+    xSemaphoreGive(motionLock);
     
-    // Hold position for specified time
-    delay(Config::SERVO_DELAY_MS);
+    if (finished) {
+        finishedCallback = std::move(callback);
+    }
+    return wait;
+}
+
+bool ServoMotor::finishMove(MotionCallback& callback) {
+    // Only one of the motion task and releaseNow() may complete a move
+    if (!moving || phase != Phase::HOLD) return false;
+    phase = Phase::IDLE;
+    moving = false;
     
     // Release servo (stop PWM signal to save power)
-    ledcWrite(pwmChannel, 0);
+    PwmDriver::getInstance().write(pwmChannel, 0);
+    releasedUs = micros();
     
     // Update current position
-    currentAngle = target;
+    currentAngle = targetAngle;
+    
+    callback.swap(completionCallback);
+    xSemaphoreGive(motionDone);
+    return true;
+}
+
+bool ServoMotor::waitForMotion(TickType_t timeout) {
+    if (!moving) return true;
+    
+    if (xSemaphoreTake(motionDone, timeout) == pdTRUE) {
+        return true;
+    }
+    return !moving;
+}
+
+void ServoMotor::releaseNow() {
+    MotionCallback callback;
+    bool finished = false;
+    xSemaphoreTake(motionLock, portMAX_DELAY);
+    if (moving && phase == Phase::HOLD) {
+        finished = finishMove(callback);
+    } else if (moving) {
+        // Profiled move still travelling: release as soon as it arrives
+        holdTimeMs = 0;
+    }
+    xSemaphoreGive(motionLock);
+    
+    if (finished && callback) {
+        callback(*this);
+    }
+}
+
+void ServoMotor::halt() {
+    xSemaphoreTake(motionLock, portMAX_DELAY);
+    bool travelling = moving && phase == Phase::PROFILE;
+    if (travelling) {
+        // The motion task owns the profile state; it stops at its next step
+        haltRequested = true;
+    }
+    xSemaphoreGive(motionLock);
     
-    Serial.println("[SERVO] Pin " + String(pin) + " moved to " + String(target) + "° (duty: " + String(dutyCycle) + ")");
+    // Already at its target, only the hold is left
+    if (!travelling) releaseNow();
 }
 
 void ServoMotor::moveTo(int targetAngle) {
-    moveAndRelease(targetAngle);
+    startMove(targetAngle);
+    waitForMotion();
 }
 
 void ServoMotor::reset() {
-    moveAndRelease(Config::RESET_ANGLE);
+    moveTo(Config::RESET_ANGLE);
 }
@@ -0,0 +1,96 @@
+// src/ThresholdCalibrator.cpp
+#include "ThresholdCalibrator.h"
+#include <vector>
+#include <cmath>
+
+namespace {
+    constexpr int NUM_BINS = ThresholdCalibrator::SWEEP_POINTS + 1;
+
+    // Bin 0 holds scores below the lowest threshold; a score in bin b clears thresholds 0 .. b-1
+    int scoreToBin(float score) {
+        if (score < ThresholdCalibrator::SWEEP_MIN) return 0;
+        int bin = (int)floorf((score - ThresholdCalibrator::SWEEP_MIN) / ThresholdCalibrator::SWEEP_STEP + 1e-4f) + 1;
+        return bin < NUM_BINS ? bin : NUM_BINS - 1;
+    }
+
+    float binThreshold(int k) {
+        return ThresholdCalibrator::SWEEP_MIN + k * ThresholdCalibrator::SWEEP_STEP;
+    }
+}
+
+CalibrationResult ThresholdCalibrator::sweep(const ScoreSample* samples, int count, SimilarityMode mode,
+                                             float currentChannelThreshold, volatile bool* cancel) {
+    CalibrationResult result = {};
+    result.channelThreshold = currentChannelThreshold;
+
+    const bool sweepChannel = mode == SimilarityMode::STRICT;
+    const int channelBins = sweepChannel ? NUM_BINS : 1;
+
+    // Histogram the labeled scores once; every threshold pair is then a suffix-sum lookup
+    // instead of a pass over all samples.
+    std::vector<uint16_t> good(NUM_BINS * channelBins, 0);
+    std::vector<uint16_t> flawed(NUM_BINS * channelBins, 0);
+
+    for (int i = 0; i < count; i++) {
+        const ScoreSample& s = samples[i];
+        if (s.label == LABEL_UNKNOWN) continue;
+
+        float score = s.avgSimilarity;
+        if (mode == SimilarityMode::BEST_OF_BOTH && s.bestSimilarity > score) {
+            score = s.bestSimilarity;
+        }
+        int idx = scoreToBin(score) * channelBins + (sweepChannel ? scoreToBin(s.minSimilarity) : 0);
+
+        if (s.label == LABEL_GOOD) {
+            good[idx]++;
+            result.goodSamples++;
+        } else {
+            flawed[idx]++;
+            result.flawedSamples++;
+        }
+    }
+
+    if (result.goodSamples < MIN_GOOD_SAMPLES || result.flawedSamples < MIN_FLAWED_SAMPLES) {
+        return result;
+    }
+
+    // 2D suffix sums: acc[a][c] = samples whose bins are >= a and >= c
+    for (int a = NUM_BINS - 1; a >= 0; a--) {
+        for (int c = channelBins - 1; c >= 0; c--) {
+            int idx = a * channelBins + c;
+            int right = c + 1 < channelBins ? idx + 1 : -1;
+            int down = a + 1 < NUM_BINS ? idx + channelBins : -1;
+            int diag = (right >= 0 && down >= 0) ? down + 1 : -1;
+            good[idx] += (right >= 0 ? good[right] : 0) + (down >= 0 ? good[down] : 0) - (diag >= 0 ? good[diag] : 0);
+            flawed[idx] += (right >= 0 ? flawed[right] : 0) + (down >= 0 ? flawed[down] : 0) - (diag >= 0 ? flawed[diag] : 0);
+        }
+    }
+
+    // Scan strictest thresholds first so ties resolve towards rejecting
+    float bestCost = INFINITY;
+    const int channelPoints = sweepChannel ? SWEEP_POINTS : 1;
+    for (int ka = SWEEP_POINTS - 1; ka >= 0; ka--) {
+        if (cancel && *cancel) {
+            result.valid = false;
+            return result;
+        }
+        for (int kc = channelPoints - 1; kc >= 0; kc--) {
+            int idx = (ka + 1) * channelBins + (sweepChannel ? kc + 1 : 0);
+            float far = (float)flawed[idx] / result.flawedSamples;
+            float frr = (float)(result.goodSamples - good[idx]) / result.goodSamples;
+            float cost = FALSE_ACCEPT_WEIGHT * far + frr;
+            result.evaluatedPairs++;
+
+            if (cost < bestCost) {
+                bestCost = cost;
+                result.valid = true;
+                result.averageThreshold = binThreshold(ka);
+                if (sweepChannel) result.channelThreshold = binThreshold(kc);
+                result.falseAcceptRate = far;
+                result.falseRejectRate = frr;
+            }
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,102 @@
+// src/WireProtocol.cpp
+#include "WireProtocol.h"
+#include <string.h>
+
+namespace WireProtocol {
+
+Writer::Writer(uint8_t* buffer, size_t capacity, Type type) : buffer(buffer), capacity(capacity), used(0), overflow(false) {
+    if (capacity < HEADER_SIZE) {
+        overflow = true;
+        return;
+    }
+    buffer[0] = VERSION;
+    buffer[1] = (uint8_t)type;
+    used = HEADER_SIZE;
+}
+
+uint8_t* Writer::reserve(Tag tag, size_t length) {
+    if (overflow || length > UINT16_MAX || capacity - used < fieldSize(length)) {
+        overflow = true;
+        return nullptr;
+    }
+    uint8_t* field = buffer + used;
+    field[0] = (uint8_t)tag;
+    field[1] = (uint8_t)(length & 0xFF);
+    field[2] = (uint8_t)(length >> 8);
+    used += fieldSize(length);
+    return field + FIELD_HEADER_SIZE;
+}
+
+void Writer::putU8(Tag tag, uint8_t value) {
+    uint8_t* out = reserve(tag, 1);
+    if (out) out[0] = value;
+}
+
+void Writer::putU16(Tag tag, uint16_t value) {
+    uint8_t* out = reserve(tag, 2);
+    if (!out) return;
+    out[0] = (uint8_t)(value & 0xFF);
+    out[1] = (uint8_t)(value >> 8);
+}
+
+void Writer::putU32(Tag tag, uint32_t value) {
+    uint8_t* out = reserve(tag, 4);
+    if (!out) return;
+    for (int i = 0; i < 4; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+void Writer::putText(Tag tag, std::string_view text) {
+    uint8_t* out = reserve(tag, text.size());
+    if (out && !text.empty()) memcpy(out, text.data(), text.size());
+}
+
+void Writer::putSamples(Tag tag, const int* values, size_t count, size_t step) {
+    if (step == 0) step = 1;
+    size_t kept = (count + step - 1) / step;
+    uint8_t* out = reserve(tag, kept * 2);
+    if (!out) return;
+
+    for (size_t i = 0; i < count; i += step) {
+        int value = values[i] < 0 ? 0 : (values[i] > UINT16_MAX ? UINT16_MAX : values[i]);
+        *out++ = (uint8_t)(value & 0xFF);
+        *out++ = (uint8_t)(value >> 8);
+    }
+}
+
+uint32_t Field::u32() const {
+    if (length < 4) return u16();
+    return (uint32_t)value[0] | ((uint32_t)value[1] << 8) | ((uint32_t)value[2] << 16) | ((uint32_t)value[3] << 24);
+}
+
+Reader::Reader(const uint8_t* data, size_t length)
+    : data(data), length(length), offset(HEADER_SIZE), headerValid(false), truncated(false), messageType(Type::LOG) {
+    if (data != nullptr && length >= HEADER_SIZE && data[0] == VERSION) {
+        headerValid = true;
+        messageType = (Type)data[1];
+    }
+}
+
+bool Reader::next(Field& field) {
+    if (!headerValid || truncated || offset == length) return false;
+    if (length - offset < FIELD_HEADER_SIZE) {
+        truncated = true;
+        return false;
+    }
+
+    const uint8_t* header = data + offset;
+    uint16_t valueLength = (uint16_t)(header[1] | (header[2] << 8));
+    if (length - offset - FIELD_HEADER_SIZE < valueLength) {
+        truncated = true;
+        return false;
+    }
+
+    field.tag = (Tag)header[0];
+    field.value = header + FIELD_HEADER_SIZE;
+    field.length = valueLength;
+    offset += FIELD_HEADER_SIZE + valueLength;
+    return true;
+}
+
+}
@@ -6,6 +6,8 @@
 #include "SequenceManager.h"
 #include "CommandHandler.h"
 #include "Displayer.h"
+#include "Inventory.h"
+#include "CommandJournal.h"
 
 // Global objects
 ServoController servoController;
@@ -14,10 +16,13 @@ SequenceManager sequenceManager(servoController);
 CommandHandler commandHandler(servoController, piezoSensor, sequenceManager);
 
 void setup() {
+    Serial.setRxBufferSize(Config::SERIAL_RX_BUFFER_SIZE);  // Must precede begin()
     Serial.begin(115200);
     
-    // Initialize all components
+    // Initialize all components; the journal first, so no resent command is admitted before it is loaded
+    CommandJournal::getInstance().initialize();
     Displayer::getInstance().initialize();
+    Inventory::getInstance().initialize();
     piezoSensor.initialize();  // Initialize piezo sensor
     servoController.initialize();
     servoController.setPiezoSensor(&piezoSensor);
@@ -28,6 +33,9 @@ void setup() {
     piezoSensor.setLogCallback([](const String& msg) {
         Displayer::getInstance().logMessage(msg);
     });
+    piezoSensor.setGraphCallback([](int servoIndex, int triggerChannel, const std::vector<std::vector<int>>& channels) {
+        Displayer::getInstance().broadcastGraph(servoIndex, triggerChannel, channels);
+    });
     
     // Start tasks
     commandHandler.startTask();
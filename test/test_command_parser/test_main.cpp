@@ -0,0 +1,163 @@
+// test/test_command_parser/test_main.cpp
+// Host-side checks and fuzzing of the command tokenizer and the verb table.
+#include <unity.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include "CommandParser.h"
+#include "CommandVerbs.h"
+
+// CommandHandler's verbs, each with its Verb as the handler
+static constexpr CommandVerbs::VerbTable VERBS;
+static constexpr size_t VERB_COUNT = CommandVerbs::COUNT;
+static constexpr CommandTable<Verb, VERB_COUNT> COMMANDS(VERBS.specs);
+static_assert(COMMANDS.valid(), "Verb table needs a collision-free seed");
+
+static std::mt19937 random_(41);
+
+void setUp() {}
+void tearDown() {}
+
+void test_every_verb_is_found_case_insensitively() {
+    for (size_t i = 0; i < VERB_COUNT; i++) {
+        std::string lower(CommandVerbs::SPECS[i].verb);
+        for (char& c : lower) c = (char)tolower(c);
+        TEST_ASSERT_EQUAL(i, COMMANDS.find(CommandVerbs::SPECS[i].verb)->handler);
+        TEST_ASSERT_NOT_NULL(COMMANDS.find(lower));
+        TEST_ASSERT_EQUAL(i, COMMANDS.find(lower)->handler);
+    }
+}
+
+void test_shared_prefixes_route_exactly() {
+    // The old startsWith chain could never reach RESETDATA and sent STARTANGLE to ANGLE
+    TEST_ASSERT_TRUE(COMMANDS.find("reset")->handler == Verb::RESET);
+    TEST_ASSERT_TRUE(COMMANDS.find("RESETDATA")->handler == Verb::RESETDATA);
+    TEST_ASSERT_TRUE(COMMANDS.find("ANGLE")->handler == Verb::ANGLE);
+    TEST_ASSERT_TRUE(COMMANDS.find("STARTANGLE")->handler == Verb::STARTANGLE);
+    TEST_ASSERT_NULL(COMMANDS.find("RESE"));
+    TEST_ASSERT_NULL(COMMANDS.find("RESETDATAX"));
+    TEST_ASSERT_NULL(COMMANDS.find(""));
+}
+
+void test_tokenizer_splits_in_place() {
+    const char* line = "  SERVOCAL\t2  dispense 28 \r\n";
+    CommandArgs args(line);
+    TEST_ASSERT_TRUE(args.verb() == "SERVOCAL");
+    TEST_ASSERT_EQUAL(3, args.count());
+    TEST_ASSERT_TRUE(args[0] == "2");
+    TEST_ASSERT_TRUE(args.is(1, "DISPENSE"));
+    TEST_ASSERT_TRUE(args[3].empty());
+    TEST_ASSERT_TRUE(args[1].data() >= line && args[1].data() < line + strlen(line));
+    
+    int value = 0;
+    TEST_ASSERT_TRUE(args.toInt(2, value));
+    TEST_ASSERT_EQUAL(28, value);
+    TEST_ASSERT_TRUE(args.rest(1) == "dispense 28");
+}
+
+void test_rest_keeps_names_with_spaces() {
+    CommandArgs args("EXECUTE device1 morning  pills ");
+    TEST_ASSERT_TRUE(args[0] == "device1");
+    TEST_ASSERT_TRUE(args.rest(1) == "morning  pills");
+    TEST_ASSERT_TRUE(args.rest(5).empty());
+}
+
+void test_tokens_beyond_the_limit_stay_in_rest() {
+    std::string line = "MULTI";
+    for (int i = 0; i < CommandParser::MAX_TOKENS + 3; i++) line += " " + std::to_string(i + 1);
+    CommandArgs args(line);
+    TEST_ASSERT_EQUAL(CommandParser::MAX_TOKENS - 1, args.count());
+    TEST_ASSERT_TRUE(args.rest(0) == std::string_view(line).substr(6));
+}
+
+void test_integer_edges() {
+    int value = 0;
+    TEST_ASSERT_TRUE(CommandArgs::parseInt("2147483647", value));
+    TEST_ASSERT_EQUAL(2147483647, value);
+    TEST_ASSERT_TRUE(CommandArgs::parseInt("-2147483648", value));
+    TEST_ASSERT_EQUAL(-2147483647LL - 1, value);
+    TEST_ASSERT_TRUE(CommandArgs::parseInt("+7", value));
+    TEST_ASSERT_EQUAL(7, value);
+    TEST_ASSERT_FALSE(CommandArgs::parseInt("2147483648", value));
+    TEST_ASSERT_FALSE(CommandArgs::parseInt("99999999999999999999", value));
+    TEST_ASSERT_FALSE(CommandArgs::parseInt("", value));
+    TEST_ASSERT_FALSE(CommandArgs::parseInt("-", value));
+    TEST_ASSERT_FALSE(CommandArgs::parseInt("12a", value));
+    TEST_ASSERT_FALSE(CommandArgs::parseInt("1.5", value));
+}
+
+void test_float_edges() {
+    float value = 0.0f;
+    TEST_ASSERT_TRUE(CommandArgs::parseFloat("0.85", value));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.85f, value);
+    TEST_ASSERT_TRUE(CommandArgs::parseFloat(".5", value));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.5f, value);
+    TEST_ASSERT_TRUE(CommandArgs::parseFloat("-3.", value));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, -3.0f, value);
+    TEST_ASSERT_FALSE(CommandArgs::parseFloat(".", value));
+    TEST_ASSERT_FALSE(CommandArgs::parseFloat("1e3", value));
+    TEST_ASSERT_FALSE(CommandArgs::parseFloat("", value));
+}
+
+// Random bytes, biased towards separators, digits and real verbs so the interesting paths run
+static std::string randomLine() {
+    static const char* pieces[] = {" ", "\t", "-", "+", "0", "9", "2147483648", "RESET", "resetdata", "ANGLE", "x"};
+    std::string line;
+    int parts = random_() % 16;
+    for (int i = 0; i < parts; i++) {
+        if (random_() % 3 == 0) line += pieces[random_() % (sizeof(pieces) / sizeof(pieces[0]))];
+        else line += (char)(random_() % 256);
+    }
+    return line;
+}
+
+void test_fuzz_tokenizer_and_lookup() {
+    for (int n = 0; n < 200000; n++) {
+        std::string line = randomLine();
+        std::string_view view(line);
+        CommandArgs args(view);
+    
+        TEST_ASSERT_TRUE(args.count() >= 0 && args.count() < CommandParser::MAX_TOKENS);
+        for (int i = -1; i <= args.count(); i++) {
+            std::string_view token = i < 0 ? args.verb() : args[i];
+            if (token.empty()) continue;
+            // Every token is a non-empty view into the line without separators
+            TEST_ASSERT_TRUE(token.data() >= view.data() && token.data() + token.size() <= view.data() + view.size());
+            for (char c : token) TEST_ASSERT_FALSE(CommandParser::isSpace(c));
+        }
+        std::string_view rest = args.rest(0);
+        TEST_ASSERT_TRUE(rest.empty() || (rest.data() >= view.data() && rest.data() + rest.size() <= view.data() + view.size()));
+    
+        const CommandSpec<Verb>* spec = COMMANDS.find(args.verb());
+        if (spec) TEST_ASSERT_TRUE(CommandParser::equalsIgnoreCase(spec->verb, args.verb()));
+    
+        // parseInt agrees with strtoll on tokens of an optional sign and digits only
+        for (int i = 0; i < args.count(); i++) {
+            std::string token(args[i]);
+            int value = 0;
+            bool parsed = CommandArgs::parseInt(args[i], value);
+            size_t digits = (token[0] == '+' || token[0] == '-') ? 1 : 0;
+            errno = 0;
+            long long reference = strtoll(token.c_str(), nullptr, 10);
+            bool expected = digits < token.size() && token.find_first_not_of("0123456789", digits) == std::string::npos &&
+                            errno == 0 && reference >= INT32_MIN && reference <= INT32_MAX;
+            TEST_ASSERT_EQUAL(expected, parsed);
+            if (parsed) TEST_ASSERT_EQUAL(reference, value);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_verb_is_found_case_insensitively);
+    RUN_TEST(test_shared_prefixes_route_exactly);
+    RUN_TEST(test_tokenizer_splits_in_place);
+    RUN_TEST(test_rest_keeps_names_with_spaces);
+    RUN_TEST(test_tokens_beyond_the_limit_stay_in_rest);
+    RUN_TEST(test_integer_edges);
+    RUN_TEST(test_float_edges);
+    RUN_TEST(test_fuzz_tokenizer_and_lookup);
+    return UNITY_END();
+}
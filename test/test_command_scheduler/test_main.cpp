@@ -0,0 +1,200 @@
+// test/test_command_scheduler/test_main.cpp
+// Host-side checks of CommandScheduler: lane limits, reserved slots, deficit round-robin,
+// and a load simulation of one client flooding the device next to two ordinary ones.
+#include <unity.h>
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+#include "CommandScheduler.h"
+
+// Same shape as the firmware: Config::COMMAND_QUEUE_LENGTH slots, Displayer::COMMAND_LANES
+// lanes (5 WebSocket clients, serial, local), COMMAND_CLIENT_DEPTH and COMMAND_JOB_COST
+constexpr int SLOTS = 12;
+constexpr int LANES = 7;
+constexpr int DEPTH = 5;
+constexpr int JOB_COST = 4;
+
+using Scheduler = CommandScheduler<SLOTS, LANES>;
+
+void setUp() {}
+void tearDown() {}
+
+void test_lane_is_fifo_and_depth_limited() {
+    Scheduler scheduler(DEPTH, JOB_COST);
+    int slots[DEPTH];
+    for (int i = 0; i < DEPTH; i++) {
+        slots[i] = scheduler.push(0, 1);
+        TEST_ASSERT_NOT_EQUAL(Scheduler::NONE, slots[i]);
+    }
+    TEST_ASSERT_EQUAL(0, scheduler.space(0));
+    TEST_ASSERT_EQUAL(Scheduler::NONE, scheduler.push(0, 1));
+    
+    for (int i = 0; i < DEPTH; i++) {
+        TEST_ASSERT_EQUAL(slots[i], scheduler.pop());
+    }
+    TEST_ASSERT_EQUAL(Scheduler::NONE, scheduler.pop());
+    TEST_ASSERT_EQUAL(0, scheduler.pending());
+}
+
+void test_flooding_clients_leave_a_slot_for_every_idle_lane() {
+    Scheduler scheduler(DEPTH, JOB_COST);
+    
+    // Two clients queue as much as they are allowed to
+    int flooded = 0;
+    for (int lane = 0; lane < 2; lane++) {
+        while (scheduler.push(lane, JOB_COST) != Scheduler::NONE) flooded++;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(SLOTS - (LANES - 2), flooded);
+    
+    // Every other lane still gets its command in
+    for (int lane = 2; lane < LANES; lane++) {
+        TEST_ASSERT_EQUAL(1, scheduler.space(lane) > 0);
+        TEST_ASSERT_NOT_EQUAL(Scheduler::NONE, scheduler.push(lane, 1));
+    }
+    TEST_ASSERT_EQUAL(SLOTS, scheduler.pending());
+}
+
+void test_single_client_gets_its_full_depth() {
+    // A batch of COMMAND_CLIENT_DEPTH commands must fit next to the reserved slots
+    Scheduler scheduler(DEPTH, JOB_COST);
+    TEST_ASSERT_EQUAL(DEPTH, scheduler.space(LANES - 1));
+    for (int i = 0; i < DEPTH; i++) {
+        TEST_ASSERT_NOT_EQUAL(Scheduler::NONE, scheduler.push(LANES - 1, JOB_COST));
+    }
+}
+
+void test_quick_commands_interleave_with_jobs() {
+    // One job per round against a quantum's worth of quick commands
+    Scheduler scheduler(DEPTH, JOB_COST);
+    int owner[SLOTS];
+    for (int i = 0; i < 2; i++) owner[scheduler.push(0, JOB_COST)] = 0;
+    for (int i = 0; i < DEPTH; i++) owner[scheduler.push(1, 1)] = 1;
+    TEST_ASSERT_EQUAL(2 + DEPTH, scheduler.pending());
+    
+    int order[7];
+    for (int i = 0; i < 7; i++) order[i] = owner[scheduler.pop()];
+    const int expected[7] = {0, 1, 1, 1, 1, 0, 1};
+    for (int i = 0; i < 7; i++) TEST_ASSERT_EQUAL(expected[i], order[i]);
+}
+
+void test_urgent_runs_first_and_bypasses_lane_limits() {
+    Scheduler scheduler(DEPTH, JOB_COST);
+    scheduler.push(0, 1);
+    scheduler.push(1, 1);
+    int first = scheduler.pushUrgent();
+    int second = scheduler.pushUrgent();
+    TEST_ASSERT_EQUAL(second, scheduler.pop());
+    TEST_ASSERT_EQUAL(first, scheduler.pop());
+    TEST_ASSERT_EQUAL(2, scheduler.pending());
+}
+
+void test_random_operations_keep_invariants() {
+    Scheduler scheduler(DEPTH, JOB_COST);
+    std::deque<int> model[LANES];
+    int owner[SLOTS] = {};
+    std::mt19937 random(3);
+    
+    for (int step = 0; step < 200000; step++) {
+        int op = random() % 3;
+        if (op < 2) {
+            int lane = random() % LANES;
+            int space = scheduler.space(lane);
+            int slot = scheduler.push(lane, 1 + random() % 6);
+            TEST_ASSERT_EQUAL(space > 0, slot != Scheduler::NONE);
+            if (slot != Scheduler::NONE) {
+                owner[slot] = lane;
+                model[lane].push_back(slot);
+            }
+        } else if (random() % 50 == 0) {
+            int slot = scheduler.pushUrgent();
+            if (slot != Scheduler::NONE) TEST_ASSERT_EQUAL(slot, scheduler.pop());
+        } else {
+            int slot = scheduler.pop();
+            if (slot != Scheduler::NONE) {
+                int lane = owner[slot];
+                TEST_ASSERT_FALSE(model[lane].empty());
+                TEST_ASSERT_EQUAL(model[lane].front(), slot);
+                model[lane].pop_front();
+            }
+        }
+    
+        int total = 0;
+        int empty = 0;
+        for (int lane = 0; lane < LANES; lane++) {
+            TEST_ASSERT_EQUAL((int)model[lane].size(), scheduler.pending(lane));
+            TEST_ASSERT_LESS_OR_EQUAL(DEPTH, scheduler.pending(lane));
+            total += model[lane].size();
+            if (model[lane].empty()) empty++;
+        }
+        TEST_ASSERT_EQUAL(total, scheduler.pending());
+        // Lane pushes never eat into the slots held back for empty lanes
+        TEST_ASSERT_LESS_OR_EQUAL(SLOTS - empty, total);
+    }
+}
+
+// Discrete-time load simulation in 1 ms steps. Client 0 retries a PILL (cost 4, 800 ms)
+// every 10 ms; client 1 sends a quick command (20 ms) every 1.5 s; client 2 a PILL every 4 s.
+struct Command {
+    int client;
+    int serviceMs;
+    int cost;
+    long queuedMs;
+};
+
+struct LoadResult {
+    std::vector<long> waits[3];
+    int dropped[3] = {0, 0, 0};
+};
+
+static LoadResult simulate() {
+    Scheduler scheduler(DEPTH, JOB_COST);
+    Command slots[SLOTS];
+    LoadResult result;
+    long busyUntil = 0;
+    
+    auto submit = [&](const Command& command) {
+        int slot = scheduler.push(command.client, command.cost);
+        if (slot == Scheduler::NONE) result.dropped[command.client]++;
+        else slots[slot] = command;
+    };
+    
+    for (long t = 0; t < 600000; t++) {
+        if (t % 10 == 0) submit({0, 800, JOB_COST, t});
+        if (t % 1500 == 7) submit({1, 20, 1, t});
+        if (t % 4000 == 13) submit({2, 800, JOB_COST, t});
+        if (t >= busyUntil) {
+            int slot = scheduler.pop();
+            if (slot != Scheduler::NONE) {
+                result.waits[slots[slot].client].push_back(t - slots[slot].queuedMs);
+                busyUntil = t + slots[slot].serviceMs;
+            }
+        }
+    }
+    return result;
+}
+
+void test_flooding_client_does_not_starve_others() {
+    LoadResult result = simulate();
+    TEST_ASSERT_EQUAL(0, result.dropped[1]);
+    TEST_ASSERT_EQUAL(0, result.dropped[2]);
+    TEST_ASSERT_GREATER_THAN(0, result.dropped[0]);
+    
+    // Each ordinary command waits at most for the job in progress and one job per other lane
+    for (int client = 1; client < 3; client++) {
+        long worst = *std::max_element(result.waits[client].begin(), result.waits[client].end());
+        TEST_ASSERT_LESS_OR_EQUAL(3 * 800, worst);
+    }
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_lane_is_fifo_and_depth_limited);
+    RUN_TEST(test_flooding_clients_leave_a_slot_for_every_idle_lane);
+    RUN_TEST(test_single_client_gets_its_full_depth);
+    RUN_TEST(test_quick_commands_interleave_with_jobs);
+    RUN_TEST(test_urgent_runs_first_and_bypasses_lane_limits);
+    RUN_TEST(test_random_operations_keep_invariants);
+    RUN_TEST(test_flooding_client_does_not_starve_others);
+    return UNITY_END();
+}
@@ -0,0 +1,204 @@
+// test/test_drop_attribution/test_main.cpp
+// Host-side simulation of concurrent dispensing: synthetic impacts from servos at different
+// spots above three piezos, overlapped in one capture window and attributed back to their servo.
+#include <unity.h>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "DropAttributor.h"
+
+constexpr int CHANNELS = 3;
+constexpr int SERVOS = 3;
+constexpr int THRESHOLD = 100;
+constexpr int QUIET_SAMPLES = 10;
+constexpr int WINDOW = 600;
+
+// Where each servo drops relative to the sensors: amplitude share and arrival lag per channel
+struct ServoGeometry {
+    float gain[CHANNELS];
+    int lag[CHANNELS];
+};
+
+static const ServoGeometry GEOMETRY[SERVOS] = {
+    {{1.0f, 0.4f, 0.15f}, {0, 3, 6}},
+    {{0.15f, 0.4f, 1.0f}, {6, 3, 0}},
+    {{0.35f, 1.0f, 0.35f}, {3, 0, 3}},
+};
+
+static std::mt19937 random_(7);
+static DropSignature signatures[SERVOS];
+
+using Capture = std::vector<std::vector<int>>;
+
+static Capture emptyCapture() {
+    Capture capture(CHANNELS, std::vector<int>(WINDOW, 0));
+    std::uniform_int_distribution<int> noise(0, 20);
+    for (auto& channel : capture) {
+        for (int& x : channel) x = noise(random_);
+    }
+    return capture;
+}
+
+// A pill hitting the plate: fast rise, exponential ring-down, amplitude and lag jittered
+static void addImpact(Capture& capture, int servo, int onset) {
+    std::uniform_real_distribution<float> amplitude(1350.0f, 1650.0f);
+    std::uniform_int_distribution<int> jitter(-1, 1);
+    float a = amplitude(random_);
+    for (int c = 0; c < CHANNELS; c++) {
+        float peak = a * GEOMETRY[servo].gain[c];
+        int start = onset + GEOMETRY[servo].lag[c] + (c == 0 ? 0 : jitter(random_));
+        for (int t = 0; t < 120 && start + t < WINDOW; t++) {
+            float rise = t < 3 ? (t + 1) / 3.0f : 1.0f;
+            capture[c][start + t] += (int)(peak * rise * expf(-t / 15.0f));
+        }
+    }
+}
+
+static int segment(const Capture& capture, ImpactFeatures* impacts) {
+    return DropAttributor::segmentImpacts(capture, CHANNELS, THRESHOLD, QUIET_SAMPLES, impacts, DropAttributor::MAX_IMPACTS);
+}
+
+static AttributionResult attribute(const Capture& capture, const AttributionCandidate* candidates, int count) {
+    ImpactFeatures impacts[DropAttributor::MAX_IMPACTS];
+    int impactCount = segment(capture, impacts);
+    return DropAttributor::attribute(impacts, impactCount, candidates, count, CHANNELS);
+}
+
+// Signatures come from the first test, which trains them
+static void candidatesFor(AttributionCandidate* candidates, int count, const float* expectedOnsets) {
+    for (int s = 0; s < count; s++) {
+        candidates[s].servo = s;
+        candidates[s].expectedOnset = expectedOnsets ? expectedOnsets[s] : -1.0f;
+        candidates[s].onsetTolerance = 20.0f;
+        candidates[s].signature = &signatures[s];
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_isolated_impacts_train_signatures() {
+    for (int s = 0; s < SERVOS; s++) {
+        signatures[s] = DropSignature();
+        for (int n = 0; n < 20; n++) {
+            Capture capture = emptyCapture();
+            addImpact(capture, s, 100);
+            ImpactFeatures impacts[DropAttributor::MAX_IMPACTS];
+            TEST_ASSERT_EQUAL(1, segment(capture, impacts));
+            DropAttributor::updateSignature(signatures[s], impacts[0], CHANNELS);
+        }
+        TEST_ASSERT_TRUE(signatures[s].ready());
+    }
+    // Each servo is loudest on its own channel
+    TEST_ASSERT_GREATER_THAN(signatures[0].shareMean[1], signatures[0].shareMean[0]);
+    TEST_ASSERT_GREATER_THAN(signatures[1].shareMean[1], signatures[1].shareMean[2]);
+    TEST_ASSERT_GREATER_THAN(signatures[2].shareMean[0], signatures[2].shareMean[1]);
+}
+
+void test_separate_impacts_in_any_order() {
+    // No timing hints: the signatures alone tell the servos apart
+    AttributionCandidate candidates[SERVOS];
+    candidatesFor(candidates, SERVOS, nullptr);
+    
+    const int onsets[SERVOS] = {380, 60, 220};
+    Capture capture = emptyCapture();
+    for (int s = 0; s < SERVOS; s++) addImpact(capture, s, onsets[s]);
+    
+    AttributionResult result = attribute(capture, candidates, SERVOS);
+    TEST_ASSERT_EQUAL(SERVOS, result.impactCount);
+    for (int i = 0; i < result.impactCount; i++) {
+        int servo = result.assigned[i];
+        TEST_ASSERT_TRUE(result.confident[i]);
+        TEST_ASSERT_LESS_OR_EQUAL(2, abs(result.impacts[i].onset - onsets[servo]));
+    }
+    for (int s = 0; s < SERVOS; s++) TEST_ASSERT_EQUAL((int)DropVerdict::DROPPED, (int)result.verdicts[s]);
+}
+
+void test_overlapping_impacts_are_split_and_attributed() {
+    // Servo 1 lands while servo 0 is still ringing
+    AttributionCandidate candidates[2];
+    candidatesFor(candidates, 2, nullptr);
+    
+    Capture capture = emptyCapture();
+    addImpact(capture, 0, 100);
+    addImpact(capture, 1, 130);
+    
+    AttributionResult result = attribute(capture, candidates, 2);
+    TEST_ASSERT_EQUAL(2, result.impactCount);
+    TEST_ASSERT_EQUAL(0, result.assigned[0]);
+    TEST_ASSERT_EQUAL(1, result.assigned[1]);
+    TEST_ASSERT_EQUAL((int)DropVerdict::DROPPED, (int)result.verdicts[0]);
+    TEST_ASSERT_EQUAL((int)DropVerdict::DROPPED, (int)result.verdicts[1]);
+}
+
+void test_missing_pill_is_reported_for_its_servo() {
+    const float expected[SERVOS] = {60.0f, 220.0f, 380.0f};
+    AttributionCandidate candidates[SERVOS];
+    candidatesFor(candidates, SERVOS, expected);
+    
+    Capture capture = emptyCapture();
+    addImpact(capture, 0, 60);
+    addImpact(capture, 2, 380);
+    
+    AttributionResult result = attribute(capture, candidates, SERVOS);
+    TEST_ASSERT_EQUAL(2, result.impactCount);
+    TEST_ASSERT_EQUAL((int)DropVerdict::DROPPED, (int)result.verdicts[0]);
+    TEST_ASSERT_EQUAL((int)DropVerdict::MISSING, (int)result.verdicts[1]);
+    TEST_ASSERT_EQUAL((int)DropVerdict::DROPPED, (int)result.verdicts[2]);
+}
+
+void test_double_pill_is_reported_as_multiple() {
+    const float expected[2] = {60.0f, 300.0f};
+    AttributionCandidate candidates[2];
+    candidatesFor(candidates, 2, expected);
+    
+    Capture capture = emptyCapture();
+    addImpact(capture, 0, 60);
+    addImpact(capture, 1, 300);
+    addImpact(capture, 1, 450);
+    
+    AttributionResult result = attribute(capture, candidates, 2);
+    TEST_ASSERT_EQUAL(3, result.impactCount);
+    TEST_ASSERT_EQUAL((int)DropVerdict::DROPPED, (int)result.verdicts[0]);
+    TEST_ASSERT_EQUAL((int)DropVerdict::MULTIPLE, (int)result.verdicts[1]);
+}
+
+void test_quiet_window_leaves_every_servo_missing() {
+    AttributionCandidate candidates[SERVOS];
+    candidatesFor(candidates, SERVOS, nullptr);
+    
+    AttributionResult result = attribute(emptyCapture(), candidates, SERVOS);
+    TEST_ASSERT_EQUAL(0, result.impactCount);
+    for (int s = 0; s < SERVOS; s++) TEST_ASSERT_EQUAL((int)DropVerdict::MISSING, (int)result.verdicts[s]);
+    TEST_ASSERT_EQUAL((int)DropVerdict::NOT_REQUESTED, (int)result.verdicts[SERVOS]);
+}
+
+void test_untrained_servos_with_same_timing_are_ambiguous() {
+    // Without signatures and with identical expected onsets, a lone impact cannot be placed
+    DropSignature untrained;
+    AttributionCandidate candidates[2] = {
+        {0, 100.0f, 20.0f, &untrained},
+        {1, 100.0f, 20.0f, &untrained},
+    };
+    
+    Capture capture = emptyCapture();
+    addImpact(capture, 0, 100);
+    
+    AttributionResult result = attribute(capture, candidates, 2);
+    TEST_ASSERT_EQUAL(1, result.impactCount);
+    TEST_ASSERT_FALSE(result.confident[0]);
+    TEST_ASSERT_EQUAL((int)DropVerdict::AMBIGUOUS, (int)result.verdicts[0]);
+    TEST_ASSERT_EQUAL((int)DropVerdict::AMBIGUOUS, (int)result.verdicts[1]);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_isolated_impacts_train_signatures);
+    RUN_TEST(test_separate_impacts_in_any_order);
+    RUN_TEST(test_overlapping_impacts_are_split_and_attributed);
+    RUN_TEST(test_missing_pill_is_reported_for_its_servo);
+    RUN_TEST(test_double_pill_is_reported_as_multiple);
+    RUN_TEST(test_quiet_window_leaves_every_servo_missing);
+    RUN_TEST(test_untrained_servos_with_same_timing_are_ambiguous);
+    return UNITY_END();
+}
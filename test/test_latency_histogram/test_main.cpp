@@ -0,0 +1,97 @@
+// test/test_latency_histogram/test_main.cpp
+// Bucket boundaries and percentile lookup of the dispense latency histogram.
+#include <unity.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "LatencyHistogram.h"
+
+static std::mt19937 random_(40);
+
+void setUp() {}
+void tearDown() {}
+
+void test_buckets_tile_the_range() {
+    TEST_ASSERT_EQUAL(176, LatencyHistogram::BUCKETS);
+    uint32_t expectedLow = 0;
+    for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+        uint32_t low = LatencyHistogram::bucketLow(i);
+        uint32_t width = LatencyHistogram::bucketWidth(i);
+        TEST_ASSERT_EQUAL(expectedLow, low);
+        TEST_ASSERT_EQUAL(i, LatencyHistogram::bucketOf(low));
+        TEST_ASSERT_EQUAL(i, LatencyHistogram::bucketOf(low + width - 1));
+        if (low >= (uint32_t)LatencyHistogram::SUB_BUCKETS) TEST_ASSERT_TRUE(width * 8 <= low);   // <= 12.5%
+        expectedLow = low + width;
+    }
+    TEST_ASSERT_EQUAL(LatencyHistogram::MAX_VALUE + 1, expectedLow);
+    TEST_ASSERT_EQUAL(LatencyHistogram::BUCKETS - 1, LatencyHistogram::bucketOf(LatencyHistogram::MAX_VALUE));
+}
+
+void test_exact_below_eight_microseconds() {
+    LatencyHistogram histogram;
+    for (uint32_t us = 0; us < 8; us++) histogram.record(us);
+    TEST_ASSERT_EQUAL(8, histogram.count());
+    TEST_ASSERT_EQUAL(0, histogram.percentile(0.125f));
+    TEST_ASSERT_EQUAL(3, histogram.percentile(0.5f));
+    TEST_ASSERT_EQUAL(7, histogram.percentile(1.0f));
+}
+
+void test_percentiles_within_one_bucket_of_exact() {
+    std::lognormal_distribution<double> latency(9.0, 1.5);   // Around 8 ms, long tail
+    for (int round = 0; round < 20; round++) {
+        LatencyHistogram histogram;
+        std::vector<uint32_t> samples;
+        int count = 1 + random_() % 5000;
+        for (int i = 0; i < count; i++) {
+            uint32_t us = (uint32_t)std::min(latency(random_), 2.0e7);
+            samples.push_back(us);
+            histogram.record(us);
+        }
+        std::sort(samples.begin(), samples.end());
+        TEST_ASSERT_EQUAL(samples.back(), histogram.max());
+        
+        for (float fraction : {0.01f, 0.5f, 0.95f, 0.99f, 1.0f}) {
+            // The sample of that rank, clamped like record() clamps
+            size_t rank = (size_t)std::max(1.0f, std::ceil(fraction * count - 0.001f)) - 1;
+            uint32_t exact = std::min(samples[rank], LatencyHistogram::MAX_VALUE);
+            int bucket = LatencyHistogram::bucketOf(exact);
+            uint32_t reported = histogram.percentile(fraction);
+            TEST_ASSERT_EQUAL(bucket, LatencyHistogram::bucketOf(reported));
+        }
+    }
+}
+
+void test_full_bucket_halves_the_histogram() {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 1000; i++) histogram.record(100000);
+    for (uint32_t i = 0; i < UINT16_MAX; i++) histogram.record(1000);
+    TEST_ASSERT_EQUAL(1000 + UINT16_MAX, histogram.count());
+    
+    // The next sample in the full bucket halves everything first
+    histogram.record(1000);
+    TEST_ASSERT_EQUAL(500 + UINT16_MAX / 2 + 1, histogram.count());
+    TEST_ASSERT_EQUAL(LatencyHistogram::bucketOf(1000), LatencyHistogram::bucketOf(histogram.percentile(0.5f)));
+    TEST_ASSERT_EQUAL(LatencyHistogram::bucketOf(100000), LatencyHistogram::bucketOf(histogram.percentile(1.0f)));
+    TEST_ASSERT_EQUAL(100000, histogram.max());
+}
+
+void test_empty_and_reset() {
+    LatencyHistogram histogram;
+    TEST_ASSERT_EQUAL(0, histogram.percentile(0.5f));
+    histogram.record(5000);
+    histogram.reset();
+    TEST_ASSERT_EQUAL(0, histogram.count());
+    TEST_ASSERT_EQUAL(0, histogram.max());
+    TEST_ASSERT_EQUAL(0, histogram.percentile(0.99f));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_buckets_tile_the_range);
+    RUN_TEST(test_exact_below_eight_microseconds);
+    RUN_TEST(test_percentiles_within_one_bucket_of_exact);
+    RUN_TEST(test_full_bucket_halves_the_histogram);
+    RUN_TEST(test_empty_and_reset);
+    return UNITY_END();
+}
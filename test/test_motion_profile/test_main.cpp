@@ -0,0 +1,100 @@
+// test/test_motion_profile/test_main.cpp
+// Profiled moves stay within their limits and never pass the target.
+#include <unity.h>
+#include <cmath>
+#include <random>
+#include "MotionPlanner.h"
+
+static constexpr float DT = 0.02f;    // Config::SERVO_PROFILE_TICK_MS
+static std::mt19937 random_(32);
+
+void setUp() {}
+void tearDown() {}
+
+// Run a move to completion and check every frame against the profile
+static void checkMove(const MotionProfile& profile, float from, float to) {
+    MotionState state = {from, 0.0f, 0.0f};
+    float distance = fabsf(to - from);
+    float direction = to >= from ? 1.0f : -1.0f;
+    
+    // Time-optimal S-curve is at most distance / V + V / A + A / J; allow slack for the frame grid
+    float bound = distance / profile.maxVelocity + profile.maxVelocity / profile.acceleration +
+                  (profile.jerk > 0.0f ? profile.acceleration / profile.jerk : 0.0f);
+    int maxFrames = (int)(1.5f * bound / DT) + 20;
+    
+    float previousAccel = 0.0f;
+    for (int frame = 0; frame < maxFrames; frame++) {
+        bool arrived = MotionPlanner::step(profile, state, to, DT);
+        if (arrived) {
+            TEST_ASSERT_EQUAL_FLOAT(to, state.position);
+            TEST_ASSERT_EQUAL_FLOAT(0.0f, state.velocity);
+            return;
+        }
+        TEST_ASSERT_TRUE(fabsf(state.velocity) <= profile.maxVelocity + 1e-3f);
+        TEST_ASSERT_TRUE(fabsf(state.acceleration) <= profile.acceleration + 1e-3f);
+        if (profile.jerk > 0.0f) {
+            TEST_ASSERT_TRUE(fabsf(state.acceleration - previousAccel) <= profile.jerk * DT * 1.001f);
+        }
+        TEST_ASSERT_TRUE(direction * (to - state.position) > 0.0f);
+        previousAccel = state.acceleration;
+    }
+    TEST_FAIL_MESSAGE("move did not arrive");
+}
+
+void test_reported_overshoot_cases() {
+    // 70° at 400 deg/s and 3000 deg/s^2 peaked at 532 and 480 deg/s and overshot by 4.3° and 2°
+    checkMove(MotionProfile(400.0f, 3000.0f, 10000.0f), 10.0f, 80.0f);
+    checkMove(MotionProfile(400.0f, 3000.0f, 30000.0f), 10.0f, 80.0f);
+    checkMove(MotionProfile(400.0f, 3000.0f, 10000.0f), 80.0f, 10.0f);
+}
+
+void test_trapezoidal_profiles() {
+    checkMove(MotionProfile(400.0f, 3000.0f), 10.0f, 80.0f);
+    checkMove(MotionProfile(90.0f, 200.0f), 0.0f, 180.0f);
+    checkMove(MotionProfile(1000.0f, 50000.0f), 30.0f, 31.0f);
+}
+
+void test_tuner_candidates() {
+    // ServoController::tuneProfile tries (v, 4v, 32v)
+    for (float v : {60.0f, 120.0f, 360.0f, 720.0f}) {
+        checkMove(MotionProfile(v, 4.0f * v, 32.0f * v), 0.0f, 90.0f);
+        checkMove(MotionProfile(v, 4.0f * v, 32.0f * v), 90.0f, 85.0f);
+    }
+}
+
+void test_random_profiles() {
+    std::uniform_real_distribution<float> angle(0.0f, 180.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int n = 0; n < 2000; n++) {
+        float velocity = 20.0f + 980.0f * unit(random_);
+        float accel = velocity * (1.0f + 49.0f * unit(random_));
+        float jerk = unit(random_) < 0.2f ? 0.0f : accel * (1.0f + 49.0f * unit(random_));
+        checkMove(MotionProfile(velocity, accel, jerk), angle(random_), angle(random_));
+    }
+}
+
+void test_redirected_move_arrives() {
+    // A new target mid-move continues from the current velocity
+    MotionProfile profile(400.0f, 3000.0f, 10000.0f);
+    MotionState state = {0.0f, 0.0f, 0.0f};
+    for (int frame = 0; frame < 10; frame++) MotionPlanner::step(profile, state, 120.0f, DT);
+    TEST_ASSERT_TRUE(state.velocity > 0.0f);
+    
+    bool arrived = false;
+    for (int frame = 0; frame < 500 && !arrived; frame++) {
+        arrived = MotionPlanner::step(profile, state, 20.0f, DT);
+        TEST_ASSERT_TRUE(fabsf(state.velocity) <= profile.maxVelocity + 1e-3f);
+    }
+    TEST_ASSERT_TRUE(arrived);
+    TEST_ASSERT_EQUAL_FLOAT(20.0f, state.position);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_reported_overshoot_cases);
+    RUN_TEST(test_trapezoidal_profiles);
+    RUN_TEST(test_tuner_candidates);
+    RUN_TEST(test_random_profiles);
+    RUN_TEST(test_redirected_move_arrives);
+    return UNITY_END();
+}
@@ -0,0 +1,111 @@
+// test/test_parser_benchmark/test_main.cpp
+// Host-side benchmark of command dispatch: the in-place tokenizer and hashed verb table
+// against the copy-uppercase-split-and-scan approach it replaced. Only correctness is
+// asserted; the timings are printed for comparison across changes.
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "CommandParser.h"
+#include "CommandVerbs.h"
+
+// CommandHandler's verbs, each with its Verb as the handler
+static constexpr CommandVerbs::VerbTable VERBS;
+static constexpr size_t VERB_COUNT = CommandVerbs::COUNT;
+static constexpr CommandTable<Verb, VERB_COUNT> COMMANDS(VERBS.specs);
+
+// A mix like the one the console and the web UI send, verbs late in the table included
+static const char* const SAMPLES[] = {
+    "PILL 3", "pill 1", "STATS", "STATS 2", "MULTI 1 2 3 4 5 6", "SEQUENCE device1 morning 1 2 1",
+    "EXECUTE device1 morning", "THRESHOLD 2 120 0.85 40", "SERVOCAL 4 dispense 28", "REFILL 3 30",
+    "LABEL 2 vitamin-d", "  angle 95  ", "RESETDATA 2", "UNKNOWN 1", "PROFILE 1 slow 500 2",
+};
+static constexpr int SAMPLE_COUNT = sizeof(SAMPLES) / sizeof(SAMPLES[0]);
+static constexpr int ROUNDS = 200000;
+
+// The old path: an uppercase copy of the line, split into owned strings, verbs compared in turn
+static int legacyDispatch(const std::string& line, std::vector<std::string>& tokens) {
+    std::string upper = line;
+    for (char& c : upper) c = CommandParser::toUpper(c);
+    tokens.clear();
+    size_t i = 0;
+    while (true) {
+        while (i < upper.size() && CommandParser::isSpace(upper[i])) i++;
+        if (i == upper.size()) break;
+        size_t start = i;
+        while (i < upper.size() && !CommandParser::isSpace(upper[i])) i++;
+        tokens.push_back(upper.substr(start, i - start));
+    }
+    if (tokens.empty()) return -1;
+    for (size_t v = 0; v < VERB_COUNT; v++) {
+        if (tokens[0] == CommandVerbs::SPECS[v].verb) return (int)CommandVerbs::SPECS[v].id;
+    }
+    return -1;
+}
+
+static int tableDispatch(std::string_view line, int& argumentSum) {
+    CommandArgs args(line);
+    const CommandSpec<Verb>* spec = COMMANDS.find(args.verb());
+    if (!spec) return -1;
+    int value = 0;
+    for (int i = 0; i < args.count(); i++) {
+        if (args.toInt(i, value)) argumentSum += value;
+    }
+    return (int)spec->handler;
+}
+
+template <typename F>
+static double nanosPerCommand(F&& run) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int s = 0; s < SAMPLE_COUNT; s++) run(s);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ((double)ROUNDS * SAMPLE_COUNT);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_both_paths_route_the_same() {
+    std::vector<std::string> tokens;
+    for (int s = 0; s < SAMPLE_COUNT; s++) {
+        int sum = 0;
+        TEST_ASSERT_EQUAL(legacyDispatch(SAMPLES[s], tokens), tableDispatch(SAMPLES[s], sum));
+    }
+    int sum = 0;
+    TEST_ASSERT_EQUAL(-1, tableDispatch("UNKNOWN 1", sum));
+}
+
+void test_dispatch_timing() {
+    std::vector<std::string> legacyLines(SAMPLES, SAMPLES + SAMPLE_COUNT);
+    long legacyHits = 0;
+    long tableHits = 0;
+    int argumentSum = 0;
+    
+    double legacy = nanosPerCommand([&](int s) {
+        std::vector<std::string> parsed;
+        legacyHits += legacyDispatch(legacyLines[s], parsed) >= 0;
+        // Argument parsing on the old path went through String::toInt on each copy
+        for (size_t i = 1; i < parsed.size(); i++) argumentSum += atoi(parsed[i].c_str());
+    });
+    double table = nanosPerCommand([&](int s) {
+        tableHits += tableDispatch(SAMPLES[s], argumentSum) >= 0;
+    });
+    
+    char message[128];
+    snprintf(message, sizeof(message), "legacy %.1f ns/command, table %.1f ns/command (%.1fx)", legacy, table, legacy / table);
+    TEST_MESSAGE(message);
+    // Keeps the loops from being optimised away
+    TEST_ASSERT_EQUAL(legacyHits, tableHits);
+    TEST_ASSERT_NOT_EQUAL(0, argumentSum);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_both_paths_route_the_same);
+    RUN_TEST(test_dispatch_timing);
+    return UNITY_END();
+}
@@ -0,0 +1,174 @@
+// test/test_serial_framer/test_main.cpp
+// Text lines and checksummed frames through the serial console framer, clean and under noise.
+#include <unity.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "SerialFramer.h"
+
+static std::mt19937 random_(43);
+
+void setUp() {}
+void tearDown() {}
+
+static std::string frame(uint8_t sequence, const std::string& payload) {
+    std::string out;
+    out += (char)SerialFramer::FRAME_START;
+    out += (char)sequence;
+    out += (char)payload.size();
+    out += payload;
+    uint8_t crc = 0;
+    for (size_t i = 1; i < out.size(); i++) crc = SerialFramer::crc8(crc, (uint8_t)out[i]);
+    out += (char)crc;
+    return out;
+}
+
+// Feed the input one byte per millisecond and collect every event but NONE
+static std::vector<SerialFramer::Event> feedAll(SerialFramer& framer, const std::string& input, uint32_t& now,
+                                                std::vector<std::string>* data = nullptr) {
+    std::vector<SerialFramer::Event> events;
+    for (char c : input) {
+        SerialFramer::Event event = framer.feed((uint8_t)c, ++now);
+        if (event == SerialFramer::Event::NONE) continue;
+        events.push_back(event);
+        if (data) data->push_back(std::string(framer.data(), framer.length()));
+    }
+    return events;
+}
+
+void test_crc8_check_value() {
+    // CRC-8 with polynomial 0x07 and zero init
+    uint8_t crc = 0;
+    for (char c : std::string("123456789")) crc = SerialFramer::crc8(crc, (uint8_t)c);
+    TEST_ASSERT_EQUAL(0xF4, crc);
+}
+
+void test_text_lines() {
+    SerialFramer framer;
+    uint32_t now = 0;
+    std::vector<std::string> data;
+    auto events = feedAll(framer, "PILL 1\r\n\r\n\nSTATS\n", now, &data);
+    TEST_ASSERT_EQUAL(2, events.size());
+    TEST_ASSERT_TRUE(events[0] == SerialFramer::Event::LINE && data[0] == "PILL 1");
+    TEST_ASSERT_TRUE(events[1] == SerialFramer::Event::LINE && data[1] == "STATS");
+}
+
+void test_long_line_is_dropped_whole() {
+    SerialFramer framer;
+    uint32_t now = 0;
+    std::vector<std::string> data;
+    auto events = feedAll(framer, std::string(SerialFramer::MAX_LINE + 20, 'x') + "\nRESET\n", now, &data);
+    TEST_ASSERT_EQUAL(2, events.size());
+    TEST_ASSERT_TRUE(events[0] == SerialFramer::Event::OVERFLOW);
+    TEST_ASSERT_TRUE(events[1] == SerialFramer::Event::LINE && data[1] == "RESET");
+    
+    // Exactly MAX_LINE still fits
+    events = feedAll(framer, std::string(SerialFramer::MAX_LINE, 'y') + "\n", now, &data);
+    TEST_ASSERT_EQUAL(1, events.size());
+    TEST_ASSERT_TRUE(events[0] == SerialFramer::Event::LINE && data.back().size() == SerialFramer::MAX_LINE);
+}
+
+void test_frames_round_trip() {
+    SerialFramer framer;
+    uint32_t now = 0;
+    std::vector<std::string> data;
+    std::string full(SerialFramer::MAX_PAYLOAD, 'z');
+    auto events = feedAll(framer, frame(7, "PILL 1\nPILL 2") + frame(8, "") + frame(9, full) + "STATS\n", now, &data);
+    TEST_ASSERT_EQUAL(4, events.size());
+    TEST_ASSERT_TRUE(events[0] == SerialFramer::Event::FRAME && data[0] == "PILL 1\nPILL 2");
+    TEST_ASSERT_TRUE(events[1] == SerialFramer::Event::FRAME && data[1].empty());
+    TEST_ASSERT_TRUE(events[2] == SerialFramer::Event::FRAME && data[2] == full);
+    TEST_ASSERT_EQUAL(9, framer.sequence());
+    TEST_ASSERT_TRUE(events[3] == SerialFramer::Event::LINE && data[3] == "STATS");
+}
+
+void test_corrupt_frame_is_reported() {
+    SerialFramer framer;
+    uint32_t now = 0;
+    std::string bad = frame(3, "PILL 4");
+    bad[4] ^= 0x20;
+    auto events = feedAll(framer, bad + frame(4, "PILL 4"), now);
+    TEST_ASSERT_EQUAL(2, events.size());
+    TEST_ASSERT_TRUE(events[0] == SerialFramer::Event::BAD_FRAME);
+    TEST_ASSERT_TRUE(events[1] == SerialFramer::Event::FRAME);
+    TEST_ASSERT_EQUAL(4, framer.sequence());
+}
+
+void test_stalled_frame_times_out() {
+    SerialFramer framer;
+    uint32_t now = 0;
+    std::string partial = frame(5, "PILL 2").substr(0, 5);
+    TEST_ASSERT_EQUAL(0, feedAll(framer, partial, now).size());
+    
+    // The first byte after the timeout reports the frame and is read as text
+    now += SerialFramer::FRAME_TIMEOUT_MS + 1;
+    TEST_ASSERT_TRUE(framer.feed('R', now) == SerialFramer::Event::BAD_FRAME);
+    TEST_ASSERT_EQUAL(5, framer.sequence());
+    std::vector<std::string> data;
+    auto events = feedAll(framer, "ESET\n", now, &data);
+    TEST_ASSERT_EQUAL(1, events.size());
+    TEST_ASSERT_TRUE(data[0] == "RESET");
+}
+
+void test_frame_start_inside_a_line_is_text() {
+    SerialFramer framer;
+    uint32_t now = 0;
+    std::vector<std::string> data;
+    auto events = feedAll(framer, "AB" + frame(1, "X") + "\n", now, &data);
+    TEST_ASSERT_EQUAL(1, events.size());
+    TEST_ASSERT_TRUE(events[0] == SerialFramer::Event::LINE && data[0] == "AB" + frame(1, "X"));
+}
+
+void test_fuzz_serial_framer() {
+    SerialFramer framer;
+    uint32_t now = 0;
+    for (int n = 0; n < 1000000; n++) {
+        now += random_() % 4 == 0 ? random_() % 700 : 1;
+        SerialFramer::Event event = framer.feed((uint8_t)(random_() % 256), now);
+        if (event == SerialFramer::Event::LINE) {
+            TEST_ASSERT_LESS_OR_EQUAL(SerialFramer::MAX_LINE, framer.length());
+            TEST_ASSERT_EQUAL('\0', framer.data()[framer.length()]);
+        } else if (event == SerialFramer::Event::FRAME) {
+            TEST_ASSERT_LESS_OR_EQUAL(SerialFramer::MAX_PAYLOAD, framer.length());
+            TEST_ASSERT_EQUAL('\0', framer.data()[framer.length()]);
+        }
+    }
+}
+
+void test_frames_survive_surrounding_noise() {
+    // Valid frames sent after a line ending always arrive intact, whatever text came before
+    SerialFramer framer;
+    uint32_t now = 0;
+    for (int n = 0; n < 5000; n++) {
+        std::string noise;
+        int noiseLength = random_() % 300;
+        for (int i = 0; i < noiseLength; i++) noise += (char)(' ' + random_() % 95);
+        std::string payload = "PILL " + std::to_string(random_() % 6 + 1) + "\nSTATS";
+        uint8_t sequence = (uint8_t)n;
+        std::string input = noise + "\n" + frame(sequence, payload);
+    
+        bool delivered = false;
+        for (char c : input) {
+            if (framer.feed((uint8_t)c, ++now) == SerialFramer::Event::FRAME) {
+                TEST_ASSERT_EQUAL(sequence, framer.sequence());
+                TEST_ASSERT_TRUE(std::string(framer.data(), framer.length()) == payload);
+                delivered = true;
+            }
+        }
+        TEST_ASSERT_TRUE(delivered);
+    }
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc8_check_value);
+    RUN_TEST(test_text_lines);
+    RUN_TEST(test_long_line_is_dropped_whole);
+    RUN_TEST(test_frames_round_trip);
+    RUN_TEST(test_corrupt_frame_is_reported);
+    RUN_TEST(test_stalled_frame_times_out);
+    RUN_TEST(test_frame_start_inside_a_line_is_text);
+    RUN_TEST(test_fuzz_serial_framer);
+    RUN_TEST(test_frames_survive_surrounding_noise);
+    return UNITY_END();
+}
@@ -0,0 +1,72 @@
+// test/test_stroke_search/test_main.cpp
+// The minimum-angle search against a known reliability threshold.
+#include <unity.h>
+#include <functional>
+#include <vector>
+#include "StrokeSearch.h"
+
+using StrokeSearch::Probe;
+
+static constexpr int RESOLUTION = 2;    // ServoController's ANGLE_SEARCH_RESOLUTION
+
+void setUp() {}
+void tearDown() {}
+
+// Strokes of at least `threshold` degrees dispense; records what was probed
+struct ThresholdProbe {
+    int threshold;
+    std::vector<int> probed;
+
+    Probe operator()(int stroke) {
+        probed.push_back(stroke);
+        return stroke >= threshold ? Probe::RELIABLE : Probe::UNRELIABLE;
+    }
+};
+
+void test_monotone_threshold_is_found_within_resolution() {
+    for (int longest = 1; longest <= 90; longest++) {
+        for (int threshold = 1; threshold <= longest; threshold++) {
+            ThresholdProbe probe = {threshold, {}};
+            int found = StrokeSearch::shortestReliable(longest, RESOLUTION, std::ref(probe));
+            TEST_ASSERT_TRUE(found >= threshold);
+            TEST_ASSERT_TRUE(found - threshold < RESOLUTION);
+            TEST_ASSERT_TRUE(found <= longest);
+            TEST_ASSERT_EQUAL(longest, probe.probed[0]);
+            TEST_ASSERT_TRUE(probe.probed.size() <= 7);    // The longest, then log2(90 / 2) rounded up
+        }
+    }
+}
+
+void test_no_stroke_works() {
+    ThresholdProbe probe = {91, {}};
+    TEST_ASSERT_EQUAL(StrokeSearch::NOT_RELIABLE, StrokeSearch::shortestReliable(60, RESOLUTION, std::ref(probe)));
+    TEST_ASSERT_EQUAL(1, probe.probed.size());
+}
+
+void test_every_stroke_works() {
+    ThresholdProbe probe = {0, {}};
+    int found = StrokeSearch::shortestReliable(60, RESOLUTION, std::ref(probe));
+    TEST_ASSERT_TRUE(found >= 0 && found <= RESOLUTION);
+    for (int stroke : probe.probed) TEST_ASSERT_TRUE(stroke > 0);
+}
+
+void test_stop_ends_the_search() {
+    int probes = 0;
+    auto probe = [&](int stroke) {
+        return ++probes == 3 ? Probe::STOPPED : Probe::RELIABLE;
+    };
+    TEST_ASSERT_EQUAL(StrokeSearch::STOPPED, StrokeSearch::shortestReliable(60, RESOLUTION, probe));
+    TEST_ASSERT_EQUAL(3, probes);
+    
+    auto stopAtOnce = [](int stroke) { return Probe::STOPPED; };
+    TEST_ASSERT_EQUAL(StrokeSearch::STOPPED, StrokeSearch::shortestReliable(60, RESOLUTION, stopAtOnce));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_monotone_threshold_is_found_within_resolution);
+    RUN_TEST(test_no_stroke_works);
+    RUN_TEST(test_every_stroke_works);
+    RUN_TEST(test_stop_ends_the_search);
+    return UNITY_END();
+}
@@ -0,0 +1,161 @@
+// test/test_threshold_calibrator/test_main.cpp
+// Host-side checks of the threshold sweep: the suffix-sum lookups against a brute-force pass
+// over every sample for every threshold pair, in each similarity mode.
+#include <unity.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "ThresholdCalibrator.h"
+
+using namespace ThresholdCalibrator;
+
+static std::mt19937 random_(27);
+
+// Scores sit mid-bin so the brute force and the binning agree on which thresholds they clear
+static float randomScore(float low, float high) {
+    int lowBin = (int)roundf((low - SWEEP_MIN) / SWEEP_STEP);
+    int highBin = (int)roundf((high - SWEEP_MIN) / SWEEP_STEP);
+    int bin = lowBin + (int)(random_() % (highBin - lowBin + 1));
+    return SWEEP_MIN + bin * SWEEP_STEP + SWEEP_STEP * 0.5f;
+}
+
+static std::vector<ScoreSample> randomHistory(int count) {
+    std::vector<ScoreSample> samples;
+    for (int i = 0; i < count; i++) {
+        ScoreSample s;
+        int kind = random_() % 5;
+        s.label = kind == 0 ? LABEL_UNKNOWN : (kind == 1 ? LABEL_FLAWED : LABEL_GOOD);
+        // Good dispenses score high, flawed ones lower, with overlap so the sweep has a trade-off
+        float low = s.label == LABEL_FLAWED ? 0.25f : 0.55f;
+        float high = s.label == LABEL_FLAWED ? 0.85f : 0.99f;
+        s.avgSimilarity = randomScore(low, high);
+        // Whole bins above and below the average keep the channel scores mid-bin too
+        s.bestSimilarity = std::min(0.99f + SWEEP_STEP * 0.5f, s.avgSimilarity + (random_() % 15) * SWEEP_STEP);
+        s.minSimilarity = s.avgSimilarity - (random_() % 20) * SWEEP_STEP;
+        samples.push_back(s);
+    }
+    return samples;
+}
+
+static bool accepts(const ScoreSample& s, SimilarityMode mode, float average, float channel) {
+    switch (mode) {
+        case SimilarityMode::BEST_OF_BOTH: return s.avgSimilarity >= average || s.bestSimilarity >= average;
+        case SimilarityMode::AVERAGE_ONLY: return s.avgSimilarity >= average;
+        case SimilarityMode::STRICT: return s.avgSimilarity >= average && s.minSimilarity >= channel;
+    }
+    return false;
+}
+
+// Same cost and tie-breaking as the sweep, one full pass per threshold pair
+static CalibrationResult bruteForce(const std::vector<ScoreSample>& samples, SimilarityMode mode, float currentChannel) {
+    CalibrationResult best = {};
+    best.channelThreshold = currentChannel;
+    for (const ScoreSample& s : samples) {
+        if (s.label == LABEL_GOOD) best.goodSamples++;
+        if (s.label == LABEL_FLAWED) best.flawedSamples++;
+    }
+    if (best.goodSamples < MIN_GOOD_SAMPLES || best.flawedSamples < MIN_FLAWED_SAMPLES) return best;
+    
+    float bestCost = INFINITY;
+    int channelPoints = mode == SimilarityMode::STRICT ? SWEEP_POINTS : 1;
+    for (int ka = SWEEP_POINTS - 1; ka >= 0; ka--) {
+        for (int kc = channelPoints - 1; kc >= 0; kc--) {
+            float average = SWEEP_MIN + ka * SWEEP_STEP;
+            float channel = mode == SimilarityMode::STRICT ? SWEEP_MIN + kc * SWEEP_STEP : currentChannel;
+            int goodAccepted = 0;
+            int flawedAccepted = 0;
+            for (const ScoreSample& s : samples) {
+                if (s.label == LABEL_UNKNOWN || !accepts(s, mode, average, channel)) continue;
+                if (s.label == LABEL_GOOD) goodAccepted++;
+                else flawedAccepted++;
+            }
+            float far = (float)flawedAccepted / best.flawedSamples;
+            float frr = (float)(best.goodSamples - goodAccepted) / best.goodSamples;
+            float cost = FALSE_ACCEPT_WEIGHT * far + frr;
+            if (cost < bestCost) {
+                bestCost = cost;
+                best.valid = true;
+                best.averageThreshold = average;
+                best.channelThreshold = channel;
+                best.falseAcceptRate = far;
+                best.falseRejectRate = frr;
+            }
+        }
+    }
+    return best;
+}
+
+static void assertMatchesBruteForce(SimilarityMode mode, int rounds) {
+    for (int round = 0; round < rounds; round++) {
+        std::vector<ScoreSample> samples = randomHistory(5 + random_() % (MAX_SAMPLES - 4));
+        CalibrationResult expected = bruteForce(samples, mode, 0.5f);
+        CalibrationResult result = sweep(samples.data(), (int)samples.size(), mode, 0.5f);
+    
+        TEST_ASSERT_EQUAL(expected.valid, result.valid);
+        TEST_ASSERT_EQUAL(expected.goodSamples, result.goodSamples);
+        TEST_ASSERT_EQUAL(expected.flawedSamples, result.flawedSamples);
+        if (!expected.valid) continue;
+        TEST_ASSERT_FLOAT_WITHIN(1e-4f, expected.averageThreshold, result.averageThreshold);
+        TEST_ASSERT_FLOAT_WITHIN(1e-4f, expected.channelThreshold, result.channelThreshold);
+        TEST_ASSERT_FLOAT_WITHIN(1e-6f, expected.falseAcceptRate, result.falseAcceptRate);
+        TEST_ASSERT_FLOAT_WITHIN(1e-6f, expected.falseRejectRate, result.falseRejectRate);
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_best_of_both_matches_brute_force() {
+    assertMatchesBruteForce(SimilarityMode::BEST_OF_BOTH, 300);
+}
+
+void test_average_only_matches_brute_force() {
+    assertMatchesBruteForce(SimilarityMode::AVERAGE_ONLY, 300);
+}
+
+void test_strict_matches_brute_force() {
+    // Every (average, channel) pair goes through the 2D suffix sums
+    assertMatchesBruteForce(SimilarityMode::STRICT, 40);
+}
+
+void test_best_channel_rescues_a_low_average_only_in_best_of_both() {
+    std::vector<ScoreSample> samples;
+    for (int i = 0; i < 4; i++) samples.push_back({0.505f, 0.905f, 0.405f, LABEL_GOOD});
+    samples.push_back({0.705f, 0.755f, 0.655f, LABEL_FLAWED});
+    
+    // The best channel alone separates the labels: accept at 0.76 and above
+    CalibrationResult best = sweep(samples.data(), (int)samples.size(), SimilarityMode::BEST_OF_BOTH, 0.5f);
+    TEST_ASSERT_TRUE(best.valid);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.90f, best.averageThreshold);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, best.falseAcceptRate);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, best.falseRejectRate);
+    
+    // On the average alone the good dispenses score below the flawed one
+    CalibrationResult average = sweep(samples.data(), (int)samples.size(), SimilarityMode::AVERAGE_ONLY, 0.5f);
+    TEST_ASSERT_TRUE(average.valid);
+    TEST_ASSERT_TRUE(2.0f * average.falseAcceptRate + average.falseRejectRate > 0.0f);
+    TEST_ASSERT_EQUAL_FLOAT(0.5f, average.channelThreshold);
+}
+
+void test_too_few_labels_or_cancel_gives_no_result() {
+    std::vector<ScoreSample> samples(MIN_GOOD_SAMPLES, ScoreSample{0.9f, 0.9f, 0.9f, LABEL_GOOD});
+    samples.push_back({0.4f, 0.4f, 0.4f, LABEL_UNKNOWN});
+    TEST_ASSERT_FALSE(sweep(samples.data(), (int)samples.size(), SimilarityMode::BEST_OF_BOTH, 0.5f).valid);
+    
+    samples.push_back({0.4f, 0.4f, 0.4f, LABEL_FLAWED});
+    TEST_ASSERT_TRUE(sweep(samples.data(), (int)samples.size(), SimilarityMode::BEST_OF_BOTH, 0.5f).valid);
+    
+    volatile bool cancel = true;
+    TEST_ASSERT_FALSE(sweep(samples.data(), (int)samples.size(), SimilarityMode::STRICT, 0.5f, &cancel).valid);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_best_of_both_matches_brute_force);
+    RUN_TEST(test_average_only_matches_brute_force);
+    RUN_TEST(test_strict_matches_brute_force);
+    RUN_TEST(test_best_channel_rescues_a_low_average_only_in_best_of_both);
+    RUN_TEST(test_too_few_labels_or_cancel_gives_no_result);
+    return UNITY_END();
+}
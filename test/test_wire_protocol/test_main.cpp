@@ -0,0 +1,169 @@
+// test/test_wire_protocol/test_main.cpp
+// Round trips through the binary WebSocket protocol, and frames the reader must refuse.
+#include <unity.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "WireProtocol.h"
+
+using namespace WireProtocol;
+
+void setUp() {}
+void tearDown() {}
+
+void test_round_trip_of_every_width() {
+    uint8_t buffer[256];
+    Writer writer(buffer, sizeof(buffer), Type::JOB);
+    writer.putU8(Tag::STATE, 0xAB);
+    writer.putU16(Tag::DONE, 0);
+    writer.putU16(Tag::TOTAL, 0xFFFF);
+    writer.putU32(Tag::MS, 0xDEADBEEF);
+    writer.putText(Tag::TEXT, "PILL 3");
+    writer.putText(Tag::RESULT, "");
+    const int samples[] = {-5, 1, 2, 70000, 4, 5, 65535};
+    writer.putSamples(Tag::SAMPLES, samples, 7, 3);
+    TEST_ASSERT_TRUE(writer.ok());
+    TEST_ASSERT_EQUAL(HEADER_SIZE + Writer::fieldSize(1) + 2 * Writer::fieldSize(2) + Writer::fieldSize(4) +
+                      Writer::fieldSize(6) + Writer::fieldSize(0) + Writer::fieldSize(6), writer.size());
+    
+    Reader reader(writer.data(), writer.size());
+    TEST_ASSERT_TRUE(reader.valid());
+    TEST_ASSERT_TRUE(reader.type() == Type::JOB);
+    Field field;
+    TEST_ASSERT_TRUE(reader.next(field) && field.tag == Tag::STATE && field.u8() == 0xAB);
+    TEST_ASSERT_TRUE(reader.next(field) && field.tag == Tag::DONE && field.u16() == 0);
+    TEST_ASSERT_TRUE(reader.next(field) && field.tag == Tag::TOTAL && field.u16() == 0xFFFF);
+    TEST_ASSERT_TRUE(reader.next(field) && field.tag == Tag::MS && field.u32() == 0xDEADBEEF);
+    TEST_ASSERT_TRUE(reader.next(field) && field.tag == Tag::TEXT && field.text() == "PILL 3");
+    TEST_ASSERT_TRUE(reader.next(field) && field.tag == Tag::RESULT && field.text().empty());
+    TEST_ASSERT_TRUE(reader.next(field) && field.tag == Tag::SAMPLES && field.length == 6);
+    // Every third sample, clamped to u16: -5, 70000, 65535
+    TEST_ASSERT_EQUAL(0, field.value[0] | (field.value[1] << 8));
+    TEST_ASSERT_EQUAL(65535, field.value[2] | (field.value[3] << 8));
+    TEST_ASSERT_EQUAL(65535, field.value[4] | (field.value[5] << 8));
+    TEST_ASSERT_FALSE(reader.next(field));
+    TEST_ASSERT_FALSE(reader.malformed());
+}
+
+void test_narrow_fields_widen() {
+    // A field sent narrower than the reader expects still reads, so a width can grow later
+    uint8_t buffer[32];
+    Writer writer(buffer, sizeof(buffer), Type::ACK);
+    writer.putU8(Tag::JOB, 200);
+    writer.putU16(Tag::MS, 40000);
+    Reader reader(writer.data(), writer.size());
+    Field field;
+    TEST_ASSERT_TRUE(reader.next(field));
+    TEST_ASSERT_EQUAL(200, field.u16());
+    TEST_ASSERT_EQUAL(200, field.u32());
+    TEST_ASSERT_TRUE(reader.next(field));
+    TEST_ASSERT_EQUAL(40000, field.u32());
+}
+
+void test_command_frame_layout() {
+    // The bytes data/app.js encodeCommandFrame() sends for seq 0x1234 and "PILL 1", "STATS"
+    const uint8_t frame[] = {
+        1, 2,
+        1, 2, 0, 0x34, 0x12,
+        2, 6, 0, 'P', 'I', 'L', 'L', ' ', '1',
+        2, 5, 0, 'S', 'T', 'A', 'T', 'S',
+    };
+    uint8_t buffer[64];
+    Writer writer(buffer, sizeof(buffer), Type::COMMAND);
+    writer.putU16(Tag::SEQ, 0x1234);
+    writer.putText(Tag::TEXT, "PILL 1");
+    writer.putText(Tag::TEXT, "STATS");
+    TEST_ASSERT_EQUAL(sizeof(frame), writer.size());
+    TEST_ASSERT_EQUAL_MEMORY(frame, writer.data(), sizeof(frame));
+}
+
+void test_unknown_tags_are_skipped() {
+    uint8_t buffer[64];
+    Writer writer(buffer, sizeof(buffer), Type::LOG);
+    writer.putText((Tag)200, "from a newer firmware");
+    writer.putText(Tag::TEXT, "hello");
+    Reader reader(writer.data(), writer.size());
+    Field field;
+    TEST_ASSERT_TRUE(reader.next(field) && (uint8_t)field.tag == 200);
+    TEST_ASSERT_TRUE(reader.next(field) && field.tag == Tag::TEXT && field.text() == "hello");
+    TEST_ASSERT_FALSE(reader.next(field));
+    TEST_ASSERT_FALSE(reader.malformed());
+}
+
+void test_truncated_frames_are_malformed() {
+    uint8_t buffer[64];
+    Writer writer(buffer, sizeof(buffer), Type::ACK);
+    writer.putU16(Tag::SEQ, 7);
+    writer.putText(Tag::TEXT, "abc");
+    std::vector<size_t> boundaries = {HEADER_SIZE, HEADER_SIZE + Writer::fieldSize(2), writer.size()};
+    
+    for (size_t cut = 0; cut < writer.size(); cut++) {
+        // A heap copy of exactly the prefix, so reading past it trips the sanitizer
+        std::vector<uint8_t> prefix(writer.data(), writer.data() + cut);
+        Reader reader(prefix.data(), prefix.size());
+        if (cut < HEADER_SIZE) {
+            TEST_ASSERT_FALSE(reader.valid());
+            continue;
+        }
+        Field field;
+        size_t fields = 0;
+        while (reader.next(field)) fields++;
+        bool onBoundary = false;
+        for (size_t b = 0; b < boundaries.size(); b++) onBoundary = onBoundary || boundaries[b] == cut;
+        TEST_ASSERT_EQUAL(!onBoundary, reader.malformed());
+        TEST_ASSERT_TRUE(fields <= 1);
+    }
+}
+
+void test_other_versions_are_refused() {
+    const uint8_t frame[] = {VERSION + 1, (uint8_t)Type::LOG, (uint8_t)Tag::TEXT, 1, 0, 'x'};
+    Reader reader(frame, sizeof(frame));
+    Field field;
+    TEST_ASSERT_FALSE(reader.valid());
+    TEST_ASSERT_FALSE(reader.next(field));
+    TEST_ASSERT_FALSE(Reader(nullptr, 0).valid());
+}
+
+void test_writer_never_overflows() {
+    // Guard bytes after the capacity must survive every put
+    uint8_t buffer[32 + 8];
+    for (size_t capacity = 0; capacity <= 32; capacity++) {
+        memset(buffer, 0xEE, sizeof(buffer));
+        Writer writer(buffer, capacity, Type::GRAPH);
+        TEST_ASSERT_EQUAL(capacity >= HEADER_SIZE, writer.ok());
+        writer.putU32(Tag::MS, 1);
+        writer.putText(Tag::TEXT, "0123456789");
+        writer.putU8(Tag::SERVO, 1);
+        writer.putU16(Tag::DONE, 1);
+        TEST_ASSERT_TRUE(writer.size() <= capacity);
+        for (size_t i = capacity; i < sizeof(buffer); i++) TEST_ASSERT_EQUAL(0xEE, buffer[i]);
+    
+        // Once failed, later fields that would fit are not written either
+        if (!writer.ok()) {
+            size_t size = writer.size();
+            writer.putU8(Tag::SERVO, 1);
+            TEST_ASSERT_EQUAL(size, writer.size());
+        }
+    }
+}
+
+void test_text_longer_than_a_field_fails() {
+    std::vector<uint8_t> buffer(70000);
+    Writer writer(buffer.data(), buffer.size(), Type::LOG);
+    writer.putText(Tag::TEXT, std::string(UINT16_MAX + 1, 'x'));
+    TEST_ASSERT_FALSE(writer.ok());
+    TEST_ASSERT_EQUAL(HEADER_SIZE, writer.size());
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_of_every_width);
+    RUN_TEST(test_narrow_fields_widen);
+    RUN_TEST(test_command_frame_layout);
+    RUN_TEST(test_unknown_tags_are_skipped);
+    RUN_TEST(test_truncated_frames_are_malformed);
+    RUN_TEST(test_other_versions_are_refused);
+    RUN_TEST(test_writer_never_overflows);
+    RUN_TEST(test_text_longer_than_a_field_fails);
+    return UNITY_END();
+}